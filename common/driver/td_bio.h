@@ -31,12 +31,15 @@ typedef union {
 	uint8_t u8;
 	struct {
 		uint8_t is_part:1;
-		uint8_t unused:3;
+		uint8_t origin:3;       /* submitting node + 1, 0 if unknown */
 		uint8_t commit_level:4;
 
 	};
 } td_bio_flags_t;
 
+/* nodes that can be recorded in td_bio_flags_t.origin */
+#define TD_BIO_ORIGIN_MAX 7
+
 /* Predeclare this, for the endio function argument */
 struct td_engine;
 
@@ -51,6 +54,8 @@ static inline unsigned int td_bio_get_byte_size(td_bio_ref ref);
 static inline uint64_t td_bio_get_sector_offset(td_bio_ref ref);
 
 static inline int td_bio_is_sync(td_bio_ref ref);
+static inline int td_bio_is_flush(td_bio_ref ref);
+static inline int td_bio_is_fua(td_bio_ref ref);
 static inline int td_bio_is_write(td_bio_ref ref);
 static inline int td_bio_is_discard(td_bio_ref ref);
 
@@ -61,6 +66,21 @@ static inline void td_bio_complete_success (td_bio_ref bio);
 static inline void td_bio_complete_failure (td_bio_ref bio);
 
 extern void td_bio_endio(struct td_engine *eng, td_bio_ref bio, int result, cycles_t ts);
+extern void td_bio_copy_from_virt(td_bio_ref bio, const void *src);
+extern void td_bio_copy_to_virt(td_bio_ref bio, void *dst);
+extern int td_bio_is_zero(td_bio_ref bio);
+extern void td_bio_init_page_write(td_bio_ref bio, struct bio_vec *bvec,
+		struct page *page, uint64_t sector, unsigned size);
+
+/** a driver owned bio that goes through the block completion path, the
+ * owner is called when it completes; it has no block device */
+struct td_bio_owner {
+	void (*end)(struct td_bio_owner *owner, int result);
+};
+
+extern void td_bio_init_owned(td_bio_ref bio, struct bio_vec *bvec,
+		struct page **pages, unsigned count, uint64_t sector, int write,
+		struct td_bio_owner *owner);
 
 #include "td_bio_linux.h"
 
@@ -72,6 +92,20 @@ static inline int td_bio_is_part(td_bio_ref ref)
 	return f->is_part;
 }
 
+/** remember which node submitted the bio, so it can complete there */
+static inline void td_bio_set_origin(td_bio_ref ref, int node)
+{
+	td_bio_flags_t *f = td_bio_flags_ref(ref);
+	f->origin = (node >= 0 && node < TD_BIO_ORIGIN_MAX) ? node + 1 : 0;
+}
+
+/** return the node that submitted the bio, or -1 if not known */
+static inline int td_bio_origin(td_bio_ref ref)
+{
+	td_bio_flags_t *f = td_bio_flags_ref(ref);
+	return (int)f->origin - 1;
+}
+
 static inline int td_bio_is_read(td_bio_ref ref)
 {
 	return ! td_bio_is_write(ref);
@@ -81,5 +115,27 @@ static inline int td_bio_is_read(td_bio_ref ref)
 #include "lk_biolist.h"
 #endif
 
+struct td_biogrp;
+
+#define TD_BIO_CURSOR_PARTS 64 /**< parts a cursor can have in flight */
+
+/** a bio larger than a data buffer, handed out one part at a time */
+struct td_bio_cursor {
+	td_bio_ref          bc_bio;         /**< bio being handed out, NULL if none */
+	struct td_biogrp    *bc_grp;        /**< counts its parts */
+	uint64_t            bc_addr;        /**< byte address of the next part */
+	unsigned            bc_left;        /**< bytes not handed out yet */
+	unsigned            bc_oidx;        /**< vec the next part starts in */
+	unsigned            bc_ovec_used;   /**< bytes of that vec already used */
+	struct bio_list     bc_free;        /**< parts not in flight */
+	void                *bc_parts;      /**< TD_BIO_CURSOR_PARTS parts */
+};
+
+/** returns the bio the cursor is handing out, or NULL */
+static inline td_bio_ref td_bio_cursor_bio(struct td_bio_cursor *bc)
+{
+	return bc->bc_bio;
+}
+
 #endif
 
@@ -43,6 +43,14 @@ int td_split_req_create_list(struct td_engine *eng, td_bio_ref orig_bio,
 }
 
 
+int td_split_req_create_discard_list(struct td_engine *eng,
+		td_bio_ref orig_bio, struct bio_list *merged,
+		uint64_t sector, uint64_t bytes, struct bio_list *split_bios)
+{
+	return td_split_req_create_discard_range(eng, orig_bio, merged,
+			sector, bytes, td_split_req_create_list_cb, split_bios);
+}
+
 /* Helper interface for td_engine.c */
 int td_split_req_create(struct td_engine *eng, td_bio_ref obio,
 		td_split_req_create_cb cb, void *opaque)
@@ -58,22 +66,26 @@ static void td_biogrp_dealloc_kfree(struct td_biogrp *sreq)
 	kfree(sreq);
 }
 
-struct td_biogrp* td_biogrp_alloc( unsigned int extra)
+struct td_biogrp* td_biogrp_alloc_node( unsigned int extra, int node)
 {
 	struct td_biogrp *sreq;
 	int size = sizeof(struct td_biogrp) + extra;
 
-	if ((sreq = kzalloc(size, GFP_KERNEL)) ) {
+	if ((sreq = kzalloc_node(size, GFP_KERNEL, node)) ) {
 		sreq->_dealloc = td_biogrp_dealloc_kfree;
 	}
 	return sreq;
 	
 }
+struct td_biogrp* td_biogrp_alloc( unsigned int extra)
+{
+	return td_biogrp_alloc_node(extra, NUMA_NO_NODE);
+}
 struct td_biogrp* td_biogrp_alloc_kzalloc(struct td_engine* eng,
 		unsigned int extra)
 {
 	struct td_biogrp *sreq;
-	sreq = td_biogrp_alloc(extra);
+	sreq = td_biogrp_alloc_node(extra, td_engine_node(eng));
 	td_eng_trace(eng, TR_BIO, "split:malloc:alloc", (uint64_t)sreq);
 	return sreq;
 }
@@ -107,11 +119,22 @@ struct td_biogrp* td_stash_biogrp_alloc (struct td_engine *eng,
 void td_biogrp_complete_part(struct td_engine *eng, td_bio_ref bio, int result, cycles_t ts)
 {
 	struct td_biogrp *sr = td_bio_group(bio);
-	int done, total;
 
 	if (unlikely(!sr) )
 		return;
 
+	/* the part itself is done with, the biogrp is not */
+	if (sr->sr_cursor)
+		td_bio_cursor_put(sr->sr_cursor, bio);
+
+	td_biogrp_complete_rest(eng, sr, result);
+}
+
+void td_biogrp_complete_rest(struct td_engine *eng, struct td_biogrp *sr, int result)
+{
+	td_bio_ref merged;
+	int done, total;
+
 	/* if nothing failed yet, update the biogrp status */
 	if (result && ! sr->sr_result)
 		sr->sr_result = result;
@@ -142,6 +165,12 @@ void td_biogrp_complete_part(struct td_engine *eng, td_bio_ref bio, int result,
 
 	td_bio_endio(eng, sr->sr_orig, sr->sr_result,
 			td_get_cycles() - sr->sr_created);
+
+	/* discards that were merged into this one finish with it */
+	while ((merged = bio_list_pop(&sr->sr_merged)))
+		td_bio_endio(eng, merged, sr->sr_result,
+				td_get_cycles() - sr->sr_created);
+
 	td_biogrp_free(sr);
 }
 
@@ -37,6 +37,7 @@ struct td_biogrp {
 	void                (*_dealloc)(struct td_biogrp*);
 	
 	td_bio_ref	    sr_orig;
+	struct bio_list     sr_merged;    /**< merged discards completed with sr_orig */
 
 	// TODO: atomic
 	atomic_t            sr_total;     /**< total number of splits */
@@ -46,12 +47,15 @@ struct td_biogrp {
 
 	long                sr_created;
 
+	struct td_bio_cursor *sr_cursor;  /**< pool the parts go back to, if any */
+
 	td_bio_t            sr_bios[0];
 };
 
 
 
 struct td_biogrp* td_biogrp_alloc(unsigned int extra);
+struct td_biogrp* td_biogrp_alloc_node(unsigned int extra, int node);
 
 /* Deprecated */
 struct td_biogrp* td_biogrp_alloc_kzalloc(struct td_engine* eng,
@@ -73,8 +77,9 @@ static inline struct td_biogrp *td_bio_group(td_bio_ref bio)
 	return (struct td_biogrp *)bio->bi_private;
 }
 
-/* returns the number of discard bios that need to be created from this bio */
-static inline int td_bio_discard_count(td_bio_ref bio, struct td_engine *eng)
+/* returns the number of discard bios that need to be created for a range */
+static inline int td_discard_range_count(struct td_engine *eng,
+		uint64_t sector, uint64_t bytes)
 {
 	uint64_t start, end; /*start and end lba*/
 	uint64_t start_off, end_off; /*start and end lba offset*/
@@ -86,13 +91,9 @@ static inline int td_bio_discard_count(td_bio_ref bio, struct td_engine *eng)
 	uint64_t max_stripe;
 	uint8_t ssd_count = (uint8_t)td_eng_conf_hw_var_get(eng, SSD_COUNT);
 
-	/* Fast path. */
-	if(likely(td_bio_is_discard(bio) == 0))
-		goto not_discard;
-
 	/* Set to byte size */
-	start = td_bio_get_sector_offset(bio) << SECTOR_SHIFT;
-	end = start + td_bio_get_byte_size(bio) - 1;
+	start = sector << SECTOR_SHIFT;
+	end = start + bytes - 1;
 
 	/* Convert to LBA */
 	start /= hw_sec;
@@ -162,12 +163,24 @@ massive_trim:
 under1_per_ssd:
 just_fragments:
 just_one:
-not_discard:
 	return (int)count;
 
 }
+
+/* returns the number of discard bios that need to be created from this bio */
+static inline int td_bio_discard_count(td_bio_ref bio, struct td_engine *eng)
+{
+	/* Fast path. */
+	if(likely(td_bio_is_discard(bio) == 0))
+		return 0;
+
+	return td_discard_range_count(eng, td_bio_get_sector_offset(bio),
+			td_bio_get_byte_size(bio));
+}
 /* End part of a split req */
 extern void td_biogrp_complete_part(struct td_engine *eng, td_bio_ref bio, int result, cycles_t ts);
+/* End the parts of a split req that will never be created */
+extern void td_biogrp_complete_rest(struct td_engine *eng, struct td_biogrp *bg, int result);
 
 /* releases resources held by a split req */
 static inline void td_biogrp_free(struct td_biogrp *bg)
@@ -193,7 +206,33 @@ extern int td_split_req_create(struct td_engine *eng, td_bio_ref orig_bio,
 extern int td_split_req_create_discard(struct td_engine *eng,
 		td_bio_ref orig_bio, td_split_req_create_cb cb, void *opaque);
 
+/* splits a discard range covering orig_bio and the merged bios */
+extern int td_split_req_create_discard_range(struct td_engine *eng,
+		td_bio_ref orig_bio, struct bio_list *merged,
+		uint64_t sector, uint64_t bytes,
+		td_split_req_create_cb cb, void *opaque);
+
+/* like td_split_req_create_list(), for a merged discard range */
+extern int td_split_req_create_discard_list(struct td_engine *eng,
+		td_bio_ref orig_bio, struct bio_list *merged,
+		uint64_t sector, uint64_t bytes, struct bio_list *split_bios);
+
 extern int td_bio_split(td_bio_ref obio, unsigned size, td_split_req_create_cb cb, void *opaque);
+
+/* bio cursor: splits a bio a part at a time, from a pool of parts */
+extern int td_bio_cursor_init(struct td_bio_cursor *bc, int node);
+extern void td_bio_cursor_exit(struct td_bio_cursor *bc);
+extern int td_bio_cursor_start(struct td_engine *eng,
+		struct td_bio_cursor *bc, td_bio_ref obio);
+extern td_bio_ref td_bio_cursor_next(struct td_bio_cursor *bc);
+extern void td_bio_cursor_abort(struct td_engine *eng,
+		struct td_bio_cursor *bc, int result);
+
+/** a completed part goes back to the pool */
+static inline void td_bio_cursor_put(struct td_bio_cursor *bc, td_bio_ref part)
+{
+	bio_list_add(&bc->bc_free, part);
+}
 extern int td_bio_replicate(td_bio_ref obio, int num, td_split_req_create_cb cb, void *opaque);
 
 #endif
@@ -148,7 +148,7 @@ int td_cmd_gen_SEC_dup (struct td_engine *eng, struct td_token *tok)
 	td_cmd_set_xsum(tdcmd, buddy->data_xsum);
 
 	/* We grab our buddy status check */
-	tok->ops.status_check = buddy->ops.status_check;
+	tok->status_check = buddy->status_check;
 
 	return 0;
 }
@@ -540,14 +540,14 @@ common_timeout_handling:
 
 int td_speedup_command_on_ooo_seq(struct td_engine *eng, uint32_t missing_seq, uint64_t timeout)
 {
-	struct td_token_list *act_tok_list;
-	struct td_token *nxt, *otok;
+	struct td_token_map *act_tok_map;
+	struct td_token *otok;
 	td_cmd_t *ocmd = NULL;
 	int found = 0;
 
-	act_tok_list = &eng->tok_pool[TD_TOK_FOR_FW].td_active_tokens;
+	act_tok_map = &eng->tok_pool[TD_TOK_FOR_FW].td_active_tokens;
 
-	for_each_token_list_token(otok, nxt, act_tok_list) {
+	for_each_token_map_token(otok, act_tok_map) {
 		ocmd = (void*)&otok->cmd_bytes;
 		if (ocmd->cmd.seq == missing_seq) {
 
@@ -631,8 +631,8 @@ static void __td_cmd_ooo_handling (struct td_token *tok, td_status_t *st)
 int td_replay_command_on_ooo_token(struct td_token *tok, uint8_t last_status_byte)
 {
 	struct td_engine *eng = td_token_engine(tok);
-	struct td_token_list *act_tok_list;
-	struct td_token *nxt, *otok;
+	struct td_token_map *act_tok_map;
+	struct td_token *otok;
 	uint64_t xs = tok->last_xstatus;
 	td_cmd_t *ocmd = NULL;
 	int found = 0;
@@ -640,9 +640,9 @@ int td_replay_command_on_ooo_token(struct td_token *tok, uint8_t last_status_byt
 	if (last_status_byte != TD_STATUS_OoO)
 		return 0;
 
-	act_tok_list = &eng->tok_pool[TD_TOK_FOR_FW].td_active_tokens;
+	act_tok_map = &eng->tok_pool[TD_TOK_FOR_FW].td_active_tokens;
 
-	for_each_token_list_token(otok, nxt, act_tok_list) {
+	for_each_token_map_token(otok, act_tok_map) {
 		ocmd = (void*)&otok->cmd_bytes;
 		if (ocmd->cmd.seq == (xs >> 32)) {
 			eng->td_counters.token.seq_replay_cnt ++;
@@ -666,8 +666,8 @@ int td_replay_command_on_ooo_token(struct td_token *tok, uint8_t last_status_byt
 			(unsigned)(xs >> 32));
 
 #if 0
-	act_tok_list = &eng->tok_pool[TD_TOK_FOR_FW].td_active_tokens;
-	for_each_token_list_token(otok, nxt, act_tok_list) {
+	act_tok_map = &eng->tok_pool[TD_TOK_FOR_FW].td_active_tokens;
+	for_each_token_map_token(otok, act_tok_map) {
 		td_cmd_t *ocmd = (void*)&otok->cmd_bytes;
 		printk("[%u] SEQ %llu (0x%x) CMD %016llx\n", otok->tokid,
 			otok->cmd_seq, ocmd->cmd.seq,
@@ -1056,7 +1056,7 @@ static int td_cmd_status_bio_write (struct td_token *tok)
 	case TD_STATUS_FIELD_ERR:
 		eng->td_counters.token.cmd_error_cnt ++;
 		td_eng_trace(eng, TR_TOKEN, "TD:field_err:tok", tok->tokid);
-		if (! tok->host.bio) {
+		if (! tok->host.bio && ! tok->host.ureq) {
 			/*
 			 * BIO was early committed... 
 			 * We still have the core buffer assigned to us, but the
@@ -1088,7 +1088,7 @@ static int td_cmd_status_bio_write (struct td_token *tok)
 		}
 		
 		eng->td_counters.token.seq_dup_cnt ++;
-		if (tok->host.bio) {
+		if (tok->host.bio || tok->host.ureq) {
 			tok->result = TD_TOK_RESULT_FAIL_CAN_RETRY;
 			return 1;
 		}
@@ -1437,7 +1437,7 @@ int td_cmd_status_check(struct td_token *tok)
 		
 	case TD_STATUS_OoO_DUP_ERR:
 		eng->td_counters.token.seq_dup_cnt ++;
-		if (tok->host.bio) {
+		if (tok->host.bio || tok->host.ureq) {
 			tok->result = TD_TOK_RESULT_FAIL_CAN_RETRY;
 			return 1;
 		}
@@ -1480,8 +1480,9 @@ int td_cmd_gen_bio(struct td_engine *eng, struct td_token *tok)
 	td_cmd_t *tdcmd = (void*)&tok->cmd_bytes;
 	td_bio_ref bio = tok->host.bio;
 
-	WARN_ON(!bio);
-	if (!bio) {
+	/* read-ahead and user ring tokens are the only ones without a bio */
+	WARN_ON(!bio && !tok->readahead && !tok->host.ureq);
+	if (!bio && !tok->readahead && !tok->host.ureq) {
 		td_eng_trace(eng, TR_CMD, "BUG:TD:gen_bio:bio==0", tok->tokid);
 		return -EINVAL;
 	}
@@ -1493,18 +1494,18 @@ int td_cmd_gen_bio(struct td_engine *eng, struct td_token *tok)
 		return -EINVAL;
 	}
 
-	if (bio && td_bio_is_discard(bio))
+	if (tok->zero_trim || (bio && td_bio_is_discard(bio)))
 	{
 		/* Construct the command. */
 		td_cmdgen_trim(tok->cmd_bytes, (uint8_t)tok->port, 1);
 
 		tdcmd->src.bufid = (uint8_t)tok->core_bufid;
 		tdcmd->src.wep = tok->wr_bufid;
-		tok->ops.status_check = td_cmd_status_bio_trim;
+		tok->status_check = td_cmd_status_bio_trim;
 
 	} else if (tok->len_host_to_dev) {
 		/* Working on a WRITE bio */
-		tok->ops.status_check = td_cmd_status_bio_write;
+		tok->status_check = td_cmd_status_bio_write;
 #ifdef CONFIG_TERADIMM_USES_CORE_BUFFS_ONLY
 		if (td_eng_conf_var_get(eng, CORE_ONLY)) {
 			uint core_bufs = (uint)td_eng_conf_var_get(eng, CORE_BUFS);
@@ -1618,7 +1619,7 @@ int td_cmd_gen_bio(struct td_engine *eng, struct td_token *tok)
 
 	} else if (tok->len_dev_to_host) {
 		/* Working on a READ bio */
-		tok->ops.status_check = td_cmd_status_bio_read;
+		tok->status_check = td_cmd_status_bio_read;
 #ifdef CONFIG_TERADIMM_USES_CORE_BUFFS_ONLY
 		if (td_eng_conf_var_get(eng, CORE_ONLY)) {
 			uint core_bufs = (uint)td_eng_conf_var_get(eng, CORE_BUFS);
@@ -1738,7 +1739,7 @@ int td_cmd_gen_seq_advance(struct td_engine *eng, struct td_token *tok)
 	tdcmd->src.diag_reg_src.sub_cmd = TD_FW_DIAG_GET_REG;
 	tdcmd->src.diag_reg_src.reg = 7;
 
-	tok->ops.status_check = td_cmd_status_check;
+	tok->status_check = td_cmd_status_check;
 
 	return 0;
 }
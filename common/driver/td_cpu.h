@@ -40,6 +40,7 @@ struct td_cpu_stats {
 	cycles_t busy_time_start;               /**< reset when idle */
 	enum td_cpu_state cur_state;        /**< current state */
 	cycles_t cpu_totals[TD_CPU_MAX];    /**< total ticks spent in different sections */
+	uint64_t poll_tokens;               /**< active tokens checked in TD_CPU_DRV_POLL */
 };
 
 static inline void td_cpu_start(struct td_cpu_stats *s,
@@ -62,7 +62,7 @@ void td_eng_reset_retry_timeout_handler(struct td_engine *eng,
 	 */
 	do {
 		int rc;
-		struct td_token_list *act_tok_list;
+		struct td_token_map *act_tok_map;
 
 		tok = list_entry(resets_list->next,
 				struct td_token, link);
@@ -102,8 +102,8 @@ void td_eng_reset_retry_timeout_handler(struct td_engine *eng,
 		/* it restarted, so add it to the active list */
 		tok->result = TD_TOK_RESULT_ACTIVE;
 
-		act_tok_list = &eng->tok_pool[td_token_type(tok)].td_active_tokens;
-		td_tokens_enqueue(act_tok_list, tok);
+		act_tok_map = &eng->tok_pool[td_token_type(tok)].td_active_tokens;
+		td_tokmap_enqueue(act_tok_map, tok);
 
 		/* restart the counter */
 		td_reset_token_timeout(eng, tok);
@@ -208,8 +208,8 @@ void td_eng_migrate_timeout_handler(struct td_engine *eng,
 			continue;
 		}
 
-		if ( td_token_is_write(tok) && ! tok->host.bio ) {
-			/* We can only redo writes if we have a bio */
+		if ( td_token_is_write(tok) && ! tok->host.bio && ! tok->host.ureq ) {
+			/* We can only redo writes if we have the data */
 			if (tok->result == TD_TOK_RESULT_OK)
 				tok->result = TD_TOK_RESULT_FAIL_ABORT;
 			list_add_tail(&tok->link, complete_list);
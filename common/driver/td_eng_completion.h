@@ -31,6 +31,7 @@
 #include "td_eng_conf.h"
 #include "td_token.h"
 #include "td_token_list.h"
+#include "td_token_map.h"
 
 /* ------------------------------------------------------------------------ */
 
@@ -193,6 +193,22 @@ const struct td_conf_var_desc td_eng_conf_var_desc[TD_CONF_REGS_MAX] = {
 
 	TD_CONF_ENTRY(INCOMING_SLEEP,              always,    0,  10000)
 	TD_CONF_ENTRY(INCOMING_WAKE,               always,    0,  10000)
+
+	TD_CONF_ENTRY(DEALLOCATE_BATCH,            always,    0,  TD_HOST_RD_BUFS_PER_DEV)
+	TD_CONF_ENTRY(DEALLOCATE_HOLD_USEC,        always,    0,  UINT_MAX)
+	TD_CONF_ENTRY(READAHEAD_DEPTH,             always,    0,  TD_HOST_RD_BUFS_PER_DEV)
+	TD_CONF_ENTRY(READAHEAD_TRIGGER,           always,    1,  UINT_MAX)
+	TD_CONF_ENTRY(READ_CACHE_PAGES,            always,    0,  UINT_MAX)
+	TD_CONF_ENTRY(WRITE_COALESCE,              always,    0,  1)
+	TD_CONF_ENTRY(DISCARD_MERGE_MAX,           always,    0,  TD_DISCARD_HOLD_MAX)
+	TD_CONF_ENTRY(DISCARD_HOLD_USEC,           always,    0,  UINT_MAX)
+	TD_CONF_ENTRY(ADAPTIVE_START_BURST,        always,    0,  1)
+	TD_CONF_ENTRY(START_BURST_LAT_USEC,        always,    1,  UINT_MAX)
+	TD_CONF_ENTRY(BIO_R_DEADLINE_USEC,         always,    0,  UINT_MAX)
+	TD_CONF_ENTRY(BIO_W_DEADLINE_USEC,         always,    0,  UINT_MAX)
+	TD_CONF_ENTRY(ZERO_WRITE_TRIM,             always,    0,  1)
+	TD_CONF_ENTRY(WRITE_STAGING_PAGES,         always,    0,  TD_WRSTAGE_PAGES_MAX)
+	TD_CONF_ENTRY(WRITE_STAGING_ACK,           always,    0,  1)
 };
 
 /* WINDOWS NEEDS THESE IN ORDER OF ENUMS IN td_defs.h */
@@ -348,6 +364,21 @@ void td_eng_conf_init(struct td_engine *eng, struct td_eng_conf *conf)
 	td_eng_conf_var_set(eng, CORE_ONLY, 0);                     /* 0 == use LBA addresses */
 #endif
 	td_eng_conf_var_set(eng, INDEPENDENT_DEALLOCATE, 0);        /* 0 means use fast deallocates with other commands */
+	td_eng_conf_var_set(eng, DEALLOCATE_BATCH, 8);              /* hold up to 8 deallocates for commands in flight to carry */
+	td_eng_conf_var_set(eng, DEALLOCATE_HOLD_USEC, 20);         /* ... but no longer than 20us */
+	td_eng_conf_var_set(eng, READAHEAD_DEPTH, 0);               /* no speculative reads unless asked for */
+	td_eng_conf_var_set(eng, READAHEAD_TRIGGER, 4);             /* ... then only once a stream has read 4 LBAs in a row */
+	td_eng_conf_var_set(eng, READ_CACHE_PAGES, 0);              /* no host read cache unless asked for */
+	td_eng_conf_var_set(eng, WRITE_COALESCE, 1);                /* sector sized writers get full LBA writes */
+	td_eng_conf_var_set(eng, DISCARD_MERGE_MAX, 32);            /* merge up to 32 queued discards */
+	td_eng_conf_var_set(eng, DISCARD_HOLD_USEC, 1000);          /* ... holding them behind other IO for at most 1ms */
+	td_eng_conf_var_set(eng, ADAPTIVE_START_BURST, 0);          /* always burst MAX_START_BURST commands */
+	td_eng_conf_var_set(eng, START_BURST_LAT_USEC, 100);        /* ... or back off when tokens take over 100us */
+	td_eng_conf_var_set(eng, BIO_R_DEADLINE_USEC, 2000);        /* reads stuck at the queue head 2ms are overdue */
+	td_eng_conf_var_set(eng, BIO_W_DEADLINE_USEC, 10000);       /* ... writes after 10ms */
+	td_eng_conf_var_set(eng, ZERO_WRITE_TRIM, 1);               /* trimmed LBAs read back as zeros */
+	td_eng_conf_var_set(eng, WRITE_STAGING_PAGES, 0);           /* no write staging unless asked for */
+	td_eng_conf_var_set(eng, WRITE_STAGING_ACK, 0);             /* ... and then flushes wait for the staged writes */
 
 	td_eng_conf_var_set(eng, TARGET_IOPS, 2000000);             /* after N IOPS call schedule() */
 	td_eng_conf_var_set(eng, IOPS_SAMPLE_MSEC, 100);            /* frequency for updating eng->td_iops */
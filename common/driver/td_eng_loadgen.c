@@ -0,0 +1,562 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                                                                       *
+ *    Copyright (c) 2014 Diablo Technologies Inc. (Diablo).              *
+ *    All rights reserved.                                               *
+ *                                                                       *
+ *    This program is free software; you can redistribute it and/or      *
+ *    modify it under the terms of the GNU General Public License        *
+ *    as published by the Free Software Foundation; either version 2     *
+ *    of the License, or (at your option) any later version located at   *
+ *    <http://www.gnu.org/licenses/                                      *
+ *                                                                       *
+ *    This program is distributed WITHOUT ANY WARRANTY; without even     *
+ *    the implied warranty of MERCHANTABILITY or FITNESS FOR A           *
+ *    PARTICULAR PURPOSE.  See the GNU General Public License for        *
+ *    more details.                                                      *
+ *                                                                       *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include "td_kdefn.h"
+#include "td_compat.h"
+
+#include <linux/mm.h>
+#include <linux/sched.h>
+#include <linux/wait.h>
+#include <linux/bitops.h>
+
+#include "td_engine.h"
+#include "td_devgroup.h"
+#include "td_cpu.h"
+#include "td_bio.h"
+#include "td_biogrp.h"
+#include "td_memspace.h"
+#include "td_eng_loadgen.h"
+#include "td_util.h"
+
+#ifndef CONFIG_TERADIMM_LOADGEN
+#error this file should only be compiled into a LOADGEN driver
+#endif
+
+/*
+ * Synthetic load generator
+ *
+ * TD_IOCTL_DEVICE_LOADGEN keeps queue_depth requests of block_size bytes
+ * queued on the engine for duration_msec, then waits for them to drain.
+ * The requests are bios the driver owns, queued with td_engine_queue_bio(),
+ * so they take the same path as block requests through the engine, the
+ * caches, and the completion path, but no file system, block layer or user
+ * copies are involved.  A driver change, firmware, or a tuning knob can be
+ * measured on its own, on a device or on the simulator.
+ *
+ * Reads all land in one set of pages and writes all come from another, the
+ * data is never looked at.  The write pages carry a pattern, so they are
+ * never sent as TRIMs.
+ *
+ * The caller's thread starts the requests and collects the completions;
+ * completions only put the request on a list.  Latency is kept in a log
+ * histogram, with 8 buckets per power of two, and percentiles are reported
+ * as the upper bound of the bucket they fall in.
+ *
+ * CPU time is taken from the device group thread's accounting, if it's
+ * built in, and includes the other devices in the group.
+ */
+
+#define TD_LOADGEN_LAT_SUB_BITS  3
+#define TD_LOADGEN_LAT_SUB       (1 << TD_LOADGEN_LAT_SUB_BITS)
+#define TD_LOADGEN_LAT_BUCKETS   (64 * TD_LOADGEN_LAT_SUB)
+
+/* percentiles reported, in hundredths of a percent */
+static const unsigned td_loadgen_pct[TD_LOADGEN_PCT_MAX] = {
+	[TD_LOADGEN_PCT_50]    = 5000,
+	[TD_LOADGEN_PCT_90]    = 9000,
+	[TD_LOADGEN_PCT_99]    = 9900,
+	[TD_LOADGEN_PCT_99_9]  = 9990,
+	[TD_LOADGEN_PCT_99_99] = 9999,
+};
+
+struct td_loadgen;
+
+struct td_loadgen_req {
+	struct td_bio_owner     owner;
+	struct td_loadgen       *lg;
+	struct td_loadgen_req   *next;          /**< on the done list */
+	cycles_t                start;
+	cycles_t                end;
+	int                     result;
+	int                     write;
+	td_bio_t                bio;
+	struct bio_vec          vec[0];         /**< one per page */
+};
+
+struct td_loadgen {
+	struct td_engine        *eng;
+	struct td_ioctl_device_loadgen *args;
+
+	spinlock_t              lock;           /**< protects done */
+	struct td_loadgen_req   *done;          /**< completed, not collected */
+	wait_queue_head_t       wq;             /**< woken when one completes */
+
+	unsigned                inflight;
+	unsigned                page_count;     /**< pages per request */
+	struct page             **rd_pages;
+	struct page             **wr_pages;
+	struct td_loadgen_req   **reqs;
+
+	uint64_t                first_block;
+	uint64_t                block_count;
+	uint64_t                next_block;     /**< for sequential runs */
+	uint64_t                rand;
+
+	uint64_t                lat_total;
+	uint64_t                lat_hist[TD_LOADGEN_LAT_BUCKETS];
+};
+
+/* ---- latency histogram ---- */
+
+static unsigned td_loadgen_lat_bucket(uint64_t nsec)
+{
+	unsigned msb;
+
+	if (nsec < TD_LOADGEN_LAT_SUB)
+		return (unsigned)nsec;
+
+	msb = fls64(nsec) - 1;
+	return ((msb - TD_LOADGEN_LAT_SUB_BITS + 1) << TD_LOADGEN_LAT_SUB_BITS)
+		| ((nsec >> (msb - TD_LOADGEN_LAT_SUB_BITS))
+				& (TD_LOADGEN_LAT_SUB - 1));
+}
+
+/* largest latency that lands in a bucket */
+static uint64_t td_loadgen_lat_ceiling(unsigned b)
+{
+	unsigned shift;
+
+	if (b < TD_LOADGEN_LAT_SUB)
+		return b;
+
+	shift = (b >> TD_LOADGEN_LAT_SUB_BITS) - 1;
+	return (((uint64_t)(TD_LOADGEN_LAT_SUB | (b & (TD_LOADGEN_LAT_SUB - 1)))
+				+ 1) << shift) - 1;
+}
+
+static void td_loadgen_percentiles(struct td_loadgen *lg, uint64_t count)
+{
+	struct td_ioctl_device_loadgen *args = lg->args;
+	uint64_t seen = 0, want;
+	unsigned b = 0, p;
+
+	for (p = 0; p < TD_LOADGEN_PCT_MAX; p++) {
+		want = (count * td_loadgen_pct[p] + 9999) / 10000;
+		want = max_t(uint64_t, want, 1);
+
+		while (b < TD_LOADGEN_LAT_BUCKETS
+				&& seen + lg->lat_hist[b] < want)
+			seen += lg->lat_hist[b++];
+
+		if (b == TD_LOADGEN_LAT_BUCKETS)
+			break;
+
+		args->lat_pct_nsec[p] = min_t(uint64_t,
+				td_loadgen_lat_ceiling(b), args->lat_max_nsec);
+	}
+}
+
+/* ---- requests ---- */
+
+static uint64_t td_loadgen_rand(struct td_loadgen *lg)
+{
+	uint64_t x = lg->rand;
+
+	/* xorshift64* */
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	lg->rand = x;
+
+	return x * 0x2545F4914F6CDD1DULL;
+}
+
+static void td_loadgen_end(struct td_bio_owner *owner, int result)
+{
+	struct td_loadgen_req *req = container_of(owner,
+			struct td_loadgen_req, owner);
+	struct td_loadgen *lg = req->lg;
+	unsigned long flags;
+
+	req->end = td_get_cycles();
+	req->result = result;
+
+	/* wake under the lock, so the runner can't free lg under wake_up() */
+	spin_lock_irqsave(&lg->lock, flags);
+	req->next = lg->done;
+	lg->done = req;
+	wake_up(&lg->wq);
+	spin_unlock_irqrestore(&lg->lock, flags);
+}
+
+static void td_loadgen_start(struct td_loadgen *lg, struct td_loadgen_req *req)
+{
+	struct td_ioctl_device_loadgen *args = lg->args;
+	uint64_t block, rnd;
+
+	rnd = td_loadgen_rand(lg);
+	req->write = (rnd % 100) >= args->read_pct;
+
+	if (args->random) {
+		block = td_loadgen_rand(lg) % lg->block_count;
+	} else {
+		block = lg->next_block;
+		if (++lg->next_block == lg->block_count)
+			lg->next_block = 0;
+	}
+	block += lg->first_block;
+
+	td_bio_init_owned(&req->bio, req->vec,
+			req->write ? lg->wr_pages : lg->rd_pages,
+			lg->page_count, block * (args->block_size / 512),
+			req->write, &req->owner);
+
+	lg->inflight++;
+	req->start = td_get_cycles();
+
+	/* a bio that fails the checks is completed before this returns */
+	(void)td_engine_queue_bio(lg->eng, &req->bio);
+}
+
+/* returns non-zero if the run should stop */
+static int td_loadgen_collect(struct td_loadgen *lg)
+{
+	struct td_ioctl_device_loadgen *args = lg->args;
+	struct td_loadgen_req *req, *next;
+	cycles_t started;
+	uint64_t nsec;
+	int stop = 0;
+
+	spin_lock_irq(&lg->lock);
+	req = lg->done;
+	lg->done = NULL;
+	spin_unlock_irq(&lg->lock);
+
+	for (; req; req = next) {
+		next = req->next;
+		lg->inflight--;
+
+		/* idle until it's started again */
+		started = req->start;
+		req->start = 0;
+
+		if (unlikely(req->result)) {
+			args->errors++;
+			stop = 1;
+			continue;
+		}
+
+		if (req->write) {
+			args->writes++;
+			args->write_bytes += args->block_size;
+		} else {
+			args->reads++;
+			args->read_bytes += args->block_size;
+		}
+
+		nsec = td_cycles_to_nsec(req->end - started);
+		if (args->reads + args->writes == 1 || nsec < args->lat_min_nsec)
+			args->lat_min_nsec = nsec;
+		if (nsec > args->lat_max_nsec)
+			args->lat_max_nsec = nsec;
+		lg->lat_total += nsec;
+		lg->lat_hist[td_loadgen_lat_bucket(nsec)]++;
+	}
+
+	return stop;
+}
+
+static int td_loadgen_has_done(struct td_loadgen *lg)
+{
+	return ACCESS_ONCE(lg->done) != NULL;
+}
+
+/* ---- setup ---- */
+
+static int td_loadgen_check(struct td_engine *eng,
+		struct td_ioctl_device_loadgen *args)
+{
+	uint64_t capacity = td_engine_capacity(eng);
+
+	memset(&args->reads, 0, sizeof(*args)
+			- offsetof(struct td_ioctl_device_loadgen, reads));
+
+	if (args->read_pct > 100)
+		return -EINVAL;
+
+	if (!args->block_size || args->block_size % PAGE_SIZE
+			|| args->block_size % TERADIMM_DATA_BUF_SIZE
+			|| args->block_size > TD_SPLIT_REQ_PART_MAX
+					* TERADIMM_DATA_BUF_SIZE)
+		return -EINVAL;
+
+	if (!args->queue_depth || args->queue_depth > TD_LOADGEN_DEPTH_MAX)
+		return -EINVAL;
+
+	if (!args->duration_msec
+			|| args->duration_msec > TD_LOADGEN_DURATION_MAX)
+		return -EINVAL;
+
+	if (args->offset % args->block_size || args->offset >= capacity)
+		return -EINVAL;
+
+	if (!args->length)
+		args->length = capacity - args->offset;
+
+	if (args->length > capacity - args->offset
+			|| args->length < args->block_size)
+		return -EINVAL;
+
+	return 0;
+}
+
+static void td_loadgen_free_pages(struct page **pages, unsigned count)
+{
+	unsigned i;
+
+	if (!pages)
+		return;
+
+	for (i = 0; i < count; i++) {
+		if (pages[i])
+			__free_page(pages[i]);
+	}
+	kfree(pages);
+}
+
+static struct page **td_loadgen_alloc_pages(struct td_loadgen *lg,
+		uint64_t pattern)
+{
+	int node = td_engine_node(lg->eng);
+	struct page **pages;
+	uint64_t *data;
+	unsigned i, w;
+
+	pages = kzalloc_node(lg->page_count * sizeof(*pages), GFP_KERNEL, node);
+	if (!pages)
+		return NULL;
+
+	for (i = 0; i < lg->page_count; i++) {
+		pages[i] = alloc_pages_node(node, GFP_KERNEL, 0);
+		if (!pages[i])
+			goto error;
+
+		if (!pattern)
+			continue;
+
+		data = page_address(pages[i]);
+		for (w = 0; w < PAGE_SIZE / sizeof(*data); w++)
+			data[w] = pattern + w;
+	}
+
+	return pages;
+
+error:
+	td_loadgen_free_pages(pages, lg->page_count);
+	return NULL;
+}
+
+static void td_loadgen_free(struct td_loadgen *lg)
+{
+	unsigned i;
+
+	if (lg->reqs) {
+		for (i = 0; i < lg->args->queue_depth; i++)
+			kfree(lg->reqs[i]);
+		kfree(lg->reqs);
+	}
+	td_loadgen_free_pages(lg->wr_pages, lg->page_count);
+	td_loadgen_free_pages(lg->rd_pages, lg->page_count);
+	kfree(lg);
+}
+
+static struct td_loadgen *td_loadgen_alloc(struct td_engine *eng,
+		struct td_ioctl_device_loadgen *args)
+{
+	int node = td_engine_node(eng);
+	struct td_loadgen *lg;
+	unsigned i;
+
+	lg = kzalloc_node(sizeof(*lg), GFP_KERNEL, node);
+	if (!lg)
+		return NULL;
+
+	lg->eng = eng;
+	lg->args = args;
+	spin_lock_init(&lg->lock);
+	init_waitqueue_head(&lg->wq);
+
+	lg->page_count = args->block_size / PAGE_SIZE;
+	lg->first_block = args->offset / args->block_size;
+	lg->block_count = args->length / args->block_size;
+	lg->rand = args->seed ?: 0x9E3779B97F4A7C15ULL;
+
+	lg->rd_pages = td_loadgen_alloc_pages(lg, 0);
+	if (!lg->rd_pages)
+		goto error;
+
+	lg->wr_pages = td_loadgen_alloc_pages(lg, lg->rand | 1);
+	if (!lg->wr_pages)
+		goto error;
+
+	lg->reqs = kzalloc_node(args->queue_depth * sizeof(*lg->reqs),
+			GFP_KERNEL, node);
+	if (!lg->reqs)
+		goto error;
+
+	for (i = 0; i < args->queue_depth; i++) {
+		lg->reqs[i] = kzalloc_node(sizeof(struct td_loadgen_req)
+				+ lg->page_count * sizeof(struct bio_vec),
+				GFP_KERNEL, node);
+		if (!lg->reqs[i])
+			goto error;
+
+		lg->reqs[i]->lg = lg;
+		lg->reqs[i]->owner.end = td_loadgen_end;
+	}
+
+	return lg;
+
+error:
+	td_loadgen_free(lg);
+	return NULL;
+}
+
+/* ---- cpu accounting ---- */
+
+static int td_loadgen_cpu_snapshot(struct td_engine *eng, cycles_t *totals)
+{
+#ifdef CONFIG_TERADIMM_TRACK_CPU_USAGE
+	struct td_devgroup *dg = td_engine_devgroup(eng);
+
+	if (dg) {
+		memcpy(totals, dg->dg_cpu_stats.cpu_totals,
+				sizeof(cycles_t) * TD_CPU_MAX);
+		return 1;
+	}
+#endif
+	return 0;
+}
+
+/* ---- external API ---- */
+
+void td_engine_loadgen_init(struct td_engine *eng)
+{
+	atomic_set(&eng->td_loadgen_running, 0);
+}
+
+/**
+ * \brief run a synthetic load on the engine
+ *
+ * @param eng - engine to load
+ * @param args - the load to run, results are filled in
+ * @return 0 if it ran, even if requests failed, or negative errno
+ *
+ * Sleeps for the duration of the run and until the requests drain.  A
+ * signal ends the run early, the results cover what completed.
+ */
+int td_engine_loadgen_run(struct td_engine *eng,
+		struct td_ioctl_device_loadgen *args)
+{
+	cycles_t cpu_start[TD_CPU_MAX], cpu_end[TD_CPU_MAX];
+	struct td_loadgen *lg;
+	unsigned long deadline;
+	cycles_t start;
+	uint64_t count, usec;
+	unsigned i;
+	int stop = 0;
+	int rc;
+
+	BUILD_BUG_ON(TD_CPU_MAX > TD_LOADGEN_CPU_STATES);
+
+	rc = td_loadgen_check(eng, args);
+	if (rc)
+		return rc;
+
+	if (atomic_xchg(&eng->td_loadgen_running, 1))
+		return -EBUSY;
+
+	rc = -ENOMEM;
+	lg = td_loadgen_alloc(eng, args);
+	if (!lg)
+		goto error_alloc;
+
+	td_eng_info(eng, "loadgen: %u%% reads, %u bytes, depth %u, %s, "
+			"%u msec\n", args->read_pct, args->block_size,
+			args->queue_depth,
+			args->random ? "random" : "sequential",
+			args->duration_msec);
+
+	args->cpu_tracked = td_loadgen_cpu_snapshot(eng, cpu_start);
+
+	deadline = jiffies + msecs_to_jiffies(args->duration_msec);
+	start = td_get_cycles();
+
+	for (i = 0; i < args->queue_depth; i++)
+		td_loadgen_start(lg, lg->reqs[i]);
+
+	while (lg->inflight) {
+		struct td_loadgen_req *req;
+
+		if (!stop) {
+			long left = (long)(deadline - jiffies);
+
+			if (left <= 0
+					|| wait_event_interruptible_timeout(lg->wq,
+						td_loadgen_has_done(lg),
+						left) < 0)
+				stop = 1;
+		} else {
+			/* draining, the engine completes or fails them */
+			wait_event_timeout(lg->wq, td_loadgen_has_done(lg), HZ);
+		}
+
+		if (td_loadgen_collect(lg))
+			stop = 1;
+
+		if (stop || time_after_eq(jiffies, deadline))
+			continue;
+
+		/* collected requests are idle, start them again */
+		for (i = 0; i < args->queue_depth
+				&& lg->inflight < args->queue_depth; i++) {
+			req = lg->reqs[i];
+			if (!req->start)
+				td_loadgen_start(lg, req);
+		}
+	}
+
+	usec = td_cycles_to_usec(td_get_cycles() - start);
+
+	if (args->cpu_tracked && td_loadgen_cpu_snapshot(eng, cpu_end)) {
+		for (i = 0; i < TD_CPU_MAX; i++)
+			args->cpu_usec[i] = td_cycles_to_usec(
+					cpu_end[i] - cpu_start[i]);
+	}
+
+	count = args->reads + args->writes;
+	args->elapsed_usec = usec;
+	usec = usec ?: 1;
+	args->iops = count * 1000000 / usec;
+	args->bytes_per_sec = (args->read_bytes + args->write_bytes)
+		* 1000000 / usec;
+	if (count) {
+		args->lat_avg_nsec = lg->lat_total / count;
+		td_loadgen_percentiles(lg, count);
+	}
+
+	td_eng_info(eng, "loadgen: %llu IOPS, %llu bytes/s, %llu errors\n",
+			args->iops, args->bytes_per_sec, args->errors);
+
+	rc = 0;
+	td_loadgen_free(lg);
+
+error_alloc:
+	atomic_set(&eng->td_loadgen_running, 0);
+	return rc;
+}
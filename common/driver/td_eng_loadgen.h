@@ -0,0 +1,42 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                                                                       *
+ *    Copyright (c) 2014 Diablo Technologies Inc. (Diablo).              *
+ *    All rights reserved.                                               *
+ *                                                                       *
+ *    This program is free software; you can redistribute it and/or      *
+ *    modify it under the terms of the GNU General Public License        *
+ *    as published by the Free Software Foundation; either version 2     *
+ *    of the License, or (at your option) any later version located at   *
+ *    <http://www.gnu.org/licenses/                                      *
+ *                                                                       *
+ *    This program is distributed WITHOUT ANY WARRANTY; without even     *
+ *    the implied warranty of MERCHANTABILITY or FITNESS FOR A           *
+ *    PARTICULAR PURPOSE.  See the GNU General Public License for        *
+ *    more details.                                                      *
+ *                                                                       *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef _TD_ENG_LOADGEN_H_
+#define _TD_ENG_LOADGEN_H_
+
+#include "td_compat.h"
+#include "td_defs.h"
+#include "td_ioctl.h"
+#include "td_engine_def.h"
+
+#ifdef CONFIG_TERADIMM_LOADGEN
+
+extern void td_engine_loadgen_init(struct td_engine *eng);
+
+/** run a synthetic load on the engine, returns when it has drained */
+extern int td_engine_loadgen_run(struct td_engine *eng,
+		struct td_ioctl_device_loadgen *lg);
+
+#else
+
+#define td_engine_loadgen_init(eng) do { /* nothing */ } while(0)
+#define td_engine_loadgen_run(eng,lg) (-EOPNOTSUPP)
+
+#endif
+
+#endif
@@ -22,6 +22,7 @@
 #include "td_engine.h"
 #include "td_token.h"
 #include "td_token_list.h"
+#include "td_token_map.h"
 #include "td_eng_mcefree.h"
 #include "td_eng_hal.h"
 #include "td_device.h"
@@ -645,7 +646,7 @@ td_eng_trace(eng, TR_RDBUF, "find:match:cmd     ", match_tok->cmd_bytes[0]);
 				&& dtok->result == TD_TOK_RESULT_ACTIVE) {
 
 			enum td_token_type dtype;
-			struct td_token_list *alist;
+			struct td_token_map *alist;
 
 			td_eng_trace(eng, TR_RDBUF, "find:complete:dealloc:tok",
 					dealloc_tokid);
@@ -653,7 +654,7 @@ td_eng_trace(eng, TR_RDBUF, "find:match:cmd     ", match_tok->cmd_bytes[0]);
 			/* it was on the active list, remove it */
 			dtype = td_token_type(dtok);
 			alist = &eng->tok_pool[dtype].td_active_tokens;
-			td_tokens_del(alist, dtok);
+			td_tokmap_del(alist, dtok);
 
 			/* update counters */
 			eng->td_stats.control.req_active_cnt --;
@@ -920,7 +921,7 @@ static void td_mcefree_debug_dump(struct td_engine *eng)
 	td_eng_warn(eng, "active tokens ---------------------------\n");
 
 	tok_pool = &eng->tok_pool[TD_TOK_FOR_FW];
-	for_each_token_list_token(tok, nxt, &tok_pool->td_active_tokens) {
+	for_each_token_map_token(tok, &tok_pool->td_active_tokens) {
 		td_token_error_dump(tok, "active");
 	}
 
@@ -0,0 +1,355 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                                                                       *
+ *    Copyright (c) 2014 Diablo Technologies Inc. (Diablo).              *
+ *    All rights reserved.                                               *
+ *                                                                       *
+ *    This program is free software; you can redistribute it and/or      *
+ *    modify it under the terms of the GNU General Public License        *
+ *    as published by the Free Software Foundation; either version 2     *
+ *    of the License, or (at your option) any later version located at   *
+ *    <http://www.gnu.org/licenses/                                      *
+ *                                                                       *
+ *    This program is distributed WITHOUT ANY WARRANTY; without even     *
+ *    the implied warranty of MERCHANTABILITY or FITNESS FOR A           *
+ *    PARTICULAR PURPOSE.  See the GNU General Public License for        *
+ *    more details.                                                      *
+ *                                                                       *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include "td_kdefn.h"
+#include "td_compat.h"
+
+#include "td_engine.h"
+#include "td_token.h"
+#include "td_bio.h"
+#include "td_eng_rdcache.h"
+#include "td_util.h"
+
+#ifndef CONFIG_TERADIMM_READ_CACHE
+#error this file should only be compiled into a READ_CACHE driver
+#endif
+
+/*
+ * Host read cache
+ *
+ * Whole LBAs read from the device are copied into host pages allocated on
+ * the device's node, and later reads of those LBAs are completed without
+ * going to the device.  READ_CACHE_PAGES sets the size; 0 disables it.
+ *
+ * Replacement is segmented LRU.  New entries go on the probation list, and
+ * only a hit moves an entry to the protected list, which holds at most 3/4
+ * of the cache.  A scan larger than the cache only cycles the probation
+ * list and leaves the hot set alone.
+ *
+ * Writes and discards drop the entries they overlap when they are started.
+ * A read that was already running when a write to an LBA in the same hash
+ * bucket started is not cached, since it may have returned the old data.
+ */
+
+#define TD_RDCACHE_PROTECTED_MAX(_pages) ((_pages) - (_pages) / 4)
+
+static inline struct td_rc_bucket *td_rc_bucket(struct td_rdcache *rc,
+		uint64_t lba)
+{
+	return rc->rc_buckets + (lba & (TD_RDCACHE_HASH_SIZE - 1));
+}
+
+static inline unsigned td_rc_count(struct td_rdcache *rc)
+{
+	return rc->rc_probation_count + rc->rc_protected_count;
+}
+
+static struct td_rc_entry *td_rc_lookup(struct td_rdcache *rc, uint64_t lba)
+{
+	struct td_rc_entry *ent;
+
+	for (ent = td_rc_bucket(rc, lba)->rc_chain; ent; ent = ent->rc_next)
+		if (ent->rc_lba == lba)
+			return ent;
+
+	return NULL;
+}
+
+/* take an entry off its hash chain and LRU list */
+static void td_rc_unlink(struct td_rdcache *rc, struct td_rc_entry *ent)
+{
+	struct td_rc_entry **pp = &td_rc_bucket(rc, ent->rc_lba)->rc_chain;
+
+	while (*pp != ent)
+		pp = &(*pp)->rc_next;
+	*pp = ent->rc_next;
+
+	list_del(&ent->rc_lru_link);
+	if (ent->rc_protected)
+		rc->rc_protected_count --;
+	else
+		rc->rc_probation_count --;
+}
+
+static void td_rc_remove(struct td_rdcache *rc, struct td_rc_entry *ent)
+{
+	td_rc_unlink(rc, ent);
+	__free_page(ent->rc_page);
+	kfree(ent);
+}
+
+/* least recently used entry, probation first */
+static struct td_rc_entry *td_rc_victim(struct td_rdcache *rc)
+{
+	struct list_head *lru;
+
+	if (!list_empty(&rc->rc_probation))
+		lru = &rc->rc_probation;
+	else if (!list_empty(&rc->rc_protected))
+		lru = &rc->rc_protected;
+	else
+		return NULL;
+
+	return list_entry(lru->prev, struct td_rc_entry, rc_lru_link);
+}
+
+/* evict until no more than pages are cached */
+static void td_rc_trim(struct td_engine *eng, unsigned pages)
+{
+	struct td_rdcache *rc = &eng->td_rdcache;
+
+	while (td_rc_count(rc) > pages) {
+		td_rc_remove(rc, td_rc_victim(rc));
+		eng->td_counters.misc.read_cache_evict_cnt ++;
+	}
+}
+
+/* a hit moves the entry to the head of the protected list */
+static void td_rc_touch(struct td_rdcache *rc, struct td_rc_entry *ent,
+		unsigned pages)
+{
+	struct td_rc_entry *old;
+
+	list_move(&ent->rc_lru_link, &rc->rc_protected);
+	if (ent->rc_protected)
+		return;
+
+	ent->rc_protected = 1;
+	rc->rc_probation_count --;
+	rc->rc_protected_count ++;
+
+	/* the protected list overflows back into probation */
+	while (rc->rc_protected_count > TD_RDCACHE_PROTECTED_MAX(pages)) {
+		old = list_entry(rc->rc_protected.prev,
+				struct td_rc_entry, rc_lru_link);
+		list_move(&old->rc_lru_link, &rc->rc_probation);
+		old->rc_protected = 0;
+		rc->rc_protected_count --;
+		rc->rc_probation_count ++;
+	}
+}
+
+static void td_rc_invalidate_list(struct td_engine *eng,
+		struct list_head *lru, uint64_t lba, uint64_t count)
+{
+	struct td_rc_entry *ent, *nxt;
+
+	list_for_each_entry_safe(ent, nxt, lru, rc_lru_link) {
+		if (ent->rc_lba < lba || ent->rc_lba >= lba + count)
+			continue;
+
+		td_rc_remove(&eng->td_rdcache, ent);
+		eng->td_counters.misc.read_cache_invalidate_cnt ++;
+	}
+}
+
+/* a write to [lba, lba+count) is starting */
+static void td_rc_invalidate(struct td_engine *eng, uint64_t lba,
+		uint64_t count)
+{
+	struct td_rdcache *rc = &eng->td_rdcache;
+	struct td_rc_entry *ent;
+	cycles_t now = td_get_cycles();
+	uint64_t i;
+
+	if (count >= TD_RDCACHE_HASH_SIZE) {
+		/* large discards cover every bucket, walk the entries instead */
+		rc->rc_last_wide_write = now;
+		td_rc_invalidate_list(eng, &rc->rc_probation, lba, count);
+		td_rc_invalidate_list(eng, &rc->rc_protected, lba, count);
+		return;
+	}
+
+	for (i = 0; i < count; i++) {
+		td_rc_bucket(rc, lba + i)->rc_last_write = now;
+
+		ent = td_rc_lookup(rc, lba + i);
+		if (ent) {
+			td_rc_remove(rc, ent);
+			eng->td_counters.misc.read_cache_invalidate_cnt ++;
+		}
+	}
+}
+
+int td_engine_rdcache_bio(struct td_engine *eng, td_bio_ref bio)
+{
+	struct td_rdcache *rc = &eng->td_rdcache;
+	uint hw_sector_size = (uint)td_eng_conf_hw_var_get(eng, HW_SECTOR_SIZE);
+	unsigned pages = (unsigned)td_eng_conf_var_get(eng, READ_CACHE_PAGES);
+	struct td_rc_entry *ent;
+	uint64_t lba;
+
+	if (unlikely (!rc->rc_buckets)) {
+		if (!pages || hw_sector_size != PAGE_SIZE)
+			return 0;
+
+		rc->rc_buckets = kzalloc_node(TD_RDCACHE_HASH_SIZE
+				* sizeof(struct td_rc_bucket), GFP_KERNEL,
+				td_engine_node(eng));
+		if (!rc->rc_buckets)
+			return 0;
+
+		/* writes that started before now were not tracked */
+		rc->rc_last_wide_write = td_get_cycles();
+	}
+
+	lba = td_bio_lba(eng, bio);
+
+	/* writes are tracked even while disabled, for reads still running
+	 * when it's enabled again */
+	if (td_bio_is_write(bio) || td_bio_is_discard(bio)) {
+		td_rc_invalidate(eng, lba, td_bio_lba_span(bio, hw_sector_size));
+		return 0;
+	}
+
+	/* shrunk, or disabled */
+	if (unlikely (td_rc_count(rc) > pages))
+		td_rc_trim(eng, pages);
+
+	if (!pages || td_bio_lba_span(bio, hw_sector_size) != 1)
+		return 0;
+
+	ent = td_rc_lookup(rc, lba);
+	if (!ent) {
+		eng->td_counters.misc.read_cache_miss_cnt ++;
+		return 0;
+	}
+
+	eng->td_counters.misc.read_cache_hit_cnt ++;
+	td_eng_trace(eng, TR_BIO, "BIO:rdcache:hit", lba);
+
+	td_rc_touch(rc, ent, pages);
+
+	td_bio_copy_from_virt(bio, PTR_OFS(page_address(ent->rc_page),
+				td_bio_lba_offset(eng, bio)));
+
+	eng->td_stats.read.req_completed_cnt ++;
+	eng->td_stats.read.bytes_transfered += td_bio_get_byte_size(bio);
+
+	td_bio_endio(eng, bio, 0, 0);
+	return 1;
+}
+
+void td_engine_rdcache_fill(struct td_engine *eng, struct td_token *tok,
+		td_bio_ref bio)
+{
+	struct td_rdcache *rc = &eng->td_rdcache;
+	unsigned pages = (unsigned)td_eng_conf_var_get(eng, READ_CACHE_PAGES);
+	struct td_rc_bucket *bucket;
+	struct td_rc_entry *ent;
+	uint64_t lba;
+	int node;
+
+	if (!pages || !rc->rc_buckets)
+		return;
+
+	if (td_bio_is_write(bio) || td_bio_is_discard(bio))
+		return;
+
+	/* only whole LBAs are cached */
+	if (td_bio_get_byte_size(bio) != td_eng_conf_hw_var_get(eng, HW_SECTOR_SIZE)
+			|| td_bio_lba_offset(eng, bio))
+		return;
+
+	lba = td_bio_lba(eng, bio);
+	bucket = td_rc_bucket(rc, lba);
+
+	/* a write started while this was read could have changed the data */
+	if (bucket->rc_last_write >= tok->ts_start
+			|| rc->rc_last_wide_write >= tok->ts_start)
+		return;
+
+	if (td_rc_lookup(rc, lba))
+		return;
+
+	if (td_rc_count(rc) >= pages) {
+		/* reuse the least valuable entry */
+		ent = td_rc_victim(rc);
+		td_rc_unlink(rc, ent);
+		eng->td_counters.misc.read_cache_evict_cnt ++;
+
+	} else {
+		node = td_engine_node(eng);
+
+		ent = kzalloc_node(sizeof(*ent), GFP_NOWAIT | __GFP_NOWARN, node);
+		if (!ent)
+			return;
+
+		ent->rc_page = alloc_pages_node(node,
+				GFP_NOWAIT | __GFP_NOWARN, 0);
+		if (!ent->rc_page) {
+			kfree(ent);
+			return;
+		}
+	}
+
+	td_bio_copy_to_virt(bio, page_address(ent->rc_page));
+
+	ent->rc_lba = lba;
+	ent->rc_protected = 0;
+	ent->rc_next = bucket->rc_chain;
+	bucket->rc_chain = ent;
+
+	list_add(&ent->rc_lru_link, &rc->rc_probation);
+	rc->rc_probation_count ++;
+
+	eng->td_counters.misc.read_cache_fill_cnt ++;
+}
+
+void td_engine_rdcache_invalidate(struct td_engine *eng, uint64_t lba,
+		uint64_t count)
+{
+	/* nothing was read through the cache yet */
+	if (!eng->td_rdcache.rc_buckets)
+		return;
+
+	td_rc_invalidate(eng, lba, count);
+}
+
+void td_engine_rdcache_flush(struct td_engine *eng)
+{
+	struct td_rdcache *rc = &eng->td_rdcache;
+
+	if (!rc->rc_buckets)
+		return;
+
+	/* also keeps reads running now from being cached */
+	rc->rc_last_wide_write = td_get_cycles();
+
+	td_rc_invalidate_list(eng, &rc->rc_probation, 0, -1ULL);
+	td_rc_invalidate_list(eng, &rc->rc_protected, 0, -1ULL);
+}
+
+void td_engine_rdcache_init(struct td_engine *eng)
+{
+	struct td_rdcache *rc = &eng->td_rdcache;
+
+	memset(rc, 0, sizeof(*rc));
+	INIT_LIST_HEAD(&rc->rc_probation);
+	INIT_LIST_HEAD(&rc->rc_protected);
+}
+
+void td_engine_rdcache_exit(struct td_engine *eng)
+{
+	struct td_rdcache *rc = &eng->td_rdcache;
+
+	td_engine_rdcache_flush(eng);
+
+	kfree(rc->rc_buckets);
+	rc->rc_buckets = NULL;
+}
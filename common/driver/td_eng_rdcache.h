@@ -0,0 +1,62 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                                                                       *
+ *    Copyright (c) 2014 Diablo Technologies Inc. (Diablo).              *
+ *    All rights reserved.                                               *
+ *                                                                       *
+ *    This program is free software; you can redistribute it and/or      *
+ *    modify it under the terms of the GNU General Public License        *
+ *    as published by the Free Software Foundation; either version 2     *
+ *    of the License, or (at your option) any later version located at   *
+ *    <http://www.gnu.org/licenses/                                      *
+ *                                                                       *
+ *    This program is distributed WITHOUT ANY WARRANTY; without even     *
+ *    the implied warranty of MERCHANTABILITY or FITNESS FOR A           *
+ *    PARTICULAR PURPOSE.  See the GNU General Public License for        *
+ *    more details.                                                      *
+ *                                                                       *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef _TD_ENG_RDCACHE_H_
+#define _TD_ENG_RDCACHE_H_
+
+#include "td_compat.h"
+#include "td_defs.h"
+#include "td_bio.h"
+#include "td_engine_def.h"
+
+struct td_token;
+
+#ifdef CONFIG_TERADIMM_READ_CACHE
+
+extern void td_engine_rdcache_init(struct td_engine *eng);
+extern void td_engine_rdcache_exit(struct td_engine *eng);
+
+/** drop everything cached */
+extern void td_engine_rdcache_flush(struct td_engine *eng);
+
+/**
+ * look at a bio about to be started
+ * @return non-zero if the bio was completed from the cache
+ */
+extern int td_engine_rdcache_bio(struct td_engine *eng, td_bio_ref bio);
+
+/** remember the data of a read bio that completed successfully */
+extern void td_engine_rdcache_fill(struct td_engine *eng,
+		struct td_token *tok, td_bio_ref bio);
+
+/** a write that isn't a bio is starting on [lba, lba+count) */
+extern void td_engine_rdcache_invalidate(struct td_engine *eng,
+		uint64_t lba, uint64_t count);
+
+#else
+
+#define td_engine_rdcache_init(eng) do { /* nothing */ } while(0)
+#define td_engine_rdcache_exit(eng) do { /* nothing */ } while(0)
+#define td_engine_rdcache_flush(eng) do { /* nothing */ } while(0)
+#define td_engine_rdcache_bio(eng,bio) (0)
+#define td_engine_rdcache_fill(eng,tok,bio) do { /* nothing */ } while(0)
+#define td_engine_rdcache_invalidate(eng,lba,count) do { /* nothing */ } while(0)
+
+#endif
+
+#endif
@@ -0,0 +1,509 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                                                                       *
+ *    Copyright (c) 2014 Diablo Technologies Inc. (Diablo).              *
+ *    All rights reserved.                                               *
+ *                                                                       *
+ *    This program is free software; you can redistribute it and/or      *
+ *    modify it under the terms of the GNU General Public License        *
+ *    as published by the Free Software Foundation; either version 2     *
+ *    of the License, or (at your option) any later version located at   *
+ *    <http://www.gnu.org/licenses/                                      *
+ *                                                                       *
+ *    This program is distributed WITHOUT ANY WARRANTY; without even     *
+ *    the implied warranty of MERCHANTABILITY or FITNESS FOR A           *
+ *    PARTICULAR PURPOSE.  See the GNU General Public License for        *
+ *    more details.                                                      *
+ *                                                                       *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include "td_kdefn.h"
+#include "td_compat.h"
+
+#include "td_engine.h"
+#include "td_token.h"
+#include "td_bio.h"
+#include "td_eng_readahead.h"
+#include "td_eng_wrstage.h"
+#include "td_util.h"
+
+#ifndef CONFIG_TERADIMM_READAHEAD
+#error this file should only be compiled into a READAHEAD driver
+#endif
+
+/*
+ * Sequential read-ahead
+ *
+ * Demand reads are watched for a few sequential streams.  Once a stream has
+ * read READAHEAD_TRIGGER LBAs in a row, and the engine has nothing else to
+ * start, up to READAHEAD_DEPTH LBAs in front of the stream are read with
+ * tokens that carry no bio.  Speculative reads take device bandwidth from
+ * random readers, so READAHEAD_DEPTH is 0, and all of this off, unless set.
+ *
+ * A speculative read goes through a read buffer like any other read, and
+ * its data is moved to a host page on completion so the read buffer can be
+ * deallocated right away; holding read buffers would stall the rotation
+ * the MCE-FREE matching depends on, and take them from demand reads.
+ *
+ * Reads that find their LBA staged are completed from the page.  Reads that
+ * find it in flight wait on the slot.  Writes, discards and media changing
+ * ucmds drop staged pages, and mark in flight ones stale.
+ */
+
+/* ---- slots ---- */
+
+static struct td_ra_slot *td_ra_find_lba(struct td_engine *eng, uint64_t lba)
+{
+	struct td_ra_slot *slot;
+	unsigned i;
+
+	if (!eng->td_ra_slots_used)
+		return NULL;
+
+	for (i = 0; i < TD_READAHEAD_SLOTS; i++) {
+		slot = eng->td_ra_slots + i;
+		if (slot->ra_state != TD_RA_SLOT_FREE && slot->ra_lba == lba)
+			return slot;
+	}
+
+	return NULL;
+}
+
+static struct td_ra_slot *td_ra_find_tok(struct td_engine *eng,
+		struct td_token *tok)
+{
+	struct td_ra_slot *slot;
+	unsigned i;
+
+	for (i = 0; i < TD_READAHEAD_SLOTS; i++) {
+		slot = eng->td_ra_slots + i;
+		/* the page follows the token through a retry; tokid doesn't */
+		if (slot->ra_state == TD_RA_SLOT_INFLIGHT
+				&& slot->ra_page == tok->host.page)
+			return slot;
+	}
+
+	return NULL;
+}
+
+static void td_ra_slot_free(struct td_engine *eng, struct td_ra_slot *slot)
+{
+	WARN_ON(!bio_list_empty(&slot->ra_waiters));
+
+	if (slot->ra_page)
+		__free_page(slot->ra_page);
+	slot->ra_page = NULL;
+	slot->ra_state = TD_RA_SLOT_FREE;
+	slot->ra_stale = 0;
+
+	eng->td_ra_slots_used --;
+}
+
+/* staged data nobody asked for */
+static void td_ra_slot_drop(struct td_engine *eng, struct td_ra_slot *slot)
+{
+	eng->td_counters.misc.readahead_wasted_cnt ++;
+	td_ra_slot_free(eng, slot);
+}
+
+/* take a free slot, or replace the oldest staged page */
+static struct td_ra_slot *td_ra_slot_alloc(struct td_engine *eng)
+{
+	struct td_ra_slot *slot, *oldest = NULL;
+	unsigned i;
+
+	for (i = 0; i < TD_READAHEAD_SLOTS; i++) {
+		slot = eng->td_ra_slots + i;
+
+		if (slot->ra_state == TD_RA_SLOT_FREE)
+			goto found;
+
+		if (slot->ra_state == TD_RA_SLOT_VALID
+				&& (!oldest || slot->ra_ts < oldest->ra_ts))
+			oldest = slot;
+	}
+
+	/* everything is in flight */
+	if (!oldest)
+		return NULL;
+
+	slot = oldest;
+	td_ra_slot_drop(eng, slot);
+
+found:
+	eng->td_ra_slots_used ++;
+	return slot;
+}
+
+/* drop anything staged for [lba, lba+count) */
+static void td_ra_invalidate(struct td_engine *eng, uint64_t lba,
+		uint64_t count)
+{
+	struct td_ra_slot *slot;
+	unsigned i;
+
+	for (i = 0; i < TD_READAHEAD_SLOTS; i++) {
+		slot = eng->td_ra_slots + i;
+
+		if (slot->ra_lba < lba || slot->ra_lba >= lba + count)
+			continue;
+
+		switch (slot->ra_state) {
+		case TD_RA_SLOT_VALID:
+			td_ra_slot_drop(eng, slot);
+			break;
+		case TD_RA_SLOT_INFLIGHT:
+			/* dropped when the read completes */
+			slot->ra_stale = 1;
+			break;
+		}
+	}
+}
+
+/* ---- streams ---- */
+
+/* account a demand read of lba */
+static void td_ra_stream_update(struct td_engine *eng, uint64_t lba)
+{
+	struct td_ra_stream *rs, *victim = NULL;
+	unsigned i;
+
+	for (i = 0; i < TD_READAHEAD_STREAMS; i++) {
+		rs = eng->td_ra_streams + i;
+
+		if (rs->rs_run) {
+			/* sub-LBA reads land on the same LBA more than once */
+			if (rs->rs_next_lba == lba + 1)
+				goto touch;
+
+			if (rs->rs_next_lba == lba)
+				goto extend;
+		}
+
+		if (!victim || rs->rs_last_used < victim->rs_last_used)
+			victim = rs;
+	}
+
+	/* start a new stream in place of the least recently used one */
+	rs = victim;
+	rs->rs_run = 0;
+	rs->rs_ahead_lba = 0;
+
+extend:
+	rs->rs_run ++;
+	rs->rs_next_lba = lba + 1;
+	if (rs->rs_ahead_lba < rs->rs_next_lba)
+		rs->rs_ahead_lba = rs->rs_next_lba;
+
+touch:
+	rs->rs_last_used = td_get_cycles();
+}
+
+/* ---- demand reads ---- */
+
+static bool td_ra_supported(struct td_engine *eng)
+{
+	if (!td_eng_conf_var_get(eng, READAHEAD_DEPTH))
+		return false;
+
+	/* staged pages are whole LBAs of plain data */
+	if (td_eng_conf_hw_var_get(eng, HW_SECTOR_SIZE) != PAGE_SIZE)
+		return false;
+	if (eng->td_bio_copy_ops.dev_to_host
+			!= td_token_copy_ops_bio.dev_to_host)
+		return false;
+
+	/* firmware hacks don't return real data */
+	if (td_eng_conf_var_get(eng, MAGIC_FLAGS))
+		return false;
+#ifdef CONFIG_TERADIMM_USES_CORE_BUFFS_ONLY
+	if (td_eng_conf_var_get(eng, CORE_ONLY))
+		return false;
+#endif
+
+	return true;
+}
+
+/* complete a read bio from a staged page, returns true if the bio read to
+ * the end of the LBA */
+static bool td_ra_complete_bio(struct td_engine *eng, td_bio_ref bio,
+		struct page *page)
+{
+	unsigned size = td_bio_get_byte_size(bio);
+	uint64_t lba_ofs = td_bio_lba_offset(eng, bio);
+
+	td_bio_copy_from_virt(bio, PTR_OFS(page_address(page), lba_ofs));
+
+	eng->td_stats.read.req_completed_cnt ++;
+	eng->td_stats.read.bytes_transfered += size;
+
+	td_bio_endio(eng, bio, 0, 0);
+
+	return lba_ofs + size >= td_eng_conf_hw_var_get(eng, HW_SECTOR_SIZE);
+}
+
+int td_engine_readahead_bio(struct td_engine *eng, td_bio_ref bio)
+{
+	uint hw_sector_size = (uint)td_eng_conf_hw_var_get(eng, HW_SECTOR_SIZE);
+	struct td_ra_slot *slot;
+	uint64_t lba;
+
+	if (unlikely (!td_ra_supported(eng))) {
+		/* turned off, or reconfigured, with data staged */
+		if (eng->td_ra_slots_used)
+			td_engine_readahead_drop_all(eng);
+		return 0;
+	}
+
+	lba = td_bio_lba(eng, bio);
+
+	if (td_bio_is_write(bio) || td_bio_is_discard(bio)) {
+		if (eng->td_ra_slots_used)
+			td_ra_invalidate(eng, lba,
+					td_bio_lba_span(bio, hw_sector_size));
+		return 0;
+	}
+
+	/* only reads within one LBA are tracked */
+	if (td_bio_lba_span(bio, hw_sector_size) != 1)
+		return 0;
+
+	td_ra_stream_update(eng, lba);
+
+	slot = td_ra_find_lba(eng, lba);
+	if (!slot)
+		return 0;
+
+	switch (slot->ra_state) {
+	case TD_RA_SLOT_VALID:
+		eng->td_counters.misc.readahead_hit_cnt ++;
+		td_eng_trace(eng, TR_BIO, "BIO:readahead:hit", lba);
+
+		/* streams read an LBA once; keep it only for sub-LBA reads */
+		if (td_ra_complete_bio(eng, bio, slot->ra_page))
+			td_ra_slot_free(eng, slot);
+		return 1;
+
+	case TD_RA_SLOT_INFLIGHT:
+		if (slot->ra_stale)
+			break;
+
+		eng->td_counters.misc.readahead_wait_cnt ++;
+		td_eng_trace(eng, TR_BIO, "BIO:readahead:wait", lba);
+
+		bio_list_add(&slot->ra_waiters, bio);
+		return 1;
+	}
+
+	return 0;
+}
+
+/* ---- speculative reads ---- */
+
+static int td_ra_read_completion(struct td_token *tok)
+{
+	struct td_engine *eng = td_token_engine(tok);
+	struct td_ra_slot *slot;
+	td_bio_ref bio;
+	bool consumed = false;
+
+	eng->td_ra_inflight --;
+
+	slot = td_ra_find_tok(eng, tok);
+	if (WARN_ON(!slot))
+		return TD_TOKEN_PRE_COMPLETION_DONE;
+
+	td_eng_trace(eng, TR_BIO, "BIO:readahead:done", slot->ra_lba);
+
+	if (unlikely (tok->result)) {
+		/* the waiting reads will have to go to the device */
+		while ((bio = bio_list_pop(&slot->ra_waiters)))
+			td_engine_push_bio(eng, bio);
+
+		/* the page is freed with the token */
+		slot->ra_page = NULL;
+		td_ra_slot_free(eng, slot);
+		return TD_TOKEN_PRE_COMPLETION_DONE;
+	}
+
+	/* take the page from the token, so it's not freed with it */
+	tok->host.page = NULL;
+	tok->host_buf_virt = NULL;
+
+	/* reads that waited were queued before any write that made this
+	 * slot stale, so they still get this data */
+	while ((bio = bio_list_pop(&slot->ra_waiters)))
+		consumed |= td_ra_complete_bio(eng, bio, slot->ra_page);
+
+	if (consumed || slot->ra_stale) {
+		if (!consumed)
+			eng->td_counters.misc.readahead_wasted_cnt ++;
+		td_ra_slot_free(eng, slot);
+		return TD_TOKEN_PRE_COMPLETION_DONE;
+	}
+
+	slot->ra_state = TD_RA_SLOT_VALID;
+	slot->ra_ts = td_get_cycles();
+
+	return TD_TOKEN_PRE_COMPLETION_DONE;
+}
+
+static struct td_token *td_ra_construct_token(struct td_engine *eng,
+		struct td_ra_slot *slot, uint64_t lba)
+{
+	struct td_token *tok;
+
+	/* allocate a token with a page to read into */
+	tok = td_alloc_token_with_host_page(eng, TD_TOK_FOR_FW,
+			0, (uint)td_eng_conf_hw_var_get(eng, HW_SECTOR_SIZE));
+	if (unlikely(!tok))
+		return NULL;
+
+	/* there is no bio, the command is generated from the LBA */
+	tok->readahead = 1;
+	td_token_assign_lba_and_offset(tok, lba, 0);
+
+	/* update latency if needed */
+	td_eng_latency_start(&eng->td_tok_latency, tok);
+
+	/* data is moved to the slot on completion */
+	tok->ops.pre_completion_hook = td_ra_read_completion;
+
+	slot->ra_lba = lba;
+	slot->ra_state = TD_RA_SLOT_INFLIGHT;
+	slot->ra_stale = 0;
+	slot->ra_page = tok->host.page;
+	slot->ra_ts = td_get_cycles();
+
+	eng->td_ra_inflight ++;
+	eng->td_counters.misc.readahead_issued_cnt ++;
+
+	return tok;
+}
+
+unsigned td_engine_readahead_begin(struct td_engine *eng, uint *max)
+{
+	struct td_ra_stream *rs;
+	struct td_ra_slot *slot;
+	struct td_token *tok;
+	uint64_t depth, trigger, lba_count;
+	int tok_avail, core_avail;
+	unsigned i, started = 0;
+
+	if (!td_ra_supported(eng))
+		return 0;
+
+	/* demand IO always goes first */
+	if (td_engine_queued_bios(eng))
+		return 0;
+
+	/* a write in flight could land after the read; the write
+	 * invalidates anything it overlaps when it starts */
+	if (eng->td_stats.write.req_active_cnt || eng->td_rmw_inflight
+			|| !bio_list_empty(&eng->td_rmw_bios)
+			|| td_engine_wrstage_count(eng))
+		return 0;
+
+	depth = td_eng_conf_var_get(eng, READAHEAD_DEPTH);
+	if (eng->td_ra_inflight >= depth)
+		return 0;
+
+	if (unlikely (!td_engine_sequence_limit_check(eng)))
+		return 0;
+
+	tok_avail = min_t(uint, td_available_tokens(eng, TD_TOK_FOR_FW), *max);
+#ifdef CONFIG_TERADIMM_RUSH_INGRESS_PIPE
+	tok_avail = min_t(uint, tok_avail, td_noupdate_headroom(eng));
+#endif
+	core_avail = td_available_core_buffers(eng);
+
+	trigger = td_eng_conf_var_get(eng, READAHEAD_TRIGGER);
+	lba_count = td_engine_capacity(eng)
+		/ td_eng_conf_hw_var_get(eng, HW_SECTOR_SIZE);
+
+	for (i = 0; i < TD_READAHEAD_STREAMS; i++) {
+		rs = eng->td_ra_streams + i;
+
+		if (rs->rs_run < trigger)
+			continue;
+
+		while (rs->rs_ahead_lba < rs->rs_next_lba + depth
+				&& rs->rs_ahead_lba < lba_count) {
+
+			if (tok_avail <= 0 || core_avail <= 0
+					|| eng->td_ra_inflight >= depth)
+				goto done;
+
+			if (!td_ra_find_lba(eng, rs->rs_ahead_lba)) {
+				slot = td_ra_slot_alloc(eng);
+				if (!slot)
+					goto done;
+
+				tok = td_ra_construct_token(eng, slot,
+						rs->rs_ahead_lba);
+				if (unlikely(!tok)) {
+					td_ra_slot_free(eng, slot);
+					goto done;
+				}
+
+				td_eng_trace(eng, TR_BIO, "BIO:readahead:lba",
+						rs->rs_ahead_lba);
+
+				/* send it to the hardware */
+				td_engine_start_token(eng, tok);
+				tok_avail --;
+				core_avail --;
+				started ++;
+			}
+
+			rs->rs_ahead_lba ++;
+		}
+	}
+
+done:
+	(*max) -= min_t(uint, *max, started);
+	return started;
+}
+
+void td_engine_readahead_invalidate(struct td_engine *eng, uint64_t lba,
+		uint64_t count)
+{
+	if (eng->td_ra_slots_used)
+		td_ra_invalidate(eng, lba, count);
+}
+
+/* ---- setup ---- */
+
+void td_engine_readahead_drop_all(struct td_engine *eng)
+{
+	struct td_ra_slot *slot;
+	unsigned i;
+
+	for (i = 0; i < TD_READAHEAD_SLOTS; i++) {
+		slot = eng->td_ra_slots + i;
+
+		switch (slot->ra_state) {
+		case TD_RA_SLOT_VALID:
+			td_ra_slot_drop(eng, slot);
+			break;
+		case TD_RA_SLOT_INFLIGHT:
+			slot->ra_stale = 1;
+			break;
+		}
+	}
+
+	memset(eng->td_ra_streams, 0, sizeof(eng->td_ra_streams));
+}
+
+void td_engine_readahead_init(struct td_engine *eng)
+{
+	unsigned i;
+
+	memset(eng->td_ra_streams, 0, sizeof(eng->td_ra_streams));
+	memset(eng->td_ra_slots, 0, sizeof(eng->td_ra_slots));
+
+	for (i = 0; i < TD_READAHEAD_SLOTS; i++)
+		bio_list_init(&eng->td_ra_slots[i].ra_waiters);
+
+	eng->td_ra_slots_used = 0;
+	eng->td_ra_inflight = 0;
+}
@@ -0,0 +1,58 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                                                                       *
+ *    Copyright (c) 2014 Diablo Technologies Inc. (Diablo).              *
+ *    All rights reserved.                                               *
+ *                                                                       *
+ *    This program is free software; you can redistribute it and/or      *
+ *    modify it under the terms of the GNU General Public License        *
+ *    as published by the Free Software Foundation; either version 2     *
+ *    of the License, or (at your option) any later version located at   *
+ *    <http://www.gnu.org/licenses/                                      *
+ *                                                                       *
+ *    This program is distributed WITHOUT ANY WARRANTY; without even     *
+ *    the implied warranty of MERCHANTABILITY or FITNESS FOR A           *
+ *    PARTICULAR PURPOSE.  See the GNU General Public License for        *
+ *    more details.                                                      *
+ *                                                                       *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef _TD_ENG_READAHEAD_H_
+#define _TD_ENG_READAHEAD_H_
+
+#include "td_compat.h"
+#include "td_defs.h"
+#include "td_bio.h"
+#include "td_engine_def.h"
+
+#ifdef CONFIG_TERADIMM_READAHEAD
+
+/** reset stream tracking and read-ahead slots */
+extern void td_engine_readahead_init(struct td_engine *eng);
+
+/** free staged data, and forget in flight read-ahead */
+extern void td_engine_readahead_drop_all(struct td_engine *eng);
+
+/**
+ * look at a bio about to be started
+ * @return non-zero if the bio was consumed by read-ahead
+ */
+extern int td_engine_readahead_bio(struct td_engine *eng, td_bio_ref bio);
+
+/** start speculative reads, returns number of tokens started */
+extern unsigned td_engine_readahead_begin(struct td_engine *eng, uint *max);
+
+/** a write that isn't a bio is starting on [lba, lba+count) */
+extern void td_engine_readahead_invalidate(struct td_engine *eng,
+		uint64_t lba, uint64_t count);
+
+#else
+
+#define td_engine_readahead_init(eng) do { /* nothing */ } while(0)
+#define td_engine_readahead_drop_all(eng) do { /* nothing */ } while(0)
+#define td_engine_readahead_bio(eng,bio) (0)
+#define td_engine_readahead_begin(eng,max) (0)
+#define td_engine_readahead_invalidate(eng,lba,count) do { /* nothing */ } while(0)
+
+#endif
+
+#endif
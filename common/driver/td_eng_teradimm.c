@@ -512,7 +512,7 @@ int teradimm_ops_init(struct td_engine *eng)
 
 	/* allocate and initialize the serial link */
 
-	node = dev->td_cpu_socket;
+	node = dev->td_node;
 
 	td = kzalloc_node(sizeof(*td), GFP_KERNEL, node);
 	if (!td)
@@ -2199,6 +2199,7 @@ static int teradimm_ops_hw_init(struct td_engine *eng)
 	struct td_token *tok, *nxt;
 	enum td_token_type tt;
 	struct td_token_list *tok_list;
+	struct td_token_map *tok_map;
 #endif
 
 	WARN_ON_ACCESS_FROM_WRONG_CPU(eng);
@@ -2230,16 +2231,16 @@ static int teradimm_ops_hw_init(struct td_engine *eng)
 			&eng->td_early_completed_reads_tokens) {
 			__td_tokens_del(&eng->td_early_completed_reads_tokens, tok);
 			td_token_error_dump(tok, "Clear early read");
-			td_tokens_enqueue(&eng->tok_pool[TD_TOK_FOR_FW].td_active_tokens, tok);
+			td_tokmap_enqueue(&eng->tok_pool[TD_TOK_FOR_FW].td_active_tokens, tok);
 	}
 #endif
 
 #ifdef CONFIG_TERADIMM_ENABLE_FORCE_RESET
 	td_eng_notice(eng, "Reset all active tokens (%d)\n", td_all_active_tokens(eng));
 	for_each_token_type(tt) {
-		tok_list = &eng->tok_pool[tt].td_active_tokens;
-		for_each_token_list_token(tok, nxt, tok_list) {
-			__td_tokens_del(tok_list, tok);
+		tok_map = &eng->tok_pool[tt].td_active_tokens;
+		for_each_token_map_token(tok, tok_map) {
+			__td_tokmap_del(tok_map, tok);
 			td_token_error_dump(tok, "Reset active");
 
 			tok->result = -EIO;
@@ -2249,10 +2250,12 @@ static int teradimm_ops_hw_init(struct td_engine *eng)
 				td_request_end_common_bio(tok);
 			else if (tok->host.ucmd)
 				td_request_end_common_ucmd(tok);
+			else if (tok->host.ureq)
+				tok->ops.pre_completion_hook(tok);
 
 			td_free_all_buffers(eng, tok);
 			td_token_reset(tok);
-			td_tokens_enqueue(&eng->tok_pool[tt].td_free_tokens, tok);
+			td_tokmap_enqueue(&eng->tok_pool[tt].td_free_tokens, tok);
 
 			tok->odd = !tok->odd;
 			if (tok == eng->maint_toks[tt])
@@ -2271,7 +2274,7 @@ static int teradimm_ops_hw_init(struct td_engine *eng)
 
 		td_free_all_buffers(eng, tok);
 		td_token_reset(tok);
-		td_tokens_enqueue(&eng->tok_pool[tt].td_free_tokens, tok);
+		td_tokmap_enqueue(&eng->tok_pool[tt].td_free_tokens, tok);
 	}
 
 	/*
@@ -2295,9 +2298,9 @@ static int teradimm_ops_hw_init(struct td_engine *eng)
 
 	td_eng_info(eng, "Resetting free tokens\n");
 	for_each_token_type(tt) {
-		tok_list = &eng->tok_pool[tt].td_free_tokens;
-		for_each_token_list_token(tok, nxt, tok_list) {
-			__td_tokens_del(tok_list, tok);
+		tok_map = &eng->tok_pool[tt].td_free_tokens;
+		for_each_token_map_token(tok, tok_map) {
+			__td_tokmap_del(tok_map, tok);
 			td_token_reset(tok);
 			td_cmdgen_reset(tok->cmd_bytes);
 			tok->ops.pre_completion_hook = teradimm_hw_init_reset_done;
@@ -2309,9 +2312,9 @@ static int teradimm_ops_hw_init(struct td_engine *eng)
 
 	td_eng_info(eng, "Resetting timedout tokens\n");
 	for_each_token_type(tt) {
-		tok_list = &eng->tok_pool[tt].td_timedout_tokens;
-		for_each_token_list_token(tok, nxt, tok_list) {
-			__td_tokens_del(tok_list, tok);
+		tok_map = &eng->tok_pool[tt].td_timedout_tokens;
+		for_each_token_map_token(tok, tok_map) {
+			__td_tokmap_del(tok_map, tok);
 			td_token_reset(tok);
 			td_cmdgen_reset(tok->cmd_bytes);
 			tok->ops.pre_completion_hook = teradimm_hw_init_reset_done;
@@ -2323,9 +2326,9 @@ static int teradimm_ops_hw_init(struct td_engine *eng)
 
 	td_eng_info(eng, "Resetting resumable tokens\n");
 	for_each_token_type(tt) {
-		tok_list = &eng->tok_pool[tt].td_resumable_tokens;
-		for_each_token_list_token(tok, nxt, tok_list) {
-			__td_tokens_del(tok_list, tok);
+		tok_map = &eng->tok_pool[tt].td_resumable_tokens;
+		for_each_token_map_token(tok, tok_map) {
+			__td_tokmap_del(tok_map, tok);
 			td_token_reset(tok);
 			td_cmdgen_reset(tok->cmd_bytes);
 			tok->ops.pre_completion_hook = teradimm_hw_init_reset_done;
@@ -3453,15 +3456,16 @@ int teradimm_ops_create_cmd(struct td_engine *eng, struct td_token *tok)
 		return td_cmd_gen_SEC_dup(eng, tok);
 	}
 
-	/* block request baring tokens */
-	if (tok->host.bio) {
+	/* block request baring tokens, read-ahead done on their behalf, and
+	 * user ring requests */
+	if (tok->host.bio || tok->readahead || tok->host.ureq) {
 		if (! tok->cmd_seq)
 			tok->cmd_seq = td_engine_next_sequence(eng);
 		return td_cmd_gen_bio(eng, tok);
 	}
 
 	/* BIOs get special status_check ops, but now we just get a normal one */
-	tok->ops.status_check = td_cmd_status_check;
+	tok->status_check = td_cmd_status_check;
 	/* tokens handling user requests */
 	if (tok->host.ucmd){
 		rc = td_eng_cmdgen(eng, ucmd, tok->cmd_bytes, tok->host.ucmd,
@@ -4489,7 +4493,9 @@ static int teradimm_ops_trim(struct td_engine *eng,
 		struct td_token *tok)
 {
 	uint64_t size = td_bio_get_byte_size(tok->host.bio);
-	uint64_t *page = (uint64_t*)tok->host.bio->bi_io_vec->bv_page;
+	/* discards carry a page for the ranges, zero writes use the token's */
+	uint64_t *page = tok->zero_trim ? (uint64_t*)tok->host_buf_virt
+		: (uint64_t*)tok->host.bio->bi_io_vec->bv_page;
 	td_bio_flags_t flags = *td_bio_flags_ref(tok->host.bio);
 	uint64_t value = 0;
 	uint64_t lba = tok->lba;
@@ -4545,9 +4551,11 @@ static int teradimm_ops_trim(struct td_engine *eng,
 		page++;
 	}
 */
-	tok->host.bio->bio_size = 512;
-	/* just because they may have been messed up */
-	*td_bio_flags_ref(tok->host.bio) = flags;
+	if (!tok->zero_trim) {
+		tok->host.bio->bio_size = 512;
+		/* just because they may have been messed up */
+		*td_bio_flags_ref(tok->host.bio) = flags;
+	}
 
 
 	teradimm_ops_write_page(eng, tok);
@@ -0,0 +1,638 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                                                                       *
+ *    Copyright (c) 2014 Diablo Technologies Inc. (Diablo).              *
+ *    All rights reserved.                                               *
+ *                                                                       *
+ *    This program is free software; you can redistribute it and/or      *
+ *    modify it under the terms of the GNU General Public License        *
+ *    as published by the Free Software Foundation; either version 2     *
+ *    of the License, or (at your option) any later version located at   *
+ *    <http://www.gnu.org/licenses/                                      *
+ *                                                                       *
+ *    This program is distributed WITHOUT ANY WARRANTY; without even     *
+ *    the implied warranty of MERCHANTABILITY or FITNESS FOR A           *
+ *    PARTICULAR PURPOSE.  See the GNU General Public License for        *
+ *    more details.                                                      *
+ *                                                                       *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include "td_kdefn.h"
+#include "td_compat.h"
+
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <asm/uaccess.h>
+
+#include "td_engine.h"
+#include "td_token.h"
+#include "td_eng_uring.h"
+#include "td_eng_readahead.h"
+#include "td_eng_rdcache.h"
+#include "td_eng_wrstage.h"
+#include "td_util.h"
+
+#ifndef CONFIG_TERADIMM_USER_RING
+#error this file should only be compiled into a USER_RING driver
+#endif
+
+/*
+ * User IO rings
+ *
+ * An open of the device char device can set up a submission and completion
+ * ring, mmap()ed by the user, along with a buffer that is pinned and mapped
+ * into the kernel for the life of the ring.  The user posts LBA, count and
+ * buffer offset entries, and calls URING_ENTER to get them started.
+ *
+ * The engine worker takes entries off the rings next to bios, one token
+ * per LBA, and the data is copied between the device buffers and the user
+ * buffer directly.  No bio is allocated and the block layer is not used.
+ * An entry is completed once all of its LBAs are.
+ *
+ * Writes drop what the read cache and read-ahead hold for their LBAs, like
+ * write bios do.  There is no ordering between ring entries and bios.
+ */
+
+/* ---- refs ---- */
+
+static struct td_uring *td_uring_get(struct td_engine *eng,
+		struct file *filp)
+{
+	struct td_uring *ring = NULL;
+	unsigned i;
+
+	spin_lock_bh(&eng->td_uring_lock);
+	for (i = 0; i < TD_URING_MAX; i++) {
+		if (eng->td_urings[i] && eng->td_urings[i]->ur_owner == filp) {
+			ring = eng->td_urings[i];
+			atomic_inc(&ring->ur_ref);
+			break;
+		}
+	}
+	spin_unlock_bh(&eng->td_uring_lock);
+
+	return ring;
+}
+
+static void td_uring_put(struct td_engine *eng, struct td_uring *ring)
+{
+	/* under the lock, so the releaser can't free it under wake_up() */
+	spin_lock_bh(&eng->td_uring_lock);
+	if (atomic_dec_and_test(&ring->ur_ref))
+		wake_up(&ring->ur_wq);
+	spin_unlock_bh(&eng->td_uring_lock);
+}
+
+/* ---- shared indices ---- */
+
+static uint32_t td_uring_cq_posted(struct td_uring *ring)
+{
+	uint32_t used = ring->ur_cq_tail - ACCESS_ONCE(ring->ur_ctl->cq_head);
+
+	return min_t(uint32_t, used, ring->ur_cq_entries);
+}
+
+static bool td_uring_cq_space(struct td_uring *ring)
+{
+	return td_uring_cq_posted(ring) + ring->ur_cq_reserved
+		< ring->ur_cq_entries;
+}
+
+static bool td_uring_sq_posted(struct td_uring *ring)
+{
+	uint32_t tail = ACCESS_ONCE(ring->ur_ctl->sq_tail);
+
+	/* anything past a full ring is garbage */
+	return tail != ring->ur_sq_head
+		&& tail - ring->ur_sq_head <= ring->ur_sq_entries;
+}
+
+/* stop looking at a ring until the next enter */
+static void td_uring_idle(struct td_engine *eng, struct td_uring *ring)
+{
+	spin_lock_bh(&eng->td_uring_lock);
+	/* an enter for entries posted since the last look got here first */
+	if (ring->ur_ready && !(td_uring_sq_posted(ring)
+				&& td_uring_cq_space(ring))) {
+		ring->ur_ready = 0;
+		eng->td_uring_ready --;
+	}
+	spin_unlock_bh(&eng->td_uring_lock);
+}
+
+static void td_uring_post(struct td_engine *eng, struct td_uring *ring,
+		struct td_uring_req *req)
+{
+	struct td_uring_cqe *cqe;
+
+	cqe = ring->ur_cq + (ring->ur_cq_tail & (ring->ur_cq_entries - 1));
+	cqe->user_data = req->user_data;
+	cqe->result = req->result ?: (int32_t)req->bytes;
+	cqe->rsvd = 0;
+
+	/* entry is visible before the tail that covers it */
+	smp_wmb();
+	ring->ur_cq_tail ++;
+	ring->ur_ctl->cq_tail = ring->ur_cq_tail;
+	ring->ur_cq_reserved --;
+
+	wake_up(&ring->ur_wq);
+}
+
+/* ---- starting entries ---- */
+
+static bool td_uring_supported(struct td_engine *eng)
+{
+	/* the buffer holds plain data, whole pages per LBA */
+	if (td_eng_conf_hw_var_get(eng, HW_SECTOR_SIZE) != PAGE_SIZE)
+		return false;
+	if (eng->td_bio_copy_ops.dev_to_host
+			!= td_token_copy_ops_bio.dev_to_host)
+		return false;
+
+	/* firmware hacks don't move real data */
+	if (td_eng_conf_var_get(eng, MAGIC_FLAGS))
+		return false;
+#ifdef CONFIG_TERADIMM_USES_CORE_BUFFS_ONLY
+	if (td_eng_conf_var_get(eng, CORE_ONLY))
+		return false;
+#endif
+
+	return true;
+}
+
+static int td_uring_check_sqe(struct td_engine *eng, struct td_uring *ring,
+		const struct td_uring_sqe *sqe)
+{
+	uint64_t hw_sector_size = td_eng_conf_hw_var_get(eng, HW_SECTOR_SIZE);
+	uint64_t lba_max = td_engine_capacity(eng) / hw_sector_size;
+	uint64_t len = sqe->lba_count * hw_sector_size;
+
+	if (!td_uring_supported(eng))
+		return -EOPNOTSUPP;
+
+	if (sqe->op != TD_URING_OP_READ && sqe->op != TD_URING_OP_WRITE)
+		return -EINVAL;
+
+	if (!sqe->lba_count || sqe->lba >= lba_max
+			|| sqe->lba_count > lba_max - sqe->lba)
+		return -EINVAL;
+
+	if ((sqe->buf_ofs & (hw_sector_size - 1))
+			|| sqe->buf_ofs > ring->ur_buf_len
+			|| len > ring->ur_buf_len - sqe->buf_ofs)
+		return -EFAULT;
+
+	return 0;
+}
+
+static int td_uring_token_completion(struct td_token *tok)
+{
+	struct td_engine *eng = td_token_engine(tok);
+	struct td_uring_req *req = tok->host.ureq;
+	struct td_uring *ring = req->ring;
+	unsigned size = tok->len_host_to_dev + tok->len_dev_to_host;
+
+	/* the buffer belongs to the ring */
+	tok->host.ureq = NULL;
+	tok->host_buf_virt = NULL;
+
+	td_update_request_end_counters(eng, tok, size, tok->result);
+
+	if (unlikely (tok->result)) {
+		if (!req->result)
+			req->result = tok->result;
+	} else {
+		req->bytes += size;
+		eng->td_counters.misc.uring_lba_cnt ++;
+	}
+
+	/* an entry left partly started by a release is never posted */
+	if (!--req->left)
+		td_uring_post(eng, ring, req);
+
+	td_uring_put(eng, ring);
+
+	return TD_TOKEN_PRE_COMPLETION_DONE;
+}
+
+static struct td_token *td_uring_construct_token(struct td_engine *eng,
+		struct td_uring *ring)
+{
+	uint hw_sector_size = (uint)td_eng_conf_hw_var_get(eng, HW_SECTOR_SIZE);
+	struct td_uring_sqe *sqe = &ring->ur_cur_sqe;
+	bool write = sqe->op == TD_URING_OP_WRITE;
+	struct td_token *tok;
+
+	tok = td_alloc_token_with_buffers(eng, TD_TOK_FOR_FW,
+			write ? hw_sector_size : 0,
+			write ? 0 : hw_sector_size);
+	if (unlikely(!tok))
+		return NULL;
+
+	/* there is no bio, the data moves straight to/from the user buffer */
+	tok->host.ureq = ring->ur_cur;
+	tok->host_buf_virt = PTR_OFS(ring->ur_buf_virt, sqe->buf_ofs
+			+ (uint64_t)ring->ur_cur_done * hw_sector_size);
+	tok->copy_ops = eng->td_virt_copy_ops;
+	td_token_assign_lba_and_offset(tok, sqe->lba + ring->ur_cur_done, 0);
+
+	/* update latency if needed */
+	td_eng_latency_start(&eng->td_tok_latency, tok);
+
+	tok->ops.pre_completion_hook = td_uring_token_completion;
+
+	/* the ring stays until this completes */
+	atomic_inc(&ring->ur_ref);
+
+	return tok;
+}
+
+/* take the next posted entry, returns false if there is none to take */
+static bool td_uring_take_sqe(struct td_engine *eng, struct td_uring *ring)
+{
+	struct td_uring_sqe *sqe = &ring->ur_cur_sqe;
+	struct td_uring_req *req;
+	unsigned slot;
+	int rc;
+
+	while (td_uring_sq_posted(ring)) {
+		slot = ring->ur_sq_head & (ring->ur_sq_entries - 1);
+
+		/* the last entry in this slot is still running */
+		req = ring->ur_reqs + slot;
+		if (req->left)
+			return false;
+
+		if (!td_uring_cq_space(ring))
+			return false;
+
+		/* read the entry after the tail that covers it, and only
+		 * once, the user can change it under us */
+		smp_rmb();
+		*sqe = ring->ur_sq[slot];
+
+		ring->ur_sq_head ++;
+		ring->ur_ctl->sq_head = ring->ur_sq_head;
+		ring->ur_cq_reserved ++;
+
+		req->user_data = sqe->user_data;
+		req->bytes = 0;
+		req->result = 0;
+
+		rc = td_uring_check_sqe(eng, ring, sqe);
+		if (rc) {
+			req->result = rc;
+			td_uring_post(eng, ring, req);
+			continue;
+		}
+
+		if (sqe->op == TD_URING_OP_WRITE) {
+			td_engine_rdcache_invalidate(eng, sqe->lba,
+					sqe->lba_count);
+			td_engine_readahead_invalidate(eng, sqe->lba,
+					sqe->lba_count);
+		}
+
+		req->left = sqe->lba_count;
+		ring->ur_cur = req;
+		ring->ur_cur_done = 0;
+
+		eng->td_counters.misc.uring_req_cnt ++;
+		return true;
+	}
+
+	return false;
+}
+
+static unsigned td_uring_start(struct td_engine *eng, struct td_uring *ring,
+		uint *max)
+{
+	struct td_token *tok;
+	unsigned started = 0;
+
+	while (*max) {
+		if (!ring->ur_cur && !td_uring_take_sqe(eng, ring)) {
+			td_uring_idle(eng, ring);
+			break;
+		}
+
+		/* staged writes to the LBA go out first */
+		if (td_engine_wrstage_conflict_lba(eng, ring->ur_cur_sqe.lba
+					+ ring->ur_cur_done, 1))
+			break;
+
+		tok = td_uring_construct_token(eng, ring);
+		if (unlikely(!tok))
+			break;
+
+		td_eng_trace(eng, TR_BIO, "BIO:uring:lba", tok->lba);
+
+		/* send it to the hardware */
+		td_engine_start_token(eng, tok);
+		(*max) --;
+		started ++;
+
+		if (++ ring->ur_cur_done == ring->ur_cur_sqe.lba_count)
+			ring->ur_cur = NULL;
+	}
+
+	return started;
+}
+
+unsigned td_engine_uring_begin(struct td_engine *eng, uint *max)
+{
+	struct td_uring *rings[TD_URING_MAX];
+	unsigned i, count = 0, started = 0;
+	uint avail;
+
+	if (!eng->td_uring_ready)
+		return 0;
+
+	if (unlikely (!td_engine_sequence_limit_check(eng)))
+		return 0;
+
+	avail = *max;
+#ifdef CONFIG_TERADIMM_RUSH_INGRESS_PIPE
+	avail = min_t(uint, avail, td_noupdate_headroom(eng));
+#endif
+
+	spin_lock_bh(&eng->td_uring_lock);
+	for (i = 0; i < TD_URING_MAX; i++) {
+		if (eng->td_urings[i] && eng->td_urings[i]->ur_ready) {
+			rings[count] = eng->td_urings[i];
+			atomic_inc(&rings[count]->ur_ref);
+			count ++;
+		}
+	}
+	spin_unlock_bh(&eng->td_uring_lock);
+
+	for (i = 0; i < count; i++) {
+		if (avail)
+			started += td_uring_start(eng, rings[i], &avail);
+		td_uring_put(eng, rings[i]);
+	}
+
+	(*max) -= min_t(uint, *max, started);
+	return started;
+}
+
+/* ---- setup ---- */
+
+static void td_uring_free(struct td_uring *ring)
+{
+	unsigned i;
+
+	if (ring->ur_buf_virt)
+		vunmap(ring->ur_buf_virt);
+
+	/* reads wrote to these */
+	for (i = 0; i < ring->ur_page_count; i++) {
+		set_page_dirty_lock(ring->ur_pages[i]);
+		put_page(ring->ur_pages[i]);
+	}
+
+	vfree(ring->ur_pages);
+	vfree(ring->ur_mem);
+	kfree(ring);
+}
+
+static int td_uring_pin_buffer(struct td_uring *ring, unsigned long addr,
+		uint64_t len)
+{
+	unsigned count = (unsigned)(len >> PAGE_SHIFT);
+	int rc;
+
+	ring->ur_pages = vzalloc(count * sizeof(struct page *));
+	if (!ring->ur_pages)
+		return -ENOMEM;
+
+	down_read(&current->mm->mmap_sem);
+	rc = get_user_pages(current,
+			current->mm,
+			addr,
+			count,
+			1, /* allow writes */
+			0, /* don't force if shared */
+			ring->ur_pages,
+			NULL);
+	up_read(&current->mm->mmap_sem);
+
+	/* release only what was pinned */
+	if (rc > 0)
+		ring->ur_page_count = rc;
+	if (rc < 0)
+		return rc;
+	if (rc != count)
+		return -EFAULT;
+
+	ring->ur_buf_virt = vmap(ring->ur_pages, count, VM_MAP, PAGE_KERNEL);
+	if (!ring->ur_buf_virt)
+		return -ENOMEM;
+
+	ring->ur_buf_len = len;
+	return 0;
+}
+
+int td_engine_uring_setup(struct td_engine *eng, struct file *filp,
+		struct td_ioctl_device_uring_setup *setup,
+		struct td_ioctl_device_uring_setup __user *u_setup)
+{
+	unsigned long addr = (unsigned long)setup->buf;
+	uint32_t sq_entries = setup->sq_entries;
+	struct td_uring *ring;
+	size_t sq_off, cq_off;
+	unsigned i;
+	int rc;
+
+	if (!td_uring_supported(eng))
+		return -EOPNOTSUPP;
+
+	if (!sq_entries || sq_entries > TD_URING_ENTRIES_MAX
+			|| (sq_entries & (sq_entries - 1)))
+		return -EINVAL;
+
+	if (!setup->buf_len || setup->buf_len > TD_URING_BUF_MAX
+			|| ((addr | setup->buf_len) & ~PAGE_MASK))
+		return -EINVAL;
+
+	rc = -ENOMEM;
+	ring = kzalloc_node(sizeof(*ring)
+			+ sq_entries * sizeof(struct td_uring_req),
+			GFP_KERNEL, td_engine_node(eng));
+	if (!ring)
+		goto error_alloc;
+
+	ring->ur_owner = filp;
+	atomic_set(&ring->ur_ref, 1);
+	init_waitqueue_head(&ring->ur_wq);
+
+	ring->ur_sq_entries = sq_entries;
+	ring->ur_cq_entries = sq_entries * 2;
+	for (i = 0; i < sq_entries; i++)
+		ring->ur_reqs[i].ring = ring;
+
+	/* control block, then the entries on their own cache lines */
+	sq_off = ALIGN(sizeof(struct td_uring_ctl), L1_CACHE_BYTES);
+	cq_off = ALIGN(sq_off + ring->ur_sq_entries
+			* sizeof(struct td_uring_sqe), L1_CACHE_BYTES);
+	ring->ur_mem_size = PAGE_ALIGN(cq_off + ring->ur_cq_entries
+			* sizeof(struct td_uring_cqe));
+
+	ring->ur_mem = vmalloc_user(ring->ur_mem_size);
+	if (!ring->ur_mem)
+		goto error_mem;
+
+	ring->ur_ctl = ring->ur_mem;
+	ring->ur_sq = PTR_OFS(ring->ur_mem, sq_off);
+	ring->ur_cq = PTR_OFS(ring->ur_mem, cq_off);
+
+	ring->ur_ctl->sq_entries = ring->ur_sq_entries;
+	ring->ur_ctl->cq_entries = ring->ur_cq_entries;
+	ring->ur_ctl->sq_off = sq_off;
+	ring->ur_ctl->cq_off = cq_off;
+
+	rc = td_uring_pin_buffer(ring, addr, setup->buf_len);
+	if (rc)
+		goto error_pin;
+
+	/* once attached an mmap() can map ur_mem, so failing after that
+	 * would free it under the mapping; tell the user first */
+	setup->cq_entries = ring->ur_cq_entries;
+	setup->mmap_len = ring->ur_mem_size;
+	rc = -EFAULT;
+	if (copy_to_user(u_setup, setup, sizeof(*setup)))
+		goto error_copy;
+
+	/* one ring per open, and a few per device */
+	rc = -EBUSY;
+	spin_lock_bh(&eng->td_uring_lock);
+	for (i = 0; i < TD_URING_MAX; i++)
+		if (eng->td_urings[i] && eng->td_urings[i]->ur_owner == filp)
+			break;
+	if (i == TD_URING_MAX) {
+		for (i = 0; i < TD_URING_MAX; i++) {
+			if (!eng->td_urings[i]) {
+				eng->td_urings[i] = ring;
+				rc = 0;
+				break;
+			}
+		}
+	}
+	spin_unlock_bh(&eng->td_uring_lock);
+	if (rc)
+		goto error_attach;
+
+	return 0;
+
+error_attach:
+error_copy:
+error_pin:
+error_mem:
+	td_uring_free(ring);
+error_alloc:
+	return rc;
+}
+
+int td_engine_uring_enter(struct td_engine *eng, struct file *filp,
+		struct td_ioctl_device_uring_enter *enter)
+{
+	struct td_uring *ring;
+	uint32_t min_complete;
+	unsigned long timeout;
+	long ret;
+	int rc = 0;
+
+	ring = td_uring_get(eng, filp);
+	if (!ring)
+		return -ENXIO;
+
+	if (!td_state_can_accept_requests(eng)) {
+		rc = -EIO;
+		goto done;
+	}
+
+	spin_lock_bh(&eng->td_uring_lock);
+	if (!ring->ur_ready) {
+		ring->ur_ready = 1;
+		eng->td_uring_ready ++;
+	}
+	spin_unlock_bh(&eng->td_uring_lock);
+
+	td_engine_poke(eng);
+
+	min_complete = min_t(uint32_t, enter->min_complete,
+			ring->ur_cq_entries);
+	if (!min_complete)
+		goto done;
+
+	timeout = msecs_to_jiffies(enter->timeout_msec ?: 60*MSEC_PER_SEC);
+	ret = wait_event_interruptible_timeout(ring->ur_wq,
+			td_uring_cq_posted(ring) >= min_complete, timeout);
+	if (!ret)
+		rc = -ETIMEDOUT;
+	else if (ret < 0)
+		rc = (int)ret;
+
+done:
+	td_uring_put(eng, ring);
+	return rc;
+}
+
+int td_engine_uring_mmap(struct td_engine *eng, struct file *filp,
+		struct vm_area_struct *vma)
+{
+	struct td_uring *ring;
+	int rc;
+
+	ring = td_uring_get(eng, filp);
+	if (!ring)
+		return -ENXIO;
+
+	rc = -EINVAL;
+	if (!vma->vm_pgoff
+			&& vma->vm_end - vma->vm_start == ring->ur_mem_size)
+		rc = remap_vmalloc_range(vma, ring->ur_mem, 0);
+
+	td_uring_put(eng, ring);
+	return rc;
+}
+
+void td_engine_uring_release(struct td_engine *eng, struct file *filp)
+{
+	struct td_uring *ring = NULL;
+	unsigned i;
+
+	spin_lock_bh(&eng->td_uring_lock);
+	for (i = 0; i < TD_URING_MAX; i++) {
+		if (eng->td_urings[i] && eng->td_urings[i]->ur_owner == filp) {
+			ring = eng->td_urings[i];
+			eng->td_urings[i] = NULL;
+			if (ring->ur_ready) {
+				ring->ur_ready = 0;
+				eng->td_uring_ready --;
+			}
+			break;
+		}
+	}
+	spin_unlock_bh(&eng->td_uring_lock);
+
+	if (!ring)
+		return;
+
+	/* tokens still running hold the buffer */
+	td_uring_put(eng, ring);
+	wait_event(ring->ur_wq, !atomic_read(&ring->ur_ref));
+
+	/* let the last td_uring_put() get out of wake_up() */
+	spin_lock_bh(&eng->td_uring_lock);
+	spin_unlock_bh(&eng->td_uring_lock);
+
+	td_uring_free(ring);
+}
+
+void td_engine_uring_init(struct td_engine *eng)
+{
+	spin_lock_init(&eng->td_uring_lock);
+	memset(eng->td_urings, 0, sizeof(eng->td_urings));
+	eng->td_uring_ready = 0;
+}
@@ -0,0 +1,107 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                                                                       *
+ *    Copyright (c) 2014 Diablo Technologies Inc. (Diablo).              *
+ *    All rights reserved.                                               *
+ *                                                                       *
+ *    This program is free software; you can redistribute it and/or      *
+ *    modify it under the terms of the GNU General Public License        *
+ *    as published by the Free Software Foundation; either version 2     *
+ *    of the License, or (at your option) any later version located at   *
+ *    <http://www.gnu.org/licenses/                                      *
+ *                                                                       *
+ *    This program is distributed WITHOUT ANY WARRANTY; without even     *
+ *    the implied warranty of MERCHANTABILITY or FITNESS FOR A           *
+ *    PARTICULAR PURPOSE.  See the GNU General Public License for        *
+ *    more details.                                                      *
+ *                                                                       *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef _TD_ENG_URING_H_
+#define _TD_ENG_URING_H_
+
+#include "td_compat.h"
+#include "td_defs.h"
+#include "td_ioctl.h"
+#include "td_engine_def.h"
+
+struct file;
+struct vm_area_struct;
+
+#ifdef CONFIG_TERADIMM_USER_RING
+
+/** a submission entry while its LBAs are in flight */
+struct td_uring_req {
+	struct td_uring         *ring;
+	uint64_t                user_data;
+	uint32_t                left;           /**< LBAs not completed yet */
+	uint32_t                bytes;          /**< transferred so far */
+	int                     result;         /**< first error */
+};
+
+struct td_uring {
+	struct file             *ur_owner;      /**< the open file that set it up */
+	atomic_t                ur_ref;         /**< engine slot, tokens, and the worker */
+	wait_queue_head_t       ur_wq;          /**< completions posted, last ref dropped */
+	unsigned                ur_ready;       /**< counted in td_uring_ready */
+
+	/* shared with user space */
+	void                    *ur_mem;
+	size_t                  ur_mem_size;
+	struct td_uring_ctl     *ur_ctl;
+	struct td_uring_sqe     *ur_sq;
+	struct td_uring_cqe     *ur_cq;
+
+	/* user space can scribble on the shared indices, these are ours */
+	uint32_t                ur_sq_entries;
+	uint32_t                ur_cq_entries;
+	uint32_t                ur_sq_head;
+	uint32_t                ur_cq_tail;
+	uint32_t                ur_cq_reserved; /**< for entries taken but not posted */
+
+	/* entry being started, one LBA per token */
+	struct td_uring_req     *ur_cur;
+	struct td_uring_sqe     ur_cur_sqe;
+	uint32_t                ur_cur_done;
+
+	/* registered buffer, pinned and mapped for the life of the ring */
+	struct page             **ur_pages;
+	unsigned                ur_page_count;
+	void                    *ur_buf_virt;
+	uint64_t                ur_buf_len;
+
+	struct td_uring_req     ur_reqs[0];     /**< one per submission slot */
+};
+
+extern void td_engine_uring_init(struct td_engine *eng);
+
+/** set up a ring for an open file, register its buffer, and copy the
+ * result out to u_setup before the ring can be mapped */
+extern int td_engine_uring_setup(struct td_engine *eng, struct file *filp,
+		struct td_ioctl_device_uring_setup *setup,
+		struct td_ioctl_device_uring_setup __user *u_setup);
+
+/** start posted entries, and wait for completions if asked to */
+extern int td_engine_uring_enter(struct td_engine *eng, struct file *filp,
+		struct td_ioctl_device_uring_enter *enter);
+
+/** map the ring of an open file into user space */
+extern int td_engine_uring_mmap(struct td_engine *eng, struct file *filp,
+		struct vm_area_struct *vma);
+
+/** tear down the ring of an open file, after its IO drains */
+extern void td_engine_uring_release(struct td_engine *eng,
+		struct file *filp);
+
+/** start posted entries, returns number of tokens started */
+extern unsigned td_engine_uring_begin(struct td_engine *eng, uint *max);
+
+#else
+
+#define td_engine_uring_init(eng) do { /* nothing */ } while(0)
+#define td_engine_uring_mmap(eng,filp,vma) (-EIO)
+#define td_engine_uring_release(eng,filp) do { /* nothing */ } while(0)
+#define td_engine_uring_begin(eng,max) (0)
+
+#endif
+
+#endif
@@ -0,0 +1,414 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                                                                       *
+ *    Copyright (c) 2014 Diablo Technologies Inc. (Diablo).              *
+ *    All rights reserved.                                               *
+ *                                                                       *
+ *    This program is free software; you can redistribute it and/or      *
+ *    modify it under the terms of the GNU General Public License        *
+ *    as published by the Free Software Foundation; either version 2     *
+ *    of the License, or (at your option) any later version located at   *
+ *    <http://www.gnu.org/licenses/                                      *
+ *                                                                       *
+ *    This program is distributed WITHOUT ANY WARRANTY; without even     *
+ *    the implied warranty of MERCHANTABILITY or FITNESS FOR A           *
+ *    PARTICULAR PURPOSE.  See the GNU General Public License for        *
+ *    more details.                                                      *
+ *                                                                       *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include "td_kdefn.h"
+#include "td_compat.h"
+
+#include "td_engine.h"
+#include "td_token.h"
+#include "td_bio.h"
+#include "td_eng_wrstage.h"
+#include "td_eng_rdcache.h"
+#include "td_eng_readahead.h"
+#include "td_util.h"
+
+#ifndef CONFIG_TERADIMM_WRITE_STAGING
+#error this file should only be compiled into a WRITE_STAGING driver
+#endif
+
+/*
+ * Write staging
+ *
+ * Writes that reach the head of the queue are copied into host pages
+ * allocated on the device's node, and with WRITE_STAGING_ACK at 0 they are
+ * completed right away; a burst of writes then costs a copy each and goes
+ * out to the device as tokens free up.  With WRITE_STAGING_ACK at 1 the
+ * writes are only completed once their data reaches the EARLY_COMMIT level.
+ * WRITE_STAGING_PAGES sets the size; 0 disables it.
+ *
+ * Staged LBAs are written out oldest first, ahead of any bio queued after
+ * them.  Until then, writes to a staged LBA are merged into its page, single
+ * LBA reads of it are completed from the page, and any other IO touching it
+ * waits.  Only a whole LBA write can start a new staged LBA.  Once an LBA is
+ * being written out it is only looked up by the token writing it; the
+ * device keeps it in order with IO that follows.
+ *
+ * A flush waits until every staged LBA has reached EARLY_COMMIT, like it
+ * would for a volatile write cache.  FUA writes are never staged, and wait
+ * the same way, so nothing staged before them is left behind.  Kernels
+ * that don't send flushes always get the late completion.
+ */
+
+struct td_ws_entry {
+	struct td_ws_entry      *ws_next;            /**< next entry in the hash chain */
+	struct list_head        ws_link;             /**< on ws_queued or ws_free, nothing while written */
+	uint64_t                ws_lba;              /**< block LBA (before striping) */
+	uint64_t                ws_sector;           /**< first sector of the LBA */
+	struct page             *ws_page;            /**< staged data */
+	struct bio_list         ws_held;             /**< writes completed when this is written */
+	uint8_t                 ws_acked:1;          /**< a write was completed before this was written */
+	td_bio_t                ws_bio;              /**< writes the page out */
+	struct bio_vec          ws_vec;
+};
+
+static inline struct td_ws_entry **td_ws_chain(struct td_wrstage *ws,
+		uint64_t lba)
+{
+	return ws->ws_hash + (lba & (TD_WRSTAGE_HASH_SIZE - 1));
+}
+
+/* only staged entries are hashed, at most one for an LBA */
+static struct td_ws_entry *td_ws_lookup(struct td_wrstage *ws, uint64_t lba)
+{
+	struct td_ws_entry *ent;
+
+	for (ent = *td_ws_chain(ws, lba); ent; ent = ent->ws_next)
+		if (ent->ws_lba == lba)
+			return ent;
+
+	return NULL;
+}
+
+static void td_ws_hash(struct td_wrstage *ws, struct td_ws_entry *ent)
+{
+	struct td_ws_entry **chain = td_ws_chain(ws, ent->ws_lba);
+
+	ent->ws_next = *chain;
+	*chain = ent;
+}
+
+static void td_ws_unhash(struct td_wrstage *ws, struct td_ws_entry *ent)
+{
+	struct td_ws_entry **pp = td_ws_chain(ws, ent->ws_lba);
+
+	while (*pp != ent)
+		pp = &(*pp)->ws_next;
+	*pp = ent->ws_next;
+}
+
+static struct td_ws_entry *td_ws_alloc(struct td_engine *eng)
+{
+	struct td_wrstage *ws = &eng->td_wrstage;
+	struct td_ws_entry *ent;
+	int node;
+
+	if (!list_empty(&ws->ws_free)) {
+		ent = list_entry(ws->ws_free.next, struct td_ws_entry, ws_link);
+		list_del(&ent->ws_link);
+		return ent;
+	}
+
+	node = td_engine_node(eng);
+
+	ent = kzalloc_node(sizeof(*ent), GFP_NOWAIT | __GFP_NOWARN, node);
+	if (!ent)
+		return NULL;
+
+	ent->ws_page = alloc_pages_node(node, GFP_NOWAIT | __GFP_NOWARN, 0);
+	if (!ent->ws_page) {
+		kfree(ent);
+		return NULL;
+	}
+
+	ws->ws_alloc_count ++;
+	return ent;
+}
+
+/* done with an entry that is off the lists; it is kept for reuse, unless
+ * the buffer shrunk */
+static void td_ws_release(struct td_engine *eng, struct td_ws_entry *ent)
+{
+	struct td_wrstage *ws = &eng->td_wrstage;
+
+	ws->ws_count --;
+
+	if (ws->ws_alloc_count > td_eng_conf_var_get(eng, WRITE_STAGING_PAGES)) {
+		__free_page(ent->ws_page);
+		kfree(ent);
+		ws->ws_alloc_count --;
+		return;
+	}
+
+	list_add(&ent->ws_link, &ws->ws_free);
+}
+
+static inline bool td_ws_ack_early(struct td_engine *eng)
+{
+#ifdef KABI__blk_queue_flush
+	return !td_eng_conf_var_get(eng, WRITE_STAGING_ACK);
+#else
+	/* flushes are not advertised, nothing would wait for the data */
+	return false;
+#endif
+}
+
+int td_engine_wrstage_bio(struct td_engine *eng, td_bio_ref bio)
+{
+	struct td_wrstage *ws = &eng->td_wrstage;
+	uint hw_sector_size = (uint)td_eng_conf_hw_var_get(eng, HW_SECTOR_SIZE);
+	unsigned pages = (unsigned)td_eng_conf_var_get(eng, WRITE_STAGING_PAGES);
+	struct td_ws_entry *ent;
+	unsigned size;
+	uint64_t lba, ofs;
+
+	if (unlikely (!ws->ws_hash)) {
+		if (!pages || hw_sector_size != PAGE_SIZE)
+			return 0;
+
+		ws->ws_hash = kzalloc_node(TD_WRSTAGE_HASH_SIZE
+				* sizeof(struct td_ws_entry *), GFP_KERNEL,
+				td_engine_node(eng));
+		if (!ws->ws_hash)
+			return 0;
+	}
+
+	size = td_bio_get_byte_size(bio);
+	/* FUA writes have to reach the device before they complete */
+	if (!size || td_bio_is_discard(bio) || td_bio_is_flush(bio)
+			|| td_bio_is_fua(bio)
+			|| td_bio_lba_span(bio, hw_sector_size) != 1)
+		return 0;
+
+	lba = td_bio_lba(eng, bio);
+	ofs = td_bio_lba_offset(eng, bio);
+	ent = td_ws_lookup(ws, lba);
+
+	if (!td_bio_is_write(bio)) {
+		if (!ent)
+			return 0;
+
+		eng->td_counters.misc.write_stage_read_hit_cnt ++;
+		td_eng_trace(eng, TR_BIO, "BIO:wrstage:hit", lba);
+
+		td_bio_copy_from_virt(bio, PTR_OFS(page_address(ent->ws_page),
+					ofs));
+
+		eng->td_stats.read.req_completed_cnt ++;
+		eng->td_stats.read.bytes_transfered += size;
+
+		td_bio_endio(eng, bio, 0, 0);
+		return 1;
+	}
+
+	if (ent) {
+		/* not written out yet, take the new data */
+		eng->td_counters.misc.write_stage_merge_cnt ++;
+
+	} else {
+		/* a new staged LBA has to be written whole, and fit */
+		if (size != hw_sector_size || ws->ws_count >= pages)
+			return 0;
+
+		ent = td_ws_alloc(eng);
+		if (!ent)
+			return 0;
+
+		ent->ws_lba = lba;
+		ent->ws_sector = td_bio_get_sector_offset(bio);
+		ent->ws_acked = 0;
+		bio_list_init(&ent->ws_held);
+
+		td_ws_hash(ws, ent);
+		list_add_tail(&ent->ws_link, &ws->ws_queued);
+		ws->ws_queued_count ++;
+		ws->ws_count ++;
+
+		eng->td_counters.misc.write_stage_cnt ++;
+	}
+
+	/* anything cached for the LBA is older now */
+	td_engine_rdcache_invalidate(eng, lba, 1);
+	td_engine_readahead_invalidate(eng, lba, 1);
+
+	td_bio_copy_to_virt(bio, PTR_OFS(page_address(ent->ws_page), ofs));
+
+	td_eng_trace(eng, TR_BIO, "BIO:wrstage:lba", lba);
+
+	if (td_ws_ack_early(eng)) {
+		ent->ws_acked = 1;
+		td_bio_endio(eng, bio, 0, 0);
+	} else
+		bio_list_add(&ent->ws_held, bio);
+
+	return 1;
+}
+
+int td_engine_wrstage_conflict_lba(struct td_engine *eng, uint64_t lba,
+		uint64_t count)
+{
+	struct td_wrstage *ws = &eng->td_wrstage;
+	struct td_ws_entry *ent;
+	uint64_t i;
+
+	if (!ws->ws_queued_count)
+		return 0;
+
+	if (count > ws->ws_queued_count) {
+		/* large discards, walk the entries instead */
+		list_for_each_entry(ent, &ws->ws_queued, ws_link) {
+			if (ent->ws_lba >= lba && ent->ws_lba < lba + count)
+				return 1;
+		}
+		return 0;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (td_ws_lookup(ws, lba + i))
+			return 1;
+	}
+
+	return 0;
+}
+
+int td_engine_wrstage_conflict(struct td_engine *eng, td_bio_ref bio)
+{
+	uint hw_sector_size;
+
+	if (!eng->td_wrstage.ws_count)
+		return 0;
+
+	/* staged writes that were completed have to be written first */
+	if (td_bio_is_flush(bio) || td_bio_is_fua(bio))
+		return 1;
+
+	if (!td_bio_get_byte_size(bio))
+		return 0;
+
+	hw_sector_size = (uint)td_eng_conf_hw_var_get(eng, HW_SECTOR_SIZE);
+
+	return td_engine_wrstage_conflict_lba(eng, td_bio_lba(eng, bio),
+			td_bio_lba_span(bio, hw_sector_size));
+}
+
+td_bio_ref td_engine_wrstage_next(struct td_engine *eng)
+{
+	struct td_wrstage *ws = &eng->td_wrstage;
+	struct td_ws_entry *ent;
+
+	if (list_empty(&ws->ws_queued))
+		return NULL;
+
+	ent = list_entry(ws->ws_queued.next, struct td_ws_entry, ws_link);
+	list_del(&ent->ws_link);
+	ws->ws_queued_count --;
+	td_ws_unhash(ws, ent);
+
+	td_bio_init_page_write(&ent->ws_bio, &ent->ws_vec, ent->ws_page,
+			ent->ws_sector,
+			(unsigned)td_eng_conf_hw_var_get(eng, HW_SECTOR_SIZE));
+
+	return &ent->ws_bio;
+}
+
+void td_engine_wrstage_requeue(struct td_engine *eng, td_bio_ref bio)
+{
+	struct td_wrstage *ws = &eng->td_wrstage;
+	struct td_ws_entry *ent = container_of(bio, struct td_ws_entry, ws_bio);
+
+	/* still the oldest; nothing was staged for the LBA meanwhile */
+	list_add(&ent->ws_link, &ws->ws_queued);
+	ws->ws_queued_count ++;
+	td_ws_hash(ws, ent);
+}
+
+void td_engine_wrstage_endio(struct td_engine *eng, td_bio_ref bio,
+		int result)
+{
+	struct td_ws_entry *ent = container_of(bio, struct td_ws_entry, ws_bio);
+	td_bio_ref held;
+
+	td_eng_trace(eng, TR_BIO, "BIO:wrstage:done", ent->ws_lba);
+
+	eng->td_counters.misc.write_stage_drain_cnt ++;
+
+	while ((held = bio_list_pop(&ent->ws_held)))
+		td_bio_endio(eng, held, result, 0);
+
+	if (unlikely (result && ent->ws_acked)) {
+		/* nobody is left to tell */
+		eng->td_counters.misc.write_stage_error_cnt ++;
+		if (td_ratelimit())
+			td_eng_err(eng, "staged write to LBA %llu failed, "
+					"rc=%d\n", ent->ws_lba, result);
+	}
+
+	td_ws_release(eng, ent);
+}
+
+unsigned td_engine_wrstage_terminate(struct td_engine *eng, int result)
+{
+	struct td_wrstage *ws = &eng->td_wrstage;
+	struct td_ws_entry *ent;
+	td_bio_ref bio;
+	unsigned cnt = 0, lost = 0;
+
+	while (!list_empty(&ws->ws_queued)) {
+		ent = list_entry(ws->ws_queued.next, struct td_ws_entry,
+				ws_link);
+
+		while ((bio = bio_list_pop(&ent->ws_held))) {
+			td_bio_endio(eng, bio, result, 0);
+			eng->td_stats.write.req_failed_cnt ++;
+			cnt ++;
+		}
+
+		if (ent->ws_acked)
+			lost ++;
+
+		list_del(&ent->ws_link);
+		ws->ws_queued_count --;
+		td_ws_unhash(ws, ent);
+		td_ws_release(eng, ent);
+	}
+
+	if (lost) {
+		eng->td_counters.misc.write_stage_error_cnt += lost;
+		td_eng_err(eng, "dropped %u staged writes\n", lost);
+	}
+
+	return cnt;
+}
+
+void td_engine_wrstage_init(struct td_engine *eng)
+{
+	struct td_wrstage *ws = &eng->td_wrstage;
+
+	memset(ws, 0, sizeof(*ws));
+	INIT_LIST_HEAD(&ws->ws_queued);
+	INIT_LIST_HEAD(&ws->ws_free);
+}
+
+void td_engine_wrstage_exit(struct td_engine *eng)
+{
+	struct td_wrstage *ws = &eng->td_wrstage;
+	struct td_ws_entry *ent;
+
+	td_engine_wrstage_terminate(eng, -EIO);
+	WARN_ON(ws->ws_count);
+
+	while (!list_empty(&ws->ws_free)) {
+		ent = list_entry(ws->ws_free.next, struct td_ws_entry, ws_link);
+		list_del(&ent->ws_link);
+		__free_page(ent->ws_page);
+		kfree(ent);
+		ws->ws_alloc_count --;
+	}
+
+	kfree(ws->ws_hash);
+	ws->ws_hash = NULL;
+}
@@ -0,0 +1,89 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                                                                       *
+ *    Copyright (c) 2014 Diablo Technologies Inc. (Diablo).              *
+ *    All rights reserved.                                               *
+ *                                                                       *
+ *    This program is free software; you can redistribute it and/or      *
+ *    modify it under the terms of the GNU General Public License        *
+ *    as published by the Free Software Foundation; either version 2     *
+ *    of the License, or (at your option) any later version located at   *
+ *    <http://www.gnu.org/licenses/                                      *
+ *                                                                       *
+ *    This program is distributed WITHOUT ANY WARRANTY; without even     *
+ *    the implied warranty of MERCHANTABILITY or FITNESS FOR A           *
+ *    PARTICULAR PURPOSE.  See the GNU General Public License for        *
+ *    more details.                                                      *
+ *                                                                       *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef _TD_ENG_WRSTAGE_H_
+#define _TD_ENG_WRSTAGE_H_
+
+#include "td_compat.h"
+#include "td_defs.h"
+#include "td_bio.h"
+#include "td_engine_def.h"
+
+#ifdef CONFIG_TERADIMM_WRITE_STAGING
+
+extern void td_engine_wrstage_init(struct td_engine *eng);
+extern void td_engine_wrstage_exit(struct td_engine *eng);
+
+/**
+ * look at the bio at the head of the queue, after it was taken off
+ * @return non-zero if the bio was staged, or completed from staged data
+ */
+extern int td_engine_wrstage_bio(struct td_engine *eng, td_bio_ref bio);
+
+/**
+ * check a bio about to be started against the staged writes
+ * @return non-zero if it has to wait for them to be written out
+ */
+extern int td_engine_wrstage_conflict(struct td_engine *eng, td_bio_ref bio);
+
+/** same, for IO to [lba, lba+count) that isn't a bio */
+extern int td_engine_wrstage_conflict_lba(struct td_engine *eng,
+		uint64_t lba, uint64_t count);
+
+/** oldest staged LBA, as a write bio now in flight; NULL if none */
+extern td_bio_ref td_engine_wrstage_next(struct td_engine *eng);
+
+/** the bio from td_engine_wrstage_next() could not be started */
+extern void td_engine_wrstage_requeue(struct td_engine *eng, td_bio_ref bio);
+
+/** the bio from td_engine_wrstage_next() reached EARLY_COMMIT, or failed */
+extern void td_engine_wrstage_endio(struct td_engine *eng, td_bio_ref bio,
+		int result);
+
+/** drop staged writes not in flight, returns the number of bios failed */
+extern unsigned td_engine_wrstage_terminate(struct td_engine *eng, int result);
+
+/** LBAs staged or being written out */
+static inline unsigned td_engine_wrstage_count(struct td_engine *eng)
+{
+	return eng->td_wrstage.ws_count;
+}
+
+/** LBAs staged and not written out yet */
+static inline unsigned td_engine_wrstage_queued(struct td_engine *eng)
+{
+	return eng->td_wrstage.ws_queued_count;
+}
+
+#else
+
+#define td_engine_wrstage_init(eng) do { /* nothing */ } while(0)
+#define td_engine_wrstage_exit(eng) do { /* nothing */ } while(0)
+#define td_engine_wrstage_bio(eng,bio) (0)
+#define td_engine_wrstage_conflict(eng,bio) (0)
+#define td_engine_wrstage_conflict_lba(eng,lba,count) (0)
+#define td_engine_wrstage_next(eng) (NULL)
+#define td_engine_wrstage_requeue(eng,bio) do { /* nothing */ } while(0)
+#define td_engine_wrstage_endio(eng,bio,result) do { /* nothing */ } while(0)
+#define td_engine_wrstage_terminate(eng,result) (0)
+#define td_engine_wrstage_count(eng) (0)
+#define td_engine_wrstage_queued(eng) (0)
+
+#endif
+
+#endif
@@ -30,6 +30,11 @@
 #include "td_bio.h"
 #include "td_eng_completion.h"
 #include "td_eng_mcefree.h"
+#include "td_eng_readahead.h"
+#include "td_eng_uring.h"
+#include "td_eng_rdcache.h"
+#include "td_eng_wrstage.h"
+#include "td_eng_loadgen.h"
 #include "td_ioctl.h"
 #include "td_histogram.h"
 #include "td_memspace.h"
@@ -308,28 +313,13 @@ int td_test_waiting_incoming_capacity(struct td_engine *eng)
  * @param eng   - the device
  * @param bio  - block to enqueue for processing
  */
-void td_queue_incoming_bio(struct td_engine *eng, td_bio_ref bio)
+static void __td_queue_incoming_bio(struct td_engine *eng, td_bio_ref bio)
 {
 	unsigned is_write;
 
-#if CONFIG_TERADIMM_INCOMING_BACKPRESSURE != TD_BACKPRESSURE_NONE
-	int rc;
-	/* see if it's OK to send the IO, or wait for over capacity condition
-	 * to clear up... on occasion we may have to kill the IO */
-	rc = td_test_waiting_incoming_capacity(eng);
-	if (unlikely(rc)) {
-		if (td_ratelimit())
-			td_eng_err(eng, "IO canceled by signal\n");
-		td_bio_endio(eng, bio, rc, 0);
-		return;
-	}
-#endif
-
 	/* TODO will have to handle barriers / flushes here */
 	is_write = td_bio_is_write (bio);
 
-	spin_lock_bh(&eng->td_incoming_bio_lock);
-
 #ifdef CONFIG_TERADIMM_ABSOLUTELY_NO_READS
 	if (is_write)
 #endif
@@ -341,10 +331,46 @@ void td_queue_incoming_bio(struct td_engine *eng, td_bio_ref bio)
 		eng->td_incoming_bio_writes ++;
 	else
 		eng->td_incoming_bio_reads ++;
+}
 
+void td_queue_incoming_bio(struct td_engine *eng, td_bio_ref bio)
+{
+	spin_lock_bh(&eng->td_incoming_bio_lock);
+	__td_queue_incoming_bio(eng, bio);
 	spin_unlock_bh(&eng->td_incoming_bio_lock);
 }
 
+/**
+ * Add a list of accepted bios to the back of the pending list
+ * @param eng   - the device
+ * @param bios  - bios collected by the submitter, emptied
+ *
+ * The incoming lock is taken once for the whole list, and the worker is
+ * poked at most once.
+ */
+void td_engine_queue_bio_list(struct td_engine *eng, struct bio_list *bios)
+{
+	td_bio_ref bio;
+	unsigned count = 0;
+
+	if (bio_list_empty(bios))
+		return;
+
+	spin_lock_bh(&eng->td_incoming_bio_lock);
+
+	while ((bio = bio_list_pop(bios))) {
+		__td_queue_incoming_bio(eng, bio);
+		count ++;
+	}
+
+	eng->td_counters.misc.plug_batch_cnt ++;
+	eng->td_counters.misc.plug_bio_cnt += count;
+
+	spin_unlock_bh(&eng->td_incoming_bio_lock);
+
+	td_engine_sometimes_poke(eng);
+}
+
 void td_migrate_incoming_to_queued(struct td_engine *eng)
 {
 	/* avoid cache thrashing just to check that there is nothing there */
@@ -358,8 +384,9 @@ void td_migrate_incoming_to_queued(struct td_engine *eng)
 
 	bio_list_merge(&eng->td_queued_bios, &eng->td_incoming_bios);
 
-	eng->td_queued_bio_writes = eng->td_incoming_bio_writes;
-	eng->td_queued_bio_reads  = eng->td_incoming_bio_reads;
+	/* add, the bio on the cursor is counted while it's off the list */
+	eng->td_queued_bio_writes += eng->td_incoming_bio_writes;
+	eng->td_queued_bio_reads  += eng->td_incoming_bio_reads;
 
 	/* purge the incoming queue */
 
@@ -486,7 +513,7 @@ static int td_engine_bio_collision(struct td_engine *eng, td_bio_ref bio)
 {
 	int collision, mode;
 	uint64_t bio_lba;
-	struct td_token *tok, *nxt;
+	struct td_token *tok;
 	td_bio_ref tbio;
 //	uint64_t start;
 
@@ -526,7 +553,7 @@ static int td_engine_bio_collision(struct td_engine *eng, td_bio_ref bio)
 	default:
 	case 1: /* any inflight R-M-W to this LBA could cause issues */
 
-		for_each_token_list_token(tok, nxt,
+		for_each_token_map_token(tok,
 				&eng->tok_pool[TD_TOK_FOR_FW].td_active_tokens) {
 			/* first check the LBA for overlap */
 			if (tok->lba != bio_lba)
@@ -545,7 +572,7 @@ static int td_engine_bio_collision(struct td_engine *eng, td_bio_ref bio)
 
 	case 2: /* any inflight writes to this LBA could cause issues */
 
-		for_each_token_list_token(tok, nxt,
+		for_each_token_map_token(tok,
 				&eng->tok_pool[TD_TOK_FOR_FW].td_active_tokens) {
 			/* first check the LBA for overlap */
 			if (tok->lba != bio_lba)
@@ -565,7 +592,7 @@ static int td_engine_bio_collision(struct td_engine *eng, td_bio_ref bio)
 
 	case 3: /* any inflight IO to this LBA could cause issues */
 
-		for_each_token_list_token(tok, nxt,
+		for_each_token_map_token(tok,
 				&eng->tok_pool[TD_TOK_FOR_FW].td_active_tokens) {
 			/* first check the LBA for overlap */
 			if (tok->lba != bio_lba)
@@ -592,6 +619,242 @@ done:
 	return collision;
 }
 
+/* --- discard merging --- */
+
+/* return non-zero if the bio touches any of the held discards */
+static int td_engine_discard_overlap(struct td_engine *eng, td_bio_ref bio)
+{
+	uint64_t start, end, held_start;
+	td_bio_ref held;
+	unsigned i;
+
+	start = td_bio_get_sector_offset(bio);
+	end = start + (td_bio_get_byte_size(bio) >> SECTOR_SHIFT);
+
+	/* quick test against the span of everything held */
+	if (end <= td_bio_get_sector_offset(eng->td_discard_held[0])
+			|| start >= eng->td_discard_held_end)
+		return 0;
+
+	for (i = 0; i < eng->td_discard_held_count; i++) {
+		held = eng->td_discard_held[i];
+		held_start = td_bio_get_sector_offset(held);
+
+		/* sorted, nothing further can overlap */
+		if (held_start >= end)
+			break;
+
+		if (held_start + (td_bio_get_byte_size(held) >> SECTOR_SHIFT)
+				> start)
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * move the discard at the head of the queue to the held array
+ * returns non-zero if it was held
+ */
+static int td_engine_hold_discard(struct td_engine *eng, td_bio_ref bio)
+{
+	unsigned max = (unsigned)td_eng_conf_var_get(eng, DISCARD_MERGE_MAX);
+	uint64_t sector, end;
+	unsigned i;
+
+	if (eng->td_discard_held_count >= max
+			|| td_bio_is_part(bio)
+			|| !td_bio_get_byte_size(bio))
+		return 0;
+
+	bio = bio_list_pop(&eng->td_queued_bios);
+	eng->td_queued_bio_writes --;
+
+	sector = td_bio_get_sector_offset(bio);
+	end = sector + (td_bio_get_byte_size(bio) >> SECTOR_SHIFT);
+
+	/* keep them sorted by sector */
+	i = eng->td_discard_held_count;
+	while (i && td_bio_get_sector_offset(eng->td_discard_held[i-1]) > sector) {
+		eng->td_discard_held[i] = eng->td_discard_held[i-1];
+		i --;
+	}
+	eng->td_discard_held[i] = bio;
+
+	if (!eng->td_discard_held_count ++) {
+		eng->td_discard_held_since = td_get_cycles();
+		eng->td_discard_held_end = end;
+	} else if (end > eng->td_discard_held_end)
+		eng->td_discard_held_end = end;
+
+	td_eng_trace(eng, TR_TRIM, "BIO:discard:hold", (uint64_t)bio);
+	eng->td_counters.misc.discard_held_cnt ++;
+
+	return 1;
+}
+
+/* return non-zero if the held discards have to go out before next */
+static int td_engine_discards_due(struct td_engine *eng, td_bio_ref next)
+{
+	cycles_t hold;
+
+	/* nothing else is waiting, or something already needs them gone */
+	if (!next || eng->td_discard_flush)
+		return 1;
+
+	if (eng->td_discard_held_count
+			>= td_eng_conf_var_get(eng, DISCARD_MERGE_MAX))
+		return 1;
+
+	if (td_engine_discard_overlap(eng, next)) {
+		/* next has to see the discards done */
+		eng->td_discard_flush = 1;
+		eng->td_counters.misc.discard_flush_cnt ++;
+		return 1;
+	}
+
+	hold = td_usec_to_cycles(td_eng_conf_var_get(eng, DISCARD_HOLD_USEC));
+	return td_get_cycles() - eng->td_discard_held_since >= hold;
+}
+
+/*
+ * take the lowest run of held discards that touch or overlap, and split
+ * their combined range into TRIM commands; the first bio owns the split
+ * and the others are completed with it
+ */
+static int td_engine_get_discard_bios(struct td_engine *eng,
+		struct bio_list *bios)
+{
+	struct bio_list merged;
+	td_bio_ref first, bio;
+	uint64_t start, end, bio_start, bio_end;
+	unsigned n;
+	int rc;
+
+	first = eng->td_discard_held[0];
+	start = td_bio_get_sector_offset(first);
+	end = start + (td_bio_get_byte_size(first) >> SECTOR_SHIFT);
+
+	bio_list_init(&merged);
+	for (n = 1; n < eng->td_discard_held_count; n++) {
+		bio = eng->td_discard_held[n];
+		bio_start = td_bio_get_sector_offset(bio);
+		bio_end = bio_start + (td_bio_get_byte_size(bio) >> SECTOR_SHIFT);
+
+		/* a gap, or the range would get too large */
+		if (bio_start > end
+				|| max_t(uint64_t, end, bio_end) - start > TD_MAX_DISCARD_SECTORS)
+			break;
+
+		if (bio_end > end)
+			end = bio_end;
+
+		bio_list_add(&merged, bio);
+	}
+
+	eng->td_discard_held_count -= n;
+	memmove(eng->td_discard_held, eng->td_discard_held + n,
+			eng->td_discard_held_count * sizeof(td_bio_ref));
+	if (!eng->td_discard_held_count)
+		eng->td_discard_flush = 0;
+
+	td_eng_trace(eng, TR_TRIM, "BIO:discard:sctr", start);
+	td_eng_trace(eng, TR_TRIM, "BIO:discard:bios", n);
+
+	eng->td_counters.misc.discard_sent_cnt ++;
+	eng->td_counters.misc.discard_merged_cnt += n - 1;
+
+	rc = td_split_req_create_discard_list(eng, first, &merged, start,
+			(end - start) << SECTOR_SHIFT, bios);
+	if (unlikely (rc<0)) {
+		td_eng_err(eng, "failed to split merged discard, rc=%d\n", rc);
+		td_bio_endio(eng, first, rc, 0);
+		while ((bio = bio_list_pop(&merged)))
+			td_bio_endio(eng, bio, rc, 0);
+		return rc;
+	}
+
+	eng->td_stats.write.split_req_cnt ++;
+
+	return rc;
+}
+
+/* hand out the next part of the bio the cursor is on */
+static int td_engine_get_cursor_bio(struct td_engine *eng,
+		struct bio_list *bios, struct td_io_begin_state *bs)
+{
+	struct td_bio_cursor *bc = &eng->td_bio_cursor;
+	int is_write = td_bio_is_write(td_bio_cursor_bio(bc));
+	td_bio_ref part;
+
+	if (is_write && (td_engine_hold_back_write(eng) || !bs->wr_avail))
+		return 0;
+
+	/* none left if all parts are in flight */
+	part = td_bio_cursor_next(bc);
+	if (!part)
+		return 0;
+
+	if (!td_bio_cursor_bio(bc)) {
+		if (is_write)
+			eng->td_queued_bio_writes --;
+		else
+			eng->td_queued_bio_reads --;
+	}
+
+	bio_list_add(bios, part);
+	return 1;
+}
+
+/*
+ * track how long the bio at the head of the queue has been waiting there;
+ * bios that cannot start are pushed back to the head, so they keep their
+ * age until they get out; returns non-zero once it is past the deadline
+ */
+static int td_engine_age_head_bio(struct td_engine *eng, td_bio_ref first)
+{
+	uint64_t deadline, usec;
+
+	if (first != eng->td_head_bio) {
+		eng->td_head_bio = first;
+		eng->td_head_bio_since = td_get_cycles();
+		eng->td_head_bio_write = first && td_bio_is_write(first);
+		eng->td_head_bio_overdue = 0;
+		return 0;
+	}
+
+	if (!first)
+		return 0;
+
+	deadline = eng->td_head_bio_write
+		? td_eng_conf_var_get(eng, BIO_W_DEADLINE_USEC)
+		: td_eng_conf_var_get(eng, BIO_R_DEADLINE_USEC);
+	if (!deadline)
+		return 0;
+
+	usec = td_cycles_to_nsec(td_get_cycles() - eng->td_head_bio_since) / 1000;
+	if (usec < deadline)
+		return 0;
+
+	if (eng->td_head_bio_write) {
+		if (!eng->td_head_bio_overdue)
+			eng->td_counters.misc.bio_w_overdue_cnt ++;
+		if (usec > eng->td_counters.misc.bio_w_overdue_max_usec)
+			eng->td_counters.misc.bio_w_overdue_max_usec = usec;
+	} else {
+		if (!eng->td_head_bio_overdue)
+			eng->td_counters.misc.bio_r_overdue_cnt ++;
+		if (usec > eng->td_counters.misc.bio_r_overdue_max_usec)
+			eng->td_counters.misc.bio_r_overdue_max_usec = usec;
+	}
+
+	if (!eng->td_head_bio_overdue)
+		td_eng_trace(eng, TR_BIO, "BIO:overdue", (uint64_t)first);
+	eng->td_head_bio_overdue = 1;
+
+	return 1;
+}
+
 /**
  * \brief get the next bio to execute
  * @param eng       - engine used
@@ -610,17 +873,51 @@ static inline int td_engine_get_bios(struct td_engine *eng,
 //#else
 	struct td_biogrp *split_req = NULL;
 //#endif
+	/* finish handing out the large bio already started; if it can't
+	 * go on, parts of it may be waiting on the queue for a token */
+	if (td_bio_cursor_bio(&eng->td_bio_cursor)) {
+		rc = td_engine_get_cursor_bio(eng, bios, bs);
+		if (rc)
+			return rc;
+	}
+
 	if (bio_list_empty(&eng->td_queued_bios))
 		td_migrate_incoming_to_queued(eng);
 
 	/* peek at the next upcoming bio */
 	first = bio_list_peek(&eng->td_queued_bios);
+
+	/* discards wait behind other IO, to be merged with their neighbours */
+	while (first && td_bio_is_discard(first)
+			&& td_engine_hold_discard(eng, first)) {
+		if (bio_list_empty(&eng->td_queued_bios))
+			td_migrate_incoming_to_queued(eng);
+		first = bio_list_peek(&eng->td_queued_bios);
+	}
+
+	td_engine_age_head_bio(eng, first);
+
+	if (eng->td_discard_held_count && td_engine_discards_due(eng, first)) {
+		/* staged writes were queued before them */
+		if (!td_engine_hold_back_write(eng) && bs->wr_avail
+				&& !td_engine_wrstage_queued(eng))
+			return td_engine_get_discard_bios(eng, bios);
+
+		/* an overlapping bio has to wait for them */
+		if (eng->td_discard_flush)
+			return 0;
+	}
+
 	if (!first)
 		return 0;
 
 	if (td_engine_bio_collision(eng, first))
 		return 0;
 
+	/* staged writes it touches, or has to follow, go out first */
+	if (td_engine_wrstage_conflict(eng, first))
+		return 0;
+
 	if (td_bio_is_write(first) ) {
 		/* writes are not allowed at this time */
 		if (td_engine_hold_back_write(eng))
@@ -641,6 +938,15 @@ static inline int td_engine_get_bios(struct td_engine *eng,
 	if (unlikely (!bio))
 		return 0;
 
+	/* it left the head, a new bio at its address must not inherit its
+	 * age; td_engine_age_popped_bio() gives it back if it's pushed back */
+	if (bio == eng->td_head_bio) {
+		eng->td_popped_bio = bio;
+		eng->td_popped_bio_since = eng->td_head_bio_since;
+		eng->td_popped_bio_overdue = eng->td_head_bio_overdue;
+		td_engine_age_head_bio(eng, NULL);
+	}
+
 td_eng_trace(eng, TR_BIO, "BIO:pop:bio  ", (uint64_t)bio);
 td_eng_trace(eng, TR_BIO, "BIO:pop:write", td_bio_is_write(bio));
 td_eng_trace(eng, TR_BIO, "BIO:pop:sctr ", td_bio_get_sector_offset(bio));
@@ -652,6 +958,12 @@ td_eng_trace(eng, TR_BIO, "BIO:pop:size ", td_bio_get_byte_size(bio));
 		td_bio_endio(eng, bio, rc, 0);
 		return rc;
 	}
+
+	/* an empty flush has nothing to send, it only had to get here */
+	if (unlikely (!td_bio_get_byte_size(bio))) {
+		bio_list_add(bios, bio);
+		return 1;
+	}
 #if 0
 	if (unlikely (td_bio_is_part(bio))) {
 		/* already split, return it */
@@ -667,6 +979,19 @@ td_eng_trace(eng, TR_BIO, "BIO:pop:size ", td_bio_get_byte_size(bio));
 		return 1;
 	}
 
+	/* data goes out as tokens free up, without splitting it all first */
+	if (!discard && !td_bio_cursor_start(eng, &eng->td_bio_cursor, bio)) {
+		if (td_bio_is_write(bio)) {
+			eng->td_queued_bio_writes ++;
+			eng->td_stats.write.split_req_cnt ++;
+		} else {
+			eng->td_queued_bio_reads ++;
+			eng->td_stats.read.split_req_cnt ++;
+		}
+
+		return td_engine_get_cursor_bio(eng, bios, bs);
+	}
+
 	rc = td_split_req_create_list(eng, bio, &split_req, bios);
 	if (unlikely (rc<0)) {
 		td_eng_err(eng, "failed to split bio, rc=%d dir = %s\n", rc,
@@ -695,7 +1020,7 @@ td_eng_trace(eng, TR_BIO, "BIO:pop:size ", td_bio_get_byte_size(bio));
 
 /* push a bit to the start of the queue;
  * used to return a bio that cannot be started now to the head of the queue */
-static void td_engine_push_bio(struct td_engine *eng, td_bio_ref bio)
+void td_engine_push_bio(struct td_engine *eng, td_bio_ref bio)
 {
 	bio_list_add_head(&eng->td_queued_bios, bio);
 
@@ -748,6 +1073,12 @@ void __td_terminate_all_outstanding_bios(struct td_engine *eng,
 		bio_list_add(&terminating, bio);
 	}
 
+	/* and the discards held back for merging */
+	while (eng->td_discard_held_count)
+		bio_list_add(&terminating,
+			eng->td_discard_held[-- eng->td_discard_held_count]);
+	eng->td_discard_flush = 0;
+
 	while((bio = bio_list_pop(&terminating))) {
 		int is_write = td_bio_is_write(bio);
 		td_bio_endio(eng, bio, result, 0);
@@ -758,6 +1089,23 @@ void __td_terminate_all_outstanding_bios(struct td_engine *eng,
 		cnt ++;
 	}
 
+	/* and what's left of the one being handed out */
+	bio = td_bio_cursor_bio(&eng->td_bio_cursor);
+	if (bio) {
+		if (td_bio_is_write(bio)) {
+			eng->td_queued_bio_writes --;
+			eng->td_stats.write.req_failed_cnt ++;
+		} else {
+			eng->td_queued_bio_reads --;
+			eng->td_stats.read.req_failed_cnt ++;
+		}
+		td_bio_cursor_abort(eng, &eng->td_bio_cursor, result);
+		cnt ++;
+	}
+
+	/* and the staged writes not sent yet */
+	cnt += td_engine_wrstage_terminate(eng, result);
+
 	if (cnt)
 		td_eng_warn(eng, "terminated %u queued bios\n", cnt);
 
@@ -765,7 +1113,7 @@ void __td_terminate_all_outstanding_bios(struct td_engine *eng,
 	cnt = 0;
 	while (tt < TD_TOK_TYPE_MAX) {
 
-		tok = td_tokens_dequeue(&eng->tok_pool[tt].td_active_tokens);
+		tok = td_tokmap_dequeue(&eng->tok_pool[tt].td_active_tokens);
 		if (!tok) {
 			/* none left in this token type, try the next one */
 			tt ++;
@@ -1126,12 +1474,14 @@ static void td_engine_queue_sreq_bio(struct td_biogrp *bg,
 #endif
 
 /**
- * \brief receive and queue a bio from the block layer
+ * \brief check a bio from the block layer before it is queued
  *
- * This function is called by the block layer and given a bio to queue.
+ * Returns zero if the bio can be queued, otherwise the bio was completed
+ * with the returned error.  Can sleep if incoming backpressure is used.
  */
-int td_engine_queue_bio(struct td_engine *eng, td_bio_ref bio)
+int td_engine_accept_bio(struct td_engine *eng, td_bio_ref bio)
 {
+	int rc;
 
 	/* Discard? */
 	if (td_bio_is_discard(bio) && td_eng_conf_hw_var_get(eng, DISCARD) == 0) {
@@ -1144,7 +1494,8 @@ int td_engine_queue_bio(struct td_engine *eng, td_bio_ref bio)
 		goto bad_request;
 	}
 
-	if (unlikely (! td_bio_is_discard(bio) &&
+	/* empty flushes have no span */
+	if (unlikely (! td_bio_is_discard(bio) && td_bio_get_byte_size(bio) &&
 			td_bio_page_span(bio, TERADIMM_DATA_BUF_SIZE) > TD_SPLIT_REQ_PART_MAX))
 	{
 		goto bad_request;
@@ -1155,8 +1506,8 @@ int td_engine_queue_bio(struct td_engine *eng, td_bio_ref bio)
 		if (td_ratelimit())
 			td_eng_warn(eng, "request in state %d (pm)\n",
 					td_run_state(eng));
-		td_bio_endio(eng, bio, -EAGAIN, 0);
-		goto done;
+		rc = -EAGAIN;
+		goto failed;
 	}
 
 #ifdef CONFIG_TERADIMM_BIO_SLEEP
@@ -1179,11 +1530,10 @@ int td_engine_queue_bio(struct td_engine *eng, td_bio_ref bio)
 		if (td_ratelimit())
 			td_eng_warn(eng, "request in state %d\n",
 					td_run_state(eng));
-		td_bio_endio(eng, bio, -EIO, 0);
-		goto done;
+		rc = -EIO;
+		goto failed;
 	}
 
-	/* TODO: should support plugged operation and call blk_queue_plug() */
 #if 0
 /* this is disabled because td_biogrp_alloc() doesn't lock, and devgroup
  * now uses multiple threads so it's harder to determine when to do it */
@@ -1199,19 +1549,52 @@ int td_engine_queue_bio(struct td_engine *eng, td_bio_ref bio)
 	}
 #endif
 
-	td_queue_incoming_bio(eng, bio);
+#if CONFIG_TERADIMM_INCOMING_BACKPRESSURE != TD_BACKPRESSURE_NONE
+	/* see if it's OK to send the IO, or wait for over capacity condition
+	 * to clear up... on occasion we may have to kill the IO */
+	rc = td_test_waiting_incoming_capacity(eng);
+	if (unlikely(rc)) {
+		if (td_ratelimit())
+			td_eng_err(eng, "IO canceled by signal\n");
+		goto failed;
+	}
+#endif
 
-	td_engine_sometimes_poke(eng);
+	/* completion can be routed back to the submitting node */
+	td_bio_set_origin(bio, numa_node_id());
 
-	goto done;
+	return 0;
 
 bad_request:
 	td_eng_err(eng, "bad bio: size=%u sector=%llu direction=%s\n",
 			td_bio_get_byte_size(bio),
 			td_bio_get_sector_offset(bio),
 			td_bio_is_write(bio) ? "write" : "read");
-	td_bio_endio(eng, bio, -EIO, 0);
-done:
+	rc = -EIO;
+failed:
+	td_bio_endio(eng, bio, rc, 0);
+	return rc;
+}
+
+/**
+ * \brief receive and queue a bio from the block layer
+ *
+ * This function is called by the block layer and given a bio to queue.
+ */
+void td_engine_queue_accepted_bio(struct td_engine *eng, td_bio_ref bio)
+{
+	td_queue_incoming_bio(eng, bio);
+
+	td_engine_sometimes_poke(eng);
+}
+
+int td_engine_queue_bio(struct td_engine *eng, td_bio_ref bio)
+{
+	if (td_engine_accept_bio(eng, bio))
+		return 0;
+
+	td_engine_queue_accepted_bio(eng, bio);
+
 	return 0;
 }
 
@@ -1330,7 +1713,7 @@ static void td_request_eng_write(struct td_token *tok)
 	td_request_end_common(tok);
 }
 
-static void td_update_request_end_counters(struct td_engine *eng,
+void td_update_request_end_counters(struct td_engine *eng,
 		struct td_token *tok, unsigned size, int result)
 {
 
@@ -1393,12 +1776,22 @@ static void td_release_tok_bio(struct td_token *tok, int result)
 	/* done with this R-M-W */
 	if (tok->rmw)
 		eng->td_active_rmw_tokens_count --;
-
+	else if (!result)
+		td_engine_rdcache_fill(eng, tok, bio);
 
 	/* complete */
-	td_bio_endio(eng, bio, result, tok->ts_end - tok->ts_start);
+	if (unlikely (tok->staged))
+		td_engine_wrstage_endio(eng, bio, result);
+	else
+		td_bio_endio(eng, bio, result, tok->ts_end - tok->ts_start);
 	tok->host.bio = NULL;
 
+	/* along with any partial writes merged into this one */
+	while ((bio = bio_list_pop(&tok->host.coalesced))) {
+		size += td_bio_get_byte_size(bio);
+		td_bio_endio(eng, bio, result, tok->ts_end - tok->ts_start);
+	}
+
 	/* update counters */
 	td_update_request_end_counters(eng, tok, size, result);
 
@@ -1602,7 +1995,7 @@ void td_request_end_deallocate(struct td_token *tok)
 void td_engine_start_token(struct td_engine *eng, struct td_token *tok)
 {
 	int rc;
-	struct td_token_list *tok_list;
+	struct td_token_map *tok_map;
 
 	td_engine_exit_polling_loop(eng);
 
@@ -1620,7 +2013,8 @@ void td_engine_start_token(struct td_engine *eng, struct td_token *tok)
 	} else
 	{
 		/* handle writes differently than reads */
-		if ((tok->host.bio) && td_bio_is_discard(tok->host.bio)) {
+		if (tok->zero_trim
+				|| ((tok->host.bio) && td_bio_is_discard(tok->host.bio))) {
 			td_request_start_trim(tok);
 			td_token_set_default_op(tok, completion, td_request_eng_trim);
 		} else if (td_token_is_write(tok)) {
@@ -1644,6 +2038,12 @@ void td_engine_start_token(struct td_engine *eng, struct td_token *tok)
 		tok->free_rd_bufid = (uint8_t)td_next_rdbuf_to_deallocate(eng);
 td_eng_trace(eng, TR_RDBUF, "deallocate:pig:rdbuf", tok->free_rd_bufid);
 td_eng_trace(eng, TR_RDBUF, "deallocate:pig:queued", td_pending_rdbuf_deallocations(eng));
+		if (TD_IS_RD_BUFID_VALID(tok->free_rd_bufid)) {
+			/* one less DEALLOCATE command to send */
+			eng->td_counters.misc.deallocate_piggyback_cnt ++;
+			if (!td_pending_rdbuf_deallocations(eng))
+				eng->td_dealloc_held_since = 0;
+		}
 	}
 
 	td_eng_trace(eng, TR_BIO, "deallocate", tok->free_rd_bufid);
@@ -1674,7 +2074,7 @@ td_eng_trace(eng, TR_RDBUF, "deallocate:pig:queued", td_pending_rdbuf_deallocati
 
 
 	/* expecting _create_cmd() call to set the status check function */
-	WARN_ON(!tok->ops.status_check);
+	WARN_ON(!tok->status_check);
 
 	/* schedule the command */
 	tok->result = TD_TOK_RESULT_ACTIVE;
@@ -1756,8 +2156,8 @@ td_eng_trace(eng, TR_RDBUF, "deallocate:pig:queued", td_pending_rdbuf_deallocati
 
 	/* TODO: td_trace_token(eng, tok); */
 
-	tok_list = &eng->tok_pool[td_token_type(tok)].td_active_tokens;
-	td_tokens_enqueue(tok_list, tok);
+	tok_map = &eng->tok_pool[td_token_type(tok)].td_active_tokens;
+	td_tokmap_enqueue(tok_map, tok);
 	if (tok->rmw)
 		eng->td_active_rmw_tokens_count ++;
 
@@ -1793,13 +2193,106 @@ failed_to_start:
 
 
 static int td_engine_io_begin_block(struct td_engine *eng, uint *max);
+#ifdef CONFIG_TERADIMM_WRITE_STAGING
+static int td_engine_io_begin_wrstage(struct td_engine *eng, uint *max);
+#endif
 static unsigned td_engine_deallocate_rdbufs(struct td_engine *eng, uint *max);
 
+/** return true if pending deallocates should wait for the next commands
+ * to carry them, instead of each taking a command slot of its own */
+static bool td_engine_hold_deallocates(struct td_engine *eng)
+{
+	uint64_t batch, hold_usec;
+	cycles_t now;
+
+	batch = td_eng_conf_var_get(eng, DEALLOCATE_BATCH);
+	hold_usec = td_eng_conf_var_get(eng, DEALLOCATE_HOLD_USEC);
+
+	/* only worth waiting if there are commands in flight, whose
+	 * completions will bring in more work, and nobody needs the
+	 * read buffers right now */
+	if (!batch || !hold_usec
+			|| td_pending_rdbuf_deallocations(eng) >= batch
+			|| td_eng_conf_var_get(eng, INDEPENDENT_DEALLOCATE)
+			|| td_state_is_purging_read_buffers(eng)
+			|| !td_state_can_accept_requests(eng)
+			|| !td_all_active_tokens(eng)
+			|| eng->td_early_completed_reads_tokens.count
+			|| (eng->td_head_bio_overdue && !eng->td_head_bio_write))
+		goto send_now;
+
+	now = td_get_cycles();
+	if (!eng->td_dealloc_held_since) {
+		eng->td_dealloc_held_since = now;
+		eng->td_counters.misc.deallocate_held_cnt ++;
+		return true;
+	}
+
+	if ((now - eng->td_dealloc_held_since) < td_usec_to_cycles(hold_usec))
+		return true;
+
+send_now:
+	eng->td_dealloc_held_since = 0;
+	return false;
+}
+
+/** return how many commands the next begin pass may start; with
+ * ADAPTIVE_START_BURST set, the burst halves each time a sampled token
+ * takes longer than START_BURST_LAT_USEC, and grows back while tokens
+ * are quick, doubling while the queue is deeper than the burst */
+static uint td_engine_start_burst(struct td_engine *eng)
+{
+	struct td_io_latency_counters *rd = &eng->td_counters.read.hw;
+	struct td_io_latency_counters *wr = &eng->td_counters.write.hw;
+	uint limit = (uint)td_eng_conf_var_get(eng, MAX_START_BURST);
+	uint burst, avail;
+	uint64_t lat_nsec = 0;
+
+	/* an overdue bio gets everything the engine can give it */
+	if (!td_eng_conf_var_get(eng, ADAPTIVE_START_BURST)
+			|| eng->td_head_bio_overdue) {
+		burst = limit;
+		goto done;
+	}
+
+	burst = eng->td_start_burst;
+	if (!burst || burst > limit)
+		burst = limit;
+
+	/* only react to new samples, the same one would keep shrinking it */
+	if (rd->lat_cnt != eng->td_start_burst_rd_cnt) {
+		eng->td_start_burst_rd_cnt = rd->lat_cnt;
+		lat_nsec = rd->latency;
+	}
+	if (wr->lat_cnt != eng->td_start_burst_wr_cnt) {
+		eng->td_start_burst_wr_cnt = wr->lat_cnt;
+		lat_nsec = max_t(uint64_t, lat_nsec, wr->latency);
+	}
+
+	if (lat_nsec) {
+		if (lat_nsec > 1000ULL * td_eng_conf_var_get(eng, START_BURST_LAT_USEC))
+			burst = max_t(uint, 1, burst / 2);
+		else if (td_engine_queued_commands(eng) > burst)
+			burst = min_t(uint, limit, burst * 2);
+		else if (burst < limit)
+			burst ++;
+	}
+	eng->td_start_burst = burst;
+
+	/* no point allowing more than the tokens that can carry them */
+	avail = td_all_available_tokens(eng);
+	if (avail && burst > avail)
+		burst = avail;
+
+done:
+	eng->td_counters.misc.start_burst = burst;
+	return burst;
+}
 
 void td_engine_io_begin(struct td_engine *eng)
 {
 	int prev;
-	uint max = (uint)td_eng_conf_var_get(eng, MAX_START_BURST);
+	uint max = td_engine_start_burst(eng);
 	uint total = 0;
 
 #ifdef CONFIG_TERADIMM_DEVGROUP_TASK_WORK
@@ -1831,6 +2324,12 @@ void td_engine_io_begin(struct td_engine *eng)
 			&& td_engine_queued_ucmds(eng))
 		total += td_engine_io_begin_ucmd(eng, &max);
 
+#ifdef CONFIG_TERADIMM_WRITE_STAGING
+	/* writes staged in host memory go out ahead of newer IO */
+	if (td_state_can_start_io_requests(eng))
+		total += td_engine_io_begin_wrstage(eng, &max);
+#endif
+
 	/* now send IO commands */
 	if (td_engine_queued_bios(eng) ) {
 		unsigned to_tok_cnt = td_all_timedout_tokens(eng);
@@ -1847,13 +2346,29 @@ void td_engine_io_begin(struct td_engine *eng)
 			/* then start block requests */
 			total += td_engine_io_begin_block(eng, &max);
 		}
-	}
+	} else if (eng->td_head_bio)
+		/* the queue drained, nothing is waiting at the head */
+		td_engine_age_head_bio(eng, NULL);
+
+	/* newer work waits while an overdue bio is stuck at the head */
+	if (eng->td_head_bio_overdue)
+		goto skip_new_work;
 
+	/* then entries posted on user IO rings */
+	if (max && td_state_can_start_io_requests(eng))
+		total += td_engine_uring_begin(eng, &max);
+
+	/* read ahead of sequential readers, if there is nothing else to do */
+	if (max && td_state_can_start_io_requests(eng))
+		total += td_engine_readahead_begin(eng, &max);
+
+skip_new_work:
 	/* follow up deallocations */
 	if (td_pending_rdbuf_deallocations(eng)
 			&& (!total
 				|| td_state_is_purging_read_buffers(eng)
-				|| !td_engine_queued_commands(eng))) {
+				|| !td_engine_queued_commands(eng))
+			&& !td_engine_hold_deallocates(eng)) {
 		/* There are rdbufs to deallocate, but there is no more work pending.
 		 * We have to create DEALLOCATE commands to flush them out. */
 		total += td_engine_deallocate_rdbufs(eng, &max);
@@ -1899,6 +2414,16 @@ static int td_engine_io_begin_ucmd(struct td_engine *eng, uint *max)
 		ioctl = &ucmd->ioctl;
 		tt = td_eng_hal_cmd_to_token_type(eng, &ioctl->cmd);
 
+		/* the command could change the media under cached data */
+		if (ioctl->data_len_to_device || td_cmd_is_sequenced(ioctl->cmd)) {
+			/* ... and has to follow the staged writes */
+			if (td_engine_wrstage_count(eng))
+				goto failed_to_get_token;
+
+			td_engine_readahead_drop_all(eng);
+			td_engine_rdcache_flush(eng);
+		}
+
 		if(unlikely(ucmd->locked)) {
 			tok = td_alloc_token_when_locked(eng, tt,
 					ioctl->data_len_to_device,
@@ -2010,6 +2535,107 @@ static inline int td_io_begin_state_init(struct td_engine *eng,
 }
 
 
+/*
+ * merge partial writes into one full LBA write
+ *
+ * Sector sized writers send an LBA as a run of small writes, each of which
+ * would need its own R-M-W.  If the bios queued right behind this one fill
+ * in the rest of the LBA, they are all copied into a host page and written
+ * with a single token, which completes every one of them.
+ *
+ * Returns NULL without taking anything off the queue if the LBA is not
+ * fully covered.
+ */
+static struct td_token *td_engine_construct_coalesced_token_for_bio(
+		struct td_engine *eng, struct td_io_begin_state *bs)
+{
+	uint hw_sector_size = (uint)td_eng_conf_hw_var_get(eng, HW_SECTOR_SIZE);
+	unsigned covered, size, count, i;
+	uint64_t next_sector;
+	struct td_token *tok;
+	td_bio_ref bio;
+
+	if (!td_eng_conf_var_get(eng, WRITE_COALESCE))
+		return NULL;
+
+	/* the host page carries data only, no metadata */
+	if (hw_sector_size != PAGE_SIZE
+			|| eng->td_bio_copy_ops.host_to_dev
+				!= td_token_copy_ops_bio.host_to_dev)
+		return NULL;
+
+	/* has to start at the beginning of the LBA */
+	if (td_bio_lba_offset(eng, bs->bio))
+		return NULL;
+
+	if (bio_list_empty(&eng->td_queued_bios))
+		td_migrate_incoming_to_queued(eng);
+
+	covered = td_bio_get_byte_size(bs->bio);
+	next_sector = td_bio_get_sector_offset(bs->bio)
+		+ (covered >> SECTOR_SHIFT);
+	count = 0;
+
+	/* only the bios at the head of the queue, so ordering is kept */
+	bio_list_for_each(bio, &eng->td_queued_bios) {
+		if (covered >= hw_sector_size)
+			break;
+
+		size = td_bio_get_byte_size(bio);
+		if (!size || !td_bio_needs_rmw(eng, bio)
+				|| td_bio_get_sector_offset(bio) != next_sector)
+			return NULL;
+
+		covered += size;
+		next_sector += size >> SECTOR_SHIFT;
+		count ++;
+	}
+
+	if (covered != hw_sector_size)
+		return NULL;
+
+	tok = td_alloc_token_with_host_page(eng, TD_TOK_FOR_FW,
+			hw_sector_size, 0);
+	if (unlikely(!tok))
+		return NULL;
+
+	/* update resources remaining */
+	bs->core_avail --;
+	bs->tok_avail --;
+	bs->wr_avail --;
+
+	/* set magic flags as needed */
+	tok->magic_flags = (uint8_t)td_eng_conf_var_get(eng, MAGIC_FLAGS);
+
+	/* the first bio drives the command, the rest ride along */
+	tok->host.bio = bs->bio;
+	td_token_assign_lba_and_offset_from_bio(tok, bs->bio);
+	td_bio_copy_to_virt(bs->bio, tok->host_buf_virt);
+
+	for (i = 0; i < count; i++) {
+		bio = bio_list_pop(&eng->td_queued_bios);
+		eng->td_queued_bio_writes --;
+
+		td_bio_copy_to_virt(bio, PTR_OFS(tok->host_buf_virt,
+					td_bio_lba_offset(eng, bio)));
+		bio_list_add(&tok->host.coalesced, bio);
+
+		td_eng_trace(eng, TR_BIO, "BIO:coalesce:bio", (uint64_t)bio);
+	}
+
+	/* support early commit */
+	tok->ops.early_commit = td_release_tok_bio;
+
+	/* update latency if needed */
+	td_eng_latency_start(&eng->td_tok_latency, tok);
+
+	/* increment stats */
+	eng->td_counters.misc.write_coalesce_cnt ++;
+	eng->td_counters.misc.write_coalesce_bio_cnt += count + 1;
+
+	return tok;
+}
+
 static int td_engine_rmw_write_completion(struct td_token*);
 static int td_engine_rmw_read_completion(struct td_token*);
 
@@ -2328,6 +2954,66 @@ static int td_engine_SEC_completion(struct td_token *tok)
 
 
 
+/* return non-zero if the write can go out as a TRIM, since a whole LBA
+ * of zeros reads back the same from a trimmed LBA */
+static int td_engine_write_is_zero_lba(struct td_engine *eng, td_bio_ref bio)
+{
+#ifdef CONFIG_TERADIMM_TRIM
+	if (!td_eng_conf_var_get(eng, ZERO_WRITE_TRIM)
+			|| !td_eng_conf_hw_var_get(eng, DISCARD))
+		return 0;
+
+	/* a whole LBA, and no metadata that would have to be kept */
+	if (td_bio_get_byte_size(bio) != PAGE_SIZE
+			|| td_eng_conf_hw_var_get(eng, HW_SECTOR_SIZE) != PAGE_SIZE
+			|| td_bio_lba_offset(eng, bio)
+			|| eng->td_bio_copy_ops.host_to_dev
+				!= td_token_copy_ops_bio.host_to_dev)
+		return 0;
+
+	/* non-zero data usually shows in the first word, so this is cheap */
+	return td_bio_is_zero(bio);
+#else
+	return 0;
+#endif
+}
+
+/*
+ * build a TRIM for a write of zeros; the range is written to the token's
+ * host page, the bio is only completed
+ */
+static struct td_token *td_engine_construct_zero_trim_token_for_bio(
+		struct td_engine *eng, struct td_io_begin_state *bs)
+{
+	struct td_token *tok;
+
+	tok = td_alloc_token_with_host_page(eng, TD_TOK_FOR_FW, 512, 0);
+	if (unlikely(!tok))
+		return NULL;
+
+	/* update resources remaining */
+	bs->core_avail --;
+	bs->tok_avail --;
+	bs->wr_avail --;
+
+	/* set magic flags as needed */
+	tok->magic_flags = (uint8_t)td_eng_conf_var_get(eng, MAGIC_FLAGS);
+
+	tok->host.bio = bs->bio;
+	td_token_assign_lba_and_offset_from_bio(tok, bs->bio);
+	tok->zero_trim = 1;
+
+	/* support early commit */
+	tok->ops.early_commit = td_release_tok_bio;
+
+	/* update latency if needed */
+	td_eng_latency_start(&eng->td_tok_latency, tok);
+
+	eng->td_counters.misc.zero_write_trim_cnt ++;
+
+	return tok;
+}
+
 static struct td_token *td_engine_construct_token_for_bio(struct td_engine *eng,
 		struct td_io_begin_state *bs)
 {
@@ -2340,6 +3026,13 @@ static struct td_token *td_engine_construct_token_for_bio(struct td_engine *eng,
 		write_size = 512;
 	else if (td_bio_is_write(bio)) {
 		int weps_needed = 0;
+
+		if (td_engine_write_is_zero_lba(eng, bio)) {
+			tok = td_engine_construct_zero_trim_token_for_bio(eng, bs);
+			if (tok)
+				return tok;
+		}
+
 		/*
 		 * If we can do SEC, we'll do it...
 		 * These values should be tunable
@@ -2420,14 +3113,23 @@ static int td_engine_io_begin_one_bio(struct td_engine *eng,
 
 	WARN_ON(!bs->bio);
 
+	/* reads can be served from host memory, writes invalidate it */
+	if (td_engine_rdcache_bio(eng, bs->bio)
+			|| td_engine_readahead_bio(eng, bs->bio)) {
+		bs->bio = NULL;
+		return 0;
+	}
+
 	/*
 	 * Stamp our commit state info on this BIO right now
 	 */
 	td_bio_flags_ref(bs->bio)->commit_level = (uint8_t)td_eng_conf_var_get(eng, EARLY_COMMIT);
 
-	if (unlikely (td_bio_needs_rmw(eng, bs->bio)))
-		tok = td_engine_construct_rmw_token_for_bio(eng, bs);
-	else
+	if (unlikely (td_bio_needs_rmw(eng, bs->bio))) {
+		tok = td_engine_construct_coalesced_token_for_bio(eng, bs);
+		if (!tok)
+			tok = td_engine_construct_rmw_token_for_bio(eng, bs);
+	} else
 		tok = td_engine_construct_token_for_bio(eng, bs);
 
 	if (unlikely(!tok))
@@ -2462,6 +3164,23 @@ failed_to_get_token:
 
 /* --- top level handling of block requests --- */
 
+/* a bio that could not start was pushed back to the head, where it keeps
+ * the age it had when it was popped */
+static void td_engine_age_popped_bio(struct td_engine *eng)
+{
+	td_bio_ref popped = eng->td_popped_bio;
+
+	eng->td_popped_bio = NULL;
+
+	if (!popped || eng->td_head_bio
+			|| bio_list_peek(&eng->td_queued_bios) != popped)
+		return;
+
+	td_engine_age_head_bio(eng, popped);
+	eng->td_head_bio_since = eng->td_popped_bio_since;
+	eng->td_head_bio_overdue = eng->td_popped_bio_overdue;
+}
+
 static int td_engine_io_begin_block(struct td_engine *eng, uint *max)
 {
 	struct bio_list bios;
@@ -2524,6 +3243,7 @@ static int td_engine_io_begin_block(struct td_engine *eng, uint *max)
 	}
 
 bail:
+	td_engine_age_popped_bio(eng);
 	(*max) -= min_t(uint, *max, bs.tok_started);
 	return bs.tok_started;
 
@@ -2539,10 +3259,115 @@ failed_to_get_token:
 		td_engine_push_bio(eng, bs.bio);
 	bs.bio = NULL;
 
+	td_engine_age_popped_bio(eng);
 
 	return bs.tok_started;
 }
 
+/* --- writes staged in host memory --- */
+
+#ifdef CONFIG_TERADIMM_WRITE_STAGING
+/* take bios at the head of the queue into the staging buffer */
+static void td_engine_wrstage_absorb(struct td_engine *eng)
+{
+	td_bio_ref bio;
+	unsigned n;
+	bool head;
+
+	if (!td_eng_conf_var_get(eng, WRITE_STAGING_PAGES)
+			&& !td_engine_wrstage_queued(eng))
+		return;
+
+	/* older writes still being handed out, or held back, have to reach
+	 * the device before anything staged after them */
+	if (td_bio_cursor_bio(&eng->td_bio_cursor)
+			|| eng->td_discard_held_count
+			|| td_active_rmw_tokens(eng)
+			|| !bio_list_empty(&eng->td_rmw_bios))
+		return;
+
+	for (n = 0; n < TD_WRSTAGE_ABSORB_BATCH; n++) {
+		if (bio_list_empty(&eng->td_queued_bios))
+			td_migrate_incoming_to_queued(eng);
+
+		bio = bio_list_pop(&eng->td_queued_bios);
+		if (!bio)
+			break;
+
+		if (td_bio_is_write(bio))
+			eng->td_queued_bio_writes --;
+		else
+			eng->td_queued_bio_reads --;
+
+		head = bio == eng->td_head_bio;
+
+		if (!td_engine_wrstage_bio(eng, bio)) {
+			/* it goes the normal way */
+			td_engine_push_bio(eng, bio);
+			break;
+		}
+
+		if (head)
+			td_engine_age_head_bio(eng, NULL);
+	}
+}
+
+/* write out staged LBAs, oldest first */
+static int td_engine_io_begin_wrstage(struct td_engine *eng, uint *max)
+{
+	struct td_io_begin_state bs;
+	struct td_token *tok;
+
+	td_engine_wrstage_absorb(eng);
+
+	if (!td_engine_wrstage_queued(eng))
+		return 0;
+
+	if (td_io_begin_state_init(eng, &bs, *max))
+		/* no resources */
+		return 0;
+
+	while (bs.tok_avail>0 && bs.core_avail>0) {
+
+		if (td_engine_hold_back_write(eng) || !bs.wr_avail)
+			break;
+
+		bs.bio = td_engine_wrstage_next(eng);
+		if (!bs.bio)
+			break;
+
+		td_bio_flags_ref(bs.bio)->commit_level = (uint8_t)td_eng_conf_var_get(eng, EARLY_COMMIT);
+
+		tok = td_engine_construct_token_for_bio(eng, &bs);
+		if (unlikely(!tok)) {
+			td_engine_wrstage_requeue(eng, bs.bio);
+			break;
+		}
+
+		/* the bio belongs to the staging buffer */
+		tok->staged = 1;
+		if (tok->sec_buddy)
+			tok->sec_buddy->staged = 1;
+
+		td_eng_trace(eng, TR_BIO, "BIO:wrstage:start", tok->lba);
+
+		/* send it to the hardware */
+		td_engine_start_token(eng, tok);
+		bs.tok_started ++;
+
+		if (tok->sec_buddy) {
+			td_engine_start_token(eng, tok->sec_buddy);
+			bs.tok_started ++;
+		}
+	}
+
+	bs.bio = NULL;
+
+	(*max) -= min_t(uint, *max, bs.tok_started);
+	return bs.tok_started;
+}
+#endif
+
 static void td_engine_io_complete_list(struct td_engine *eng,
 		struct list_head *token_list)
 {
@@ -2616,7 +3441,7 @@ static void td_engine_handle_repeat_exhausted(struct td_engine *eng,
 		struct list_head *complete_list)   // failed ones get put on this list
 {
 	int rc;
-	struct td_token_list *tok_list;
+	struct td_token_map *tok_map;
 
 	/* If it's not a to_ssd command, it's not sequenced */
 	if (unlikely (!tok->to_ssd) )
@@ -2664,8 +3489,8 @@ static void td_engine_handle_repeat_exhausted(struct td_engine *eng,
 	tok->ops.completion = td_failed_retry_sequence_advancing_pre_completion;
 
 	/* we are active again */
-	tok_list = &eng->tok_pool[td_token_type(tok)].td_active_tokens;
-	td_tokens_enqueue(tok_list, tok);
+	tok_map = &eng->tok_pool[td_token_type(tok)].td_active_tokens;
+	td_tokmap_enqueue(tok_map, tok);
 
 	/* restart the counter */
 	td_reset_token_timeout(eng, tok);
@@ -2684,7 +3509,7 @@ static void td_engine_io_repeat_list(struct td_engine *eng,
 		struct list_head *complete_list)   // failed ones get put on this list
 {
 	struct td_token *tok;
-	struct td_token_list *tok_list;
+	struct td_token_map *tok_map;
 
 	if (list_empty(repeat_list))
 		return;
@@ -2745,7 +3570,7 @@ static void td_engine_io_repeat_list(struct td_engine *eng,
 
 		/* when replaying a write, write the data again */
 		if (td_token_is_write(tok) ) {
-			if (tok->host.bio || tok->host.ucmd) {
+			if (tok->host.bio || tok->host.ucmd || tok->host.ureq) {
 				/* we have the data, or it's a ucmd */
 				td_eng_trace(eng, TR_TOKEN, "retry:data               ",
 						tok->tokid);
@@ -2784,8 +3609,8 @@ token_is_active_again:
 		/* it restarted, so add it to the active list */
 		tok->result = TD_TOK_RESULT_ACTIVE;
 
-		tok_list = &eng->tok_pool[td_token_type(tok)].td_active_tokens;
-		td_tokens_enqueue(tok_list, tok);
+		tok_map = &eng->tok_pool[td_token_type(tok)].td_active_tokens;
+		td_tokmap_enqueue(tok_map, tok);
 
 		/* restart the counter */
 		td_reset_token_timeout(eng, tok);
@@ -2794,7 +3619,7 @@ token_is_active_again:
 
 void td_engine_io_complete(struct td_engine *eng, enum td_token_type tt)
 {
-	struct td_token *tok, *nxt;
+	struct td_token *tok;
 	struct td_token_pool *tok_pool;
 #ifdef CONFIG_TERADIMM_COMPLETE_WRITE_FIRST
 	struct list_head write_completed;
@@ -2824,17 +3649,19 @@ void td_engine_io_complete(struct td_engine *eng, enum td_token_type tt)
 	INIT_LIST_HEAD(&timedout);
 
 	td_active_tokens_lock(eng);
+	td_busy_poll_tokens(td_engine_devgroup(eng),
+			tok_pool->td_active_tokens.count);
 	oldest_seq = -1ULL;
-	for_each_token_list_token(tok, nxt, &tok_pool->td_active_tokens) {
+	for_each_token_map_token(tok, &tok_pool->td_active_tokens) {
 
 		if (tok->cmd_seq && tok->cmd_seq < oldest_seq)
 			oldest_seq = tok->cmd_seq;
 
-		if (! tok->ops.status_check(tok))
+		if (! tok->status_check(tok))
 			continue;
 
 		/* remove from active list */
-		__td_tokens_del(&tok_pool->td_active_tokens, tok);
+		__td_tokmap_del(&tok_pool->td_active_tokens, tok);
 
 		switch (tok->result) {
 		case TD_TOK_RESULT_OK:
@@ -3139,6 +3966,8 @@ static int td_engine_deallocate_rdbuf(struct td_engine *eng, unsigned rdbuf)
 	if (td_state_is_purging_read_buffers(eng))
 		tok->ops.completion = td_request_end_deallocate;
 
+	eng->td_counters.misc.deallocate_cmd_cnt ++;
+
 	/* send it to the hardware */
 	td_engine_start_token(eng, tok);
 
@@ -3477,6 +4306,21 @@ error_completion:
 };
 
 
+/** build-time checks of the cache line layout of struct td_engine */
+static void td_engine_layout_check(void)
+{
+	td_token_layout_check();
+
+	/* block layer submitters only touch the incoming queue */
+	STATIC_ASSERT((offsetof(struct td_engine, td_incoming_bio_lock) % 64) == 0);
+	STATIC_ASSERT((offsetof(struct td_engine, td_queued_bios) % 64) == 0);
+
+	/* completion loop state shares no lines with token payloads */
+	STATIC_ASSERT((offsetof(struct td_engine, td_tokens) % 64) == 0);
+	STATIC_ASSERT(offsetof(struct td_engine, td_active_rmw_tokens_count)
+			+ sizeof(unsigned) - offsetof(struct td_engine, ops) <= 64);
+	STATIC_ASSERT((offsetof(struct td_engine, tok_pool) % 64) == 0);
+}
 
 int td_engine_init(struct td_engine *eng, struct td_device *dev)
 {
@@ -3490,6 +4334,8 @@ int td_engine_init(struct td_engine *eng, struct td_device *dev)
 	struct td_token *tok;
 	const char *name;
 
+	td_engine_layout_check();
+
 	name = eng->td_name = td_device_name(dev);
 printk(KERN_ERR "%s, td_device_name = %s\n", __FUNCTION__,name);
 	init_completion(&eng->td_state_change_completion);
@@ -3551,10 +4397,10 @@ printk(KERN_ERR "%s, td_device_name = %s\n", __FUNCTION__,name);
 	/* initialize tokens */
 	for_each_token_type(tt) {
 		struct td_token_pool *tok_pool = &eng->tok_pool[tt];
-		td_token_list_init(&tok_pool->td_free_tokens);
-		td_token_list_init(&tok_pool->td_active_tokens);
-		td_token_list_init(&tok_pool->td_timedout_tokens);
-		td_token_list_init(&tok_pool->td_resumable_tokens);
+		td_token_map_init(&tok_pool->td_free_tokens, eng->td_tokens);
+		td_token_map_init(&tok_pool->td_active_tokens, eng->td_tokens);
+		td_token_map_init(&tok_pool->td_timedout_tokens, eng->td_tokens);
+		td_token_map_init(&tok_pool->td_resumable_tokens, eng->td_tokens);
 	}
 
 	eng->td_sequence_oldest = -1ULL;
@@ -3619,9 +4465,14 @@ printk(KERN_ERR "%s, td_device_name = %s\n", __FUNCTION__,name);
 	eng->td_queued_bio_writes = 0;
 	eng->td_queued_bio_reads = 0;
 
+	eng->td_discard_held_count = 0;
+	eng->td_discard_held_end = 0;
+	eng->td_discard_flush = 0;
+
 	spin_lock_init(&eng->td_queued_ucmd_lock);
 	INIT_LIST_HEAD(&eng->td_queued_ucmd_list);
 	eng->td_queued_ucmd_count = 0;
+	td_ucmd_async_init(eng);
 
 	eng->td_sample_window = td_eng_conf_var_get(eng, IOPS_SAMPLE_MSEC) * 1000UL / HZ; /* ms -> jiffies */
 	eng->td_sample_start  = jiffies;
@@ -3652,8 +4503,14 @@ printk(KERN_ERR "%s, td_device_name = %s\n", __FUNCTION__,name);
 	bio_list_init(&eng->td_rmw_bios);
 	eng->td_rmw_inflight = 0;
 
+	td_engine_readahead_init(eng);
+	td_engine_rdcache_init(eng);
+	td_engine_wrstage_init(eng);
+	td_engine_uring_init(eng);
+	td_engine_loadgen_init(eng);
+
 	/* initialize trace */
-	rc = td_trace_init(&eng->td_trace, eng->td_name, dev->td_cpu_socket);
+	rc = td_trace_init(&eng->td_trace, eng->td_name, dev->td_node);
 	if (rc < 0) {
 		td_eng_err(eng, "Initialization of trace buffer for %s failed, rc=%d\n",
 				eng->td_name, rc);
@@ -3670,7 +4527,7 @@ printk(KERN_ERR "%s, td_device_name = %s\n", __FUNCTION__,name);
 
 	/* add only those tokens which are used */
 	for (tokid=0; tokid<TD_TOKENS_PER_DEV; tokid++) {
-		struct td_token_list *tok_list;
+		struct td_token_map *tok_map;
 
 		/* limit count to configuration */
 		if (tokid >= td_eng_conf_var_get(eng, TOKENS))
@@ -3682,23 +4539,31 @@ printk(KERN_ERR "%s, td_device_name = %s\n", __FUNCTION__,name);
 		 * td_token_type() can now be used */
 		tok->token_type = td_tok_type_from_tokid(eng, tokid);
 
-		tok_list = &eng->tok_pool[td_token_type(tok)].td_free_tokens;
+		tok_map = &eng->tok_pool[td_token_type(tok)].td_free_tokens;
 
-		td_tokens_enqueue(tok_list, tok);
+		td_tokmap_enqueue(tok_map, tok);
 	}
 
 	eng->td_sample_window = td_eng_conf_var_get(eng, IOPS_SAMPLE_MSEC) * 1000UL / HZ; /* ms -> jiffies */
 
 #ifdef CONFIG_TERADIMM_PRIVATE_SPLIT_STASH
 	/* 512 is enough for 2 bios, which is common for un-aligned IO */
-	eng->td_split_stash = td_stash_init(eng, 512, 256);
+	eng->td_split_stash = td_stash_init(eng, 512, 256, td_engine_node(eng));
 #endif
 
+	rc = td_bio_cursor_init(&eng->td_bio_cursor, td_engine_node(eng));
+	if (rc)
+		goto error_cursor_init;
+
 	td_run_state_enter(eng, INIT);
 
 
 	return 0;
 
+error_cursor_init:
+#ifdef CONFIG_TERADIMM_PRIVATE_SPLIT_STASH
+	td_stash_destroy(eng, eng->td_split_stash);
+#endif
 error_ops_init:
 error_ops_trace:
 error_find_ops:
@@ -4013,8 +4878,15 @@ int td_engine_exit(struct td_engine *eng)
 {
 	td_eng_hal_exit(eng);
 
+	td_engine_readahead_drop_all(eng);
+	td_engine_rdcache_exit(eng);
+	td_engine_wrstage_exit(eng);
+	td_ucmd_async_exit(eng);
+
 	td_trace_cleanup(&eng->td_trace);
 
+	td_bio_cursor_exit(&eng->td_bio_cursor);
+
 #ifdef CONFIG_TERADIMM_PRIVATE_SPLIT_STASH
 	/* 512 is enough for 2 bios, which is common for un-aligned IO */
 	td_stash_destroy(eng, eng->td_split_stash);
@@ -35,6 +35,7 @@
 #include "td_eng_latency.h"
 #include "td_token.h"
 #include "td_token_list.h"
+#include "td_token_map.h"
 #include "td_trace.h"
 #include "td_stash.h"
 #include "td_monitor.h"
@@ -117,6 +118,17 @@ extern int td_engine_start_bio(struct td_engine *eng);
 
 extern int td_engine_queue_bio(struct td_engine *eng, td_bio_ref bio);
 
+/** validate a bio before it is queued, returns non-zero if it was failed */
+extern int td_engine_accept_bio(struct td_engine *eng, td_bio_ref bio);
+
+/** queue a bio that td_engine_accept_bio() took */
+extern void td_engine_queue_accepted_bio(struct td_engine *eng,
+		td_bio_ref bio);
+
+/** queue a list of accepted bios with a single poke */
+extern void td_engine_queue_bio_list(struct td_engine *eng,
+		struct bio_list *bios);
+
 #if CONFIG_TERADIMM_INCOMING_BACKPRESSURE == TD_BACKPRESSURE_EVENT
 static inline void td_eng_account_bio_completion(struct td_engine *eng)
 {
@@ -166,10 +178,19 @@ static inline void td_eng_account_bio_completion(struct td_engine *eng)
 #define td_eng_account_bio_completion(_eng) do { } while (0)
 #endif
 
-static inline void td_engine_endio(struct td_engine *eng, td_bio_ref bio, int result)
+static inline void td_engine_endio(struct td_engine *eng, td_bio_ref bio,
+		int result, int origin)
 {
 #ifdef CONFIG_TERADIMM_OFFLOAD_COMPLETION_THREAD
 	struct td_devgroup *dg = td_engine_devgroup(eng);
+	if (td_dg_conf_general_var_get(dg, ENDIO_ON_SUBMITTER) && !result
+			&& td_devgroup_queue_endio_remote(dg, bio, origin)) {
+
+		/* if incoming requests are waiting, release them */
+		td_eng_account_bio_completion(eng);
+
+		return;
+	}
 	if (td_dg_conf_general_var_get(dg, ENDIO_ENABLE)) {
 		td_devgroup_queue_endio(dg, bio, result);
 
@@ -201,6 +222,12 @@ static inline void td_terminate_all_outstanding_bios(struct td_engine *eng,
 	__td_terminate_all_outstanding_bios(eng, reset_active_tokens, -EIO);
 }
 
+/** NUMA node that per-device structures should be allocated on */
+static inline int td_engine_node (struct td_engine *eng)
+{
+	return td_engine_device(eng)->td_node;
+}
+
 static inline void td_engine_poke (struct td_engine *eng)
 {
 	td_device_poke(td_engine_device(eng));
@@ -221,6 +248,13 @@ extern void td_enqueue_ucmd(struct td_engine *eng, struct td_ucmd *ucmd);
 /** given a token prepared with a command, executes it in the device */
 extern void td_engine_start_token(struct td_engine *eng, struct td_token *tok);
 
+/** return a bio that cannot be started now to the head of the queue */
+extern void td_engine_push_bio(struct td_engine *eng, td_bio_ref bio);
+
+/** account for a finished read/write/control request */
+extern void td_update_request_end_counters(struct td_engine *eng,
+		struct td_token *tok, unsigned size, int result);
+
 
 /** Queue a work task to the engine for processing */
 extern int td_engine_queue_task (struct td_engine *eng, 
@@ -321,14 +355,14 @@ static inline void td_##_type_##_tokens_lock(struct td_engine *eng)    \
 {                                                                      \
 	int i;                                                         \
 	for (i=0; i<TD_TOK_TYPE_MAX; i++)                              \
-		td_tokens_lock(&eng->tok_pool[i]                       \
+		td_tokmap_lock(&eng->tok_pool[i]                       \
 				.td_##_type_##_tokens);                \
 }                                                                      \
 static inline void td_##_type_##_tokens_unlock(struct td_engine *eng)  \
 {                                                                      \
 	int i;                                                         \
 	for (i=TD_TOK_TYPE_MAX-1; i>=0; i--)                           \
-		td_tokens_unlock(&eng->tok_pool[i]                     \
+		td_tokmap_unlock(&eng->tok_pool[i]                     \
 				.td_##_type_##_tokens);                \
 }
 
@@ -401,16 +435,13 @@ static inline int td_bio_page_span(td_bio_ref bio, uint64_t size)
 	return (int)(1 + lba1 - lba0);
 }
 
-/* convert a BIO sector number to a hardware LBA and offset */
-static inline void td_token_assign_lba_and_offset_from_bio(struct td_token *tok,
-		td_bio_ref bio)
+/* convert a block LBA and offset to a hardware port, LBA and offset */
+static inline void td_token_assign_lba_and_offset(struct td_token *tok,
+		uint64_t lba, uint64_t lba_ofs)
 {
 	struct td_engine *eng = td_token_engine(tok);
 
 	if (td_eng_conf_hw_var_get(eng, SSD_COUNT) > 1) {
-		uint64_t lba = td_bio_lba(eng, bio);
-		uint64_t lba_ofs = td_bio_lba_offset(eng, bio);
-		
 		uint64_t stride = td_eng_conf_hw_var_get(eng, SSD_STRIPE_LBAS);
 		uint64_t piece = lba / stride;
 		uint64_t offset = lba % stride;
@@ -432,11 +463,21 @@ static inline void td_token_assign_lba_and_offset_from_bio(struct td_token *tok,
 		tok->lba = stride * (piece / td_eng_conf_hw_var_get(eng, SSD_COUNT)) + offset;
 		tok->lba_ofs = (uint16_t)lba_ofs;
 	} else {
-		tok->lba     = td_bio_lba(eng, bio);
-		tok->lba_ofs = (uint16_t)td_bio_lba_offset(eng, bio);
+		tok->lba     = lba;
+		tok->lba_ofs = (uint16_t)lba_ofs;
 	}
 }
 
+/* convert a BIO sector number to a hardware LBA and offset */
+static inline void td_token_assign_lba_and_offset_from_bio(struct td_token *tok,
+		td_bio_ref bio)
+{
+	struct td_engine *eng = td_token_engine(tok);
+
+	td_token_assign_lba_and_offset(tok, td_bio_lba(eng, bio),
+			td_bio_lba_offset(eng, bio));
+}
+
 /* return non-zero if access needs read-modify-write;
  * this basically means that it spans multiple hw LBAs */
 static inline int td_bio_needs_rmw(struct td_engine *eng,
@@ -977,9 +1018,9 @@ again:
 		return NULL;
 
 #ifdef CONFIG_TERADIMM_MCEFREE_TOKEN_TYPES
-	tok = td_tokens_dequeue(&eng->tok_pool[tt].td_free_tokens);
+	tok = td_tokmap_dequeue(&eng->tok_pool[tt].td_free_tokens);
 #else
-	tok = td_tokens_dequeue(&eng->td_free_tokens);
+	tok = td_tokmap_dequeue(&eng->td_free_tokens);
 #endif
 
 	td_eng_trace(eng, 32, "TD_ENG:alloc:tok", tok->tokid);
@@ -1012,33 +1053,23 @@ again:
 static inline struct td_token *td_alloc_token_id(struct td_engine *eng,
 		uint16_t tokid)
 {
-	struct td_token *tok, *nxt;
+	struct td_token *tok;
 #ifdef CONFIG_TERADIMM_MCEFREE_TOKEN_TYPES
 	enum td_token_type tt;
 #endif
-	struct td_token_list *tok_list;
+	struct td_token_map *tok_map;
 
 	td_free_tokens_lock(eng);
 
 #ifdef CONFIG_TERADIMM_MCEFREE_TOKEN_TYPES
 	tt = td_tok_type_from_tokid(eng, tokid);
-	tok_list = &eng->tok_pool[tt].td_free_tokens;
+	tok_map = &eng->tok_pool[tt].td_free_tokens;
 #else
-	tok_list = &eng->td_free_tokens;
+	tok_map = &eng->td_free_tokens;
 #endif
 
-	for_each_token_list_token(tok, nxt, tok_list) {
-
-		if (likely (tokid != tok->tokid))
-			continue;
-
-		__td_tokens_del(tok_list, tok);
-		goto bail;
-	}
-
-	tok = NULL;
+	tok = __td_tokmap_take(tok_map, tokid);
 
-bail:
 	td_free_tokens_unlock(eng);
 
 	return tok;
@@ -1069,7 +1100,7 @@ static inline void td_free_token(struct td_engine *eng,
 			td_eng_trace(eng, TR_TOKEN, "TD_ENG:hold:tok",
 					tok->tokid);
 			/* this token needs to be pushed for future cleanup */
-			td_tokens_enqueue(&eng->tok_pool[tt].td_timedout_tokens, tok);
+			td_tokmap_enqueue(&eng->tok_pool[tt].td_timedout_tokens, tok);
 			return;
 		}
 
@@ -1078,9 +1109,9 @@ static inline void td_free_token(struct td_engine *eng,
 		td_eng_trace(eng, TR_TOKEN, "TD_ENG:free:tok", tok->tokid);
 		/* token can be reused right away */
 		if (unlikely (td_eng_conf_var_get(eng, QUICK_TOK_REUSE)))
-			td_tokens_push(&eng->tok_pool[tt].td_free_tokens, tok);
+			td_tokmap_push(&eng->tok_pool[tt].td_free_tokens, tok);
 		else
-			td_tokens_enqueue(&eng->tok_pool[tt].td_free_tokens, tok);
+			td_tokmap_enqueue(&eng->tok_pool[tt].td_free_tokens, tok);
 	}
 }
 
@@ -1540,7 +1571,7 @@ static inline struct td_token *td_alloc_token_with_host_page(
 			|| dev_to_host_len > PAGE_SIZE)
 		return NULL;
 
-	page = alloc_page(GFP_KERNEL);
+	page = alloc_pages_node(td_engine_node(eng), GFP_KERNEL, 0);
 	if (!page)
 		goto error_no_page_available;
 
@@ -1919,7 +1950,8 @@ static inline unsigned td_engine_queued_bio_reads(struct td_engine *eng)
 static inline unsigned td_engine_queued_bio_writes(struct td_engine *eng)
 {
 	return (unsigned)eng->td_incoming_bio_writes
-	     + (unsigned)eng->td_queued_bio_writes;
+	     + (unsigned)eng->td_queued_bio_writes
+	     + eng->td_discard_held_count;
 }
 
 
@@ -1967,6 +1999,12 @@ static inline unsigned td_engine_queued_work(struct td_engine *eng)
 #ifdef CONFIG_TERADIMM_DEVGROUP_TASK_WORK
 	count += td_engine_queued_tasks(eng);
 #endif
+#ifdef CONFIG_TERADIMM_USER_RING
+	count += eng->td_uring_ready;
+#endif
+#ifdef CONFIG_TERADIMM_WRITE_STAGING
+	count += eng->td_wrstage.ws_queued_count;
+#endif
 
 	if (!td_eng_rdbuf_throttling(eng))
 		count += td_pending_rdbuf_deallocations(eng);
@@ -2203,6 +2241,11 @@ static inline int td_can_start_work_now(struct td_engine *eng)
 		   || !td_available_write_buffers(eng))
 		return 0;
 
+	/* a large write is being handed out */
+	bio = td_bio_cursor_bio(&eng->td_bio_cursor);
+	if (bio && td_bio_is_write(bio))
+		return 1;
+
 	if (bio_list_empty(&eng->td_queued_bios))
 		td_migrate_incoming_to_queued(eng);
 
@@ -2211,6 +2254,10 @@ static inline int td_can_start_work_now(struct td_engine *eng)
 	if (bio && td_bio_is_write(bio))
 		return 1;
 
+	/* held discards go out once nothing else is queued */
+	if (!bio && eng->td_discard_held_count)
+		return 1;
+
 	/* there is no more work until something happens:
 	 *  - get a write bio
 	 *  - get a token
@@ -34,6 +34,14 @@
  */
 #define TD_MAX_DISCARD_CHUNK      0xFFFFll
 #define TD_MAX_DISCARD_LBA_COUNT  (TD_MAX_DISCARD_CHUNK * 64)
+/* largest discard accepted from the block layer, or built by merging */
+#define TD_MAX_DISCARD_SECTORS    (TD_MAX_DISCARD_LBA_COUNT * 2)
+
+/* most discards that can be held back for merging */
+#define TD_DISCARD_HOLD_MAX       64
+
+/* most LBAs the write staging buffer can hold */
+#define TD_WRSTAGE_PAGES_MAX      16384
 /**
  * used to track read buffers
  */
@@ -68,6 +76,96 @@ struct td_corebuf {
 };
 #endif
 
+#ifdef CONFIG_TERADIMM_READAHEAD
+/**
+ * used to detect sequential readers and stage data read ahead of them
+ */
+#define TD_READAHEAD_STREAMS    4
+#define TD_READAHEAD_SLOTS      TD_HOST_RD_BUFS_PER_DEV
+
+struct td_ra_stream {
+	uint64_t                rs_next_lba;         /**< LBA this stream is expected to read next */
+	uint64_t                rs_ahead_lba;        /**< next LBA to read ahead of the stream */
+	unsigned                rs_run;              /**< sequential LBAs read so far */
+	cycles_t                rs_last_used;        /**< timestamp of last read, for replacement */
+};
+
+enum td_ra_slot_state {
+	TD_RA_SLOT_FREE = 0,
+	TD_RA_SLOT_INFLIGHT,                         /**< speculative read running into ra_page */
+	TD_RA_SLOT_VALID,                            /**< ra_page holds the data for ra_lba */
+};
+
+struct td_ra_slot {
+	uint64_t                ra_lba;              /**< block LBA (before striping) */
+	uint8_t                 ra_state;            /**< see enum td_ra_slot_state */
+	uint8_t                 ra_stale:1;          /**< overwritten while in flight */
+	struct page             *ra_page;            /**< data; owned by the token while INFLIGHT */
+	struct bio_list         ra_waiters;          /**< reads that arrived while INFLIGHT */
+	cycles_t                ra_ts;               /**< timestamp of last state change */
+};
+#endif
+
+#ifdef CONFIG_TERADIMM_READ_CACHE
+/**
+ * host memory copies of recently read LBAs
+ */
+#define TD_RDCACHE_HASH_BITS    12
+#define TD_RDCACHE_HASH_SIZE    (1 << TD_RDCACHE_HASH_BITS)
+
+struct td_rc_entry {
+	struct td_rc_entry      *rc_next;            /**< next entry in the hash chain */
+	struct list_head        rc_lru_link;         /**< position on probation or protected list */
+	uint64_t                rc_lba;              /**< block LBA (before striping) */
+	struct page             *rc_page;            /**< copy of the LBA */
+	uint8_t                 rc_protected:1;      /**< on rc_protected list */
+};
+
+struct td_rc_bucket {
+	struct td_rc_entry      *rc_chain;           /**< entries hashing here */
+	cycles_t                rc_last_write;       /**< last write started to an LBA hashing here */
+};
+
+struct td_rdcache {
+	struct td_rc_bucket     *rc_buckets;         /**< TD_RDCACHE_HASH_SIZE, allocated on first use */
+	cycles_t                rc_last_wide_write;  /**< last write covering too much to hash */
+
+	struct list_head        rc_probation;        /**< read once, in LRU order */
+	struct list_head        rc_protected;        /**< hit since being read, in LRU order */
+	unsigned                rc_probation_count;
+	unsigned                rc_protected_count;
+};
+#endif
+
+#ifdef CONFIG_TERADIMM_WRITE_STAGING
+/**
+ * host memory copies of writes, taken in ahead of the device
+ */
+#define TD_WRSTAGE_HASH_BITS    10
+#define TD_WRSTAGE_HASH_SIZE    (1 << TD_WRSTAGE_HASH_BITS)
+#define TD_WRSTAGE_ABSORB_BATCH 64           /* most bios taken off the queue in one pass */
+
+struct td_ws_entry;
+
+struct td_wrstage {
+	struct td_ws_entry      **ws_hash;           /**< TD_WRSTAGE_HASH_SIZE chains, allocated on first use */
+	struct list_head        ws_queued;           /**< staged, not written out yet, oldest first */
+	struct list_head        ws_free;             /**< spare entries, with their pages */
+	unsigned                ws_queued_count;     /**< on ws_queued */
+	unsigned                ws_count;            /**< on ws_queued, or being written out */
+	unsigned                ws_alloc_count;      /**< allocated, in use or spare */
+};
+#endif
+
+#ifdef CONFIG_TERADIMM_USER_RING
+/**
+ * user IO rings, one per open of the device char device that set one up
+ */
+#define TD_URING_MAX            8
+
+struct td_uring;
+#endif
+
 /**
  * tracks the state of a hardware engine
  */
@@ -104,8 +202,9 @@ struct td_engine {
 	struct td_eng_latency   td_bio_latency;
 	struct td_eng_latency   td_tok_latency;
 
-	/* this queue is locked by thread and block layer */
-	spinlock_t              td_incoming_bio_lock;     /**< queue lock */
+	/* this queue is locked by thread and block layer; it starts on its
+	 * own cache line so submitting CPUs don't bounce the engine's lines */
+	spinlock_t              td_incoming_bio_lock __aligned64; /**< queue lock */
 	struct bio_list         td_incoming_bios;  /**< requests from block layer */
 	uint64_t                td_incoming_bio_reads;
 	uint64_t                td_incoming_bio_writes;
@@ -123,10 +222,23 @@ struct td_engine {
 	/* incoming requests that were already removed and owned by the thread
 	 * are here (this is done to limit number of times the
 	 * td_incoming_bio_lock is used by the thread) */
-	struct bio_list         td_queued_bios;  /**< moved from incoming to queued */
+	struct bio_list         td_queued_bios __aligned64; /**< moved from incoming to queued */
 	uint64_t                td_queued_bio_reads;
 	uint64_t                td_queued_bio_writes;
 
+	/* discards taken off the queue to be merged with their neighbours,
+	 * sorted by sector; they go out when nothing else is queued, when
+	 * they get too old, or before an overlapping bio */
+	struct bio              *td_discard_held[TD_DISCARD_HOLD_MAX];
+	unsigned                td_discard_held_count;
+	uint64_t                td_discard_held_end;   /**< end sector of the held ranges */
+	cycles_t                td_discard_held_since; /**< when the oldest was held */
+	int                     td_discard_flush;      /**< send all held before anything else */
+
+	/* a large bio taken off the queue, handed out a part at a time; it
+	 * stays in td_queued_bio_{reads,writes} until the last part is out */
+	struct td_bio_cursor    td_bio_cursor;
+
 	/* queued control messages */
 	struct list_head        td_queued_ucmd_list;
 	spinlock_t              td_queued_ucmd_lock;     /**< queue lock */
@@ -135,6 +247,24 @@ struct td_engine {
 	/** commands are tracked in tokens */
 	struct td_token         td_tokens[TD_TOKENS_PER_DEV];
 
+	/** read on every pass of the completion loop, kept on one line
+	 * ahead of the token pools */
+	TD_DECLARE_IN_PRIVATE_CACHE_LINE(poll,
+		/* abstract interface (simulator or hardware) */
+		struct td_eng_hal_ops *ops;
+		void *ops_priv;
+
+		/** token sequences need to be tracked **/
+		uint64_t td_sequence_next;
+		uint64_t td_sequence_oldest;
+
+		/* keeps track of number of times status was polled */
+		uint64_t                td_polling_loop_count;
+
+		/** count read-modify-write transactions */
+		unsigned                td_active_rmw_tokens_count;
+		);
+
 	/** control the split between hw and fw tokens
 	 * tokens are split into the following groups:
 	 *
@@ -153,7 +283,7 @@ struct td_engine {
 	 *       - upper limit defined by TD_CONF_TOKENS
 	 */
 	struct td_token_pool {
-		struct td_token_list    td_free_tokens,        // tokens ready to go
+		struct td_token_map     td_free_tokens,        // tokens ready to go
 					td_active_tokens,      // tokens with commands in flight
 					td_timedout_tokens,    // tokens with timeouts, waiting for recovery
 					td_resumable_tokens;   // tokens with resolved problems, needing reset
@@ -231,13 +361,6 @@ struct td_engine {
 #define td_eng_fw_maint_tok(eng) td_eng_maint_tok(eng,TD_TOK_FOR_FW)
 #define td_eng_hw_maint_tok(eng) td_eng_maint_tok(eng,TD_TOK_FOR_HW)
 
-	/** count read-modify-write transactions */
-	unsigned                td_active_rmw_tokens_count;
-
-	/** token sequences need to be tracked **/
-	uint64_t td_sequence_next;
-	uint64_t td_sequence_oldest;
-
 	/** array of status bytes */
 #ifdef CONFIG_TERADIMM_DIRECT_STATUS_ACCESS
 	uint8_t                 *td_status;
@@ -251,9 +374,6 @@ struct td_engine {
 	uint64_t                td_no_events;
 #endif
 
-	/* keeps track of number of times status was polled */
-	uint64_t                td_polling_loop_count;
-
 #ifdef CONFIG_TERADIMM_MCEFREE_FWSTATUS
 	/** an array of corebuf tracking structures */
 	struct td_corebuf       td_corebufs[TD_CORE_BUFS_PER_DEV];
@@ -279,6 +399,27 @@ struct td_engine {
 	/** hardware command allocation count */
 	unsigned		td_hw_cmds_used;
 
+	/** when pending deallocates started being held for piggybacking, or 0 */
+	cycles_t                td_dealloc_held_since;
+
+	/** adaptive command burst size, and the latency samples it has seen */
+	unsigned                td_start_burst;
+	uint64_t                td_start_burst_rd_cnt;
+	uint64_t                td_start_burst_wr_cnt;
+
+	/** bio at the head of the queue and when it got there; it is only
+	 * compared against, never dereferenced, as it may have been started */
+	td_bio_ref              td_head_bio;
+	cycles_t                td_head_bio_since;
+	uint8_t                 td_head_bio_write;
+	uint8_t                 td_head_bio_overdue;
+
+	/** the head bio last popped off the queue, and its age, in case it
+	 * is pushed back before the block pass ends */
+	td_bio_ref              td_popped_bio;
+	cycles_t                td_popped_bio_since;
+	uint8_t                 td_popped_bio_overdue;
+
 #ifdef CONFIG_TERADIMM_MCEFREE_FWSTATUS
 	/** an array of rdbuf tracking structures */
 	struct td_rdbuf         td_rdbufs[TD_HOST_RD_BUFS_PER_DEV];
@@ -330,10 +471,6 @@ struct td_engine {
 	/* count all BIOs seen */
 	uint64_t                td_total_bios;
 
-	/* abstract interface (simulator or hardware) */
-	struct td_eng_hal_ops *ops;
-	void *ops_priv;
-
 	/* handlers that copy bio and virt buffers to the device and back
 	 * (set by td_eng_hal_enable in each HAL) */
 	struct td_token_copy_ops td_bio_copy_ops;
@@ -341,6 +478,42 @@ struct td_engine {
 
 	struct bio_list         td_rmw_bios;
 	int                     td_rmw_inflight;
+
+#ifdef CONFIG_TERADIMM_READAHEAD
+	/** sequential streams being tracked */
+	struct td_ra_stream     td_ra_streams[TD_READAHEAD_STREAMS];
+
+	/** pages read ahead, or being read ahead, of the streams */
+	struct td_ra_slot       td_ra_slots[TD_READAHEAD_SLOTS];
+	unsigned                td_ra_slots_used;
+	unsigned                td_ra_inflight;
+#endif
+
+#ifdef CONFIG_TERADIMM_READ_CACHE
+	struct td_rdcache       td_rdcache;
+#endif
+
+#ifdef CONFIG_TERADIMM_WRITE_STAGING
+	struct td_wrstage       td_wrstage;
+#endif
+
+#ifdef CONFIG_TERADIMM_USER_RING
+	spinlock_t              td_uring_lock;       /**< protects td_urings, and ur_ready in each */
+	struct td_uring         *td_urings[TD_URING_MAX];
+	unsigned                td_uring_ready;      /**< rings that have entries to start */
+#endif
+
+#ifdef CONFIG_TERADIMM_UCMD_ASYNC
+	spinlock_t              td_ucmd_async_lock;  /**< protects the lists and counts below */
+	struct list_head        td_ucmd_pool;        /**< free ucmds for asynchronous commands */
+	unsigned                td_ucmd_pool_count;  /**< ucmds allocated for the pool, free or not */
+	struct list_head        td_ucmd_async_busy;  /**< submitted, not completed */
+	struct list_head        td_ucmd_async_done;  /**< completed, not reaped */
+	wait_queue_head_t       td_ucmd_async_wq;    /**< woken when one completes */
+#endif
+#ifdef CONFIG_TERADIMM_LOADGEN
+	atomic_t                td_loadgen_running;  /**< one synthetic load at a time */
+#endif
 #ifdef CONFIG_TERADIMM_TRACE
 	struct td_trace         td_trace;
 #endif
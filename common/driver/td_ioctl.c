@@ -295,6 +295,7 @@ int td_ioctl_device_get_info(struct td_device *dev,
 	info->irq_num          = dev->td_irq;
 	info->memspeed         = dev->td_memspeed;
 	info->cpu_socket       = dev->td_cpu_socket;
+	info->numa_node        = (int16_t)dev->td_node;
 
 	/* TODO: We should put the actual UUID in here somehow */
 	memcpy(info->uuid, dev->os.uuid, sizeof(info->uuid));
@@ -352,30 +353,9 @@ int td_ioctl_device_cmd_pt(struct td_device *dev,
 
 	eng = td_device_engine(dev);
 
-	if (!td_state_can_accept_requests(eng)) {
-		rc = -EIO;
-		goto setup_error;
-	}
-
-	/* if expecting to send data, pointer and length are required */
-	if (ucmd->ioctl.data_len_to_device
-			&& !(ucmd->ioctl.data_len_to_device <= PAGE_SIZE
-				&& ucmd->ioctl.data)) {
-		td_eng_err(eng, "UCMD: to len %u, data: %p\n",
-				ucmd->ioctl.data_len_to_device,
-				ucmd->ioctl.data);
-		rc = -EINVAL;
-		goto setup_error;
-	}
-	if (ucmd->ioctl.data_len_from_device
-			&& !(ucmd->ioctl.data_len_from_device <= PAGE_SIZE
-				&& ucmd->ioctl.data)) {
-		td_eng_err(eng, "UCMD from len  %u, data: %p\n",
-				ucmd->ioctl.data_len_from_device,
-				ucmd->ioctl.data);
-		rc = -EINVAL;
+	rc = td_ucmd_check(eng, &ucmd->ioctl);
+	if (rc)
 		goto setup_error;
-	}
 
 	td_ucmd_init(ucmd);
 
@@ -351,18 +351,27 @@ static int td_monitor_update_bin_hours(struct td_bins *bins)
 static void td_monitor_update_bins(struct td_engine *eng,
 		struct td_bins *bins)
 {
+	unsigned long secs = 1;
+
 	// reset seconds bins when updates have been stalled too long
-	if (time_after(jiffies, bins->last_time + 3 * TD_MONITOR_PERIOD * HZ)) {
+	if (time_after(jiffies, bins->last_time + 3 * TD_MONITOR_PERIOD_MAX * HZ)) {
 		struct td_bin *bp = (struct td_bin*)&bins->secs;
 		td_monitor_bin_reset(bp);
+	} else {
+		// polls back off, the bins still get one count per second
+		secs = (jiffies - bins->last_time + HZ/2) / HZ;
+		if (!secs)
+			secs = 1;
 	}
 	bins->last_time = jiffies;
 
-	td_monitor_update_bin_seconds(bins);
+	while (secs--) {
+		td_monitor_update_bin_seconds(bins);
 
-	if (--bins->second_count <= 0) {
-		bins->second_count = 3600;
-		td_monitor_update_bin_hours(bins);
+		if (--bins->second_count <= 0) {
+			bins->second_count = 3600;
+			td_monitor_update_bin_hours(bins);
+		}
 	}
 }
 
@@ -382,37 +391,45 @@ static void td_monitor_wait_ecc_counts(struct td_engine *eng)
 	}
 }
 
-static int td_monitor_read_ecc_counts_iter(struct td_device *dev, void *data)
+// a device a worker is busy with is polled between its IOs
+static int td_monitor_engine_idle(struct td_engine *eng)
 {
-	struct td_engine *eng = td_device_engine(dev);
-	struct list_head *wait_list = data;
-
-	int rc = td_monitor_read_ecc_counts(eng);
-
-	if (rc == 0) {
-		td_device_hold(td_engine_device(eng));
-		list_add_tail(&eng->ecc_bins.wait_link, wait_list);
-	}
-	return 0;
+	return !td_engine_queued_work(eng) && !td_all_active_tokens(eng);
 }
 
-void td_monitor_ecc_poll_all_devs(void)
+unsigned long td_monitor_ecc_poll(struct td_engine *eng, unsigned rate)
 {
-	struct td_engine *eng, *tmp;
-	struct list_head wait_list;  // list of engines with ucmd to wait on
+	struct td_ecc_bins *eb = &eng->ecc_bins;
+	uint64_t ddr3, internal;
+
+	// polling turned off, look again later
+	if (!rate)
+		return TD_MONITOR_PERIOD * HZ;
+
+	// wait for an idle window, but no longer than one poll interval
+	if (!td_monitor_engine_idle(eng)) {
+		if (!eb->deferred_since)
+			eb->deferred_since = jiffies;
+		if (time_before(jiffies, eb->deferred_since + rate * HZ))
+			return TD_MONITOR_IDLE_RETRY;
+	}
+	eb->deferred_since = 0;
 
-	INIT_LIST_HEAD(&wait_list);
+	ddr3     = eb->ddr3.curr_count;
+	internal = eb->internal.curr_count;
 
-	// loop over td_device_list and
-	// accumulate an list of engines with ucmds to wait on
-	td_device_list_iter(td_monitor_read_ecc_counts_iter, &wait_list);
+	if (td_monitor_read_ecc_counts(eng) == 0)
+		td_monitor_wait_ecc_counts(eng);
 
-	// loop over list of engines with ucmds to wait on
-	list_for_each_entry_safe(eng, tmp, &wait_list, ecc_bins.wait_link) {
+	// back off while counts are steady, come back as soon as they move
+	if (eb->ddr3.curr_count != ddr3 || eb->internal.curr_count != internal)
+		eb->interval = rate;
+	else
+		eb->interval = min_t(unsigned, eb->interval * 2,
+				TD_MONITOR_PERIOD_MAX);
 
-		td_monitor_wait_ecc_counts(eng);
+	if (eb->interval < rate)
+		eb->interval = rate;
 
-		list_del(&eng->ecc_bins.wait_link);
-		td_device_put(td_engine_device(eng));
-	}
+	return eb->interval * HZ;
 }
@@ -22,8 +22,19 @@
 #include "td_kdefn.h"
 #include "td_defs.h"
 
+#include <linux/workqueue.h>
+
 #define TD_MONITOR_PERIOD  (1)
 
+/* polls back off to this many seconds while ECC counts don't change, under
+ * the 10 second window of the seconds bins */
+#define TD_MONITOR_PERIOD_MAX  (8)
+
+/* how often to look for an idle window on a busy device */
+#define TD_MONITOR_IDLE_RETRY  (1 + HZ/50)
+
+struct td_engine;
+
 // common header
 struct td_bin {
 	int index;           // index into counts, next bin to update
@@ -63,15 +74,24 @@ struct td_ecc_bins {
 	int ecc_alarm_read;         // set after reading ecc_alarm
 	uint32_t ecc_alarm;         // from params page 1
 	struct td_ucmd *ucmd;
-	struct list_head wait_link;
 	struct td_bins ddr3;
 	struct td_bins internal;
+
+	/* polling, see td_mon.c */
+	struct delayed_work work;   // runs on a CPU of the device's socket
+	int cpu;                    // or -1 for any
+	int attached;               // device is in a group, protected by td_monitor_lock
+	int running;                // work is scheduled, protected by td_monitor_lock
+	unsigned interval;          // seconds until the next poll
+	unsigned long deferred_since; // jiffies, while waiting for an idle window
 };
 
 extern void td_monitor_bins_init(struct td_bins *bins);
 extern int  td_monitor_get_bin_counts(const struct td_bin *bp,
 		uint64_t *counts, int limit);
-extern void td_monitor_ecc_poll_all_devs(void);
+
+/** poll one device, returns jiffies until it should be polled again */
+extern unsigned long td_monitor_ecc_poll(struct td_engine *eng, unsigned rate);
 
 extern void td_monitor_set_rate(int);
 
@@ -33,6 +33,7 @@
 #include "td_eng_latency.h"
 #include "td_token.h"
 #include "td_token_list.h"
+#include "td_token_map.h"
 #include "td_trace.h"
 #include "td_stash.h"
 #include "td_monitor.h"
@@ -138,6 +139,9 @@ struct td_osdev {
 };
 
 int td_osdev_assign_name(const char *prefix, char* buffer, int size);
+/** same, also skipping names the caller reports as taken */
+int td_osdev_assign_name_unless(const char *prefix, char* buffer, int size,
+		int (*taken)(const char *name, void *opaque), void *opaque);
 int td_osdev_dump_names(enum td_osdev_type t, char *buf, size_t len, uint32_t *count);
 	
 
@@ -68,13 +68,6 @@ static void td_raid_update_member(struct td_raid *rdev, int member_idx,
 		struct td_device *dev);
 
 
-#define STATIC_ASSERT(expr)                                             \
-	switch (0) {                                                    \
-	case (expr):                                                    \
-	case 0:                                                         \
-		/* DO NOTHING */;                                        \
-	}
-
 /* Create a dump of raid metadata */
 static void __td_raid_fill_meta (struct td_raid *rdev, struct tr_meta_data_struct *md)
 {
@@ -22,12 +22,13 @@
 #include "td_stash.h"
 
 
-struct td_stash_info* td_stash_init (void *x, unsigned alloc_size, unsigned alloc_count)
+struct td_stash_info* td_stash_init (void *x, unsigned alloc_size, unsigned alloc_count,
+		int node)
 {
 	struct td_stash_info *info;
 	int i;
 
-	info = kzalloc(sizeof(struct td_stash_info), GFP_KERNEL);
+	info = kzalloc_node(sizeof(struct td_stash_info), GFP_KERNEL, node);
 	BUG_ON(info == NULL);
 
 	INIT_LIST_HEAD(&info->elem_free_list);
@@ -35,7 +36,8 @@ struct td_stash_info* td_stash_init (void *x, unsigned alloc_size, unsigned allo
 	info->alloc_count = 0;
 	
 	for (i = 0; i < alloc_count; i++) {
-		struct td_stash_element *elem = kzalloc(info->alloc_size, GFP_KERNEL);
+		struct td_stash_element *elem = kzalloc_node(info->alloc_size,
+				GFP_KERNEL, node);
 		if (elem) {
 			list_add(&elem->link, &info->elem_free_list);
 			elem->info = info;
@@ -50,7 +50,7 @@ struct td_stash_element {
 
 
 struct td_stash_info* td_stash_init (void *x,
-		unsigned alloc_size, unsigned alloc_count);
+		unsigned alloc_size, unsigned alloc_count, int node);
 
 void td_stash_destroy(void *x, struct td_stash_info *info);
 
@@ -80,7 +80,8 @@ static inline void td_stash_dealloc(void* payload)
 	struct td_stash_element *elem = container_of(payload, struct td_stash_element, payload);
 	struct td_stash_info *info = elem->info;
 
-	memset(elem, 0, info->alloc_size);
+	/* keep the link and info, the element is used again */
+	memset(elem->payload, 0, info->alloc_size - sizeof(*elem));
 
 	list_add(&elem->link, &info->elem_free_list);
 }
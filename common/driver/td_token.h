@@ -29,6 +29,7 @@
 
 struct page;
 struct td_ucmd;
+struct td_uring_req;
 struct td_engine;
 struct td_token;
 
@@ -95,15 +96,7 @@ enum td_token_result {
 
 struct td_token_ops {
 
-	/**
-	 * check for status change
-	 * @param tok - token with outstanding command
-	 * @return zero if there is no further work
-	 *
-	 * When returning true, indicating the token needs further work,
-	 * the caller will check tok->result to determine what to do next.
-	 */
-	int (*status_check)(struct td_token *tok);
+	/* status_check lives in struct td_token, next to the fields it polls */
 
 	/**
 	 * early commit (write only)
@@ -230,9 +223,28 @@ struct td_tok_hist {
 
 /**
  * a token represents a state of a command while it is active
+ *
+ * The first cache line holds everything the completion loop reads for a
+ * token whose status byte has not changed (see td_cmd_status_check() and
+ * td_lost_command_refresh()).  Command bytes, metadata, host buffers and
+ * the remaining ops live in the cold lines that follow, and are only
+ * touched when a command is started or its status changes.  The layout
+ * is checked at build time by td_token_layout_check().
  */
 struct td_token {
+	/* -- hot: completion polling -- */
 	struct td_engine    *td_engine;
+
+	/**
+	 * check for status change
+	 * @param tok - token with outstanding command
+	 * @return zero if there is no further work
+	 *
+	 * When returning true, indicating the token needs further work,
+	 * the caller will check tok->result to determine what to do next.
+	 */
+	int (*status_check)(struct td_token *tok);
+
 	uint16_t            tokid;          /**< this token's id */
 
 	uint16_t            core_bufid;     /**< core buffer ID */
@@ -251,7 +263,9 @@ struct td_token {
 			uint8_t meta_size:2;    /**< size of metadata. */
 		};
 	};
-	
+
+	uint8_t             last_status;    /**< last status read from h/w */
+
 	union {
 		/* grouped together so they can be cleared all at once */
 		uint16_t volatile_flags;
@@ -270,53 +284,60 @@ struct td_token {
 			uint16_t ooo_replay:1;   /**< waiting for OOO replay */
 			uint16_t ooo_missing:1;  /**< the missing token */
 			uint16_t safe_in_hw:1;   /**< the token has safely reached RUSH/FW */
+			uint16_t readahead:1;    /**< speculative read with no bio */
+			uint16_t zero_trim:1;    /**< all-zero write sent as a TRIM of its LBA */
+			uint16_t staged:1;       /**< writes out a staged LBA, the bio is the driver's */
 		};
 	};
 
+	int                 result;         /**< zero on success, negative error otherwise */
+
+	uint64_t            cmd_seq;        /**< command sequence, lower 16 bits passed to firmware */
+
+	cycles_t            last_cmd_issue;  /**< the last time the command was written to HW */
+	cycles_t            active_timeout; /**< timeout token at this point */
+
+	/* used for resets */
+	uint16_t            reset_count;    /**< number of resets sent in a row before giving up */
+	uint16_t            retry_count;    /**< number of retries attempted on this token */
+	uint16_t            timeout_count;  /**< number of timeouts on this token */
+	uint16_t            cmd_refresh_count; /**< number of times this command was written */
+
+	/* -- cold: command setup and completion -- */
+	uint64_t            cmd_bytes[8] __aligned64; /**< cmd bytes sent to TeraDiMM (64 bytes) */
+
+	uint64_t            cmd_metadata[16] __packed_aligned16; /**< metadata bytes (128 bytes) */
+
 	struct td_token     *sec_buddy;     /**< SEC buddy token, for double writes */
 	uint8_t             extra_wr_bufid; /**< TripleSEC write buffer (only 1st sec buddy) */
 
-	uint8_t             last_status;    /**< last status read from h/w */
-	uint64_t            last_xstatus;   /**< last xstatus read from h/w */
-
-	int                 result;         /**< zero on success, negative error otherwise */
+	uint16_t            cmd_issue_count; /**< number of replays this token had (badxsum,timeout, etc) */
 
 	uint16_t            len_host_to_dev; /**< amount of data to write out */
 	uint16_t            len_dev_to_host; /**< amount of data to read in */
 	uint16_t            lba_ofs;        /**< partial LBA access within a 4k block */
 
+	uint64_t            last_xstatus;   /**< last xstatus read from h/w */
+
 	uint64_t            lba;            /**< block hardware address (in conf.hw_sector_size units) */
 
 	uint64_t            data_xsum[2];   /**< used for write buffers */
 
-	uint64_t            cmd_seq;        /**< command sequence, lower 16 bits passed to firmware */
-
-	uint64_t            cmd_bytes[8] __packed_aligned16; /**< cmd bytes sent to TeraDiMM (64 bytes) */
-
-	uint64_t            cmd_metadata[16] __packed_aligned16; /**< metadata bytes (128 bytes) */
-
 	cycles_t            ts_start; /** < timestamp at start of bio */
 	cycles_t            ts_end;   /** < timestamp at end of bio   */
 
 	/* IO will use data in a bio (block) or ucmd (ioctl command) or page (kernel) */
 	struct {
 		td_bio_ref	    bio;   /**< used by block requests */
+		struct bio_list     coalesced; /**< more block requests written with bio */
 		struct td_ucmd      *ucmd;  /**< user command, from ioctl */
+		struct td_uring_req *ureq;  /**< user IO ring entry, no bio */
 		struct page         *page;  /**< kernel generated command */
 	} host;
 
 	void                *host_buf_virt; /**< pointer to ucmd->data_virt or page_address(tok->page) */
 
-	cycles_t            last_cmd_issue;  /**< the last time the command was written to HW */
-	cycles_t            active_timeout; /**< timeout token at this point */
-	struct list_head    link;           /**< on td_active_tokens or td_free_tokens */
-
-	/* used for resets */
-	uint16_t            reset_count;    /**< number of resets sent in a row before giving up */
-	uint16_t            retry_count;    /**< number of retries attempted on this token */
-	uint16_t            timeout_count;  /**< number of timeouts on this token */
-	uint16_t            cmd_issue_count; /**< number of replays this token had (badxsum,timeout, etc) */
-	uint16_t            cmd_refresh_count; /**< number of times this command was written */
+	struct list_head    link;           /**< on a local completion list, or td_early_completed_reads_tokens */
 
 #ifdef CONFIG_TERADIMM_TOKEN_HISTORY
 	struct td_tok_hist tok_hist[CONFIG_TERADIMM_TOKEN_HISTORY];
@@ -327,6 +348,18 @@ struct td_token {
 	struct td_token_ops ops;
 };
 
+/* everything read by the completion loop for an unchanged status */
+#define TD_TOKEN_HOT_BYTES      64
+
+/** build-time checks of the hot/cold split of struct td_token */
+static inline void td_token_layout_check(void)
+{
+	STATIC_ASSERT(offsetof(struct td_token, cmd_bytes) == TD_TOKEN_HOT_BYTES);
+	STATIC_ASSERT(offsetof(struct td_token, cmd_refresh_count)
+			+ sizeof(uint16_t) <= TD_TOKEN_HOT_BYTES);
+	STATIC_ASSERT((sizeof(struct td_token) % TD_TOKEN_HOT_BYTES) == 0);
+}
+
 enum td_tok_event {
 	TD_TOK_EVENT_START,
 	TD_TOK_EVENT_STATUS,
@@ -425,6 +458,7 @@ static inline void td_token_reset(struct td_token *tok)
 	tok->copy_ops = td_token_copy_ops_null;
 
 	/* reset all ops pointers */
+	tok->status_check = NULL;
 	memset(&tok->ops, 0, sizeof(tok->ops));
 
 	/* reset the command bytes */
@@ -469,13 +503,17 @@ static inline void td_token_migrate(struct td_token *tok, struct td_token *old)
 
 	/* copy over the buffer information */
 	tok->host.bio        = old->host.bio;
+	tok->host.coalesced  = old->host.coalesced;
 	tok->host.ucmd       = old->host.ucmd;
+	tok->host.ureq       = old->host.ureq;
 	tok->host.page       = old->host.page;
 	tok->host_buf_virt   = old->host_buf_virt;
 
 	/* buffers are no longer owned by the old token */
 	old->host.bio        = NULL;
+	bio_list_init(&old->host.coalesced);
 	old->host.ucmd       = NULL;
+	old->host.ureq       = NULL;
 	old->host.page       = NULL;
 	old->host_buf_virt   = NULL;
 
@@ -0,0 +1,213 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                                                                       *
+ *    Copyright (c) 2013 Diablo Technologies Inc. (Diablo).              *
+ *    All rights reserved.                                               *
+ *                                                                       *
+ *    This program is free software; you can redistribute it and/or      *
+ *    modify it under the terms of the GNU General Public License        *
+ *    as published by the Free Software Foundation; either version 2     *
+ *    of the License, or (at your option) any later version located at   *
+ *    <http://www.gnu.org/licenses/                                      *
+ *                                                                       *
+ *    This program is distributed WITHOUT ANY WARRANTY; without even     *
+ *    the implied warranty of MERCHANTABILITY or FITNESS FOR A           *
+ *    PARTICULAR PURPOSE.  See the GNU General Public License for        *
+ *    more details.                                                      *
+ *                                                                       *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef _TD_TOKEN_MAP_H_
+#define _TD_TOKEN_MAP_H_
+
+#include "td_kdefn.h"
+
+
+#include "td_compat.h"
+#include "td_defs.h"
+#include "td_limits.h"
+#include "td_bitmap.h"
+#include "td_token.h"
+
+/*
+ * A token map tracks membership of an engine's tokens in a pool (free,
+ * active, timedout, resumable) using one bit per token ID.  Unlike the
+ * td_token_list it does not touch tok->link, so moving a token between
+ * pools never dereferences neighbouring tokens, and testing for a
+ * specific token ID is a single bit test.
+ *
+ * Tokens are handed out starting at a cursor that advances past the last
+ * token dequeued.  This keeps the round-robin reuse the FIFO list gave;
+ * a push moves the cursor back so the token is the next one reused.
+ */
+struct td_token_map {
+	struct td_token         *tokens;        /* engine's td_tokens[] */
+#ifdef CONFIG_TD_TOKEN_LIST_LOCK
+	spinlock_t              lock;
+#endif
+	unsigned                count;
+	unsigned                next;           /* dequeue cursor */
+	DECLARE_BITMAP(map, TD_TOKENS_PER_DEV);
+};
+
+static inline void td_token_map_init(struct td_token_map *tm,
+		struct td_token *tokens)
+{
+	tm->tokens = tokens;
+	tm->count = 0;
+	tm->next = 0;
+	INIT_BITMAP(tm->map, TD_TOKENS_PER_DEV);
+
+#ifdef CONFIG_TD_TOKEN_LIST_LOCK
+	spin_lock_init(&tm->lock);
+#endif
+}
+
+
+/* token locking functions */
+
+static inline void td_tokmap_lock(struct td_token_map *tm)
+{
+#ifdef CONFIG_TD_TOKEN_LIST_LOCK
+	spin_lock_bh(&tm->lock);
+#endif
+}
+static inline void td_tokmap_unlock(struct td_token_map *tm)
+{
+#ifdef CONFIG_TD_TOKEN_LIST_LOCK
+	spin_unlock_bh(&tm->lock);
+#endif
+}
+
+/** true if token ID is in the map */
+static inline int td_tokmap_test(struct td_token_map *tm, unsigned tokid)
+{
+	return test_bit(tokid, tm->map);
+}
+
+/** dequeue the next token at or after the cursor (lock already held by caller) */
+static inline struct td_token *__td_tokmap_dequeue(struct td_token_map *tm)
+{
+	unsigned bit;
+
+	if (!tm->count)
+		return NULL;
+
+	bit = find_next_bit(tm->map, TD_TOKENS_PER_DEV, tm->next);
+	if (bit >= TD_TOKENS_PER_DEV)
+		bit = find_first_bit(tm->map, TD_TOKENS_PER_DEV);
+	if (unlikely (bit >= TD_TOKENS_PER_DEV))
+		return NULL;
+
+	__clear_bit(bit, tm->map);
+	tm->count --;
+	tm->next = bit + 1;
+
+	return tm->tokens + bit;
+}
+
+/** lock and dequeue from map */
+static inline struct td_token *td_tokmap_dequeue(struct td_token_map *tm)
+{
+	struct td_token *tok;
+
+	td_tokmap_lock(tm);
+
+	tok = __td_tokmap_dequeue(tm);
+
+	td_tokmap_unlock(tm);
+
+	return tok;
+}
+
+/** remove a specific token ID if it is in the map (lock already held by caller) */
+static inline struct td_token *__td_tokmap_take(struct td_token_map *tm,
+		unsigned tokid)
+{
+	if (tokid >= TD_TOKENS_PER_DEV || !test_bit(tokid, tm->map))
+		return NULL;
+
+	__clear_bit(tokid, tm->map);
+	tm->count --;
+
+	return tm->tokens + tokid;
+}
+
+/** add a token to the map (lock already held by caller) */
+static inline void __td_tokmap_enqueue(struct td_token_map *tm,
+		struct td_token *tok, int quick_reuse)
+{
+	unsigned bit = (unsigned)(tok - tm->tokens);
+
+	__set_bit(bit, tm->map);
+	tm->count ++;
+
+	if (quick_reuse)
+		tm->next = bit;
+}
+
+/** lock and add to map */
+static inline void td_tokmap_enqueue(struct td_token_map *tm,
+		struct td_token *tok)
+{
+	td_tokmap_lock(tm);
+	__td_tokmap_enqueue(tm, tok, 0);
+	td_tokmap_unlock(tm);
+}
+
+/** add a token to the map, making it the next one dequeued (lock already held by caller) */
+static inline void __td_tokmap_push(struct td_token_map *tm,
+		struct td_token *tok)
+{
+	__td_tokmap_enqueue(tm, tok, 1);
+}
+
+/** lock and push to map */
+static inline void td_tokmap_push(struct td_token_map *tm,
+		struct td_token *tok)
+{
+	td_tokmap_lock(tm);
+	__td_tokmap_push(tm, tok);
+	td_tokmap_unlock(tm);
+}
+
+/** remove an element already known to be in the map (lock already held by caller) */
+static inline void __td_tokmap_del(struct td_token_map *tm,
+		struct td_token *tok)
+{
+	__clear_bit((unsigned)(tok - tm->tokens), tm->map);
+	tm->count --;
+}
+
+/** lock and remove from map */
+static inline void td_tokmap_del(struct td_token_map *tm,
+		struct td_token *tok)
+{
+	td_tokmap_lock(tm);
+	__td_tokmap_del(tm, tok);
+	td_tokmap_unlock(tm);
+}
+
+/* iteration helpers, walk set bits in token ID order */
+
+static inline struct td_token *td_tokmap_first(struct td_token_map *tm)
+{
+	unsigned bit = find_first_bit(tm->map, TD_TOKENS_PER_DEV);
+	return bit < TD_TOKENS_PER_DEV ? tm->tokens + bit : NULL;
+}
+
+static inline struct td_token *td_tokmap_next(struct td_token_map *tm,
+		struct td_token *tok)
+{
+	unsigned bit = (unsigned)(tok - tm->tokens) + 1;
+
+	bit = find_next_bit(tm->map, TD_TOKENS_PER_DEV, bit);
+	return bit < TD_TOKENS_PER_DEV ? tm->tokens + bit : NULL;
+}
+
+/** traverse the token map; the current token may be removed from the map */
+#define for_each_token_map_token(_tok,_tokmap)                          \
+	for ((_tok) = td_tokmap_first(_tokmap); (_tok);                 \
+			(_tok) = td_tokmap_next((_tokmap), (_tok)))
+
+
+#endif
@@ -19,6 +19,10 @@
 #include "td_kdefn.h"
 
 #include <linux/types.h>
+#include <asm/uaccess.h>
+#ifdef KABI__eventfd_ctx_fdget
+#include <linux/eventfd.h>
+#endif
 
 #include "td_ucmd.h"
 #include "td_engine.h"
@@ -63,6 +67,32 @@ error_no_ucmd:
 
 
 
+int td_ucmd_check(struct td_engine *eng, struct td_ioctl_device_cmd_pt *cmd)
+{
+	if (!td_state_can_accept_requests(eng))
+		return -EIO;
+
+	/* if expecting to send data, pointer and length are required */
+	if (cmd->data_len_to_device
+			&& !(cmd->data_len_to_device <= PAGE_SIZE
+				&& cmd->data)) {
+		td_eng_err(eng, "UCMD: to len %u, data: %p\n",
+				cmd->data_len_to_device,
+				cmd->data);
+		return -EINVAL;
+	}
+	if (cmd->data_len_from_device
+			&& !(cmd->data_len_from_device <= PAGE_SIZE
+				&& cmd->data)) {
+		td_eng_err(eng, "UCMD from len  %u, data: %p\n",
+				cmd->data_len_from_device,
+				cmd->data);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
 int td_ucmd_map(struct td_ucmd *ucmd,
 		struct task_struct *task, unsigned long addr)
 {
@@ -137,3 +167,334 @@ int td_ucmd_run(struct td_ucmd *ucmd, struct td_engine *eng)
 }
 
 
+
+#ifdef CONFIG_TERADIMM_UCMD_ASYNC
+/*
+ * Asynchronous pass-through commands
+ *
+ * TD_IOCTL_DEVICE_CMD_PT_SUBMIT queues commands and returns without waiting
+ * for them.  Each holds a reference for the engine, dropped when it
+ * completes, and one for the open file that submitted it, dropped when
+ * TD_IOCTL_DEVICE_CMD_PT_REAP copies the result out or the file is closed.
+ * Whichever put comes last unmaps the user pages and returns the ucmd to
+ * the pool; that can be the engine's, from the worker that completed it.
+ * td_ucmd_async_exit() puts any that are still unreaped.
+ *
+ * ucmds come from a per-device pool, allocated on the device's node as
+ * needed up to TD_UCMD_ASYNC_MAX, and kept until the engine exits.
+ */
+
+void td_ucmd_free(struct td_ucmd *ucmd)
+{
+	struct td_engine *eng = ucmd->pool_eng;
+
+	if (!eng) {
+		kfree(ucmd);
+		return;
+	}
+
+#ifdef KABI__eventfd_ctx_fdget
+	if (ucmd->async_eventfd)
+		eventfd_ctx_put(ucmd->async_eventfd);
+#endif
+	ucmd->async_eventfd = NULL;
+
+	spin_lock_bh(&eng->td_ucmd_async_lock);
+	list_add(&ucmd->async_link, &eng->td_ucmd_pool);
+	spin_unlock_bh(&eng->td_ucmd_async_lock);
+}
+
+static struct td_ucmd *td_ucmd_pool_get(struct td_engine *eng)
+{
+	struct td_ucmd *ucmd = NULL;
+	int alloc = 0;
+
+	spin_lock_bh(&eng->td_ucmd_async_lock);
+	if (!list_empty(&eng->td_ucmd_pool)) {
+		ucmd = list_first_entry(&eng->td_ucmd_pool,
+				struct td_ucmd, async_link);
+		list_del(&ucmd->async_link);
+	} else if (eng->td_ucmd_pool_count < TD_UCMD_ASYNC_MAX) {
+		eng->td_ucmd_pool_count ++;
+		alloc = 1;
+	}
+	spin_unlock_bh(&eng->td_ucmd_async_lock);
+
+	if (!alloc)
+		return ucmd;
+
+	ucmd = kzalloc_node(sizeof(*ucmd), GFP_KERNEL,
+			td_engine_node(eng));
+	if (!ucmd) {
+		spin_lock_bh(&eng->td_ucmd_async_lock);
+		eng->td_ucmd_pool_count --;
+		spin_unlock_bh(&eng->td_ucmd_async_lock);
+		return NULL;
+	}
+
+	eng->td_counters.misc.ucmd_pool_alloc_cnt ++;
+	return ucmd;
+}
+
+/* first completed command of an open file, taken off the done list */
+static struct td_ucmd *td_ucmd_async_pop(struct td_engine *eng,
+		struct file *filp)
+{
+	struct td_ucmd *ucmd;
+
+	spin_lock_bh(&eng->td_ucmd_async_lock);
+	list_for_each_entry(ucmd, &eng->td_ucmd_async_done, async_link) {
+		if (ucmd->async_owner != filp)
+			continue;
+
+		list_del(&ucmd->async_link);
+		spin_unlock_bh(&eng->td_ucmd_async_lock);
+		return ucmd;
+	}
+	spin_unlock_bh(&eng->td_ucmd_async_lock);
+
+	return NULL;
+}
+
+static int td_ucmd_async_owns(struct td_engine *eng, struct list_head *list,
+		struct file *filp)
+{
+	struct td_ucmd *ucmd;
+	int found = 0;
+
+	spin_lock_bh(&eng->td_ucmd_async_lock);
+	list_for_each_entry(ucmd, list, async_link) {
+		if (ucmd->async_owner == filp) {
+			found = 1;
+			break;
+		}
+	}
+	spin_unlock_bh(&eng->td_ucmd_async_lock);
+
+	return found;
+}
+
+void td_ucmd_async_done(struct td_ucmd *ucmd)
+{
+	struct td_engine *eng = ucmd->pool_eng;
+	int orphan;
+
+	spin_lock_bh(&eng->td_ucmd_async_lock);
+	orphan = !ucmd->async_owner;
+	if (orphan) {
+		/* the file was closed, drop its reference for it; the
+		 * engine still holds one */
+		list_del(&ucmd->async_link);
+		atomic_dec(&ucmd->ref);
+	} else
+		list_move_tail(&ucmd->async_link, &eng->td_ucmd_async_done);
+	spin_unlock_bh(&eng->td_ucmd_async_lock);
+
+	if (orphan)
+		return;
+
+#ifdef KABI__eventfd_ctx_fdget
+	/* only the last put drops the eventfd, and the engine holds one */
+	if (ucmd->async_eventfd)
+		eventfd_signal(ucmd->async_eventfd, 1);
+#endif
+
+	/* both reap and release sleep here, release uninterruptibly */
+	wake_up(&eng->td_ucmd_async_wq);
+}
+
+int td_ucmd_async_submit(struct td_engine *eng, struct file *filp,
+		struct td_ioctl_device_cmd_pt_submit *submit)
+{
+	struct td_ioctl_device_cmd_pt_async __user *u_cmds = submit->cmds;
+	struct td_ioctl_device_cmd_pt_async k_cmd;
+	struct eventfd_ctx *efd = NULL;
+	struct td_ucmd *ucmd;
+	uint32_t i;
+	int rc = 0;
+
+	if (submit->eventfd >= 0) {
+#ifdef KABI__eventfd_ctx_fdget
+		efd = eventfd_ctx_fdget(submit->eventfd);
+		if (IS_ERR(efd))
+			return PTR_ERR(efd);
+#else
+		return -EINVAL;
+#endif
+	}
+
+	for (i = 0; i < submit->count; i++) {
+		if (copy_from_user(&k_cmd, u_cmds + i, sizeof(k_cmd))) {
+			rc = -EFAULT;
+			break;
+		}
+
+		rc = td_ucmd_check(eng, &k_cmd.cmd);
+		if (rc)
+			break;
+
+		ucmd = td_ucmd_pool_get(eng);
+		if (!ucmd) {
+			rc = -EAGAIN;
+			break;
+		}
+
+		memcpy(&ucmd->ioctl, &k_cmd.cmd, sizeof(ucmd->ioctl));
+		td_ucmd_init(ucmd);
+
+		ucmd->pool_eng        = eng;
+		ucmd->async           = 1;
+		ucmd->async_owner     = filp;
+		ucmd->async_user_data = k_cmd.user_data;
+
+		if (unlikely(eng->locker_context == current))
+			ucmd->locked = 1;
+
+		if (ucmd->ioctl.data) {
+			rc = td_ucmd_map(ucmd, current,
+					(unsigned long)ucmd->ioctl.data);
+			if (rc) {
+				td_ucmd_put(ucmd);
+				break;
+			}
+		}
+
+#ifdef KABI__eventfd_ctx_fdget
+		if (efd) {
+			eventfd_ctx_get(efd);
+			ucmd->async_eventfd = efd;
+		}
+#endif
+
+		ucmd->ioctl.cycles.ioctl.start = td_get_cycles();
+
+		spin_lock_bh(&eng->td_ucmd_async_lock);
+		list_add_tail(&ucmd->async_link, &eng->td_ucmd_async_busy);
+		spin_unlock_bh(&eng->td_ucmd_async_lock);
+
+		/* the engine gets a reference, the open file keeps the other */
+		td_ucmd_ready(ucmd);
+		td_ucmd_get(ucmd);
+		td_enqueue_ucmd(eng, ucmd);
+
+		eng->td_counters.misc.ucmd_async_cnt ++;
+	}
+
+#ifdef KABI__eventfd_ctx_fdget
+	if (efd)
+		eventfd_ctx_put(efd);
+#endif
+
+	/* one poke for the whole batch */
+	if (i)
+		td_engine_poke(eng);
+
+	submit->count = i;
+	return i ? (int)i : rc;
+}
+
+int td_ucmd_async_reap(struct td_engine *eng, struct file *filp,
+		struct td_ioctl_device_cmd_pt_reap *reap)
+{
+	struct td_ioctl_device_cmd_pt_async __user *u_cmds = reap->cmds;
+	struct td_ioctl_device_cmd_pt_async k_cmd;
+	struct td_ucmd *ucmd;
+	uint32_t want = min(reap->min_complete, reap->count);
+	uint32_t got = 0;
+	long left = msecs_to_jiffies(reap->timeout_msec);
+	int rc = 0;
+
+	while (got < reap->count) {
+		ucmd = td_ucmd_async_pop(eng, filp);
+		if (!ucmd) {
+			if (got >= want || !left)
+				break;
+
+			left = wait_event_interruptible_timeout(
+					eng->td_ucmd_async_wq,
+					td_ucmd_async_owns(eng,
+						&eng->td_ucmd_async_done, filp),
+					left);
+			if (left < 0) {
+				rc = (int)left;
+				break;
+			}
+			continue;
+		}
+
+		ucmd->ioctl.cycles.ioctl.end = td_get_cycles();
+
+		k_cmd.user_data = ucmd->async_user_data;
+		memcpy(&k_cmd.cmd, &ucmd->ioctl, sizeof(k_cmd.cmd));
+
+		if (copy_to_user(u_cmds + got, &k_cmd, sizeof(k_cmd))) {
+			/* leave it for the next reap */
+			spin_lock_bh(&eng->td_ucmd_async_lock);
+			list_add(&ucmd->async_link, &eng->td_ucmd_async_done);
+			spin_unlock_bh(&eng->td_ucmd_async_lock);
+			rc = -EFAULT;
+			break;
+		}
+
+		/* drop the file's reference; the engine may still hold its
+		 * own, and the last put frees it */
+		td_ucmd_put(ucmd);
+		got ++;
+	}
+
+	reap->count = got;
+	return got ? (int)got : rc;
+}
+
+void td_ucmd_async_release(struct td_engine *eng, struct file *filp)
+{
+	struct td_ucmd *ucmd;
+
+	/* same limit td_ucmd_wait() puts on a synchronous command */
+	wait_event_timeout(eng->td_ucmd_async_wq,
+			!td_ucmd_async_owns(eng, &eng->td_ucmd_async_busy,
+				filp), 60*HZ);
+
+	/* anything still running is dropped when it completes */
+	spin_lock_bh(&eng->td_ucmd_async_lock);
+	list_for_each_entry(ucmd, &eng->td_ucmd_async_busy, async_link) {
+		if (ucmd->async_owner == filp)
+			ucmd->async_owner = NULL;
+	}
+	spin_unlock_bh(&eng->td_ucmd_async_lock);
+
+	while ((ucmd = td_ucmd_async_pop(eng, filp)))
+		td_ucmd_put(ucmd);
+}
+
+void td_ucmd_async_init(struct td_engine *eng)
+{
+	spin_lock_init(&eng->td_ucmd_async_lock);
+	INIT_LIST_HEAD(&eng->td_ucmd_pool);
+	eng->td_ucmd_pool_count = 0;
+	INIT_LIST_HEAD(&eng->td_ucmd_async_busy);
+	INIT_LIST_HEAD(&eng->td_ucmd_async_done);
+	init_waitqueue_head(&eng->td_ucmd_async_wq);
+}
+
+void td_ucmd_async_exit(struct td_engine *eng)
+{
+	struct td_ucmd *ucmd, *nxt;
+
+	/* completed, but never reaped; the last put returns each to the
+	 * pool, which is freed below */
+	list_for_each_entry_safe(ucmd, nxt, &eng->td_ucmd_async_done,
+			async_link) {
+		list_del(&ucmd->async_link);
+		td_ucmd_put(ucmd);
+	}
+
+	list_for_each_entry_safe(ucmd, nxt, &eng->td_ucmd_pool, async_link) {
+		list_del(&ucmd->async_link);
+		kfree(ucmd);
+		eng->td_ucmd_pool_count --;
+	}
+
+	WARN_ON(eng->td_ucmd_pool_count);
+}
+#endif
@@ -26,6 +26,8 @@
 #include "td_util.h"
 
 struct td_engine;
+struct file;
+struct eventfd_ctx;
 
 struct td_ucmd {
 	/* this must be first in the structure */
@@ -43,14 +45,27 @@ struct td_ucmd {
 		struct {
 			uint8_t hw_cmd:1;
 			uint8_t locked:1;
+			uint8_t async:1;
 		};
 	};
 	struct task_struct *user_task;
+
+#ifdef CONFIG_TERADIMM_UCMD_ASYNC
+	/* set after td_ucmd_init() for asynchronous commands */
+	struct td_engine         *pool_eng;      /**< returned to its pool when freed */
+	struct file              *async_owner;   /**< reaped only by this open file */
+	uint64_t                 async_user_data;
+	struct eventfd_ctx       *async_eventfd;
+	struct list_head         async_link;     /**< on the busy or done list */
+#endif
 };
 
 void td_ucmd_init(struct td_ucmd *ucmd);
 struct td_ucmd* td_ucmd_alloc(int virt_size);
 
+/** validate a pass-through command from user space */
+int td_ucmd_check(struct td_engine *eng, struct td_ioctl_device_cmd_pt *cmd);
+
 
 static inline void td_ucmd_ready(struct td_ucmd *ucmd)
 {
@@ -67,11 +82,39 @@ static inline void td_ucmd_get(struct td_ucmd *ucmd)
 	atomic_inc(&ucmd->ref);
 }
 
+#ifdef CONFIG_TERADIMM_UCMD_ASYNC
+/** free a ucmd, or return it to the pool it came from */
+void td_ucmd_free(struct td_ucmd *ucmd);
+
+/** move a completed asynchronous ucmd to the done list */
+void td_ucmd_async_done(struct td_ucmd *ucmd);
+
+void td_ucmd_async_init(struct td_engine *eng);
+void td_ucmd_async_exit(struct td_engine *eng);
+
+/** queue commands for an open file, returns number queued or error */
+int td_ucmd_async_submit(struct td_engine *eng, struct file *filp,
+		struct td_ioctl_device_cmd_pt_submit *submit);
+
+/** collect completed commands of an open file, returns number reaped or error */
+int td_ucmd_async_reap(struct td_engine *eng, struct file *filp,
+		struct td_ioctl_device_cmd_pt_reap *reap);
+
+/** wait for the commands of an open file, and drop them */
+void td_ucmd_async_release(struct td_engine *eng, struct file *filp);
+#else
+#define td_ucmd_free(ucmd) kfree(ucmd)
+#define td_ucmd_async_done(ucmd) do { /* nothing */ } while(0)
+#define td_ucmd_async_init(eng) do { /* nothing */ } while(0)
+#define td_ucmd_async_exit(eng) do { /* nothing */ } while(0)
+#define td_ucmd_async_release(eng,filp) do { /* nothing */ } while(0)
+#endif
+
 static inline void td_ucmd_put(struct td_ucmd *ucmd)
 {
 	if (atomic_dec_and_test(&ucmd->ref)) {
 		td_ucmd_unmap(ucmd);
-		kfree(ucmd);
+		td_ucmd_free(ucmd);
 	}
 }
 
@@ -86,6 +129,12 @@ static inline void td_ucmd_ending(struct td_ucmd *ucmd, int result)
 	ucmd->ioctl.result        = result;
 
 	mb();
+
+	/* nobody waits on these, they are reaped from the done list */
+	if (ucmd->async) {
+		td_ucmd_async_done(ucmd);
+		return;
+	}
 	
 	/* wake up any td_ucmd_wait() callers */
 	wake_up_interruptible(&ucmd->wq);
@@ -0,0 +1,165 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                                                                       *
+ *    Copyright (c) 2013 Diablo Technologies Inc. (Diablo).              *
+ *    All rights reserved.                                               *
+ *                                                                       *
+ *    This program is free software; you can redistribute it and/or      *
+ *    modify it under the terms of the GNU General Public License        *
+ *    as published by the Free Software Foundation; either version 2     *
+ *    of the License, or (at your option) any later version located at   *
+ *    <http://www.gnu.org/licenses/                                      *
+ *                                                                       *
+ *    This program is distributed WITHOUT ANY WARRANTY; without even     *
+ *    the implied warranty of MERCHANTABILITY or FITNESS FOR A           *
+ *    PARTICULAR PURPOSE.  See the GNU General Public License for        *
+ *    more details.                                                      *
+ *                                                                       *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifdef __KERNEL__
+#include "td_kdefn.h"
+#include <linux/slab.h>
+#else
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#define kmalloc(size, gfp) malloc(size)
+#define kfree free
+#define pr_info printf
+#define pr_err printf
+#endif
+
+#include "td_checksum.h"
+
+#ifdef CONFIG_TERADIMM_CHECKSUM128_SIMD
+
+/* scalar code is used until td_checksum_selftest() says otherwise */
+int td_checksum128_simd = 0;
+
+/* covers lengths up to two 4k blocks, and the 32 byte round up slack */
+#define TD_XSUM_TEST_MAX        (2 * 4096)
+#define TD_XSUM_TEST_BUF        (TD_XSUM_TEST_MAX + 64 + 8)
+
+static const uint64_t td_xsum_test_seeds[][2] = {
+	{ 0, 0 },
+	{ 0x0123456789abcdefULL, 0xfedcba9876543210ULL },
+	{ ~0ULL, ~0ULL },
+};
+
+#define TD_XSUM_TEST_SEED_COUNT \
+	(sizeof(td_xsum_test_seeds) / sizeof(td_xsum_test_seeds[0]))
+
+enum td_xsum_pattern {
+	TD_XSUM_PATTERN_RANDOM,
+	TD_XSUM_PATTERN_ONES,      /* every add carries out */
+	TD_XSUM_PATTERN_INDEX,     /* catches lanes folded in the wrong order */
+	TD_XSUM_PATTERN_MAX
+};
+
+static void td_xsum_test_fill(uint64_t *buf, unsigned words,
+		enum td_xsum_pattern pattern)
+{
+	uint64_t x = 0x9e3779b97f4a7c15ULL;
+	unsigned i;
+
+	for (i = 0; i < words; i++) {
+		switch (pattern) {
+		case TD_XSUM_PATTERN_RANDOM:
+			/* xorshift64 */
+			x ^= x << 13;
+			x ^= x >> 7;
+			x ^= x << 17;
+			buf[i] = x;
+			break;
+		case TD_XSUM_PATTERN_ONES:
+			buf[i] = ~0ULL;
+			break;
+		default:
+			buf[i] = ((uint64_t)i << 56) | i;
+			break;
+		}
+	}
+}
+
+/*
+ * Run every 8 byte multiple length up to TD_XSUM_TEST_MAX, on aligned and
+ * misaligned buffers, through both the dispatching td_checksum128{,_be}()
+ * and the scalar reference.
+ */
+static int td_checksum128_compare(const uint64_t *buf)
+{
+	uint64_t a[2], b[2];
+	unsigned len, s, ofs;
+	int be;
+
+	for (be = 0; be < 2; be++)
+	for (ofs = 0; ofs <= 8; ofs += 8)
+	for (s = 0; s < TD_XSUM_TEST_SEED_COUNT; s++)
+	for (len = 8; len <= TD_XSUM_TEST_MAX; len += 8) {
+		const char *src = (const char*)buf + ofs;
+
+		a[0] = b[0] = td_xsum_test_seeds[s][0];
+		a[1] = b[1] = td_xsum_test_seeds[s][1];
+
+		if (be) {
+			td_checksum128_be(src, len, a);
+			__td_checksum128_be(src, len, b);
+		} else {
+			td_checksum128(src, len, a);
+			__td_checksum128(src, len, b);
+		}
+
+		if (a[0] != b[0] || a[1] != b[1]) {
+			pr_err("checksum128%s mismatch len %u ofs %u seed %u\n",
+					be ? "_be" : "", len, ofs, s);
+			return -EIO;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Check the SIMD fletcher checksum against the scalar code and enable it
+ * only if the results are identical.  A mismatch leaves the scalar code in
+ * place; only fails if the test buffer cannot be allocated.
+ */
+int td_checksum_selftest(void)
+{
+	enum td_xsum_pattern pattern;
+	uint64_t *buf;
+	int rc = 0;
+
+	buf = kmalloc(TD_XSUM_TEST_BUF, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+
+	td_checksum128_simd = 1;
+
+	for (pattern = 0; pattern < TD_XSUM_PATTERN_MAX; pattern++) {
+		td_xsum_test_fill(buf, TD_XSUM_TEST_BUF / 8, pattern);
+
+		rc = td_checksum128_compare(buf);
+		if (rc)
+			break;
+	}
+
+	if (rc) {
+		td_checksum128_simd = 0;
+		pr_err("checksum128 SIMD failed self test, using scalar\n");
+	} else
+		pr_info("checksum128 using SIMD implementation\n");
+
+	kfree(buf);
+	return 0;
+}
+
+#else
+
+int td_checksum_selftest(void)
+{
+	return 0;
+}
+
+#endif
@@ -21,10 +21,18 @@
 #ifdef __KERNEL__
 #include <linux/types.h>
 #include <asm/byteorder.h>
+#include <asm/i387.h>
 #else
 #include <stdint.h>
 #include <endian.h>
 #define cpu_to_be64 htobe64
+#ifndef kernel_fpu_begin
+#define kernel_fpu_begin() do{}while(0)
+#define kernel_fpu_end() do{}while(0)
+#endif
+#ifndef irq_fpu_usable
+#define irq_fpu_usable() 1
+#endif
 #endif
 
 /**
@@ -57,8 +65,11 @@ static inline void td_checksum128_advance_zeroed(uint64_t *xsum, unsigned bytes)
 }
 
 /** 
- * \brief compute a host endianness fletcher checksum 
+ * \brief compute a host endianness fletcher checksum (scalar)
  * 
+ * This is the reference implementation; td_checksum128() hands long
+ * buffers to the SIMD version instead.
+ *
  * @param data    - pointer to data buffer
  * @param len     - length in bytes, assume to be multiple of 8
  * @param xsum[2] - pointer to uint64_t[2] where the fletcher checksum is stored
@@ -69,7 +80,7 @@ static inline void td_checksum128_advance_zeroed(uint64_t *xsum, unsigned bytes)
  * NOTE: overflow is ignored in checksum128
  */
 #ifdef CONFIG_TERADIMM_CHECKSUM128_C
-static inline void td_checksum128(const void *data, unsigned len,
+static inline void __td_checksum128(const void *data, unsigned len,
 		uint64_t *xsum)
 {
 	uint64_t val;
@@ -85,7 +96,7 @@ static inline void td_checksum128(const void *data, unsigned len,
 }
 #else
 
-static inline void td_checksum128(const void *src, unsigned len,
+static inline void __td_checksum128(const void *src, unsigned len,
 		uint64_t *xsum)
 {
 	register uint64_t t1=0, t2=0, t3=0, t4=0;
@@ -128,7 +139,7 @@ static inline void td_checksum128(const void *src, unsigned len,
 #endif
 
 /** 
- * \brief compute a big-endian fletcher checksum 
+ * \brief compute a big-endian fletcher checksum (scalar)
  * 
  * @param data    - pointer to data buffer
  * @param len     - length in bytes, assume to be multiple of 8
@@ -140,7 +151,7 @@ static inline void td_checksum128(const void *src, unsigned len,
  * NOTE: overflow is ignored in checksum128
  */
 #ifdef CONFIG_TERADIMM_CHECKSUM128_C
-static inline void td_checksum128_be(const void *data, unsigned len,
+static inline void __td_checksum128_be(const void *data, unsigned len,
 		uint64_t *xsum)
 {
 	uint64_t val;
@@ -155,7 +166,7 @@ static inline void td_checksum128_be(const void *data, unsigned len,
 	}
 }
 #else
-static inline void td_checksum128_be(const void *src, unsigned len,
+static inline void __td_checksum128_be(const void *src, unsigned len,
 		uint64_t *xsum)
 {
 	register uint64_t t1=0, t2=0, t3=0, t4=0;
@@ -202,6 +213,269 @@ static inline void td_checksum128_be(const void *src, unsigned len,
 }
 #endif
 
+#ifdef CONFIG_TERADIMM_CHECKSUM128_SIMD
+
+/* set by td_checksum_selftest() once the SIMD code matches the scalar code */
+extern int td_checksum128_simd;
+
+/* below this the FPU save/restore costs more than the SIMD loop saves */
+#ifdef __KERNEL__
+#define TD_CHECKSUM128_SIMD_MIN 512
+#else
+#define TD_CHECKSUM128_SIMD_MIN 64
+#endif
+
+#define TD_CHECKSUM128_LANES    8
+
+/* swap the bytes of each qword in an xmm register, SSE2 has no pshufb */
+#define TD_XSUM_BSWAPQ(x, t)                                            \
+		"pshuflw $0x1b,         %%" x ",  %%" x "    \n"        \
+		"pshufhw $0x1b,         %%" x ",  %%" x "    \n"        \
+		"movdqa  %%" x ",       %%" t "              \n"        \
+		"psrlw   $8,            %%" x "              \n"        \
+		"psllw   $8,            %%" t "              \n"        \
+		"por     %%" t ",       %%" x "              \n"
+
+/**
+ * \brief run a fletcher checksum over 8 interleaved qword lanes
+ *
+ * @param src     - pointer to data buffer
+ * @param len     - length in bytes, non-zero multiple of 64
+ * @param sum     - per lane sum of the data words
+ * @param sumsum  - per lane running sum of sum
+ * @param be      - byte swap the words first
+ *
+ * Lane k sees every 8th word starting at word k.  Each lane is an
+ * independent fletcher checksum, so the adds are not serialized behind
+ * one another the way they are in the scalar loop.
+ *
+ * Caller must hold the FPU.
+ */
+static inline void td_checksum128_lanes(const void *src, unsigned len,
+		uint64_t *sum, uint64_t *sumsum, int be)
+{
+	if (be) {
+		__asm__ __volatile__ (
+		"pxor    %%xmm4,        %%xmm4        \n"
+		"pxor    %%xmm5,        %%xmm5        \n"
+		"pxor    %%xmm6,        %%xmm6        \n"
+		"pxor    %%xmm7,        %%xmm7        \n"
+		"pxor    %%xmm8,        %%xmm8        \n"
+		"pxor    %%xmm9,        %%xmm9        \n"
+		"pxor    %%xmm10,       %%xmm10       \n"
+		"pxor    %%xmm11,       %%xmm11       \n"
+		"                                     \n"
+		"1:                                   \n"
+		"                                     \n"
+		"movdqu  0*16(%[src]),  %%xmm0        \n"
+		"movdqu  1*16(%[src]),  %%xmm1        \n"
+		"movdqu  2*16(%[src]),  %%xmm2        \n"
+		"movdqu  3*16(%[src]),  %%xmm3        \n"
+		"                                     \n"
+		TD_XSUM_BSWAPQ("xmm0", "xmm12")
+		TD_XSUM_BSWAPQ("xmm1", "xmm13")
+		TD_XSUM_BSWAPQ("xmm2", "xmm14")
+		TD_XSUM_BSWAPQ("xmm3", "xmm15")
+		"                                     \n"
+		"leaq    4*16(%[src]),  %[src]        \n"
+		"                                     \n"
+		"paddq   %%xmm0,        %%xmm4        \n"
+		"paddq   %%xmm1,        %%xmm5        \n"
+		"paddq   %%xmm2,        %%xmm6        \n"
+		"paddq   %%xmm3,        %%xmm7        \n"
+		"paddq   %%xmm4,        %%xmm8        \n"
+		"paddq   %%xmm5,        %%xmm9        \n"
+		"paddq   %%xmm6,        %%xmm10       \n"
+		"paddq   %%xmm7,        %%xmm11       \n"
+		"                                     \n"
+		"subl    $64,           %[len]        \n" // 4 * 16 == 64
+		"jnz     1b                           \n"
+		"                                     \n"
+		"movdqu  %%xmm4,        0*16(%[sum])  \n"
+		"movdqu  %%xmm5,        1*16(%[sum])  \n"
+		"movdqu  %%xmm6,        2*16(%[sum])  \n"
+		"movdqu  %%xmm7,        3*16(%[sum])  \n"
+		"movdqu  %%xmm8,        0*16(%[ss])   \n"
+		"movdqu  %%xmm9,        1*16(%[ss])   \n"
+		"movdqu  %%xmm10,       2*16(%[ss])   \n"
+		"movdqu  %%xmm11,       3*16(%[ss])   \n"
+		: [src]"+r"(src), [len]"+r"(len)
+		: [sum]"r"(sum), [ss]"r"(sumsum)
+		: "memory", "cc", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4",
+		  "xmm5", "xmm6", "xmm7", "xmm8", "xmm9", "xmm10", "xmm11",
+		  "xmm12", "xmm13", "xmm14", "xmm15"
+		);
+		return;
+	}
+
+	__asm__ __volatile__ (
+		"pxor    %%xmm4,        %%xmm4        \n"
+		"pxor    %%xmm5,        %%xmm5        \n"
+		"pxor    %%xmm6,        %%xmm6        \n"
+		"pxor    %%xmm7,        %%xmm7        \n"
+		"pxor    %%xmm8,        %%xmm8        \n"
+		"pxor    %%xmm9,        %%xmm9        \n"
+		"pxor    %%xmm10,       %%xmm10       \n"
+		"pxor    %%xmm11,       %%xmm11       \n"
+		"                                     \n"
+		"1:                                   \n"
+		"                                     \n"
+		"movdqu  0*16(%[src]),  %%xmm0        \n"
+		"movdqu  1*16(%[src]),  %%xmm1        \n"
+		"movdqu  2*16(%[src]),  %%xmm2        \n"
+		"movdqu  3*16(%[src]),  %%xmm3        \n"
+		"                                     \n"
+		"leaq    4*16(%[src]),  %[src]        \n"
+		"                                     \n"
+		"paddq   %%xmm0,        %%xmm4        \n"
+		"paddq   %%xmm1,        %%xmm5        \n"
+		"paddq   %%xmm2,        %%xmm6        \n"
+		"paddq   %%xmm3,        %%xmm7        \n"
+		"paddq   %%xmm4,        %%xmm8        \n"
+		"paddq   %%xmm5,        %%xmm9        \n"
+		"paddq   %%xmm6,        %%xmm10       \n"
+		"paddq   %%xmm7,        %%xmm11       \n"
+		"                                     \n"
+		"subl    $64,           %[len]        \n" // 4 * 16 == 64
+		"jnz     1b                           \n"
+		"                                     \n"
+		"movdqu  %%xmm4,        0*16(%[sum])  \n"
+		"movdqu  %%xmm5,        1*16(%[sum])  \n"
+		"movdqu  %%xmm6,        2*16(%[sum])  \n"
+		"movdqu  %%xmm7,        3*16(%[sum])  \n"
+		"movdqu  %%xmm8,        0*16(%[ss])   \n"
+		"movdqu  %%xmm9,        1*16(%[ss])   \n"
+		"movdqu  %%xmm10,       2*16(%[ss])   \n"
+		"movdqu  %%xmm11,       3*16(%[ss])   \n"
+		: [src]"+r"(src), [len]"+r"(len)
+		: [sum]"r"(sum), [ss]"r"(sumsum)
+		: "memory", "cc", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4",
+		  "xmm5", "xmm6", "xmm7", "xmm8", "xmm9", "xmm10", "xmm11"
+		);
+}
+
+/**
+ * \brief fold the lanes back into a single fletcher checksum
+ *
+ * For n words w[0..n-1] the scalar loop produces
+ *
+ *   xsum[0] += sum(w[i])
+ *   xsum[1] += n * xsum[0] + sum((n - i) * w[i])
+ *
+ * With n = 8m, word i = 8j + k lives in lane k, and the lane's running
+ * sum weighs it by (m - j), so (n - i) = 8 * (m - j) - k gives
+ *
+ *   sum((n - i) * w[i]) = 8 * sum(sumsum[k]) - sum(k * sum[k])
+ *
+ * Everything is modulo 2^64, exactly like the scalar code, so the
+ * result is bit identical.
+ */
+static inline void td_checksum128_fold(uint64_t *xsum, unsigned len,
+		const uint64_t *sum, const uint64_t *sumsum)
+{
+	uint64_t s = 0, ss = 0, ks = 0;
+	unsigned k;
+
+	for (k = 0; k < TD_CHECKSUM128_LANES; k++) {
+		s += sum[k];
+		ss += sumsum[k];
+		ks += k * sum[k];
+	}
+
+	xsum[1] += (uint64_t)(len / 8) * xsum[0]
+		+ TD_CHECKSUM128_LANES * ss - ks;
+	xsum[0] += s;
+}
+
+/**
+ * \brief SIMD fletcher checksum of the 64 byte aligned head of a buffer
+ *
+ * @return number of bytes consumed, the caller finishes the rest
+ */
+static inline unsigned td_checksum128_simd_head(const void *src,
+		unsigned len, uint64_t *xsum, int be)
+{
+	uint64_t sum[TD_CHECKSUM128_LANES];
+	uint64_t sumsum[TD_CHECKSUM128_LANES];
+
+	if (!td_checksum128_simd || len < TD_CHECKSUM128_SIMD_MIN
+			|| !irq_fpu_usable())
+		return 0;
+
+	len &= ~63;
+
+	kernel_fpu_begin();
+	td_checksum128_lanes(src, len, sum, sumsum, be);
+	kernel_fpu_end();
+
+	td_checksum128_fold(xsum, len, sum, sumsum);
+	return len;
+}
+
+#else
+#define td_checksum128_simd_head(src, len, xsum, be) 0
+#endif
+
+/** 
+ * \brief compute a host endianness fletcher checksum 
+ * 
+ * @param data    - pointer to data buffer
+ * @param len     - length in bytes, assume to be multiple of 8
+ * @param xsum[2] - pointer to uint64_t[2] where the fletcher checksum is stored
+ *
+ * NOTE: the initial state of xsum[2] is the seed of the checksum.  On first
+ * call that should be set to {0,0}.
+ *
+ * NOTE: overflow is ignored in checksum128
+ */
+static inline void td_checksum128(const void *src, unsigned len,
+		uint64_t *xsum)
+{
+	unsigned done = td_checksum128_simd_head(src, len, xsum, 0);
+
+	if (done) {
+		if (done == len)
+			return;
+		src = (const char*)src + done;
+		len -= done;
+	}
+
+	__td_checksum128(src, len, xsum);
+}
+
+/** 
+ * \brief compute a big-endian fletcher checksum 
+ * 
+ * @param data    - pointer to data buffer
+ * @param len     - length in bytes, assume to be multiple of 8
+ * @param xsum[2] - pointer to uint64_t[2] where the fletcher checksum is stored
+ *
+ * NOTE: the initial state of xsum[2] is the seed of the checksum.  On first
+ * call that should be set to {0,0}.
+ *
+ * NOTE: overflow is ignored in checksum128
+ */
+static inline void td_checksum128_be(const void *src, unsigned len,
+		uint64_t *xsum)
+{
+	unsigned done = td_checksum128_simd_head(src, len, xsum, 1);
+
+	if (done) {
+		if (done == len)
+			return;
+		src = (const char*)src + done;
+		len -= done;
+	}
+
+	__td_checksum128_be(src, len, xsum);
+}
+
+/*
+ * td_checksum64() folds carries back in once per 32 bytes and drops the
+ * carry of that fold, so it is not associative and cannot be split into
+ * lanes without changing its result; it stays scalar.
+ */
+
 static inline void td_checksum64(const void *src, unsigned len,
 		uint64_t *xsum)
 {
@@ -288,4 +562,6 @@ static inline void td_checksum64_be(const void *src, unsigned len,
 }
 
 
+extern int td_checksum_selftest(void);
+
 #endif
@@ -154,6 +154,16 @@ extern void td_compat_iounmap(void *vptr);
 #define __aligned64 __attribute__((aligned(64)))
 #endif
 
+/** compile time assertion, usable inside a function body */
+#ifndef STATIC_ASSERT
+#define STATIC_ASSERT(expr)                                             \
+	switch (0) {                                                    \
+	case (expr):                                                    \
+	case 0:                                                         \
+		/* DO NOTHING */;                                        \
+	}
+#endif
+
 #ifndef likely                                                                 
 #define likely(x) __builtin_expect(!!(x), 1)
 #endif
@@ -28,10 +28,19 @@
 
 #ifdef __KERNEL__ 
 #include "td_kdefn.h"
+#include <asm/i387.h>
+#include <asm/processor.h>
 #else
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <cpuid.h>
+#define kernel_fpu_begin() do{}while(0)
+#define kernel_fpu_end() do{}while(0)
+#define irq_fpu_usable() 1
+#define pr_info printf
+#define pr_err printf
 #endif
 
 #include "td_compat.h"
@@ -110,6 +119,262 @@ static void sha1_transform (struct td_sha1_context *ctx, uint32_t* pState, const
 
 
 
+/* ---- block functions ---- */
+
+/*
+ * Every implementation hashes a run of whole 64 byte blocks into the state.
+ * td_sha1_update() hands over as many blocks as it has at once.
+ */
+typedef void (*td_sha1_blocks_fn)(struct td_sha1_context *ctx,
+		uint32_t *state, const uint8_t *data, uint blocks);
+
+static void td_sha1_blocks_generic(struct td_sha1_context *ctx,
+		uint32_t *state, const uint8_t *data, uint blocks)
+{
+	while (blocks--) {
+		sha1_transform(ctx, state, data);
+		data += 64;
+	}
+}
+
+/*
+ * SHA extensions (SHA-NI), four rounds per instruction.  The assembler must
+ * know about sha1rnds4 and friends, which the kabi probe checks for.
+ */
+#if defined(__x86_64__) && (!defined(__KERNEL__) || defined(KABI__sha1rnds4))
+#define TD_SHA1_SHANI
+
+static const uint8_t td_sha1_shani_flip[16] = {
+	15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0
+};
+
+static void td_sha1_blocks_shani(struct td_sha1_context *ctx,
+		uint32_t *state, const uint8_t *data, uint blocks)
+{
+	uint64_t count = blocks;
+
+	if (!count)
+		return;
+
+	kernel_fpu_begin();
+	__asm__ __volatile__ (
+		/* ABCD in xmm0 (A in the top word), E in the top word of xmm1 */
+		"movdqu    0(%[state]), %%xmm0           \n"
+		"pshufd    $0x1b, %%xmm0, %%xmm0         \n"
+		"movd      16(%[state]), %%xmm1          \n"
+		"pslldq    $12, %%xmm1                   \n"
+		"movdqu    0(%[flip]), %%xmm7            \n"
+
+		"1:                                      \n"
+		"movdqa    %%xmm1, %%xmm8                \n"
+		"movdqa    %%xmm0, %%xmm9                \n"
+
+		/* rounds 0-3 */
+		"movdqu    0*16(%[data]), %%xmm3         \n"
+		"pshufb    %%xmm7, %%xmm3                \n"
+		"paddd     %%xmm3, %%xmm1                \n"
+		"movdqa    %%xmm0, %%xmm2                \n"
+		"sha1rnds4 $0, %%xmm1, %%xmm0            \n"
+		/* rounds 4-7 */
+		"movdqu    1*16(%[data]), %%xmm4         \n"
+		"pshufb    %%xmm7, %%xmm4                \n"
+		"sha1nexte %%xmm4, %%xmm2                \n"
+		"movdqa    %%xmm0, %%xmm1                \n"
+		"sha1rnds4 $0, %%xmm2, %%xmm0            \n"
+		"sha1msg1  %%xmm4, %%xmm3                \n"
+		/* rounds 8-11 */
+		"movdqu    2*16(%[data]), %%xmm5         \n"
+		"pshufb    %%xmm7, %%xmm5                \n"
+		"sha1nexte %%xmm5, %%xmm1                \n"
+		"movdqa    %%xmm0, %%xmm2                \n"
+		"sha1rnds4 $0, %%xmm1, %%xmm0            \n"
+		"sha1msg1  %%xmm5, %%xmm4                \n"
+		"pxor      %%xmm5, %%xmm3                \n"
+		/* rounds 12-15 */
+		"movdqu    3*16(%[data]), %%xmm6         \n"
+		"pshufb    %%xmm7, %%xmm6                \n"
+		"sha1nexte %%xmm6, %%xmm2                \n"
+		"movdqa    %%xmm0, %%xmm1                \n"
+		"sha1msg2  %%xmm6, %%xmm3                \n"
+		"sha1rnds4 $0, %%xmm2, %%xmm0            \n"
+		"sha1msg1  %%xmm6, %%xmm5                \n"
+		"pxor      %%xmm6, %%xmm4                \n"
+		/* rounds 16-19 */
+		"sha1nexte %%xmm3, %%xmm1                \n"
+		"movdqa    %%xmm0, %%xmm2                \n"
+		"sha1msg2  %%xmm3, %%xmm4                \n"
+		"sha1rnds4 $0, %%xmm1, %%xmm0            \n"
+		"sha1msg1  %%xmm3, %%xmm6                \n"
+		"pxor      %%xmm3, %%xmm5                \n"
+		/* rounds 20-23 */
+		"sha1nexte %%xmm4, %%xmm2                \n"
+		"movdqa    %%xmm0, %%xmm1                \n"
+		"sha1msg2  %%xmm4, %%xmm5                \n"
+		"sha1rnds4 $1, %%xmm2, %%xmm0            \n"
+		"sha1msg1  %%xmm4, %%xmm3                \n"
+		"pxor      %%xmm4, %%xmm6                \n"
+		/* rounds 24-27 */
+		"sha1nexte %%xmm5, %%xmm1                \n"
+		"movdqa    %%xmm0, %%xmm2                \n"
+		"sha1msg2  %%xmm5, %%xmm6                \n"
+		"sha1rnds4 $1, %%xmm1, %%xmm0            \n"
+		"sha1msg1  %%xmm5, %%xmm4                \n"
+		"pxor      %%xmm5, %%xmm3                \n"
+		/* rounds 28-31 */
+		"sha1nexte %%xmm6, %%xmm2                \n"
+		"movdqa    %%xmm0, %%xmm1                \n"
+		"sha1msg2  %%xmm6, %%xmm3                \n"
+		"sha1rnds4 $1, %%xmm2, %%xmm0            \n"
+		"sha1msg1  %%xmm6, %%xmm5                \n"
+		"pxor      %%xmm6, %%xmm4                \n"
+		/* rounds 32-35 */
+		"sha1nexte %%xmm3, %%xmm1                \n"
+		"movdqa    %%xmm0, %%xmm2                \n"
+		"sha1msg2  %%xmm3, %%xmm4                \n"
+		"sha1rnds4 $1, %%xmm1, %%xmm0            \n"
+		"sha1msg1  %%xmm3, %%xmm6                \n"
+		"pxor      %%xmm3, %%xmm5                \n"
+		/* rounds 36-39 */
+		"sha1nexte %%xmm4, %%xmm2                \n"
+		"movdqa    %%xmm0, %%xmm1                \n"
+		"sha1msg2  %%xmm4, %%xmm5                \n"
+		"sha1rnds4 $1, %%xmm2, %%xmm0            \n"
+		"sha1msg1  %%xmm4, %%xmm3                \n"
+		"pxor      %%xmm4, %%xmm6                \n"
+		/* rounds 40-43 */
+		"sha1nexte %%xmm5, %%xmm1                \n"
+		"movdqa    %%xmm0, %%xmm2                \n"
+		"sha1msg2  %%xmm5, %%xmm6                \n"
+		"sha1rnds4 $2, %%xmm1, %%xmm0            \n"
+		"sha1msg1  %%xmm5, %%xmm4                \n"
+		"pxor      %%xmm5, %%xmm3                \n"
+		/* rounds 44-47 */
+		"sha1nexte %%xmm6, %%xmm2                \n"
+		"movdqa    %%xmm0, %%xmm1                \n"
+		"sha1msg2  %%xmm6, %%xmm3                \n"
+		"sha1rnds4 $2, %%xmm2, %%xmm0            \n"
+		"sha1msg1  %%xmm6, %%xmm5                \n"
+		"pxor      %%xmm6, %%xmm4                \n"
+		/* rounds 48-51 */
+		"sha1nexte %%xmm3, %%xmm1                \n"
+		"movdqa    %%xmm0, %%xmm2                \n"
+		"sha1msg2  %%xmm3, %%xmm4                \n"
+		"sha1rnds4 $2, %%xmm1, %%xmm0            \n"
+		"sha1msg1  %%xmm3, %%xmm6                \n"
+		"pxor      %%xmm3, %%xmm5                \n"
+		/* rounds 52-55 */
+		"sha1nexte %%xmm4, %%xmm2                \n"
+		"movdqa    %%xmm0, %%xmm1                \n"
+		"sha1msg2  %%xmm4, %%xmm5                \n"
+		"sha1rnds4 $2, %%xmm2, %%xmm0            \n"
+		"sha1msg1  %%xmm4, %%xmm3                \n"
+		"pxor      %%xmm4, %%xmm6                \n"
+		/* rounds 56-59 */
+		"sha1nexte %%xmm5, %%xmm1                \n"
+		"movdqa    %%xmm0, %%xmm2                \n"
+		"sha1msg2  %%xmm5, %%xmm6                \n"
+		"sha1rnds4 $2, %%xmm1, %%xmm0            \n"
+		"sha1msg1  %%xmm5, %%xmm4                \n"
+		"pxor      %%xmm5, %%xmm3                \n"
+		/* rounds 60-63 */
+		"sha1nexte %%xmm6, %%xmm2                \n"
+		"movdqa    %%xmm0, %%xmm1                \n"
+		"sha1msg2  %%xmm6, %%xmm3                \n"
+		"sha1rnds4 $3, %%xmm2, %%xmm0            \n"
+		"sha1msg1  %%xmm6, %%xmm5                \n"
+		"pxor      %%xmm6, %%xmm4                \n"
+		/* rounds 64-67 */
+		"sha1nexte %%xmm3, %%xmm1                \n"
+		"movdqa    %%xmm0, %%xmm2                \n"
+		"sha1msg2  %%xmm3, %%xmm4                \n"
+		"sha1rnds4 $3, %%xmm1, %%xmm0            \n"
+		"sha1msg1  %%xmm3, %%xmm6                \n"
+		"pxor      %%xmm3, %%xmm5                \n"
+		/* rounds 68-71 */
+		"sha1nexte %%xmm4, %%xmm2                \n"
+		"movdqa    %%xmm0, %%xmm1                \n"
+		"sha1msg2  %%xmm4, %%xmm5                \n"
+		"sha1rnds4 $3, %%xmm2, %%xmm0            \n"
+		"pxor      %%xmm4, %%xmm6                \n"
+		/* rounds 72-75 */
+		"sha1nexte %%xmm5, %%xmm1                \n"
+		"movdqa    %%xmm0, %%xmm2                \n"
+		"sha1msg2  %%xmm5, %%xmm6                \n"
+		"sha1rnds4 $3, %%xmm1, %%xmm0            \n"
+		/* rounds 76-79 */
+		"sha1nexte %%xmm6, %%xmm2                \n"
+		"movdqa    %%xmm0, %%xmm1                \n"
+		"sha1rnds4 $3, %%xmm2, %%xmm0            \n"
+
+
+		/* add this block's result to the state */
+		"sha1nexte %%xmm8, %%xmm1                \n"
+		"paddd     %%xmm9, %%xmm0                \n"
+
+		"leaq      64(%[data]), %[data]          \n"
+		"decq      %[count]                      \n"
+		"jnz       1b                            \n"
+
+		"pshufd    $0x1b, %%xmm0, %%xmm0         \n"
+		"movdqu    %%xmm0, 0(%[state])           \n"
+		"psrldq    $12, %%xmm1                   \n"
+		"movd      %%xmm1, 16(%[state])          \n"
+
+		: [data] "+r" (data), [count] "+r" (count)
+		: [state] "r" (state), [flip] "r" (td_sha1_shani_flip)
+		: "memory", "cc", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4",
+		  "xmm5", "xmm6", "xmm7", "xmm8", "xmm9"
+		);
+	kernel_fpu_end();
+}
+
+static int td_sha1_shani_usable(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+#ifdef __KERNEL__
+	if (boot_cpu_data.cpuid_level < 7)
+		return 0;
+	cpuid_count(7, 0, &eax, &ebx, &ecx, &edx);
+#else
+	if (__get_cpuid_max(0, NULL) < 7)
+		return 0;
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+#endif
+	(void)eax; (void)ecx; (void)edx;
+
+	/* CPUID.(EAX=7,ECX=0):EBX.SHA[bit 29] */
+	return !!(ebx & (1U << 29));
+}
+#endif
+
+static struct td_sha1_impl {
+	const char              *name;
+	td_sha1_blocks_fn       blocks;
+	int                     (*usable)(void);
+} td_sha1_impls[] = {
+#ifdef TD_SHA1_SHANI
+	{ "sha-ni",  td_sha1_blocks_shani,   td_sha1_shani_usable },
+#endif
+	{ "generic", td_sha1_blocks_generic, NULL },
+};
+
+#define TD_SHA1_IMPL_COUNT (sizeof(td_sha1_impls) / sizeof(td_sha1_impls[0]))
+
+/* the generic code is used until td_sha1_selftest() picks something faster */
+static td_sha1_blocks_fn td_sha1_blocks = td_sha1_blocks_generic;
+
+static inline void td_sha1_do_blocks(struct td_sha1_context *ctx,
+		const uint8_t *data, uint blocks)
+{
+	if (td_sha1_blocks != td_sha1_blocks_generic && !irq_fpu_usable()) {
+		td_sha1_blocks_generic(ctx, ctx->state, data, blocks);
+		return;
+	}
+
+	td_sha1_blocks(ctx, ctx->state, data, blocks);
+}
+
 int td_sha1_init(struct td_sha1_state*st)
 {
 	memset(st, 0, sizeof(*st));
@@ -143,10 +408,14 @@ int td_sha1_update(struct td_sha1_state *st, void *data, uint len)
 		{
 			i = 64 - j;
 			memcpy(&st->ctx.buffer[j], data, i);
-			sha1_transform(&st->ctx, st->ctx.state, st->ctx.buffer);
+			td_sha1_do_blocks(&st->ctx, st->ctx.buffer, 1);
 
-			for( ; (i + 63) < len; i += 64)
-				sha1_transform(&st->ctx, st->ctx.state, PTR_OFS(data, i) );
+			/* all the remaining whole blocks in one go */
+			if ((i + 63) < len) {
+				uint blocks = (len - i) / 64;
+				td_sha1_do_blocks(&st->ctx, PTR_OFS(data, i), blocks);
+				i += blocks * 64;
+			}
 
 			j = 0;
 		}
@@ -187,3 +456,99 @@ int td_sha1_free(struct td_sha1_state *st)
 {
 	return 0;
 }
+
+/* ---- self test ---- */
+
+static const struct td_sha1_vector {
+	const char      *msg;
+	uint            repeat;
+	uint8_t         digest[SHA1_LENGTH];
+} td_sha1_vectors[] = {
+	{ "", 1, {
+		0xda, 0x39, 0xa3, 0xee, 0x5e, 0x6b, 0x4b, 0x0d, 0x32, 0x55,
+		0xbf, 0xef, 0x95, 0x60, 0x18, 0x90, 0xaf, 0xd8, 0x07, 0x09 } },
+	{ "abc", 1, {
+		0xa9, 0x99, 0x3e, 0x36, 0x47, 0x06, 0x81, 0x6a, 0xba, 0x3e,
+		0x25, 0x71, 0x78, 0x50, 0xc2, 0x6c, 0x9c, 0xd0, 0xd8, 0x9d } },
+	{ "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 1, {
+		0x84, 0x98, 0x3e, 0x44, 0x1c, 0x3b, 0xd2, 0x6e, 0xba, 0xae,
+		0x4a, 0xa1, 0xf9, 0x51, 0x29, 0xe5, 0xe5, 0x46, 0x70, 0xf1 } },
+	/* one million 'a's, 1000 at a time, exercises the multi-block path */
+	{ "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"
+	  "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"
+	  "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"
+	  "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"
+	  "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"
+	  "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"
+	  "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"
+	  "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"
+	  "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"
+	  "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa",
+	  1000, {
+		0x34, 0xaa, 0x97, 0x3c, 0xd4, 0xc4, 0xda, 0xa4, 0xf6, 0x1e,
+		0xeb, 0x2b, 0xdb, 0xad, 0x27, 0x31, 0x65, 0x34, 0x01, 0x6f } },
+};
+
+#define TD_SHA1_VECTOR_COUNT (sizeof(td_sha1_vectors) / sizeof(td_sha1_vectors[0]))
+
+/* return 0 if the current block function produces all the known digests */
+static int td_sha1_check_vectors(void)
+{
+	struct td_sha1_state st;
+	uint8_t out[SHA1_LENGTH];
+	uint v, r;
+
+	for (v = 0; v < TD_SHA1_VECTOR_COUNT; v++) {
+		const struct td_sha1_vector *tv = td_sha1_vectors + v;
+
+		td_sha1_init(&st);
+		for (r = 0; r < tv->repeat; r++)
+			td_sha1_update(&st, (void*)tv->msg, strlen(tv->msg));
+		td_sha1_final(&st, out);
+		td_sha1_free(&st);
+
+		if (memcmp(out, tv->digest, SHA1_LENGTH))
+			return -EIO;
+	}
+
+	return 0;
+}
+
+/**
+ * Verify every SHA1 implementation this CPU can run against known vectors,
+ * and select the first one that passes.  Only fails if the generic code
+ * itself is broken.  Must be called before any hashing is done.
+ */
+int td_sha1_selftest(void)
+{
+	const struct td_sha1_impl *impl, *chosen = NULL;
+	uint i;
+	int rc;
+
+	for (i = 0; i < TD_SHA1_IMPL_COUNT; i++) {
+		impl = td_sha1_impls + i;
+
+		if (impl->usable && !impl->usable())
+			continue;
+
+		td_sha1_blocks = impl->blocks;
+		rc = td_sha1_check_vectors();
+		if (rc) {
+			pr_err("SHA1 %s failed self test\n", impl->name);
+			continue;
+		}
+
+		if (!chosen)
+			chosen = impl;
+	}
+
+	if (!chosen) {
+		td_sha1_blocks = td_sha1_blocks_generic;
+		return -EIO;
+	}
+
+	td_sha1_blocks = chosen->blocks;
+	pr_info("SHA1 using %s implementation\n", chosen->name);
+
+	return 0;
+}
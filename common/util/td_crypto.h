@@ -50,4 +50,6 @@ int td_sha1_update(struct td_sha1_state*, void*, uint len);
 int td_sha1_final(struct td_sha1_state*, uint8_t* out);
 int td_sha1_free(struct td_sha1_state*);
 
+int td_sha1_selftest(void);
+
 #endif
@@ -206,6 +206,30 @@ enum td_eng_regs {
 	TD_CONF_INCOMING_SLEEP,         /**< incoming queue sleep threshold; no more are accepted */
 	TD_CONF_INCOMING_WAKE,          /**< incoming queue wake-up threshold */
 
+	TD_CONF_DEALLOCATE_BATCH,       /**< pending deallocates held for other commands to carry */
+	TD_CONF_DEALLOCATE_HOLD_USEC,   /**< longest a deallocate is held before it gets its own command */
+
+	TD_CONF_READAHEAD_DEPTH,        /**< LBAs read ahead of a sequential stream, 0 disables */
+	TD_CONF_READAHEAD_TRIGGER,      /**< sequential LBAs seen before read-ahead starts */
+
+	TD_CONF_READ_CACHE_PAGES,       /**< size of the host read cache, 0 disables */
+
+	TD_CONF_WRITE_COALESCE,         /**< merge queued partial writes covering an LBA, avoiding R-M-W */
+
+	TD_CONF_DISCARD_MERGE_MAX,      /**< discards held back for merging, 0 sends them in order */
+	TD_CONF_DISCARD_HOLD_USEC,      /**< longest held discards wait behind reads and writes */
+
+	TD_CONF_ADAPTIVE_START_BURST,   /**< size command bursts from load, MAX_START_BURST caps them */
+	TD_CONF_START_BURST_LAT_USEC,   /**< token latency above which adaptive bursts shrink */
+
+	TD_CONF_BIO_R_DEADLINE_USEC,    /**< read waiting at the head of the queue longer is overdue, 0 disables */
+	TD_CONF_BIO_W_DEADLINE_USEC,    /**< write waiting at the head of the queue longer is overdue, 0 disables */
+
+	TD_CONF_ZERO_WRITE_TRIM,        /**< send writes of a whole LBA of zeros as TRIM */
+
+	TD_CONF_WRITE_STAGING_PAGES,    /**< LBAs of writes taken into host memory ahead of the device, 0 disables */
+	TD_CONF_WRITE_STAGING_ACK,      /**< 0 acks staged writes at once, 1 when they reach EARLY_COMMIT */
+
 	/* END */
 	TD_CONF_REGS_MAX
 };
@@ -307,6 +331,41 @@ enum td_dev_misc_counter {
 	TD_DEV_MISC_FWSTATUS_SEMA_TIMEOUT_CNT,      /* !< number of timeouts on fw status semaphore */
 	TD_DEV_MISC_FWSTATUS_SEMA_TIMEOUT_MAX_CNT,  /* !< number of times the timeout max was reached */
 	TD_DEV_MISC_RDBUF_MARKER_ERROR_CNT,         /* !< number of misses on readbuf metadata */
+	TD_DEV_MISC_DEALLOCATE_CMD_CNT,             /* !< number of commands sent only to deallocate */
+	TD_DEV_MISC_DEALLOCATE_PIGGYBACK_CNT,       /* !< number of deallocates carried by other commands */
+	TD_DEV_MISC_DEALLOCATE_HELD_CNT,            /* !< number of times deallocates were held for piggybacking */
+	TD_DEV_MISC_READAHEAD_ISSUED_CNT,           /* !< number of speculative reads sent */
+	TD_DEV_MISC_READAHEAD_HIT_CNT,              /* !< number of reads completed from read-ahead data */
+	TD_DEV_MISC_READAHEAD_WAIT_CNT,             /* !< number of reads that waited on a read-ahead in flight */
+	TD_DEV_MISC_READAHEAD_WASTED_CNT,           /* !< number of read-ahead pages dropped unused */
+	TD_DEV_MISC_READ_CACHE_HIT_CNT,             /* !< number of reads completed from the host read cache */
+	TD_DEV_MISC_READ_CACHE_MISS_CNT,            /* !< number of reads not found in the host read cache */
+	TD_DEV_MISC_READ_CACHE_FILL_CNT,            /* !< number of LBAs added to the host read cache */
+	TD_DEV_MISC_READ_CACHE_EVICT_CNT,           /* !< number of LBAs evicted from the host read cache */
+	TD_DEV_MISC_READ_CACHE_INVALIDATE_CNT,      /* !< number of cached LBAs dropped by writes */
+	TD_DEV_MISC_WRITE_COALESCE_CNT,             /* !< number of full LBA writes built from partial writes */
+	TD_DEV_MISC_WRITE_COALESCE_BIO_CNT,         /* !< number of partial writes merged into them */
+	TD_DEV_MISC_DISCARD_HELD_CNT,               /* !< number of discards held back for merging */
+	TD_DEV_MISC_DISCARD_MERGED_CNT,             /* !< number of discards merged into a neighbouring discard */
+	TD_DEV_MISC_DISCARD_SENT_CNT,               /* !< number of merged discard ranges sent */
+	TD_DEV_MISC_DISCARD_FLUSH_CNT,              /* !< number of times a bio forced held discards out */
+	TD_DEV_MISC_PLUG_BATCH_CNT,                 /* !< number of plugged bio lists queued at once */
+	TD_DEV_MISC_PLUG_BIO_CNT,                   /* !< number of bios queued through a plug */
+	TD_DEV_MISC_URING_REQ_CNT,                  /* !< number of user ring entries started */
+	TD_DEV_MISC_URING_LBA_CNT,                  /* !< number of LBAs moved for user ring entries */
+	TD_DEV_MISC_UCMD_ASYNC_CNT,                 /* !< number of pass-through commands submitted asynchronously */
+	TD_DEV_MISC_UCMD_POOL_ALLOC_CNT,            /* !< number of asynchronous ucmds allocated, not taken from the pool */
+	TD_DEV_MISC_START_BURST,                    /* !< latest command burst size allowed */
+	TD_DEV_MISC_BIO_R_OVERDUE_CNT,              /* !< number of reads that missed their queue deadline */
+	TD_DEV_MISC_BIO_W_OVERDUE_CNT,              /* !< number of writes that missed their queue deadline */
+	TD_DEV_MISC_BIO_R_OVERDUE_MAX_USEC,         /* !< longest an overdue read waited at the head of the queue */
+	TD_DEV_MISC_BIO_W_OVERDUE_MAX_USEC,         /* !< longest an overdue write waited at the head of the queue */
+	TD_DEV_MISC_ZERO_WRITE_TRIM_CNT,            /* !< number of all-zero writes sent as TRIM */
+	TD_DEV_MISC_WRITE_STAGE_CNT,                /* !< number of writes taken into the staging buffer */
+	TD_DEV_MISC_WRITE_STAGE_MERGE_CNT,          /* !< number of writes merged into an LBA already staged */
+	TD_DEV_MISC_WRITE_STAGE_READ_HIT_CNT,       /* !< number of reads completed from the staging buffer */
+	TD_DEV_MISC_WRITE_STAGE_DRAIN_CNT,          /* !< number of staged LBAs written out to the device */
+	TD_DEV_MISC_WRITE_STAGE_ERROR_CNT,          /* !< number of acked staged writes that failed or were dropped */
 	TD_DEV_MISC_COUNT_MAX
 };
 
@@ -321,6 +380,7 @@ enum td_devgroup_conf_type {
 enum td_devgroup_conf_general {
 	TD_DEVGROUP_CONF_GENERAL_ENDIO_ENABLE,	/**< number of host visible write buffers (write entry point) */
 	TD_DEVGROUP_CONF_GENERAL_ENDIO_SPIN_MSEC,
+	TD_DEVGROUP_CONF_GENERAL_ENDIO_ON_SUBMITTER, /**< complete bios on the node that submitted them */
 	TD_DEVGROUP_CONF_GENERAL_MAX
 };
 
@@ -340,6 +400,12 @@ enum td_devgroup_conf_worker {
 	TD_DEVGROUP_CONF_WORKER_SYNC_JIFFIES,
 	TD_DEVGROUP_CONF_WORKER_WAKE_SHARE,
 	TD_DEVGROUP_CONF_WORKER_WAKE_SLEEP,
+	TD_DEVGROUP_CONF_WORKER_SCALE_MSEC,        /**< how often worker tokens are re-evaluated, 0 disables */
+	TD_DEVGROUP_CONF_WORKER_SCALE_MIN_TOKENS,  /**< never park below this many worker tokens */
+	TD_DEVGROUP_CONF_WORKER_SCALE_MAX_TOKENS,  /**< never wake above this many worker tokens */
+	TD_DEVGROUP_CONF_WORKER_SCALE_UP_QUEUED,   /**< queued bios per busy device that add a worker */
+	TD_DEVGROUP_CONF_WORKER_SCALE_DOWN_PCT,    /**< busy loop percentage below which a worker is parked */
+	TD_DEVGROUP_CONF_WORKER_SCALE_UP_PCT,      /**< busy loop percentage that adds a worker on token misses */
 	TD_DEVGROUP_CONF_WORKER_MAX
 };
 
@@ -358,6 +424,12 @@ enum td_devgroup_endio_counter {
 	TD_DEVGROUP_ENDIO_COUNT_RUNS,
 	TD_DEVGROUP_ENDIO_COUNT_DONE,
 	TD_DEVGROUP_ENDIO_COUNT_STOLEN,
+	TD_DEVGROUP_ENDIO_COUNT_BATCHES,          /**< non-empty per-CPU batches taken */
+	TD_DEVGROUP_ENDIO_COUNT_BATCH_MAX,        /**< largest batch taken */
+	TD_DEVGROUP_ENDIO_COUNT_DELAY_USEC,       /**< total queueing delay of batches */
+	TD_DEVGROUP_ENDIO_COUNT_DELAY_MAX_USEC,   /**< worst queueing delay of a batch */
+	TD_DEVGROUP_ENDIO_COUNT_REMOTE,           /**< bios sent to the submitting node */
+	TD_DEVGROUP_ENDIO_COUNT_REMOTE_IPIS,      /**< IPIs sent to start remote completion */
 	TD_DEVGROUP_ENDIO_COUNT_MAX
 };
 
@@ -373,6 +445,8 @@ enum td_devgroup_worker_counter {
 	TD_DEVGROUP_WORKER_COUNT_WAKE_CHECK,
 	TD_DEVGROUP_WORKER_COUNT_NO_WAKE_EARLY,
 	TD_DEVGROUP_WORKER_COUNT_NO_WAKE_TOKEN,
+	TD_DEVGROUP_WORKER_COUNT_SCALE_UP,
+	TD_DEVGROUP_WORKER_COUNT_SCALE_DOWN,
 	TD_DEVGROUP_WORKER_COUNT_MAX
 };
 
@@ -236,6 +236,41 @@ struct __packed td_ioctl_device_counters_internal {
 				uint64_t  fwstatus_sema_timeout_cnt;  /* !< number of timeouts on fw status semaphore */
 				uint64_t  fwstatus_sema_timeout_max_cnt;  /* !< number of times the timeout max was reached */
 				uint64_t  rdbuf_marker_error_cnt; /* !< number of misses on readbuf metadata */
+				uint64_t  deallocate_cmd_cnt;      /* !< number of commands sent only to deallocate */
+				uint64_t  deallocate_piggyback_cnt; /* !< number of deallocates carried by other commands */
+				uint64_t  deallocate_held_cnt;     /* !< number of times deallocates were held for piggybacking */
+				uint64_t  readahead_issued_cnt;    /* !< number of speculative reads sent */
+				uint64_t  readahead_hit_cnt;       /* !< number of reads completed from read-ahead data */
+				uint64_t  readahead_wait_cnt;      /* !< number of reads that waited on a read-ahead in flight */
+				uint64_t  readahead_wasted_cnt;    /* !< number of read-ahead pages dropped unused */
+				uint64_t  read_cache_hit_cnt;      /* !< number of reads completed from the host read cache */
+				uint64_t  read_cache_miss_cnt;     /* !< number of reads not found in the host read cache */
+				uint64_t  read_cache_fill_cnt;     /* !< number of LBAs added to the host read cache */
+				uint64_t  read_cache_evict_cnt;    /* !< number of LBAs evicted from the host read cache */
+				uint64_t  read_cache_invalidate_cnt; /* !< number of cached LBAs dropped by writes */
+				uint64_t  write_coalesce_cnt;      /* !< number of full LBA writes built from partial writes */
+				uint64_t  write_coalesce_bio_cnt;  /* !< number of partial writes merged into them */
+				uint64_t  discard_held_cnt;        /* !< number of discards held back for merging */
+				uint64_t  discard_merged_cnt;      /* !< number of discards merged into a neighbouring discard */
+				uint64_t  discard_sent_cnt;        /* !< number of merged discard ranges sent */
+				uint64_t  discard_flush_cnt;       /* !< number of times a bio forced held discards out */
+				uint64_t  plug_batch_cnt;          /* !< number of plugged bio lists queued at once */
+				uint64_t  plug_bio_cnt;            /* !< number of bios queued through a plug */
+				uint64_t  uring_req_cnt;           /* !< number of user ring entries started */
+				uint64_t  uring_lba_cnt;           /* !< number of LBAs moved for user ring entries */
+				uint64_t  ucmd_async_cnt;          /* !< number of pass-through commands submitted asynchronously */
+				uint64_t  ucmd_pool_alloc_cnt;     /* !< number of asynchronous ucmds allocated, not taken from the pool */
+				uint64_t  start_burst;             /* !< latest command burst size allowed */
+				uint64_t  bio_r_overdue_cnt;       /* !< number of reads that missed their queue deadline */
+				uint64_t  bio_w_overdue_cnt;       /* !< number of writes that missed their queue deadline */
+				uint64_t  bio_r_overdue_max_usec;  /* !< longest an overdue read waited at the head of the queue */
+				uint64_t  bio_w_overdue_max_usec;  /* !< longest an overdue write waited at the head of the queue */
+				uint64_t  zero_write_trim_cnt;     /* !< number of all-zero writes sent as TRIM */
+				uint64_t  write_stage_cnt;         /* !< number of writes taken into the staging buffer */
+				uint64_t  write_stage_merge_cnt;   /* !< number of writes merged into an LBA already staged */
+				uint64_t  write_stage_read_hit_cnt; /* !< number of reads completed from the staging buffer */
+				uint64_t  write_stage_drain_cnt;   /* !< number of staged LBAs written out to the device */
+				uint64_t  write_stage_error_cnt;   /* !< number of acked staged writes that failed or were dropped */
 			} misc;
 		};
 	};
@@ -304,6 +339,19 @@ struct __packed td_ioctl_device_info {
 	uint8_t   uuid[16];         /* !< UUID of device */
 	uint16_t  memspeed;         /* !< memory speed */
 	uint16_t  cpu_socket;       /* !< cpu socket */
+	int16_t   numa_node;        /* !< NUMA node of engine and buffers, -1 if none */
+};
+
+/* layout before numa_node was added, still answered under its own ioctl */
+struct __packed td_ioctl_device_info_v0 {
+	char      phys_slot_name[TD_DEVICE_SLOT_NAME_MAX];
+	uint64_t  phys_mem_base;    /* !< where it's located in physical memory */
+	uint64_t  phys_mem_size;    /* !< physical memory size */
+	uint32_t  phys_mem_speed;   /* !< DDR memory speed */
+	uint32_t  irq_num;          /* !< irq assigned to device */
+	uint8_t   uuid[16];         /* !< UUID of device */
+	uint16_t  memspeed;         /* !< memory speed */
+	uint16_t  cpu_socket;       /* !< cpu socket */
 };
 
 struct __packed td_ioctl_device_state {
@@ -399,6 +447,27 @@ struct __packed td_ioctl_monitor_rate {
 	int rate;
 };
 
+#define TD_IOCTL_PLACEMENT_SOCKETS_MAX  4  /**< sockets a _UID can describe */
+#define TD_IOCTL_PLACEMENT_CPUS_MAX     16
+
+enum td_ioctl_placement_flags {
+	TD_IOCTL_PLACEMENT_APPLY        = 1<<0, /**< restart workers on the new plan */
+};
+
+struct __packed td_ioctl_placement_socket {
+	uint16_t  devices;       /* !< devices discovered or attached */
+	uint16_t  channels;      /* !< populated memory channels, one bit each */
+	uint16_t  isolated;      /* !< isolcpus/nohz_full CPUs on the socket */
+	uint16_t  worker_count;
+	uint16_t  worker_cpu[TD_IOCTL_PLACEMENT_CPUS_MAX];
+};
+
+struct __packed td_ioctl_placement {
+	uint32_t  flags;         /* !< see enum td_ioctl_placement_flags */
+	uint32_t  socket_count;
+	struct td_ioctl_placement_socket sockets[TD_IOCTL_PLACEMENT_SOCKETS_MAX];
+};
+
 struct __packed td_ioctl_device_global_ext_status {
 	union {
 		uint8_t u8[8];
@@ -435,6 +504,129 @@ struct __packed td_ioctl_device_ecc_counters {
 		+ ((TD_IOCTL_DEVICE_ECC_COUNTERS_NUM_MAX) * sizeof(uint64_t)))
 
 
+/* user IO ring, set up on and mmap()ed from the device char device */
+
+enum td_uring_op {
+	TD_URING_OP_READ  = 1,
+	TD_URING_OP_WRITE = 2,
+};
+
+/** submission entry, posted by the user */
+struct td_uring_sqe {
+	uint8_t  op;            /* !< use enum td_uring_op */
+	uint8_t  rsvd[3];
+	uint32_t lba_count;     /* !< number of device sectors (HW_SECTOR_SIZE) */
+	uint64_t lba;           /* !< first device sector */
+	uint64_t buf_ofs;       /* !< byte offset into the registered buffer */
+	uint64_t user_data;     /* !< returned in the completion */
+};
+
+/** completion entry, posted by the driver */
+struct td_uring_cqe {
+	uint64_t user_data;     /* !< from the submission entry */
+	int32_t  result;        /* !< bytes transferred, or negative errno */
+	uint32_t rsvd;
+};
+
+/** at offset 0 of the mapping; the user only writes sq_tail and cq_head */
+struct td_uring_ctl {
+	uint32_t sq_head;       /* !< next entry the driver will consume */
+	uint32_t sq_tail;       /* !< next entry the user will fill */
+	uint32_t sq_entries;
+	uint32_t cq_head;       /* !< next entry the user will consume */
+	uint32_t cq_tail;       /* !< next entry the driver will fill */
+	uint32_t cq_entries;
+	uint64_t sq_off;        /* !< offset of the td_uring_sqe array in the mapping */
+	uint64_t cq_off;        /* !< offset of the td_uring_cqe array in the mapping */
+};
+
+struct __packed td_ioctl_device_uring_setup {
+	uint32_t sq_entries;    /* !< in: power of 2, up to TD_URING_ENTRIES_MAX */
+	uint32_t cq_entries;    /* !< out: twice sq_entries */
+	USER_PTR(buf);          /* !< in: page aligned buffer that IO moves to/from */
+	uint64_t buf_len;       /* !< in: multiple of the page size */
+	uint64_t mmap_len;      /* !< out: length to mmap() at offset 0 */
+};
+
+struct __packed td_ioctl_device_uring_enter {
+	uint32_t min_complete;  /* !< wait until this many completions are posted */
+	uint32_t timeout_msec;  /* !< how long to wait for them */
+};
+
+#define TD_URING_ENTRIES_MAX   4096
+#define TD_URING_BUF_MAX       (256ULL << 20)
+
+/* asynchronous pass-through commands, submitted and reaped on the device
+ * char device */
+
+/** one command; result and cycles are filled in when it's reaped */
+struct __packed td_ioctl_device_cmd_pt_async {
+	uint64_t user_data;                 /* !< returned with the completion */
+	struct td_ioctl_device_cmd_pt cmd;
+};
+
+struct __packed td_ioctl_device_cmd_pt_submit {
+	uint32_t count;         /* !< in: entries in cmds, out: number submitted */
+	int32_t  eventfd;       /* !< in: signalled on each completion, or -1 */
+	USER_PTR(cmds);         /* !< in: array of td_ioctl_device_cmd_pt_async */
+};
+
+struct __packed td_ioctl_device_cmd_pt_reap {
+	uint32_t count;         /* !< in: entries in cmds, out: number reaped */
+	uint32_t min_complete;  /* !< wait until this many can be reaped */
+	uint32_t timeout_msec;  /* !< how long to wait for them */
+	uint32_t rsvd;
+	USER_PTR(cmds);         /* !< out: array of td_ioctl_device_cmd_pt_async */
+};
+
+/** commands submitted and not reaped yet, on each device */
+#define TD_UCMD_ASYNC_MAX      256
+
+/* synthetic load, generated in the driver and queued on a device like block
+ * requests; writes overwrite the region */
+
+enum td_loadgen_pct {
+	TD_LOADGEN_PCT_50,
+	TD_LOADGEN_PCT_90,
+	TD_LOADGEN_PCT_99,
+	TD_LOADGEN_PCT_99_9,
+	TD_LOADGEN_PCT_99_99,
+	TD_LOADGEN_PCT_MAX
+};
+
+/** per-state CPU time slots, in the order of the driver's td_cpu_state */
+#define TD_LOADGEN_CPU_STATES  8
+
+struct __packed td_ioctl_device_loadgen {
+	uint32_t read_pct;      /* !< in: percent of requests that are reads */
+	uint32_t block_size;    /* !< in: bytes per request, multiple of 4k */
+	uint32_t queue_depth;   /* !< in: requests kept in flight */
+	uint32_t random;        /* !< in: non-zero for random offsets, else sequential */
+	uint32_t duration_msec; /* !< in: how long to keep starting requests */
+	uint32_t seed;          /* !< in: for the offsets and the read/write mix */
+	uint64_t offset;        /* !< in: first byte of the region, block_size aligned */
+	uint64_t length;        /* !< in: bytes in the region, 0 for the rest of the device */
+
+	uint64_t reads;         /* !< out: reads completed */
+	uint64_t writes;        /* !< out: writes completed */
+	uint64_t read_bytes;
+	uint64_t write_bytes;
+	uint64_t errors;        /* !< out: requests failed, the run stops at the first */
+	uint64_t elapsed_usec;  /* !< out: first start to last completion */
+	uint64_t iops;
+	uint64_t bytes_per_sec;
+	uint64_t lat_min_nsec;
+	uint64_t lat_avg_nsec;
+	uint64_t lat_max_nsec;
+	uint64_t lat_pct_nsec[TD_LOADGEN_PCT_MAX];  /* !< out: use enum td_loadgen_pct */
+	uint32_t cpu_tracked;   /* !< out: non-zero if cpu_usec was filled in */
+	uint32_t rsvd;
+	uint64_t cpu_usec[TD_LOADGEN_CPU_STATES];   /* !< out: device group thread time */
+};
+
+#define TD_LOADGEN_DEPTH_MAX     256
+#define TD_LOADGEN_DURATION_MAX  (3600 * 1000)
+
 /* ioctls for managing TR devices */
 
 #ifdef CONFIG_TERADIMM_DEPREICATED_RAID_CREATE_V0
@@ -520,6 +712,9 @@ struct __packed td_ioctl_raid_state {
 
 #define TD_IOCTL_MONITOR_RATE     _IOW(TERADIMM_IOC, 8, struct td_ioctl_monitor_rate)
 
+/** ioctl used to report the worker placement, and to re-plan it */
+#define TD_IOCTL_PLACEMENT        _IOWR(TERADIMM_IOC, 9, struct td_ioctl_placement)
+
 /* ioctls for handling device creation and management, target /dev/td-control */
 
 /** ioctl used to query names of devices */
@@ -567,6 +762,7 @@ struct __packed td_ioctl_raid_state {
 
 /** ioctl used to get device info/state */
 #define TD_IOCTL_DEVICE_GET_INFO  _IOWR(TERADIMM_IOC, 34, struct td_ioctl_device_info)
+#define TD_IOCTL_DEVICE_GET_INFO_V0  _IOWR(TERADIMM_IOC, 34, struct td_ioctl_device_info_v0)
 #define TD_IOCTL_DEVICE_GET_STATE  _IOWR(TERADIMM_IOC, 35, struct td_ioctl_device_state)
 
 /** ioctl used to reset a device */
@@ -611,6 +807,21 @@ struct __packed td_ioctl_raid_state {
 #define TD_IOCTL_DEVICE_GET_COUNTERS       _IOR(TERADIMM_IOC, 58, struct td_ioctl_device_counters)
 #define TD_IOCTL_DEVICE_GET_ALL_COUNTERS       _IOR(TERADIMM_IOC, 59, struct td_ioctl_device_counters)
 
+/** called on /dev/tdX, sets up a user IO ring for this open file */
+#define TD_IOCTL_DEVICE_URING_SETUP _IOWR(TERADIMM_IOC, 63, struct td_ioctl_device_uring_setup)
+
+/** called on /dev/tdX, starts posted ring entries and waits for completions */
+#define TD_IOCTL_DEVICE_URING_ENTER _IOW(TERADIMM_IOC, 64, struct td_ioctl_device_uring_enter)
+
+/** called on /dev/tdX, queues pass-through commands without waiting for them */
+#define TD_IOCTL_DEVICE_CMD_PT_SUBMIT _IOWR(TERADIMM_IOC, 65, struct td_ioctl_device_cmd_pt_submit)
+
+/** called on /dev/tdX, collects pass-through commands submitted by this open file */
+#define TD_IOCTL_DEVICE_CMD_PT_REAP _IOWR(TERADIMM_IOC, 66, struct td_ioctl_device_cmd_pt_reap)
+
+/** called on /dev/tdX, runs a synthetic load on the device and waits for it */
+#define TD_IOCTL_DEVICE_LOADGEN _IOWR(TERADIMM_IOC, 67, struct td_ioctl_device_loadgen)
+
 /** ioctl used to query the configuration of a device group */
 #define TD_IOCTL_DEVGROUP_GET_CONF  _IOWR(TERADIMM_IOC, 60, struct td_ioctl_conf)
 
@@ -737,6 +948,7 @@ int td_ioctl_device_start_bio(struct td_device *dev);
 int td_ioctl_device_stop_bio(struct td_device *dev, void *bio_context);
 
 int td_ioctl_control_mon_rate( struct td_ioctl_monitor_rate *mr);
+int td_ioctl_control_placement(struct td_ioctl_placement *pl);
 
 int td_ioctl_raid_get_conf(struct td_raid *dev,
                            struct td_ioctl_conf *conf, bool fill_mode);
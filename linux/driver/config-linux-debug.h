@@ -37,6 +37,7 @@
 #undef CONFIG_TERADIMM_USES_CORE_BUFFS_ONLY
 #undef CONFIG_TD_HISTOGRAM
 #undef CONFIG_TERADIMM_CHECKSUM128_C
+#define CONFIG_TERADIMM_CHECKSUM128_SIMD
 #define CONFIG_TERADIMM_INIT_MEMORY_MAPPING
 #undef CONFIG_TERADIMM_INIT_MEMORY_MAPPING_ALWAYS
 #define CONFIG_TERADIMM_MEMCPY_XSUM
@@ -71,6 +72,12 @@
 #define CONFIG_TERADIMM_MAPPER_CACHING
 #define CONFIG_TERADIMM_DONT_TRACE_IN_DEAD_STATE
 #define CONFIG_TERADIMM_RUSH_INGRESS_PIPE
+#define CONFIG_TERADIMM_READAHEAD
+#define CONFIG_TERADIMM_READ_CACHE
+#define CONFIG_TERADIMM_WRITE_STAGING
+#define CONFIG_TERADIMM_USER_RING
+#define CONFIG_TERADIMM_UCMD_ASYNC
+#define CONFIG_TERADIMM_LOADGEN
 
 #define CONFIG_TERADIMM_INCOMING_BACKPRESSURE TD_BACKPRESSURE_EVENT
 
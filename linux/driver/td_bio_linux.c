@@ -34,12 +34,25 @@
 
 int td_split_req_create_discard(struct td_engine *eng, struct bio *obio,
 		td_split_req_create_cb cb, void *opaque)
+{
+	return td_split_req_create_discard_range(eng, obio, NULL,
+			td_bio_get_sector_offset(obio),
+			td_bio_get_byte_size(obio), cb, opaque);
+}
+
+/*
+ * obio is the discard that owns the range; any merged bios are completed
+ * along with it.  The range is in bytes starting at a 512B sector.
+ */
+int td_split_req_create_discard_range(struct td_engine *eng, struct bio *obio,
+		struct bio_list *merged, uint64_t sector, uint64_t bytes,
+		td_split_req_create_cb cb, void *opaque)
 {
 	struct bio_vec *ovec;
 	struct bio *next_nbio, *nbio;
 	struct bio_vec *next_nvec;
 	struct td_biogrp *sreq;
-	uint64_t addr, align, hw_sec, size;
+	uint64_t addr, align, hw_sec, bio_sec, size;
 	uint64_t end_addr;
 	uint64_t default_size, extra_stripes, max_stripe;
 	uint64_t stripe, stripe_size;
@@ -56,10 +69,10 @@ int td_split_req_create_discard(struct td_engine *eng, struct bio *obio,
 		return -EINVAL;
 
 	td_eng_trace(eng, TR_TRIM, "BIO:trim:bio", (uint64_t)obio);
-	td_eng_trace(eng, TR_TRIM, "BIO:trim:sctr", obio->bio_sector);
-	td_eng_trace(eng, TR_TRIM, "BIO:trim:size", obio->bio_size);
+	td_eng_trace(eng, TR_TRIM, "BIO:trim:sctr", sector);
+	td_eng_trace(eng, TR_TRIM, "BIO:trim:size", bytes);
 
-	max_nbios = td_bio_discard_count(obio, eng);
+	max_nbios = td_discard_range_count(eng, sector, bytes);
 
 	if (!max_nbios || max_nbios > TD_SPLIT_REQ_PART_MAX)
 		return -EINVAL;
@@ -82,6 +95,10 @@ int td_split_req_create_discard(struct td_engine *eng, struct bio *obio,
 
 	sreq->sr_orig = obio;
 
+	bio_list_init(&sreq->sr_merged);
+	if (merged)
+		bio_list_merge(&sreq->sr_merged, merged);
+
 	atomic_set(&sreq->sr_total, 0);
 
 	/* ret_count is a private counter, returned to the caller */
@@ -101,25 +118,25 @@ int td_split_req_create_discard(struct td_engine *eng, struct bio *obio,
 	ssd_count  = td_eng_conf_hw_var_get(eng, SSD_COUNT);
 
 	/* check alignment, don't trim partial hw_sectors. */
-	if (likely(td_bio_aligned_correctly(eng, obio))) {
-		addr = td_bio_get_sector_offset(obio);
-		size = td_bio_get_byte_size(obio);
+	bio_sec = td_eng_conf_hw_var_get(eng, BIO_SECTOR_SIZE);
+	if (likely(bio_sec && !((sector << SECTOR_SHIFT) % bio_sec)
+				&& !(bytes % bio_sec))) {
+		addr = sector;
+		size = bytes;
 	}
 	else {
 		/* Check front alignment by checking if the starting byte is
 		 * on a hw_sec boundary */
-		align = (td_bio_get_sector_offset(obio) << SECTOR_SHIFT) %
-			hw_sec;
+		align = (sector << SECTOR_SHIFT) % hw_sec;
 		/* If align isn't 0, then we need to shift the address by the
 		 * difference of the hw_sec boundary and the start address */
 		if (align)
 			align = hw_sec - align;
-		addr = td_bio_get_sector_offset(obio)
-			+ (align >> SECTOR_SHIFT);
+		addr = sector + (align >> SECTOR_SHIFT);
 
 		/* Then align the back by re-calculating the size and removing
 		 * the overflow into the next hw_sec. */
-		size = td_bio_get_byte_size(obio) - align;
+		size = bytes - align;
 		size -= size % hw_sec;
 	}
 
@@ -401,6 +418,185 @@ int td_bio_split (td_bio_ref obio, unsigned split_size,
 	return ret_count;
 }
 
+/*
+ * A bio cursor hands a large bio to the engine one data buffer at a time,
+ * as tokens free up, instead of splitting all of it up front.  Parts come
+ * from a pool and go back to it when they complete; the biogrp only does the
+ * counting, and its sr_total is kept one ahead until the last part is handed
+ * out, like in td_bio_split().
+ */
+
+#define TD_BIO_CURSOR_VECS (TERADIMM_DATA_BUF_SIZE >> SECTOR_SHIFT)
+
+struct td_bio_part {
+	struct bio          bp_bio;
+	struct bio_vec      bp_vecs[TD_BIO_CURSOR_VECS];
+};
+
+int td_bio_cursor_init(struct td_bio_cursor *bc, int node)
+{
+	struct td_bio_part *parts;
+	unsigned i;
+
+	memset(bc, 0, sizeof(*bc));
+	bio_list_init(&bc->bc_free);
+
+	parts = kzalloc_node(TD_BIO_CURSOR_PARTS * sizeof(*parts),
+			GFP_KERNEL, node);
+	if (!parts)
+		return -ENOMEM;
+
+	for (i=0; i<TD_BIO_CURSOR_PARTS; i++)
+		bio_list_add(&bc->bc_free, &parts[i].bp_bio);
+
+	bc->bc_parts = parts;
+
+	return 0;
+}
+
+void td_bio_cursor_exit(struct td_bio_cursor *bc)
+{
+	WARN_ON(bc->bc_bio);
+
+	kfree(bc->bc_parts);
+	bc->bc_parts = NULL;
+	bio_list_init(&bc->bc_free);
+}
+
+/**
+ * \brief start handing out a bio
+ *
+ * @return 0 on success, negative if the bio has to be split the old way
+ */
+int td_bio_cursor_start(struct td_engine *eng, struct td_bio_cursor *bc,
+		struct bio *obio)
+{
+	struct td_biogrp *sreq;
+	uint oidx;
+
+	if (bc->bc_bio)
+		return -EBUSY;
+
+	/* sector sized vecs fit a data buffer in TD_BIO_CURSOR_VECS */
+	for (oidx = obio->bio_idx; oidx < obio->bi_vcnt; oidx++) {
+		if (bio_iovec_idx(obio, oidx)->bv_len & ((1 << SECTOR_SHIFT) - 1))
+			return -EINVAL;
+	}
+
+	sreq = td_stash_biogrp_alloc(eng, 0);
+	if (!sreq)
+		return -ENOMEM;
+
+	sreq->sr_orig = obio;
+	bio_list_init(&sreq->sr_merged);
+	atomic_set(&sreq->sr_total, 1);
+	atomic_set(&sreq->sr_finished, 0);
+	sreq->sr_created = td_get_cycles();
+	sreq->sr_result = 0;
+	sreq->sr_cursor = bc;
+
+	bc->bc_bio = obio;
+	bc->bc_grp = sreq;
+	bc->bc_addr = obio->bio_sector << SECTOR_SHIFT;
+	bc->bc_left = td_bio_get_byte_size(obio);
+	bc->bc_oidx = obio->bio_idx;
+	bc->bc_ovec_used = 0;
+
+	return 0;
+}
+
+/**
+ * \brief get the next part of the bio
+ *
+ * @return the part, or NULL if there is no bio or all parts are in flight
+ */
+struct bio *td_bio_cursor_next(struct td_bio_cursor *bc)
+{
+	td_bio_flags_t flags = { .u8 = 0 };
+	struct td_biogrp *sreq = bc->bc_grp;
+	struct bio *obio = bc->bc_bio, *nbio;
+	struct td_bio_part *part;
+	struct bio_vec *ovec;
+	uint lba_left, nbio_left;
+
+	if (!obio)
+		return NULL;
+
+	nbio = bio_list_pop(&bc->bc_free);
+	if (!nbio)
+		return NULL;
+
+	part = container_of(nbio, struct td_bio_part, bp_bio);
+	memset(nbio, 0, sizeof(*nbio));
+
+	ovec = bio_iovec_idx(obio, bc->bc_oidx);
+
+	lba_left = TERADIMM_DATA_BUF_SIZE
+		- (bc->bc_addr % TERADIMM_DATA_BUF_SIZE);
+
+	nbio->bi_rw      = obio->bi_rw;
+	nbio->bio_sector = (bc->bc_addr >> SECTOR_SHIFT);
+	nbio->bio_size   = min(bc->bc_left, lba_left);
+	nbio->bi_io_vec  = part->bp_vecs;
+
+	nbio_left = nbio->bio_size;
+
+	while (nbio_left) {
+		struct bio_vec *nvec;
+		uint ovec_left = ovec->bv_len - bc->bc_ovec_used;
+
+		if (!ovec_left) {
+			bc->bc_oidx ++;
+			bc->bc_ovec_used = 0;
+			ovec ++;
+			continue;
+		}
+
+		nvec = part->bp_vecs + nbio->bi_vcnt;
+
+		nvec->bv_page   = ovec->bv_page;
+		nvec->bv_len    = min(nbio_left, ovec_left);
+		nvec->bv_offset = ovec->bv_offset + bc->bc_ovec_used;
+
+		nbio->bi_vcnt ++;
+
+		bc->bc_ovec_used += nvec->bv_len;
+		nbio_left -= nvec->bv_len;
+	}
+
+	bc->bc_addr += nbio->bio_size;
+	bc->bc_left -= nbio->bio_size;
+
+	/* mark the new bio as being wrapped */
+	flags.is_part = 1;
+	nbio->bio_size |= flags.u8;
+	nbio->bi_private = sreq;
+
+	/* the last part hands the biogrp over to the parts in flight */
+	if (bc->bc_left)
+		atomic_inc(&sreq->sr_total);
+	else {
+		bc->bc_bio = NULL;
+		bc->bc_grp = NULL;
+	}
+
+	return nbio;
+}
+
+/** fail what is left of the bio, the parts in flight finish on their own */
+void td_bio_cursor_abort(struct td_engine *eng, struct td_bio_cursor *bc,
+		int result)
+{
+	struct td_biogrp *sreq = bc->bc_grp;
+
+	if (!bc->bc_bio)
+		return;
+
+	bc->bc_bio = NULL;
+	bc->bc_grp = NULL;
+	td_biogrp_complete_rest(eng, sreq, result);
+}
+
 int td_bio_replicate (td_bio_ref obio, int num_bios,
 		td_split_req_create_cb cb, void *opaque)
 {
@@ -477,7 +673,8 @@ int td_bio_replicate (td_bio_ref obio, int num_bios,
 }
 
 
-static void __bio_endio(struct td_engine *eng, td_bio_ref bio, int result, cycles_t ts)
+static void __bio_endio(struct td_engine *eng, td_bio_ref bio, int result,
+		cycles_t ts, int origin)
 {
 	int rw = bio_data_dir(bio);
 	unsigned int size = td_bio_get_byte_size(bio);
@@ -507,7 +704,7 @@ static void __bio_endio(struct td_engine *eng, td_bio_ref bio, int result, cycle
 #endif
 	}
 
-	td_engine_endio(eng, bio, result);
+	td_engine_endio(eng, bio, result, origin);
 
 	/* update the request latency */
 	if (rw == WRITE)
@@ -522,16 +719,20 @@ static void __bio_endio(struct td_engine *eng, td_bio_ref bio, int result, cycle
 
 void td_bio_endio(struct td_engine *eng, td_bio_ref bio, int result, cycles_t ts)
 {
+	int origin;
+
 	if (unlikely (td_bio_is_part(bio))) {
 		return td_biogrp_complete_part(eng, bio, result, ts);
 	}
 	
 	td_eng_trace(eng, TR_BIO, "BIO:end:bio   ", (uint64_t)bio);
+
+	origin = td_bio_origin(bio);
 	
 	/* Clear any flags */
 	bio->bio_size -= bio->bio_size & 0x00FF;
 
-	__bio_endio(eng, bio, result, ts);
+	__bio_endio(eng, bio, result, ts, origin);
 
 	td_eng_trace(eng, TR_BIO, "BIO:end:result", result);
 
@@ -539,3 +740,166 @@ void td_bio_endio(struct td_engine *eng, td_bio_ref bio, int result, cycles_t ts
 	eng->td_total_bios++;
 }
 
+/**
+ * \brief copy the bio's worth of data from a kernel buffer into the bio
+ *
+ * @param bio - bio to fill
+ * @param data - kernel virtual address of td_bio_get_byte_size(bio) bytes
+ */
+void td_bio_copy_from_virt(td_bio_ref bio, const void *data)
+{
+	const char *src = data;
+	struct bio_vec bvec;
+	td_bvec_iter i;
+
+	td_bio_for_each_segment(bvec, bio, i) {
+		char *dst;
+		TD_MAP_BIO_DECLARE;
+
+		TD_MAP_BIO_PAGE(dst, &bvec);
+		memcpy(dst, src, bvec.bv_len);
+		TD_UNMAP_BIO_PAGE(dst, &bvec);
+
+		src += bvec.bv_len;
+	}
+}
+
+/**
+ * \brief copy the data in a bio out to a kernel buffer
+ *
+ * @param bio - bio to read
+ * @param data - kernel virtual address of td_bio_get_byte_size(bio) bytes
+ */
+void td_bio_copy_to_virt(td_bio_ref bio, void *data)
+{
+	char *dst = data;
+	struct bio_vec bvec;
+	td_bvec_iter i;
+
+	td_bio_for_each_segment(bvec, bio, i) {
+		char *src;
+		TD_MAP_BIO_DECLARE;
+
+		TD_MAP_BIO_PAGE(src, &bvec);
+		memcpy(dst, src, bvec.bv_len);
+		TD_UNMAP_BIO_PAGE(src, &bvec);
+
+		dst += bvec.bv_len;
+	}
+}
+
+/**
+ * \brief check if a bio carries only zeros
+ *
+ * @param bio - bio to read
+ * @return non-zero if every byte is zero; stops at the first one that isn't
+ */
+int td_bio_is_zero(td_bio_ref bio)
+{
+	struct bio_vec bvec;
+	td_bvec_iter i;
+
+	td_bio_for_each_segment(bvec, bio, i) {
+		const uint64_t *src;
+		unsigned w, words = bvec.bv_len / sizeof(uint64_t);
+		int zero = 1;
+		TD_MAP_BIO_DECLARE;
+
+		WARN_ON(bvec.bv_len % sizeof(uint64_t));
+
+		TD_MAP_BIO_PAGE(src, &bvec);
+		for (w = 0; w < words; w++) {
+			if (src[w]) {
+				zero = 0;
+				break;
+			}
+		}
+		TD_UNMAP_BIO_PAGE(src, &bvec);
+
+		if (!zero)
+			return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * \brief set up a bio the driver owns to write one of its own pages
+ *
+ * @param bio - bio to set up, it is never submitted to the block layer
+ * @param bvec - single vector for the bio to use
+ * @param page - data to write, starting at its first byte
+ * @param sector - where to write it, in 512B sectors
+ * @param size - bytes to write
+ */
+void td_bio_init_page_write(td_bio_ref bio, struct bio_vec *bvec,
+		struct page *page, uint64_t sector, unsigned size)
+{
+	memset(bio, 0, sizeof(*bio));
+
+	bvec->bv_page   = page;
+	bvec->bv_len    = size;
+	bvec->bv_offset = 0;
+
+	bio->bi_rw      = WRITE;
+	bio->bio_sector = sector;
+	bio->bio_size   = size;
+	bio->bi_io_vec  = bvec;
+	bio->bi_vcnt    = 1;
+}
+
+#if KABI__bio_endio == 3
+static int td_bio_owned_end_io(struct bio *bio, unsigned int bytes_done,
+		int error)
+{
+	struct td_bio_owner *owner = bio->bi_private;
+
+	if (bio->bi_size)
+		return 1;
+
+	owner->end(owner, error);
+	return 0;
+}
+#else
+static void td_bio_owned_end_io(struct bio *bio, int error)
+{
+	struct td_bio_owner *owner = bio->bi_private;
+
+	owner->end(owner, error);
+}
+#endif
+
+/**
+ * \brief set up a bio the driver owns, completed through its owner
+ *
+ * @param bio - bio to set up, queued on the engine like a block request
+ * @param bvec - one vector per page
+ * @param pages - data, PAGE_SIZE of each page is used
+ * @param count - number of pages
+ * @param sector - where the data goes, in 512B sectors
+ * @param write - non-zero to write the pages, else they are read into
+ * @param owner - called when the bio completes
+ */
+void td_bio_init_owned(td_bio_ref bio, struct bio_vec *bvec,
+		struct page **pages, unsigned count, uint64_t sector, int write,
+		struct td_bio_owner *owner)
+{
+	unsigned i;
+
+	bio_init(bio);
+
+	for (i = 0; i < count; i++) {
+		bvec[i].bv_page   = pages[i];
+		bvec[i].bv_len    = PAGE_SIZE;
+		bvec[i].bv_offset = 0;
+	}
+
+	bio->bi_rw      = write ? WRITE : READ;
+	bio->bio_sector = sector;
+	bio->bio_size   = count * PAGE_SIZE;
+	bio->bi_io_vec  = bvec;
+	bio->bi_vcnt    = count;
+	bio->bi_max_vecs = count;
+	bio->bi_end_io  = td_bio_owned_end_io;
+	bio->bi_private = owner;
+}
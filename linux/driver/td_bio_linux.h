@@ -73,6 +73,32 @@ static inline int td_bio_is_sync(td_bio_ref ref)
 		;
 }
 
+/*
+ * Returns non-zero if writes completed before this request have to be on
+ * the device before it is processed.
+ */
+static inline int td_bio_is_flush(td_bio_ref ref)
+{
+#if defined(KABI__blk_queue_flush)
+	return !!(ref->bi_rw & REQ_FLUSH);
+#else
+	return !!(ref->bi_rw & REQ_HARDBARRIER);
+#endif
+}
+
+/*
+ * Returns non-zero if the request has to be on the device before it is
+ * completed.
+ */
+static inline int td_bio_is_fua(td_bio_ref ref)
+{
+#if defined(REQ_FUA)
+	return !!(ref->bi_rw & REQ_FUA);
+#else
+	return 0;
+#endif
+}
+
 static inline int td_bio_is_discard(td_bio_ref ref)
 {
 #if defined(BIO_DISCARD)
@@ -33,6 +33,76 @@
 #include <linux/module.h>
 
 
+#ifdef KABI__blk_check_plugged
+/*
+ * Bios submitted while the task holds a plug are collected here, and
+ * handed to the engine as one list when the plug is released.  The list is
+ * also handed over whenever it gets to TD_DEVICE_PLUG_MAX, or INCOMING_SLEEP
+ * if that's smaller, so bios held in a plug can't get around the incoming
+ * backpressure.
+ */
+#define TD_DEVICE_PLUG_MAX 64
+
+struct td_device_plug {
+	struct blk_plug_cb      cb;     /* allocated by blk_check_plugged() */
+	struct bio_list         bios;
+	unsigned                count;  /* bios on the list */
+};
+
+static void td_device_unplug(struct blk_plug_cb *cb, bool from_schedule)
+{
+	struct td_device_plug *plug = container_of(cb, struct td_device_plug, cb);
+	struct td_device *dev = cb->data;
+
+	/* only takes a spinlock and pokes, so it's fine from schedule too */
+	td_engine_queue_bio_list(&dev->td_engine, &plug->bios);
+	kfree(plug);
+}
+
+/* returns non-zero if the bio was taken by the task's plug */
+static int td_device_plug_bio(struct td_device *dev, struct bio *bio)
+{
+	struct td_engine *eng = &dev->td_engine;
+	struct blk_plug_cb *cb;
+	struct td_device_plug *plug;
+	unsigned max;
+
+	if (!current->plug)
+		return 0;
+
+	/* a bio that fails the checks is already completed */
+	if (td_engine_accept_bio(eng, bio))
+		return 1;
+
+	/* accepting can sleep, which flushes and frees the plug's list, so
+	 * it's only looked up now */
+	cb = blk_check_plugged(td_device_unplug, dev, sizeof(*plug));
+	if (!cb) {
+		td_engine_queue_accepted_bio(eng, bio);
+		return 1;
+	}
+
+	plug = container_of(cb, struct td_device_plug, cb);
+
+	bio_list_add(&plug->bios, bio);
+	plug->count ++;
+
+	max = TD_DEVICE_PLUG_MAX;
+	if (td_eng_conf_var_get(eng, INCOMING_SLEEP))
+		max = min_t(unsigned, max,
+				td_eng_conf_var_get(eng, INCOMING_SLEEP));
+
+	if (plug->count >= max) {
+		/* the list is empty after this, the plug stays */
+		td_engine_queue_bio_list(eng, &plug->bios);
+		plug->count = 0;
+	}
+
+	return 1;
+}
+#else
+#define td_device_plug_bio(dev, bio) (0)
+#endif
 
 /*
  * Request entry point for single device block requests
@@ -43,6 +113,9 @@ void td_device_make_request (struct request_queue *q, struct bio* bio)
 	struct td_device *dev = td_device_from_os(q->queuedata);
 	struct td_engine *eng = &dev->td_engine;
 
+	if (td_device_plug_bio(dev, bio))
+		return;
+
 	(void)td_engine_queue_bio(eng, bio);
 }
 #else
@@ -51,6 +124,9 @@ int td_device_make_request (struct request_queue* q, struct bio* bio)
 	struct td_device *dev = td_device_from_os(q->queuedata);
 	struct td_engine *eng = &dev->td_engine;
 
+	if (td_device_plug_bio(dev, bio))
+		return 0;
+
 	return td_engine_queue_bio(eng, bio);
 }
 #endif
@@ -286,7 +362,13 @@ int td_linux_block_create(struct td_osdev *dev)
 	 * blk_queue_ordered was replaced with blk_queue_flush 
 	 * The default implementation is QUEUE_ORDERED_DRAIN
 	 */
+#ifdef CONFIG_TERADIMM_WRITE_STAGING
+	/* writes can be completed from the staging buffer, flushes wait
+	 * for them to reach the device */
+	blk_queue_flush(queue, REQ_FLUSH);
+#else
 	blk_queue_flush(queue, 0);
+#endif
 #else
 #error undefined KABI__blk_queue_flush or KABI__blk_queue_ordered
 #endif
@@ -351,7 +433,7 @@ int td_linux_block_create(struct td_osdev *dev)
 #endif
 #ifdef KABI__blk_queue_max_discard_sectors
 		/* 0xFFFF (max sector size of chunk on trim) * 64  * # SSD */
-		blk_queue_max_discard_sectors(queue, TD_MAX_DISCARD_LBA_COUNT * 2);
+		blk_queue_max_discard_sectors(queue, TD_MAX_DISCARD_SECTORS);
 		did_something++;
 #endif
 #ifdef KABI__blk_queue_discard_zeroes_data
@@ -31,6 +31,7 @@
 #include "td_raid.h"
 #include "td_ioctl.h"
 #include "td_monitor.h"
+#include "td_place.h"
 #ifdef CONFIG_PM
 #include <linux/pm.h>
 #endif
@@ -199,6 +200,7 @@ static long td_control_ioctl(struct file *filp, unsigned int cmd,
 		struct td_ioctl_device_name dev_name;
 		struct td_ioctl_device_ver ver;
 		struct td_ioctl_monitor_rate mon_rate;
+		struct td_ioctl_placement placement;
 #ifdef TD_IOCTL_RAID_CREATE_V0
 		struct td_ioctl_raid_device_create_v0 raid_create_v0;
 #endif
@@ -309,6 +311,11 @@ static long td_control_ioctl(struct file *filp, unsigned int cmd,
 		copy_in_size = sizeof(struct td_ioctl_monitor_rate);
 		break;
 
+	case TD_IOCTL_PLACEMENT:
+		copy_in_size = sizeof(struct td_ioctl_placement);
+		copy_out_size = sizeof(struct td_ioctl_placement);
+		break;
+
 #ifdef TD_IOCTL_RAID_CREATE_V0
 	case TD_IOCTL_RAID_CREATE_V0:
 		copy_in_size = sizeof(k_arg->raid_create_v0);
@@ -485,6 +492,10 @@ static long td_control_ioctl(struct file *filp, unsigned int cmd,
 		rc = td_ioctl_control_mon_rate(&k_arg->mon_rate);
 		break;
 
+	case TD_IOCTL_PLACEMENT:
+		rc = td_ioctl_control_placement(&k_arg->placement);
+		break;
+
 #ifdef TD_IOCTL_RAID_CREATE_V0
 	case TD_IOCTL_RAID_CREATE_V0:
 		rc = td_raid_create_v0(k_arg->raid_create_v0.raid_name,
@@ -777,6 +788,11 @@ int td_ioctl_control_mon_rate( struct td_ioctl_monitor_rate *mr)
 	return 0;
 }
 
+int td_ioctl_control_placement(struct td_ioctl_placement *pl)
+{
+	return td_place_plan(pl);
+}
+
 int td_ioctl_control_driver_ver (struct td_ioctl_device_ver *ver)
 {
 	memcpy(ver->version, version, sizeof(version));
@@ -29,6 +29,11 @@ uint td_endio_msec = 0;
 module_param_named(endio_msec, td_endio_msec, uint, 0444);
 MODULE_PARM_DESC(endio_msec, "Delay for endio");
 
+uint td_endio_submitter = 0;
+
+module_param_named(endio_submitter, td_endio_submitter, uint, 0444);
+MODULE_PARM_DESC(endio_submitter, "Complete bios on the submitting node");
+
 #  define TD_DG_CONF_GENERAL_ENTRY(what, when, min, max) \
         [TD_DEVGROUP_CONF_GENERAL_##what] = { check_##when, min, max },
 #  define TD_DG_CONF_WORKER_ENTRY(what, when, min, max) \
@@ -48,6 +53,7 @@ const struct td_dg_conf_var_desc td_dg_conf_general_var_desc[TD_DEVGROUP_CONF_GE
 #ifdef CONFIG_TERADIMM_OFFLOAD_COMPLETION_THREAD
 	TD_DG_CONF_GENERAL_ENTRY(ENDIO_ENABLE,                            always,   0, UINT_MAX)
 	TD_DG_CONF_GENERAL_ENTRY(ENDIO_SPIN_MSEC,                         always,   1, UINT_MAX)
+	TD_DG_CONF_GENERAL_ENTRY(ENDIO_ON_SUBMITTER,                      always,   0, 1)
 #endif
 };
 
@@ -66,6 +72,12 @@ const struct td_dg_conf_var_desc td_dg_conf_worker_var_desc[TD_DEVGROUP_CONF_WOR
 	TD_DG_CONF_WORKER_ENTRY(SYNC_JIFFIES,                           always,  0, UINT_MAX)
 	TD_DG_CONF_WORKER_ENTRY(WAKE_SHARE,                             always,  0, UINT_MAX)
 	TD_DG_CONF_WORKER_ENTRY(WAKE_SLEEP,                             always,  0, UINT_MAX)
+	TD_DG_CONF_WORKER_ENTRY(SCALE_MSEC,                    token_recompute,  0, UINT_MAX)
+	TD_DG_CONF_WORKER_ENTRY(SCALE_MIN_TOKENS,              token_recompute,  0, TD_WORKER_MAX_PER_NODE)
+	TD_DG_CONF_WORKER_ENTRY(SCALE_MAX_TOKENS,              token_recompute,  1, TD_WORKER_MAX_PER_NODE)
+	TD_DG_CONF_WORKER_ENTRY(SCALE_UP_QUEUED,                        always,  1, UINT_MAX)
+	TD_DG_CONF_WORKER_ENTRY(SCALE_DOWN_PCT,                         always,  0, 100)
+	TD_DG_CONF_WORKER_ENTRY(SCALE_UP_PCT,                           always,  0, 100)
 };
 
 /* ---- database of all device groups ---- */
@@ -179,6 +191,9 @@ static struct td_devgroup *__td_devgroup_create(const char *name, int socket,
 {
 	int rc;
 	struct td_devgroup *dg;
+#ifdef CONFIG_TERADIMM_OFFLOAD_COMPLETION_THREAD
+	int cpu;
+#endif
 
 	rc = -ENOMEM;
 	dg = kzalloc_node(sizeof(*dg), GFP_KERNEL, socket);
@@ -194,9 +209,11 @@ static struct td_devgroup *__td_devgroup_create(const char *name, int socket,
 
 #ifdef CONFIG_TERADIMM_OFFLOAD_COMPLETION_THREAD
 	init_waitqueue_head(&dg->dg_endio_event);
-	spin_lock_init(&dg->dg_endio_lock);
-	bio_list_init(&dg->dg_endio_success);
-	bio_list_init(&dg->dg_endio_failure);
+	dg->dg_endio_batch = alloc_percpu(struct td_dg_endio_batch);
+	if (!dg->dg_endio_batch)
+		goto error_alloc_endio;
+	for_each_possible_cpu(cpu)
+		spin_lock_init(&per_cpu_ptr(dg->dg_endio_batch, cpu)->lock);
 #endif
 
 	mutex_init(&dg->dg_mutex);
@@ -214,6 +231,14 @@ static struct td_devgroup *__td_devgroup_create(const char *name, int socket,
 #endif
 	}
 
+	if (td_endio_submitter) {
+#ifdef CONFIG_TERADIMM_OFFLOAD_COMPLETION_THREAD
+		td_dg_conf_general_var_set(dg, ENDIO_ON_SUBMITTER, 1);
+#else
+		pr_warn("Module option endio_submitter ignored\n");
+#endif
+	}
+
 	td_dg_conf_worker_var_set(dg, MAX_OCCUPANCY, TD_WORKER_MAX_OCCUPANCY);
 	td_dg_conf_worker_var_set(dg, EXTRA_TOKENS, TD_WORKER_EXTRA_TOKENS);
 	td_dg_conf_worker_var_set(dg, MAX_LOOPS, TD_WORKER_MAX_LOOPS);
@@ -228,6 +253,12 @@ static struct td_devgroup *__td_devgroup_create(const char *name, int socket,
 	td_dg_conf_worker_var_set(dg, SYNC_JIFFIES, TD_WORKER_SYNC_JIFFIES);
 	td_dg_conf_worker_var_set(dg, WAKE_SHARE, TD_WORKER_WAKE_SHARE);
 	td_dg_conf_worker_var_set(dg, WAKE_SLEEP, TD_WORKER_WAKE_SLEEP);
+	td_dg_conf_worker_var_set(dg, SCALE_MSEC, TD_WORKER_SCALE_MSEC);
+	td_dg_conf_worker_var_set(dg, SCALE_MIN_TOKENS, TD_WORKER_SCALE_MIN_TOKENS);
+	td_dg_conf_worker_var_set(dg, SCALE_MAX_TOKENS, TD_WORKER_SCALE_MAX_TOKENS);
+	td_dg_conf_worker_var_set(dg, SCALE_UP_QUEUED, TD_WORKER_SCALE_UP_QUEUED);
+	td_dg_conf_worker_var_set(dg, SCALE_DOWN_PCT, TD_WORKER_SCALE_DOWN_PCT);
+	td_dg_conf_worker_var_set(dg, SCALE_UP_PCT, TD_WORKER_SCALE_UP_PCT);
 
 	atomic_set(&dg->dg_refcnt, 1);
 
@@ -238,6 +269,10 @@ static struct td_devgroup *__td_devgroup_create(const char *name, int socket,
 	return dg;
 
 error_start:
+#ifdef CONFIG_TERADIMM_OFFLOAD_COMPLETION_THREAD
+	free_percpu(dg->dg_endio_batch);
+error_alloc_endio:
+#endif
 	kfree(dg);
 error_alloc:
 	return ERR_PTR(rc);
@@ -245,6 +280,11 @@ error_alloc:
 
 /* ---- init/exit ---- */
 
+#ifdef CONFIG_TERADIMM_OFFLOAD_COMPLETION_THREAD
+static void td_endio_remote_init(void);
+static void td_endio_remote_exit(void);
+#endif
+
 int __init td_devgroup_init(void)
 {
 	mutex_init(&td_devgroup_list_mutex);
@@ -252,6 +292,10 @@ int __init td_devgroup_init(void)
 	spin_lock_init(&td_devgroup_pool_lock);
 	td_devgroup_pool_count = 0;
 
+#ifdef CONFIG_TERADIMM_OFFLOAD_COMPLETION_THREAD
+	td_endio_remote_init();
+#endif
+
 	return 0;
 }
 
@@ -260,6 +304,10 @@ void td_devgroup_exit(void)
 	WARN_ON(!list_empty(&td_devgroup_pool));
 	WARN_ON(td_devgroup_pool_count);
 
+#ifdef CONFIG_TERADIMM_OFFLOAD_COMPLETION_THREAD
+	td_endio_remote_exit();
+#endif
+
 	return;
 }
 
@@ -301,6 +349,9 @@ void td_devgroup_put(struct td_devgroup *dg)
 	WARN_ON(!list_empty(&dg->dg_devs_list));
 	WARN_ON(dg->dg_devs_count);
 
+#ifdef CONFIG_TERADIMM_OFFLOAD_COMPLETION_THREAD
+	free_percpu(dg->dg_endio_batch);
+#endif
 	kfree(dg);
 }
 
@@ -607,6 +658,31 @@ bail_no_ref:
 	return rc;
 }
 
+/** move the workers of every running group to a fresh placement plan */
+int td_devgroup_replan(void)
+{
+	int rc = 0;
+	struct td_devgroup *dg;
+
+	mutex_lock(&td_devgroup_list_mutex);
+
+	list_for_each_entry(dg, &td_devgroup_pool, dg_pool_link) {
+		td_devgroup_lock(dg);
+		if (td_devgroup_is_running(dg))
+			rc = td_work_node_replan(&dg->dg_work_node);
+		td_devgroup_unlock(dg);
+
+		if (rc) {
+			pr_err("%s: replan failed: %d\n", dg->dg_name, rc);
+			break;
+		}
+	}
+
+	mutex_unlock(&td_devgroup_list_mutex);
+
+	return rc;
+}
+
 int td_devgroup_sync_device(struct td_devgroup *dg,
 		struct td_device *dev)
 {
@@ -691,6 +767,11 @@ void td_busy_dump(struct td_devgroup *dg)
 			(drv_poll_usec * 100) / drv_ttl_usec,
 			drv_poll_usec / 1000000, drv_poll_usec % 1000000);
 
+	if (s->poll_tokens)
+		pr_info("  poll { %llu tokens, %llu cycles/token }\n",
+			(unsigned long long)s->poll_tokens,
+			(unsigned long long)(drv_poll / s->poll_tokens));
+
 	if (sim_ttl_usec)
 		pr_info("  sim { "
 			"tok %lu%% %lu.%06lu sec, "
@@ -726,6 +807,17 @@ int td_devgroup_get_counter(struct td_devgroup *dg,
 	case TD_DEVGROUP_COUNTER_ENDIO:
 		if (cntr_num >= TD_DEVGROUP_ENDIO_COUNT_MAX)
 			goto bail;
+#ifdef CONFIG_TERADIMM_OFFLOAD_COMPLETION_THREAD
+		/* producers count on their own CPU, sum them up here */
+		if (cntr_num == TD_DEVGROUP_ENDIO_COUNT_QUEUED) {
+			int cpu;
+			*val = 0;
+			for_each_possible_cpu(cpu)
+				*val += per_cpu_ptr(dg->dg_endio_batch, cpu)->queued;
+			rc = 0;
+			goto bail;
+		}
+#endif
 		reg = &dg->counters.endio[cntr_num];
 		break;
 
@@ -837,74 +929,319 @@ bail:
 /* ---- ---- */
 
 #ifdef CONFIG_TERADIMM_OFFLOAD_COMPLETION_THREAD
+/* turn a LIFO list around, so it comes back in the order it was queued */
+static inline td_bio_ref td_dg_endio_fifo(td_bio_ref bio)
+{
+	td_bio_ref next, fifo = NULL;
+
+	while (bio) {
+		next = bio->bi_next;
+		bio->bi_next = fifo;
+		fifo = bio;
+		bio = next;
+	}
+
+	return fifo;
+}
+
+/* lock-free push of a bio onto a remote list;
+ * returns true if the list was empty before */
+static inline bool td_dg_endio_push(td_bio_ref *head, td_bio_ref bio)
+{
+	td_bio_ref old;
+
+	do {
+		old = ACCESS_ONCE(*head);
+		bio->bi_next = old;
+	} while (cmpxchg(head, old, bio) != old);
+
+	return !old;
+}
+
+/* take an entire remote list, and return it in the order it was queued */
+static inline td_bio_ref td_dg_endio_take(td_bio_ref *head)
+{
+	return td_dg_endio_fifo(xchg(head, NULL));
+}
+
+/* push onto a per-CPU batch list, called with the batch lock held */
+static inline void td_dg_endio_batch_push(td_bio_ref *head, td_bio_ref bio)
+{
+	bio->bi_next = *head;
+	*head = bio;
+}
+
+/* take an entire per-CPU batch list, called with the batch lock held */
+static inline td_bio_ref td_dg_endio_batch_take(td_bio_ref *head)
+{
+	td_bio_ref bio = *head;
+
+	*head = NULL;
+	return td_dg_endio_fifo(bio);
+}
+
 /**
- * Add a bio to the back of the "done" list
+ * Add a bio to the "done" batch of the current CPU
  * @param eng    - the device
  * @param bio    - BIO to queue for completion
  */
 void td_devgroup_queue_endio(struct td_devgroup *dg, td_bio_ref bio, int result)
 {
-	spin_lock_bh(&dg->dg_endio_lock);
+	struct td_dg_endio_batch *b;
+	unsigned long flags;
+	bool first;
+
+	b = per_cpu_ptr(dg->dg_endio_batch, get_cpu());
+
+	spin_lock_irqsave(&b->lock, flags);
+
+	first = !b->success && !b->failure;
 
 	if (likely(result == 0))
-		bio_list_add(&dg->dg_endio_success, bio);
+		td_dg_endio_batch_push(&b->success, bio);
 	else
-		bio_list_add(&dg->dg_endio_failure, bio);
+		td_dg_endio_batch_push(&b->failure, bio);
+
+	/* the oldest entry in the batch determines the queueing delay */
+	if (first)
+		b->ts = td_get_cycles();
+
+	b->queued ++;
 
-	dg->dg_endio_count ++;
-	dg->dg_endio_ts = jiffies;
+	spin_unlock_irqrestore(&b->lock, flags);
 
-	spin_unlock_bh(&dg->dg_endio_lock);
-	td_dg_counter_var_endio_inc(dg, QUEUED);
+	put_cpu();
+
+	/* publish the batch before looking for sleepers; pairs with the
+	 * barrier in wait_event, so either the thread sees the batch or it
+	 * is seen on the queue */
+	smp_mb();
+
+	/* only the first bio of a batch can find the endio thread asleep */
+	if (first && waitqueue_active(&dg->dg_endio_event)) {
+		td_dg_counter_var_endio_inc(dg, WAKES);
+		wake_up_interruptible(&dg->dg_endio_event);
+	}
 }
 
-unsigned __td_devgroup_do_endio (struct td_devgroup* dg)
+/* ---- completion on the submitting node ---- */
+
+/**
+ * Each CPU has a list of bios that other nodes completed on its behalf.
+ * The first bio added to an empty list sends an IPI, which schedules the
+ * tasklet that drains the list on the target CPU.
+ */
+struct td_endio_remote {
+	td_bio_ref            bios;                       /**< LIFO, lock-free */
+	struct tasklet_struct tasklet;
+	int                   target[TD_BIO_ORIGIN_MAX];  /**< per node target, as producer */
+};
+
+static DEFINE_PER_CPU(struct td_endio_remote, td_endio_remote);
+
+static void td_endio_remote_run(unsigned long data)
 {
-	unsigned count = 0;
-	unsigned long ts_delta;
-	td_bio_ref bio;
-	struct bio_list good, bad;
+	struct td_endio_remote *r = (void*)data;
+	td_bio_ref bio, next;
 
-	if (dg == NULL || ! dg->dg_endio_count)
-		return 0;
+	for (bio = td_dg_endio_take(&r->bios); bio; bio = next) {
+		next = bio->bi_next;
+		bio->bi_next = NULL;
+		td_bio_complete_success(bio);
+	}
+}
 
-	bio_list_init(&good);
-	bio_list_init(&bad);
+static void td_endio_remote_ipi(void *data)
+{
+	struct td_endio_remote *r = data;
 
-	ts_delta = jiffies;
-	/* Grab the lock */
-	spin_lock_bh(&dg->dg_endio_lock);
+	tasklet_schedule(&r->tasklet);
+}
 
-	ts_delta -= dg->dg_endio_ts;
+/* pick a CPU on the node, spreading producers over the node's CPUs */
+static int td_endio_remote_pick(int node)
+{
+	const struct cpumask *mask = cpumask_of_node(node);
+	unsigned count = 0, nth;
+	int cpu;
 
-	/* Stash good ones */
-	bio_list_merge(&good, &dg->dg_endio_success);
-	bio_list_init(&dg->dg_endio_success);
+	for_each_cpu_and(cpu, mask, cpu_online_mask)
+		count++;
 
-	/* Stash bad ones */
-	bio_list_merge(&bad, &dg->dg_endio_failure);
-	bio_list_init(&dg->dg_endio_failure);
+	if (!count)
+		return nr_cpu_ids;
 
+	nth = smp_processor_id() % count;
+	for_each_cpu_and(cpu, mask, cpu_online_mask) {
+		if (!nth--)
+			break;
+	}
+
+	return cpu;
+}
+
+/**
+ * Queue a successfully completed bio for completion on the node that
+ * submitted it.
+ * @param dg     - devgroup doing the completion
+ * @param bio    - BIO to complete
+ * @param node   - node that submitted the bio, see td_bio_origin()
+ * @return false if the bio should be completed locally
+ */
+bool td_devgroup_queue_endio_remote(struct td_devgroup *dg, td_bio_ref bio,
+		int node)
+{
+	struct td_endio_remote *mine, *r;
+	int this_cpu, cpu, rc;
+
+	if (node < 0 || node >= TD_BIO_ORIGIN_MAX)
+		return false;
 
-	dg->dg_endio_count = 0;
-	dg->dg_endio_ts = 0;
+	this_cpu = get_cpu();
 
-	spin_unlock_bh(&dg->dg_endio_lock);
+	/* already on the submitter's node, nothing to gain */
+	if (cpu_to_node(this_cpu) == node)
+		goto local;
 
-	if (ts_delta > 3) {
-		pr_warn("DG %s endio lost %lu jiffies\n", dg->dg_name,
-				ts_delta);
+	mine = &per_cpu(td_endio_remote, this_cpu);
+	cpu = mine->target[node];
+	if (unlikely(cpu >= nr_cpu_ids || !cpu_online(cpu))) {
+		cpu = td_endio_remote_pick(node);
+		if (cpu >= nr_cpu_ids)
+			goto local;
+		mine->target[node] = cpu;
 	}
-	
-	/* Now we complete things, good first */
-	while((bio = bio_list_pop(&good))) {
-		count++;
-		td_bio_complete_success(bio);
+
+	r = &per_cpu(td_endio_remote, cpu);
+	td_dg_counter_var_endio_inc(dg, REMOTE);
+
+	if (!td_dg_endio_push(&r->bios, bio))
+		goto queued;
+
+	/* first one in, the target needs to be told */
+	td_dg_counter_var_endio_inc(dg, REMOTE_IPIS);
+	rc = smp_call_function_single(cpu, td_endio_remote_ipi, r, 0);
+	if (unlikely(rc)) {
+		/* target went away, run its list from here */
+		mine->target[node] = nr_cpu_ids;
+		td_endio_remote_run((unsigned long)r);
 	}
 
-	while((bio = bio_list_pop(&bad))) {
-		count++;
-		td_bio_complete_failure(bio);
+queued:
+	put_cpu();
+	return true;
+
+local:
+	put_cpu();
+	return false;
+}
+
+static void td_endio_remote_init(void)
+{
+	struct td_endio_remote *r;
+	int cpu, node;
+
+	for_each_possible_cpu(cpu) {
+		r = &per_cpu(td_endio_remote, cpu);
+		r->bios = NULL;
+		tasklet_init(&r->tasklet, td_endio_remote_run,
+				(unsigned long)r);
+		for (node = 0; node < TD_BIO_ORIGIN_MAX; node++)
+			r->target[node] = nr_cpu_ids;
+	}
+}
+
+static void td_endio_remote_exit(void)
+{
+	struct td_endio_remote *r;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		r = &per_cpu(td_endio_remote, cpu);
+		tasklet_kill(&r->tasklet);
+		WARN_ON(r->bios);
+	}
+}
+
+static bool td_devgroup_endio_pending(struct td_devgroup *dg)
+{
+	struct td_dg_endio_batch *b;
+	int cpu;
+
+	/* a CPU that went offline can still have a batch */
+	for_each_possible_cpu(cpu) {
+		b = per_cpu_ptr(dg->dg_endio_batch, cpu);
+		if (ACCESS_ONCE(b->success) || ACCESS_ONCE(b->failure))
+			return true;
+	}
+
+	return false;
+}
+
+unsigned __td_devgroup_do_endio (struct td_devgroup* dg)
+{
+	struct td_dg_endio_batch *b;
+	unsigned count = 0, batch;
+	unsigned long delay_usec;
+	unsigned long flags;
+	cycles_t ts;
+	td_bio_ref bio, next, success, failure;
+	int cpu;
+
+	if (dg == NULL)
+		return 0;
+
+	/* a CPU that went offline can still have a batch */
+	for_each_possible_cpu(cpu) {
+		b = per_cpu_ptr(dg->dg_endio_batch, cpu);
+		if (!ACCESS_ONCE(b->success) && !ACCESS_ONCE(b->failure))
+			continue;
+
+		/* the timestamp belongs to these lists, take them together */
+		spin_lock_irqsave(&b->lock, flags);
+		success = td_dg_endio_batch_take(&b->success);
+		failure = td_dg_endio_batch_take(&b->failure);
+		ts = b->ts;
+		b->ts = 0;
+		spin_unlock_irqrestore(&b->lock, flags);
+
+		batch = 0;
+
+		/* Now we complete things, good first */
+		for (bio = success; bio; bio = next) {
+			next = bio->bi_next;
+			bio->bi_next = NULL;
+			td_bio_complete_success(bio);
+			batch++;
+		}
+
+		for (bio = failure; bio; bio = next) {
+			next = bio->bi_next;
+			bio->bi_next = NULL;
+			td_bio_complete_failure(bio);
+			batch++;
+		}
+
+		if (!batch)
+			continue;
+
+		count += batch;
+		td_dg_counter_var_endio_inc(dg, BATCHES);
+		if (batch > td_dg_counter_var_endio_get(dg, BATCH_MAX))
+			dg->counters.endio[TD_DEVGROUP_ENDIO_COUNT_BATCH_MAX] = batch;
+
+		if (!ts)
+			continue;
+
+		delay_usec = td_cycles_to_usec(td_get_cycles() - ts);
+		td_dg_counter_var_endio_add(dg, DELAY_USEC, delay_usec);
+		if (delay_usec > td_dg_counter_var_endio_get(dg, DELAY_MAX_USEC))
+			dg->counters.endio[TD_DEVGROUP_ENDIO_COUNT_DELAY_MAX_USEC] = delay_usec;
+
+		if (delay_usec > jiffies_to_usecs(3)) {
+			pr_warn("DG %s endio lost %lu usec\n", dg->dg_name,
+					delay_usec);
+		}
 	}
 
 	td_dg_counter_var_endio_add(dg, DONE, count);
@@ -914,7 +1251,7 @@ unsigned __td_devgroup_do_endio (struct td_devgroup* dg)
 
 static int td_devgroup_endio_condition(struct td_devgroup *dg)
 {
-	if (dg->dg_endio_count)
+	if (td_devgroup_endio_pending(dg))
 		return 1;
 
 	if (kthread_should_stop())
@@ -933,7 +1270,7 @@ static int td_devgroup_endio(void *thread_data)
 	dg->dg_endio_last_activity = jiffies;
 
 	while(! kthread_should_stop() ) {
-		if (dg->dg_endio_count) {
+		if (td_devgroup_endio_pending(dg)) {
 			unsigned count = __td_devgroup_do_endio(dg);
 			if (count) {
 				td_dg_counter_var_endio_add(dg, STOLEN, count);
@@ -944,7 +1281,7 @@ static int td_devgroup_endio(void *thread_data)
 		}
 
 		/* Maybe something happend while we were completing IO */
-		if (! dg->dg_endio_count) {
+		if (! td_devgroup_endio_pending(dg)) {
 			unsigned idle_timeout = 1 + msecs_to_jiffies(td_dg_conf_general_var_get(dg, ENDIO_SPIN_MSEC));
 			if (time_after(jiffies, dg->dg_endio_last_activity + idle_timeout)) {
 #ifdef TERADIMM_CONFIG_AVOID_EVENTS
@@ -959,6 +1296,9 @@ static int td_devgroup_endio(void *thread_data)
 			}
 		}
 	}
+
+	/* don't strand anything queued while we were stopping */
+	__td_devgroup_do_endio(dg);
 	
 	return 0;
 }
@@ -45,6 +45,24 @@ struct __packed td_dg_counters {
 	uint64_t endio[TD_DEVGROUP_ENDIO_COUNT_MAX];
 };
 
+#ifdef CONFIG_TERADIMM_OFFLOAD_COMPLETION_THREAD
+/**
+ * Per-CPU batch of bios waiting for the endio thread.
+ *
+ * Producers push onto the heads under the lock, chaining through bi_next;
+ * the endio thread takes both lists and the timestamp together under the
+ * same lock.  The lock is only contended when the endio thread empties
+ * this CPU's batch while a device on it completes IO.
+ */
+struct td_dg_endio_batch {
+	spinlock_t          lock;     /**< the lists are taken with ts */
+	td_bio_ref          success;  /**< LIFO of bios that completed OK */
+	td_bio_ref          failure;  /**< LIFO of bios that completed in error */
+	cycles_t            ts;       /**< when the oldest bio was added, or 0 */
+	uint64_t            queued;   /**< bios ever added on this CPU */
+};
+#endif
+
 struct td_dg_conf {
 	uint64_t general[TD_DEVGROUP_CONF_GENERAL_MAX];
 	uint64_t worker[TD_DEVGROUP_CONF_WORKER_MAX];
@@ -90,11 +108,7 @@ struct td_devgroup {
 	wait_queue_head_t   dg_endio_event;       /**< events that the worker thread waits on */
 	unsigned long       dg_endio_last_activity;
 
-	spinlock_t          dg_endio_lock;
-	struct bio_list     dg_endio_success;
-	struct bio_list     dg_endio_failure;
-	uint64_t            dg_endio_count;
-	unsigned long       dg_endio_ts;
+	struct td_dg_endio_batch __percpu *dg_endio_batch;
 #endif
 
 	struct td_dg_counters counters;
@@ -116,6 +130,7 @@ extern int td_devgroup_create(const char *name, int node, int nice);
 extern int td_devgroup_delete(const char *name);
 extern int td_devgroup_start(const char *name);
 extern int td_devgroup_stop(const char *name);
+extern int td_devgroup_replan(void);
 
 extern int td_devgroup_get_counter(struct td_devgroup *dg,
                 struct td_worker *w,
@@ -155,6 +170,8 @@ extern int td_devgroup_remove_device(struct td_devgroup*, struct td_device*);
 
 #ifdef CONFIG_TERADIMM_OFFLOAD_COMPLETION_THREAD
 extern void td_devgroup_queue_endio(struct td_devgroup *eng, td_bio_ref bio, int result);
+extern bool td_devgroup_queue_endio_remote(struct td_devgroup *dg,
+		td_bio_ref bio, int node);
 #endif
 
 
@@ -241,12 +258,20 @@ static inline int td_switch_task(struct td_devgroup *dg, int which)
 	return -1;
 }
 
+static inline void td_busy_poll_tokens(struct td_devgroup *dg, unsigned count)
+{
+	if (dg) {
+		dg->dg_cpu_stats.poll_tokens += count;
+	}
+}
+
 #else
 
 static inline void td_busy_reset(struct td_devgroup *dg) {}
 static inline void td_busy_start(struct td_devgroup *dg) {}
 static inline void td_busy_end(struct td_devgroup *dg)   {}
 static inline int td_switch_task(struct td_devgroup *dg, int which) { return -1; }
+static inline void td_busy_poll_tokens(struct td_devgroup *dg, unsigned count) {}
 
 #endif
 
@@ -24,6 +24,7 @@
 #include "td_devgroup.h"
 #include "td_ioctl.h"
 #include "td_engine.h"
+#include "td_eng_loadgen.h"
 #include "td_eng_conf_sysfs.h"
 #include "td_eng_conf.h"
 #include "td_compat.h"
@@ -35,6 +36,8 @@
 #include "td_osdev.h"
 #include "td_mapper.h"
 #include "td_worker.h"
+#include "td_mon.h"
+#include "td_place.h"
 
 #include <linux/kernel.h>
 #include <linux/blkdev.h>
@@ -62,6 +65,7 @@ static ulong td_external_train = 0;
 static uint td_dev_per_group = 2;
 static int td_default_dg_nice = -19;
 static char* td_discovery = "bios,asl";
+static uint td_discovery_threads = 0;
 
 /*ssg:  Discovery target is RAID = 3*/
 static int td_discovery_target = TD_DISCOVERY_TARGET_RAID;
@@ -77,6 +81,10 @@ module_param_named(default_devgroup_nice, td_default_dg_nice, int, 0444);
 
 module_param_named(discovery, td_discovery, charp, 0444);
 module_param_named(discovery_target, td_discovery_target, int, 0444);
+module_param_named(discovery_threads, td_discovery_threads, uint, 0444);
+MODULE_PARM_DESC(discovery_threads,
+		"How many discovered devices to bring up at the same time "
+		"(0 for all of them).");
 
 #ifdef CONFIG_TERADIMM_STATIC_NODEMAP
 uint td_socketmap[MAX_NUMNODES];
@@ -87,6 +95,7 @@ MODULE_PARM_DESC(socketmap, "Static socket -> CPU map");
 #endif
 
 atomic_t        td_discovery_in_progress;
+static DECLARE_WAIT_QUEUE_HEAD(td_discovery_wq); /**< woken when no bring-up is left */
 
 #ifdef CONFIG_TERADIMM_FORCE_SSD_HACK
 int force_ssd = -1;
@@ -118,7 +127,20 @@ MODULE_PARM_DESC(dev_per_group,
 
 static struct mutex td_device_list_mutex; /**< prevents races with/between creates */
 
-static struct semaphore td_discovery_sema; /**< prevents races with/between creates */
+static struct semaphore td_discovery_sema; /**< limits bring-ups running at once */
+
+/**
+ * a device being created; it holds its name and memory range until the
+ * device is registered, so creates can run outside td_device_list_mutex
+ */
+struct td_device_reservation {
+	struct list_head        link;
+	char                    name[TD_DEVICE_NAME_MAX+1];
+	uint64_t                base;
+	uint64_t                size;
+};
+
+static LIST_HEAD(td_device_reserved); /**< protected by td_device_list_mutex */
 
 /*! Used by td_dev_debug() macro. */
 int td_device_debug = 1;
@@ -128,6 +150,15 @@ void td_device_destroy (struct td_osdev *odev);
 int td_device_ioctl(struct td_osdev* dev, unsigned int cmd,
 		unsigned long raw_arg);
 
+static int __td_device_reserve(struct td_device_reservation *resv);
+static void td_device_unreserve(struct td_device_reservation *resv);
+static int __td_device_name_reserved(const char *name, void *opaque);
+static int __td_device_create_reserved(struct td_device_reservation *resv,
+		const char *slot_name, uint32_t irq_num, uint16_t memspeed,
+		uint16_t cpu_socket);
+static int __td_device_select_cpu_on_socket(uint16_t socket,
+		uint start_cpu, uint end_cpu, int dir);
+
 extern int __td_osdev_unique_id_from_name(const char *name);
 
 
@@ -168,21 +199,49 @@ error_completion:
 
 
 
+/**
+ * \brief NUMA node that per-device structures are allocated on
+ *
+ * @param socket    - socket of the device's memory controller
+ * @return node of the CPU the socketmap (or topology) picks for @socket,
+ *         or NUMA_NO_NODE if it cannot be determined
+ *
+ * Socket numbers and node numbers don't match on all systems, so this
+ * goes through the same CPU that the device's worker will be placed on.
+ */
+static int td_device_socket_node(uint16_t socket)
+{
+	int cpu;
+
+	cpu = __td_device_select_cpu_on_socket(socket, 0, MAX_CPU_NUMBER-1, -1);
+	if (cpu >= 0 && cpu < nr_cpu_ids && cpu_online(cpu))
+		return cpu_to_node(cpu);
+
+	if (socket < MAX_NUMNODES && node_online(socket))
+		return socket;
+
+	return NUMA_NO_NODE;
+}
+
 /** allocate, initialize, and return a new device with refcnt=1 */
 static struct td_device *__td_device_create(
 		const char *name, const char *slot_name,
 		uint64_t phys_mem_base, uint64_t phys_mem_size,
 		uint32_t irq_num, uint16_t memspeed, uint16_t cpu_socket)
 {
-	int rc;
+	int rc, node;
 	struct td_device *dev;
 pr_err("%s: enter", __FUNCTION__);
 	rc = td_mapper_check_memory_mapping(name, phys_mem_base, phys_mem_size);
 	if (rc)
 		goto error_args;
 
+	/* the engine and its tokens are embedded in the device, so this
+	 * places everything the polling loop touches next to its worker */
+	node = td_device_socket_node(cpu_socket);
+
 	rc = -ENOMEM;
-	dev = kzalloc_node(sizeof(*dev), GFP_KERNEL, cpu_socket);
+	dev = kzalloc_node(sizeof(*dev), GFP_KERNEL, node);
 	if (!dev)
 		goto error_alloc;
 
@@ -197,9 +256,10 @@ pr_err("%s: enter", __FUNCTION__);
 	dev->td_irq = irq_num;
 	dev->td_memspeed = memspeed;
 	dev->td_cpu_socket = cpu_socket;
+	dev->td_node = node;
 
-	td_os_info(&dev->os, "Device %s is found in %s\n",
-			name, (dev->td_slot ? : "(unknown)"));
+	td_os_info(&dev->os, "Device %s is found in %s, socket %u, node %d\n",
+			name, (dev->td_slot ? : "(unknown)"), cpu_socket, node);
 pr_err("%s: td_os_info ", __FUNCTION__);
 	rc = td_mapper_init(&dev->td_mapper, name, phys_mem_base, phys_mem_size);
 	if (unlikely(rc))
@@ -429,6 +489,25 @@ int td_device_train(struct td_device *dev)
 	return 0;
 }
 
+/* a bring-up thread is done, let the next one start */
+static void td_discovery_done(void)
+{
+	up(&td_discovery_sema);
+	if (atomic_dec_and_test(&td_discovery_in_progress))
+		wake_up(&td_discovery_wq);
+}
+
+static void td_discovery_wait(void)
+{
+	int left;
+
+	while ( (left = atomic_read(&td_discovery_in_progress)) > 0) {
+		pr_warn("Waiting for device bring-up; (%u left)\n", left);
+		wait_event_timeout(td_discovery_wq,
+				!atomic_read(&td_discovery_in_progress), HZ);
+	}
+}
+
 #ifdef CONFIG_TERADIMM_ACPI_ASL
 static int td_device_create_and_online (void* arg)
 {
@@ -449,8 +528,9 @@ static int td_device_create_and_online (void* arg)
 	if (td_scan_enable == 2 && !strncmp(info->dev_name, "md", 2)) {
 		char md_name[8];
 
+		ret = -EINVAL;
 		if (strlen(info->dev_name) != 3)
-			return -EINVAL;
+			goto exit_nogrp;
 
 		strncpy(md_name, "zap", 3);
 		md_name[3] = info->dev_name[2];
@@ -552,6 +632,7 @@ exit_train:
 exit_nodev:
 exit_nocreate:
 exit_nogrp:
+	td_discovery_done();
 	return ret;
 }
 
@@ -564,13 +645,23 @@ static int td_device_probe_callback (struct td_device_info *info, void *opaque)
 
 	info->use_cpu = cpu;
 
+	td_place_device_discovered(info->uid.cpu_socket, info->uid.channel,
+			info->uid.slot_id);
+
+	/* wait for a free bring-up slot */
+	down(&td_discovery_sema);
+	atomic_inc(&td_discovery_in_progress);
+
 	worker = kthread_create(td_device_create_and_online,
 			info, "td/%s-%s", info->source, info->dev_name);
+	if (IS_ERR(worker)) {
+		td_discovery_done();
+		return PTR_ERR(worker);
+	}
 
 	if (cpu != 0) kthread_bind(worker, cpu);
 
 	wake_up_process(worker);
-	schedule();
 
 	return 0;
 }
@@ -578,7 +669,7 @@ static int td_device_probe_callback (struct td_device_info *info, void *opaque)
 
 struct td_discovery_thread_args {
 	struct td_discovered_info* dev_info;
-	char dev_name[8];
+	struct td_device_reservation resv;      /**< name and memory, until registered */
 };
 
 static int td_assign_new_name(const struct td_discovered_info* dev_info,
@@ -596,23 +687,27 @@ static int td_assign_new_name(const struct td_discovered_info* dev_info,
 			break;
 	}
 printk("Assigning new name for %p with prefix '%s'\n", dev_info, dev_prefix);
-	return td_osdev_assign_name(dev_prefix, buffer, size);
+	/* devices being brought up are not on the osdev list yet */
+	return td_osdev_assign_name_unless(dev_prefix, buffer, size,
+			__td_device_name_reserved, NULL);
 };
 
 int __td_device_create_discovered (void* data)
 {
 	struct td_discovery_thread_args *args = data;
 	struct td_discovered_info *dev_info = args->dev_info;
-	const char* dev_name = args->dev_name;
+	const char* dev_name = args->resv.name;
 	struct td_devgroup *dg;
 	struct td_device *dev;
 	int ret;
 	int loop_count = 0;
 pr_err("%s: enter", __FUNCTION__);
 	ret = -ENODEV;
-	dg = td_device_group_on_node(dev_info->source, args->dev_name, dev_info->socket);
-	if (!dg)
+	dg = td_device_group_on_node(dev_info->source, dev_name, dev_info->socket);
+	if (!dg) {
+		td_device_unreserve(&args->resv);
 		goto exit_nogrp;
+	}
 
 	/* create device.. ssg: IF A DEVICE IS FOUND, IF NOT BELOW WON'T GET CALLED */
 	pr_info("%s create device '%s' with base=0x%llx and size=0x%llx in group '%s'\n",
@@ -620,14 +715,8 @@ pr_err("%s: enter", __FUNCTION__);
 			dev_info->mem_base, dev_info->mem_size, dg->dg_name);
 
     //ssg: this call goes to common layer
-	ret = td_device_create(dev_name, dev_info->bank_locator,
-			dev_info->mem_base, dev_info->mem_size,
+	ret = __td_device_create_reserved(&args->resv, dev_info->bank_locator,
 			dev_info->irq, dev_info->mem_speed, dev_info->socket);
-
-	/* And now we are created, we release the mutex */
-	atomic_dec(&td_discovery_in_progress);
-	up(&td_discovery_sema);
-
 	if (ret) {
 		pr_err("%s ERROR: Can't create device: error %d\n",
 				dev_info->source, ret);
@@ -762,6 +851,8 @@ exit_nogrp:
 	dev_info->done(dev_info);
 	kfree(args);
 
+	td_discovery_done();
+
 	return ret;
 }
 
@@ -769,7 +860,7 @@ int td_device_create_discovered (struct td_discovered_info *dev_info, void* opaq
 {
 	struct task_struct * worker;
 	struct td_discovery_thread_args* args;
-	int cpu;
+	int cpu, ret;
 
 //SSG: WONT GET CALLED IF DEV NOT FOUND
 pr_err("%s: enter", __FUNCTION__);
@@ -780,35 +871,64 @@ pr_err("%s: enter", __FUNCTION__);
 		return -ENOMEM;
 	}
 
+	td_place_device_discovered(dev_info->socket, dev_info->channel,
+			dev_info->slot);
+
+	/* wait for a free bring-up slot */
 	down(&td_discovery_sema);
-/*/FFFFFF /*/
-	/* Find a name */
+	atomic_inc(&td_discovery_in_progress);
+
+	/* Find a name, and hold it and the memory until the device is
+	 * registered, so the next one can be created meanwhile */
 	args->dev_info = dev_info;
-	td_assign_new_name(dev_info, args->dev_name, sizeof(args->dev_name));
+	args->resv.base = dev_info->mem_base;
+	args->resv.size = dev_info->mem_size;
+
+	mutex_lock(&td_device_list_mutex);
+	ret = td_assign_new_name(dev_info, args->resv.name,
+			sizeof(args->resv.name));
+	if (!ret)
+		ret = __td_device_reserve(&args->resv);
+	mutex_unlock(&td_device_list_mutex);
+	if (ret) {
+		pr_err("%s ERROR: Can't reserve device: error %d\n",
+				dev_info->source, ret);
+		goto error_reserve;
+	}
 
 	cpu = td_device_select_cpu_on_socket(dev_info->socket);
 
 #ifndef CONFIG_TERADIMM_ALLOW_UNBOUND_DIMM
 	if (cpu == 0) {
 		pr_err("Couldn't find CPU for device on socket %u, not creating device \'%s\"\n",
-				dev_info->socket, args->dev_name);
-		dev_info->done(dev_info);
-		kfree(args);
-		return 0;
+				dev_info->socket, args->resv.name);
+		goto error_worker;
 	}
 #endif
 
-	atomic_inc(&td_discovery_in_progress);
-
+	/* each bring-up runs on its device's socket */
 	worker = kthread_create(__td_device_create_discovered,
-			args, "td/%s-%s", dev_info->source, args->dev_name);
+			args, "td/%s-%s", dev_info->source, args->resv.name);
+	if (IS_ERR(worker)) {
+		pr_err("%s ERROR: Can't start thread for '%s': error %ld\n",
+				dev_info->source, args->resv.name,
+				PTR_ERR(worker));
+		goto error_worker;
+	}
 
 	if (cpu != 0) kthread_bind(worker, cpu);
 
 	wake_up_process(worker);
-	schedule();
 
 	return 0;
+
+error_worker:
+	td_device_unreserve(&args->resv);
+error_reserve:
+	dev_info->done(dev_info);
+	kfree(args);
+	td_discovery_done();
+	return 0;
 }
 
 /* ---- init/exit ---- */
@@ -824,13 +944,12 @@ int __init td_device_init(void)
 	}
 #endif
 	mutex_init(&td_device_list_mutex);
-	sema_init(&td_discovery_sema, 1);
+	sema_init(&td_discovery_sema, td_discovery_threads ?: INT_MAX);
 
 	atomic_set(&td_discovery_in_progress, 0);
 	td_cpu_distribution_state_reset();
 
 	while (*next_discovery) {
-		int left = 0;
 		pr_info("Performing discovery: %s\n", next_discovery);
 		/*
 		* This is a bit of a hack...
@@ -839,11 +958,7 @@ int __init td_device_init(void)
 		* memory ranges, but they screw up ordering...
 		* Lets just wait for previous discovery to finish
 		*/
-		while ( (left = atomic_read(&td_discovery_in_progress)) > 0) {
-			pr_warn("Waiting for previous discovery; (%u left)\n",
-					left);
-			ssleep(1);
-		}
+		td_discovery_wait();
 
 		if (strncmp(next_discovery, "bios", 4) == 0) {
 
@@ -885,6 +1000,13 @@ int __init td_device_init(void)
 		}
 	}
 
+	/* devices come up in parallel, load is done when the slowest is */
+	td_discovery_wait();
+
+	/* groups created by the first devices up were planned before the
+	 * rest were discovered */
+	(void)td_devgroup_replan();
+
 	return 0;
 }
 
@@ -965,55 +1087,96 @@ static int __iter_device_check_exists(struct td_osdev *dev, void* data)
 
 
 
-int td_device_create(const char *name, const char *slot_name,
-		uint64_t phys_mem_base, uint64_t phys_mem_size,
-		uint32_t irq_num, uint16_t memspeed, uint16_t cpu_socket)
+/* caller holds td_device_list_mutex */
+static int __td_device_reserve(struct td_device_reservation *resv)
 {
+	struct td_device_check_exists_state check_state = {
+		resv->name, resv->base, resv->size
+	};
+	struct td_device_reservation *have;
 	int rc;
-	struct td_device *dev = NULL;
-pr_err("%s: enter", __FUNCTION__);
+
+	rc = td_osdev_list_iter(__iter_device_check_exists, &check_state);
+	if (rc)
+		return rc;
+
+	/* and against the ones still being created */
+	list_for_each_entry(have, &td_device_reserved, link) {
+		if (strncmp(resv->name, have->name, TD_DEVICE_NAME_MAX) == 0) {
+			pr_err("Device '%s' already exists.\n", resv->name);
+			return -EEXIST;
+		}
+
+		if (resv->base < have->base + have->size
+				&& have->base < resv->base + resv->size) {
+			pr_err("Device '%s' overlaps '%s'\n", resv->name,
+					have->name);
+			return -ERANGE;
+		}
+	}
+
+	list_add_tail(&resv->link, &td_device_reserved);
+	return 0;
+}
+
+static void td_device_unreserve(struct td_device_reservation *resv)
+{
 	mutex_lock(&td_device_list_mutex);
+	list_del(&resv->link);
+	mutex_unlock(&td_device_list_mutex);
+}
 
-	if (1) {
-		struct td_device_check_exists_state check_state = {
-			name, phys_mem_base, phys_mem_size
-		};
-		rc = td_osdev_list_iter(__iter_device_check_exists, &check_state);
-		if (rc)
-			goto error_create;
+/* caller holds td_device_list_mutex */
+static int __td_device_name_reserved(const char *name, void *opaque)
+{
+	struct td_device_reservation *have;
+
+	list_for_each_entry(have, &td_device_reserved, link) {
+		if (strncmp(name, have->name, TD_DEVICE_NAME_MAX) == 0)
+			return 1;
 	}
 
-	/* allocate/create a new device */
-	dev = __td_device_create(name, slot_name, phys_mem_base, phys_mem_size,
+	return 0;
+}
+
+/* create and register a device, and drop its reservation */
+static int __td_device_create_reserved(struct td_device_reservation *resv,
+		const char *slot_name, uint32_t irq_num, uint16_t memspeed,
+		uint16_t cpu_socket)
+{
+	int rc;
+	struct td_device *dev = NULL;
+
+	/* allocate/create a new device, other creates can run meanwhile */
+	dev = __td_device_create(resv->name, slot_name, resv->base, resv->size,
 			irq_num, memspeed, cpu_socket);
 	if (IS_ERR(dev)) {
 		rc = PTR_ERR(dev);
-		pr_err("Failed to create device '%s', err=%d.\n", name, rc);
+		pr_err("Failed to create device '%s', err=%d.\n", resv->name, rc);
 		goto error_create;
 	}
 
-	td_device_lock(dev);
-
 	/*
-	 * Our device is now crated and safe, so we can unlock this
-	 * We need to unlock it before the CHAR device is registered
-	 * or we have a lock (in device char layer) that get's locked after
-	 * this (inour misc_register(), or before this (in sys_open,
-	 * td_device_char_open, td_device_get_for_inode)
+	 * The device list mutex is not held here; the char device layer
+	 * takes its lock before it (in sys_open, td_device_char_open,
+	 * td_device_get_for_inode) and after it (in misc_register())
 	 */
-	mutex_unlock(&td_device_list_mutex);
+	td_device_lock(dev);
 
 	init_completion(&dev->td_state_change_completion);
 
 	rc = td_osdev_register(&dev->os);
 	if (rc) {
 		pr_err("Failed to register OS device '%s', err=%d.\n",
-				name, rc);
+				resv->name, rc);
 		goto error_osdev;
 	}
 
 	td_device_unlock(dev);
 
+	/* it's on the osdev list now */
+	td_device_unreserve(resv);
+
 	__module_get(THIS_MODULE);
 
 	return 0;
@@ -1022,11 +1185,32 @@ error_osdev:
 	td_device_unlock(dev);
 	td_device_put(dev);
 error_create:
-	mutex_unlock(&td_device_list_mutex);
+	td_device_unreserve(resv);
 
 	return rc;
 }
 
+int td_device_create(const char *name, const char *slot_name,
+		uint64_t phys_mem_base, uint64_t phys_mem_size,
+		uint32_t irq_num, uint16_t memspeed, uint16_t cpu_socket)
+{
+	int rc;
+	struct td_device_reservation resv;
+pr_err("%s: enter", __FUNCTION__);
+	snprintf(resv.name, sizeof(resv.name), "%s", name);
+	resv.base = phys_mem_base;
+	resv.size = phys_mem_size;
+
+	mutex_lock(&td_device_list_mutex);
+	rc = __td_device_reserve(&resv);
+	mutex_unlock(&td_device_list_mutex);
+	if (rc)
+		return rc;
+
+	return __td_device_create_reserved(&resv, slot_name, irq_num,
+			memspeed, cpu_socket);
+}
+
 int td_device_delete(const char *name)
 {
 	int rc;
@@ -1147,6 +1331,9 @@ int td_device_attach(struct td_device *dev, const char *group)
 		goto error_completion;
 	}
 #endif
+	/* a worker owns it now, poll it for ECC errors */
+	td_monitor_device_start(dev);
+
 	/* NOTE: returning with ref held on group,
 	 * returned in td_device_detach() */
 	return rc;
@@ -1311,6 +1498,9 @@ static int __td_device_detach(struct td_device *dev)
 
 	eng = td_device_engine(dev);
 
+	/* the monitor issues commands, stop it while the engine runs */
+	td_monitor_device_stop(dev);
+
 	/* Before we stop, we send the shutdown command
 	 */
 	td_device_shutdown(dev);
@@ -1506,6 +1696,9 @@ int __td_device_ioctl(struct td_device* dev, unsigned int cmd,
 		struct td_ioctl_device_ecc_counters e_counters;
 #ifdef CONFIG_TERADIMM_SGIO
 		sg_io_hdr_t sg_hdr;
+#endif
+#ifdef CONFIG_TERADIMM_LOADGEN
+		struct td_ioctl_device_loadgen loadgen;
 #endif
 	}__user *u_arg, *k_arg, __static_arg, *__big_arg = NULL;
 	unsigned copy_in_size, copy_out_size, big_size = 0;
@@ -1573,6 +1766,10 @@ int __td_device_ioctl(struct td_device* dev, unsigned int cmd,
 	case TD_IOCTL_DEVICE_GET_INFO:
 		copy_out_size = sizeof(struct td_ioctl_device_info);
 		break;
+	case TD_IOCTL_DEVICE_GET_INFO_V0:
+		/* v0 is a prefix of the current layout, only copy out that much */
+		copy_out_size = sizeof(struct td_ioctl_device_info_v0);
+		break;
 
 	case TD_IOCTL_DEVICE_GET_STATE:
 		copy_out_size = sizeof(struct td_ioctl_device_state);
@@ -1651,6 +1848,13 @@ int __td_device_ioctl(struct td_device* dev, unsigned int cmd,
 		copy_in_size = 0;
 		copy_out_size = 0;
 		break;
+
+#ifdef CONFIG_TERADIMM_LOADGEN
+	case TD_IOCTL_DEVICE_LOADGEN:
+		copy_in_size = sizeof(struct td_ioctl_device_loadgen);
+		copy_out_size = sizeof(struct td_ioctl_device_loadgen);
+		break;
+#endif
 	case TD_IOCTL_DEVICE_GET_ERRORS:
 		copy_out_size = sizeof(struct td_ioctl_device_error_injection);
 		break;
@@ -1727,6 +1931,7 @@ int __td_device_ioctl(struct td_device* dev, unsigned int cmd,
 	switch (cmd) {
 
 	case TD_IOCTL_DEVICE_GET_INFO:
+	case TD_IOCTL_DEVICE_GET_INFO_V0:
 		/** ioctl used to get current state */
 		rc = td_ioctl_device_get_info(dev, &k_arg->dev_info);
 		goto handled;
@@ -1760,6 +1965,13 @@ int __td_device_ioctl(struct td_device* dev, unsigned int cmd,
 	case BLKFLSBUF: /* block flush buffers */
 		rc = td_ioctl_device_flush(dev);
 		goto handled;
+#ifdef CONFIG_TERADIMM_LOADGEN
+	case TD_IOCTL_DEVICE_LOADGEN:
+		/* runs for a while, and other ioctls should still work */
+		rc = td_engine_loadgen_run(td_device_engine(dev),
+				&k_arg->loadgen);
+		goto handled;
+#endif
 	default:
 		/* rest require a lock on the device */
 		break;
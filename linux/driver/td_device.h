@@ -61,6 +61,7 @@ struct td_device {
 	int                 td_irq;
 	uint16_t            td_memspeed;
 	uint16_t            td_cpu_socket;
+	int                 td_node;        /**< NUMA node of the engine, tokens and buffers */
 	
 };
 
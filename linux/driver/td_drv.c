@@ -23,7 +23,10 @@
 #include "td_device.h"
 #include "td_raid.h"
 #include "td_mon.h"
+#include "td_place.h"
 #include "td_osdev.h"
+#include "td_crypto.h"
+#include "td_checksum.h"
 
 
 static int __init teradimm_init(void)
@@ -32,10 +35,24 @@ static int __init teradimm_init(void)
 
 	printk("TeraDIMM %s\n", TERADIMM_VERSION);
 pr_err("%s: enter", __FUNCTION__);
+	/* pick the SHA1 code before anything hashes */
+	rc = td_sha1_selftest();
+	if (rc)
+		goto error_os_init;
+
+	rc = td_checksum_selftest();
+	if (rc)
+		goto error_os_init;
+
 	rc = td_os_init();
 	if (rc)
 		goto error_os_init;
 
+	/* groups are planned as they're created */
+	rc = td_place_init();
+	if (rc)
+		goto error_place;
+
 	rc = td_devgroup_init();
 	if (rc)
 		goto error_devgroup;
@@ -75,6 +92,8 @@ error_device:
 error_raid:
 	td_devgroup_exit();
 error_devgroup:
+	td_place_exit();
+error_place:
 	td_os_exit();
 error_os_init:
 	return rc;
@@ -90,6 +109,7 @@ pr_err("%s: enter", __FUNCTION__);
 	td_raid_exit();
 	td_device_exit();
 	td_devgroup_exit();
+	td_place_exit();
 
 	td_os_exit();
 	printk("TeraDIMM module unloaded\n");
@@ -182,6 +182,21 @@ DECLARE_TD_ATTRIBUTE(  u32,  EARLY_SPLIT_REQ,           always,    0,  UINT_MAX)
 DECLARE_TD_ATTRIBUTE(  u32,  COLLISION_CHECK,           always,    0,  2);
 
 DECLARE_TD_ATTRIBUTE(  u32,  INDEPENDENT_DEALLOCATE,    always,    0,  UINT_MAX);
+DECLARE_TD_ATTRIBUTE(  u32,  DEALLOCATE_BATCH,          always,    0,  TD_HOST_RD_BUFS_PER_DEV);
+DECLARE_TD_ATTRIBUTE(  u32,  DEALLOCATE_HOLD_USEC,      always,    0,  UINT_MAX);
+DECLARE_TD_ATTRIBUTE(  u32,  READAHEAD_DEPTH,           always,    0,  TD_HOST_RD_BUFS_PER_DEV);
+DECLARE_TD_ATTRIBUTE(  u32,  READAHEAD_TRIGGER,         always,    1,  UINT_MAX);
+DECLARE_TD_ATTRIBUTE(  u32,  READ_CACHE_PAGES,          always,    0,  UINT_MAX);
+DECLARE_TD_ATTRIBUTE(  u32,  WRITE_COALESCE,            always,    0,  1);
+DECLARE_TD_ATTRIBUTE(  u32,  DISCARD_MERGE_MAX,         always,    0,  TD_DISCARD_HOLD_MAX);
+DECLARE_TD_ATTRIBUTE(  u32,  DISCARD_HOLD_USEC,         always,    0,  UINT_MAX);
+DECLARE_TD_ATTRIBUTE(  u32,  ADAPTIVE_START_BURST,      always,    0,  1);
+DECLARE_TD_ATTRIBUTE(  u32,  START_BURST_LAT_USEC,      always,    1,  UINT_MAX);
+DECLARE_TD_ATTRIBUTE(  u32,  BIO_R_DEADLINE_USEC,       always,    0,  UINT_MAX);
+DECLARE_TD_ATTRIBUTE(  u32,  BIO_W_DEADLINE_USEC,       always,    0,  UINT_MAX);
+DECLARE_TD_ATTRIBUTE(  u32,  ZERO_WRITE_TRIM,           always,    0,  1);
+DECLARE_TD_ATTRIBUTE(  u32,  WRITE_STAGING_PAGES,       always,    0,  TD_WRSTAGE_PAGES_MAX);
+DECLARE_TD_ATTRIBUTE(  u32,  WRITE_STAGING_ACK,         always,    0,  1);
 DECLARE_TD_ATTRIBUTE(  u32,  DELAY_POST_WRBUF_USEC,     always,    0,  UINT_MAX);
 DECLARE_TD_ATTRIBUTE(  u32,  DELAY_POST_CMD_USEC,       always,    0,  UINT_MAX);
 
@@ -246,6 +261,21 @@ static struct attribute *td_disk_attrs[] = {
 #endif
 	&dev_attr_MAGIC_FLAGS.attr,
 	&dev_attr_INDEPENDENT_DEALLOCATE.attr,
+	&dev_attr_DEALLOCATE_BATCH.attr,
+	&dev_attr_DEALLOCATE_HOLD_USEC.attr,
+	&dev_attr_READAHEAD_DEPTH.attr,
+	&dev_attr_READAHEAD_TRIGGER.attr,
+	&dev_attr_READ_CACHE_PAGES.attr,
+	&dev_attr_WRITE_COALESCE.attr,
+	&dev_attr_DISCARD_MERGE_MAX.attr,
+	&dev_attr_DISCARD_HOLD_USEC.attr,
+	&dev_attr_ADAPTIVE_START_BURST.attr,
+	&dev_attr_START_BURST_LAT_USEC.attr,
+	&dev_attr_BIO_R_DEADLINE_USEC.attr,
+	&dev_attr_BIO_W_DEADLINE_USEC.attr,
+	&dev_attr_ZERO_WRITE_TRIM.attr,
+	&dev_attr_WRITE_STAGING_PAGES.attr,
+	&dev_attr_WRITE_STAGING_ACK.attr,
 	&dev_attr_CLFLUSH.attr,
 	&dev_attr_WBINVD.attr,
 	&dev_attr_HOST_READ_ALIASES.attr,
@@ -25,6 +25,8 @@
 #include "td_mon.h"
 #include "td_control.h"
 
+#include <linux/topology.h>
+
 static uint td_monitor_enable = 1;
 static uint td_monitor_rate = TD_MONITOR_PERIOD;
 
@@ -38,47 +40,156 @@ MODULE_PARM_DESC(monitor,
 		"ECC monitor task (0 disable, 1 enable/default)");
 
 
-static int td_monitor_task(void *thread_data)
+/*
+ * ECC monitor
+ *
+ * Each device in a group has its own delayed work, queued on a CPU of the
+ * device's socket, so a poll doesn't wake the other sockets or disturb
+ * their workers.  The interval starts at the monitor rate, doubles up to
+ * TD_MONITOR_PERIOD_MAX while the counts don't change, and drops back to
+ * the rate when they do.  A device with IO going is polled when it goes
+ * idle, or after one more interval at the latest.
+ */
+
+static DEFINE_SPINLOCK(td_monitor_lock);
+static int td_monitor_started;
+static atomic_t td_monitor_next_cpu = ATOMIC_INIT(0);
+
+static void td_monitor_queue(struct td_ecc_bins *eb, unsigned long delay)
+{
+	if (eb->cpu < 0)
+		schedule_delayed_work(&eb->work, delay);
+	else
+		schedule_delayed_work_on(eb->cpu, &eb->work, delay);
+}
+
+static void td_monitor_work(struct work_struct *work)
+{
+	struct td_ecc_bins *eb = container_of(to_delayed_work(work),
+			struct td_ecc_bins, work);
+	struct td_engine *eng = container_of(eb, struct td_engine, ecc_bins);
+	unsigned long delay;
+
+	delay = td_monitor_ecc_poll(eng, td_monitor_rate);
+
+	spin_lock(&td_monitor_lock);
+	if (eb->running)
+		td_monitor_queue(eb, delay);
+	spin_unlock(&td_monitor_lock);
+}
+
+/* a CPU on the device's node, devices spread over them */
+static int td_monitor_pick_cpu(struct td_device *dev)
 {
-	int rate;
+	const struct cpumask *mask;
+	unsigned count = 0, nth;
+	int cpu;
+
+	if (dev->td_node == NUMA_NO_NODE)
+		return -1;
 
-	while (!kthread_should_stop()) {
+	mask = cpumask_of_node(dev->td_node);
 
-		rate = td_monitor_rate;
+	for_each_cpu_and(cpu, mask, cpu_online_mask)
+		count++;
 
-		if (likely(td_monitor_rate)) {
-			td_monitor_ecc_poll_all_devs();
-		}
-		else {
-			rate = TD_MONITOR_PERIOD;
-		}
+	if (!count)
+		return -1;
 
-		set_current_state(TASK_INTERRUPTIBLE);
-		schedule_timeout(rate * HZ);
+	nth = (unsigned)atomic_inc_return(&td_monitor_next_cpu) % count;
+	for_each_cpu_and(cpu, mask, cpu_online_mask) {
+		if (!nth--)
+			break;
 	}
 
+	return cpu;
+}
+
+/* caller holds td_monitor_lock */
+static void __td_monitor_device_start(struct td_device *dev)
+{
+	struct td_ecc_bins *eb = &td_device_engine(dev)->ecc_bins;
+
+	if (!td_monitor_started || !eb->attached || eb->running)
+		return;
+
+	INIT_DELAYED_WORK(&eb->work, td_monitor_work);
+	eb->cpu = td_monitor_pick_cpu(dev);
+	eb->interval = td_monitor_rate ?: TD_MONITOR_PERIOD;
+	eb->deferred_since = 0;
+	eb->running = 1;
+
+	td_monitor_queue(eb, eb->interval * HZ);
+}
+
+void td_monitor_device_start(struct td_device *dev)
+{
+	spin_lock(&td_monitor_lock);
+	td_device_engine(dev)->ecc_bins.attached = 1;
+	__td_monitor_device_start(dev);
+	spin_unlock(&td_monitor_lock);
+}
+
+static void __td_monitor_device_stop(struct td_device *dev, int detach)
+{
+	struct td_ecc_bins *eb = &td_device_engine(dev)->ecc_bins;
+	int running;
+
+	spin_lock(&td_monitor_lock);
+	if (detach)
+		eb->attached = 0;
+	running = eb->running;
+	eb->running = 0;
+	spin_unlock(&td_monitor_lock);
+
+	if (running)
+		cancel_delayed_work_sync(&eb->work);
+}
+
+void td_monitor_device_stop(struct td_device *dev)
+{
+	__td_monitor_device_stop(dev, 1);
+}
+
+static int td_monitor_start_iter(struct td_device *dev, void *data)
+{
+	spin_lock(&td_monitor_lock);
+	__td_monitor_device_start(dev);
+	spin_unlock(&td_monitor_lock);
 	return 0;
 }
 
-static struct task_struct *monitor_task;
+static int td_monitor_stop_iter(struct td_device *dev, void *data)
+{
+	__td_monitor_device_stop(dev, 0);
+	return 0;
+}
 
 int __init td_monitor_init(void)
 {
 	if (td_monitor_enable) {
-		monitor_task = kthread_run(td_monitor_task, NULL, "td/monitor");
-		pr_warn("Started thread td_monitor\n");
+		spin_lock(&td_monitor_lock);
+		td_monitor_started = 1;
+		spin_unlock(&td_monitor_lock);
+
+		/* devices attached during discovery */
+		td_device_list_iter(td_monitor_start_iter, NULL);
+		pr_warn("Started td_monitor\n");
 	}
 	return 0;
 }
 
 int td_monitor_exit(void)
 {
-	int rc = 0;
-	if (monitor_task) {
-		rc = kthread_stop(monitor_task);
-		pr_warn("Stopped thread td_monitor\n");
+	if (td_monitor_started) {
+		spin_lock(&td_monitor_lock);
+		td_monitor_started = 0;
+		spin_unlock(&td_monitor_lock);
+
+		td_device_list_iter(td_monitor_stop_iter, NULL);
+		pr_warn("Stopped td_monitor\n");
 	}
-	return rc;
+	return 0;
 }
 
 void td_monitor_set_rate(int rate)
@@ -22,4 +22,10 @@
 extern int __init td_monitor_init(void);
 extern int td_monitor_exit(void);
 
+struct td_device;
+
+/** start or stop polling a device, as it's attached or detached */
+extern void td_monitor_device_start(struct td_device *dev);
+extern void td_monitor_device_stop(struct td_device *dev);
+
 #endif
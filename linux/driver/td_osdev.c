@@ -29,6 +29,7 @@
 #include "td_compat.h"
 #include "td_ucmd.h"
 #include "td_eng_hal.h"
+#include "td_eng_uring.h"
 #include "td_discovery.h"
 #include "td_dev_ata.h"
 #include "td_memspace.h"
@@ -46,6 +47,7 @@
 #include <linux/export.h>
 #endif
 #include <linux/delay.h>
+#include <asm/uaccess.h>
 
 
 
@@ -144,6 +146,12 @@ int __osdev_check_name (struct td_osdev* dev, void* data)
 }
 
 int td_osdev_assign_name(const char *prefix, char* buffer, int size)
+{
+	return td_osdev_assign_name_unless(prefix, buffer, size, NULL, NULL);
+}
+
+int td_osdev_assign_name_unless(const char *prefix, char* buffer, int size,
+		int (*taken)(const char *name, void *opaque), void *opaque)
 {
 	const char* dev_prefix;
 	int dev_index = 0;
@@ -170,6 +178,8 @@ int td_osdev_assign_name(const char *prefix, char* buffer, int size)
 				'a'+(dev_index/(26*26))-1, 'a'+(dev_index%(26*26)),
 				'a'+(dev_index%26));
 		}
+		if (taken && taken(buffer, opaque))
+			continue;
 		rc = td_osdev_list_iter(__osdev_check_name, buffer);
 		if (rc == 0) {
 			return 0;
@@ -329,10 +339,13 @@ void __td_osdev_destroy(struct td_osdev *dev)
 
 void td_osdev_error_bio (td_bio_ref bio)
 {
-	struct td_osdev *odev = bdev_compat_pdata_dev(bio->bi_bdev);
-	
-	if (odev->_bio_error)
-		odev->_bio_error(odev, bio);
+	/* bios the driver owns don't come through a block device */
+	if (bio->bi_bdev) {
+		struct td_osdev *odev = bdev_compat_pdata_dev(bio->bi_bdev);
+
+		if (odev->_bio_error)
+			odev->_bio_error(odev, bio);
+	}
 
 	td_bio_complete_failure(bio);
 }
@@ -401,6 +414,9 @@ static int td_device_char_release(struct inode *inode, struct file *filp)
 #endif
 			td_engine_start_bio(eng);
 		}
+
+		td_engine_uring_release(eng, filp);
+		td_ucmd_async_release(eng, filp);
 	}
 	atomic_dec(&dev->control_users);
 
@@ -427,9 +443,14 @@ static ssize_t td_device_char_write(struct file *filp, const char __user *buf,
 
 static int td_device_char_mmap(struct file *filp, struct vm_area_struct *vma)
 {
-	/*struct td_device *dev = filp->private_data; */
+	struct td_osdev *dev = filp->private_data;
 
-	return -EIO;
+	if (dev->type != TD_OSDEV_DEVICE)
+		return -EIO;
+
+	/* the user IO ring set up by this open */
+	return td_engine_uring_mmap(td_device_engine(td_device_from_os(dev)),
+			filp, vma);
 }
 
 static loff_t td_device_char_llseek(struct file *filp, loff_t off, int seek)
@@ -439,6 +460,70 @@ static loff_t td_device_char_llseek(struct file *filp, loff_t off, int seek)
 	return -EIO;
 }
 
+#if defined(CONFIG_TERADIMM_USER_RING) || defined(CONFIG_TERADIMM_UCMD_ASYNC)
+/* user IO rings and asynchronous commands belong to the open file, so they
+ * don't go through _ioctl */
+static long td_device_char_file_ioctl(struct file *filp,
+		struct td_osdev *dev, unsigned int cmd, unsigned long raw_arg)
+{
+	struct td_engine *eng;
+	void __user *u_arg = (void __user *)raw_arg;
+	union {
+#ifdef CONFIG_TERADIMM_USER_RING
+		struct td_ioctl_device_uring_setup setup;
+		struct td_ioctl_device_uring_enter enter;
+#endif
+#ifdef CONFIG_TERADIMM_UCMD_ASYNC
+		struct td_ioctl_device_cmd_pt_submit submit;
+		struct td_ioctl_device_cmd_pt_reap reap;
+#endif
+	} k_arg;
+	int rc;
+
+	if (dev->type != TD_OSDEV_DEVICE)
+		return -ENOIOCTLCMD;
+
+	eng = td_device_engine(td_device_from_os(dev));
+
+	switch (cmd) {
+#ifdef CONFIG_TERADIMM_USER_RING
+	case TD_IOCTL_DEVICE_URING_SETUP:
+		if (copy_from_user(&k_arg.setup, u_arg, sizeof(k_arg.setup)))
+			return -EFAULT;
+		return td_engine_uring_setup(eng, filp, &k_arg.setup, u_arg);
+
+	case TD_IOCTL_DEVICE_URING_ENTER:
+		if (copy_from_user(&k_arg.enter, u_arg, sizeof(k_arg.enter)))
+			return -EFAULT;
+		return td_engine_uring_enter(eng, filp, &k_arg.enter);
+#endif
+
+#ifdef CONFIG_TERADIMM_UCMD_ASYNC
+	case TD_IOCTL_DEVICE_CMD_PT_SUBMIT:
+		if (copy_from_user(&k_arg.submit, u_arg, sizeof(k_arg.submit)))
+			return -EFAULT;
+		rc = td_ucmd_async_submit(eng, filp, &k_arg.submit);
+		/* the commands are queued, count tells how many */
+		if (copy_to_user(u_arg, &k_arg.submit, sizeof(k_arg.submit)))
+			return -EFAULT;
+		return rc;
+
+	case TD_IOCTL_DEVICE_CMD_PT_REAP:
+		if (copy_from_user(&k_arg.reap, u_arg, sizeof(k_arg.reap)))
+			return -EFAULT;
+		rc = td_ucmd_async_reap(eng, filp, &k_arg.reap);
+		if (copy_to_user(u_arg, &k_arg.reap, sizeof(k_arg.reap)))
+			return -EFAULT;
+		return rc;
+#endif
+	}
+
+	return -ENOIOCTLCMD;
+}
+#else
+#define td_device_char_file_ioctl(filp,dev,cmd,raw_arg) (-ENOIOCTLCMD)
+#endif
+
 static long td_device_char_ioctl(struct file *filp, unsigned int cmd,
 		unsigned long raw_arg)
 {
@@ -447,6 +532,10 @@ static long td_device_char_ioctl(struct file *filp, unsigned int cmd,
 
 	WARN_DEVICE_LOCKED(dev);
 
+	rc = td_device_char_file_ioctl(filp, dev, cmd, raw_arg);
+	if (rc != -ENOIOCTLCMD)
+		return rc;
+
 	rc = dev->_ioctl(dev, cmd, raw_arg);
 	if (rc == -ENOIOCTLCMD)
 		return -EINVAL;
@@ -462,6 +551,11 @@ static long td_device_char_compat_ioctl(struct file *filp, unsigned int cmd,
 
 	WARN_DEVICE_LOCKED(dev);
 
+	rc = td_device_char_file_ioctl(filp, dev, cmd,
+			(unsigned long)compat_ptr(raw_arg));
+	if (rc != -ENOIOCTLCMD)
+		return rc;
+
 	rc = dev->_ioctl(dev, cmd, (unsigned long)compat_ptr(raw_arg));
 	/* COMPAT_IOCTL is supposed to return ENOIOCTLCMD */
 	return rc;
@@ -0,0 +1,346 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                                                                       *
+ *    Copyright (c) 2013 Diablo Technologies Inc. (Diablo).              *
+ *    All rights reserved.                                               *
+ *                                                                       *
+ *    This program is free software; you can redistribute it and/or      *
+ *    modify it under the terms of the GNU General Public License        *
+ *    as published by the Free Software Foundation; either version 2     *
+ *    of the License, or (at your option) any later version located at   *
+ *    <http://www.gnu.org/licenses/                                      *
+ *                                                                       *
+ *    This program is distributed WITHOUT ANY WARRANTY; without even     *
+ *    the implied warranty of MERCHANTABILITY or FITNESS FOR A           *
+ *    PARTICULAR PURPOSE.  See the GNU General Public License for        *
+ *    more details.                                                      *
+ *                                                                       *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include "td_kdefn.h"
+
+#include "td_compat.h"
+
+#include "td_devgroup.h"
+#include "td_device.h"
+#include "td_ioctl.h"
+#include "td_place.h"
+
+#include <linux/cpumask.h>
+#include <linux/topology.h>
+#ifdef KABI__housekeeping_cpumask
+#include <linux/sched/isolation.h>
+#endif
+
+static char *td_isolated_cpus;
+module_param_named(isolated_cpus, td_isolated_cpus, charp, 0444);
+MODULE_PARM_DESC(isolated_cpus,
+		"CPU list for polling workers (default: the isolcpus/nohz_full CPUs)");
+
+/*
+ * Worker placement
+ *
+ * A device stays in the device group of the socket its memory controller is
+ * on; what gets planned is how many workers each group runs and which CPUs
+ * they are bound to.  A group gets one worker per device it has, or expects
+ * from discovery, as a device is only ever active on one worker.  CPUs are
+ * picked isolated ones first (isolcpus/nohz_full, or the isolated_cpus
+ * option), then the other non-housekeeping ones, one thread per core before
+ * any sibling.  Housekeeping CPUs are the non-isolated ones when there are
+ * isolated ones, or else each socket's first CPU, where interrupts and
+ * timers tend to land; they're only used when a socket has nothing else.
+ */
+
+enum td_place_class {
+	TD_PLACE_ISOLATED,
+	TD_PLACE_REGULAR,
+	TD_PLACE_HOUSEKEEPING,
+	TD_PLACE_CLASS_MAX
+};
+
+#define TD_PLACE_SLOTS_PER_CHANNEL 4
+
+static struct td_place_socket {
+	unsigned long   dimms;          /**< one bit per discovered channel/slot */
+	unsigned        other;          /**< discovered past the end of dimms */
+} td_place_sockets[TD_IOCTL_PLACEMENT_SOCKETS_MAX];
+
+static DEFINE_SPINLOCK(td_place_lock);
+static cpumask_var_t td_place_isolated;
+static bool td_place_have_isolated;
+
+static bool td_place_cpu_on_socket(unsigned cpu, unsigned socket)
+{
+	if (!cpu_online(cpu))
+		return false;
+
+#ifdef CONFIG_TERADIMM_STATIC_NODEMAP
+	if (socket >= td_socketmap_size)
+		return false;
+	if (socket > 0 && cpu <= td_socketmap[socket-1])
+		return false;
+	return cpu <= td_socketmap[socket];
+#else
+	return socket == topology_physical_package_id(cpu);
+#endif
+}
+
+static enum td_place_class td_place_cpu_class(unsigned cpu, unsigned first)
+{
+	if (td_place_have_isolated)
+		return cpumask_test_cpu(cpu, td_place_isolated)
+			? TD_PLACE_ISOLATED : TD_PLACE_HOUSEKEEPING;
+
+	return cpu == first ? TD_PLACE_HOUSEKEEPING : TD_PLACE_REGULAR;
+}
+
+/* on the first pass skip CPUs sharing a core with one already picked */
+static bool td_place_cpu_picked(unsigned cpu, const unsigned *cpus,
+		unsigned count, int pass)
+{
+	unsigned i;
+
+	for (i=0; i<count; i++) {
+		if (cpus[i] == cpu)
+			return true;
+		if (!pass && topology_core_id(cpus[i]) == topology_core_id(cpu))
+			return true;
+	}
+
+	return false;
+}
+
+/** fill @cpus with up to @limit CPUs of @socket, best first */
+static unsigned td_place_socket_cpus(unsigned socket, unsigned *cpus,
+		unsigned limit, unsigned *isolated)
+{
+	unsigned cpu, first = MAX_CPU_NUMBER, count = 0;
+	int class, pass;
+
+	*isolated = 0;
+	for (cpu=0; cpu<MAX_CPU_NUMBER; cpu++) {
+		if (!td_place_cpu_on_socket(cpu, socket))
+			continue;
+		if (first == MAX_CPU_NUMBER)
+			first = cpu;
+		if (td_place_cpu_class(cpu, first) == TD_PLACE_ISOLATED)
+			(*isolated) ++;
+	}
+
+	for (class=0; class<TD_PLACE_CLASS_MAX && count<limit; class++) {
+		if (class == TD_PLACE_HOUSEKEEPING && count)
+			break;
+
+		for (pass=0; pass<2 && count<limit; pass++) {
+			for (cpu=0; cpu<MAX_CPU_NUMBER && count<limit; cpu++) {
+				if (!td_place_cpu_on_socket(cpu, socket))
+					continue;
+				if (td_place_cpu_class(cpu, first) != class)
+					continue;
+				if (td_place_cpu_picked(cpu, cpus, count, pass))
+					continue;
+				cpus[count++] = cpu;
+			}
+		}
+	}
+
+	return count;
+}
+
+static void td_place_socket_dimms(unsigned socket, unsigned *devices,
+		unsigned *channels)
+{
+	struct td_place_socket *ps;
+	unsigned long dimms;
+	unsigned ch;
+
+	*devices = 0;
+	*channels = 0;
+	if (socket >= TD_IOCTL_PLACEMENT_SOCKETS_MAX)
+		return;
+
+	ps = td_place_sockets + socket;
+
+	spin_lock(&td_place_lock);
+	dimms = ps->dimms;
+	*devices = hweight_long(dimms) + ps->other;
+	spin_unlock(&td_place_lock);
+
+	for (ch=0; dimms; ch++, dimms >>= TD_PLACE_SLOTS_PER_CHANNEL) {
+		if (dimms & ((1UL << TD_PLACE_SLOTS_PER_CHANNEL) - 1))
+			*channels |= 1 << ch;
+	}
+}
+
+void td_place_device_discovered(unsigned socket, unsigned channel,
+		unsigned slot)
+{
+	struct td_place_socket *ps;
+	unsigned bit;
+
+	if (socket >= TD_IOCTL_PLACEMENT_SOCKETS_MAX)
+		return;
+
+	ps = td_place_sockets + socket;
+	bit = channel * TD_PLACE_SLOTS_PER_CHANNEL + slot;
+
+	spin_lock(&td_place_lock);
+	if (slot < TD_PLACE_SLOTS_PER_CHANNEL && bit < BITS_PER_LONG)
+		ps->dimms |= 1UL << bit;
+	else
+		ps->other ++;
+	spin_unlock(&td_place_lock);
+}
+
+/** how many workers a group on @socket should run, 0 if unknown */
+static unsigned td_place_socket_workers(unsigned socket,
+		struct td_devgroup *dg)
+{
+	unsigned devices, channels;
+
+	td_place_socket_dimms(socket, &devices, &channels);
+
+	if (dg)
+		devices = max(devices, dg->dg_work_node.wn_work_item_count);
+
+	return devices;
+}
+
+int td_place_node_cpus(struct td_devgroup *dg, unsigned *cpus, unsigned limit)
+{
+	unsigned workers, isolated, count;
+
+#ifdef CONFIG_TERADIMM_STATIC_NODEMAP
+	if (dg->dg_socket >= td_socketmap_size) {
+		pr_err("No socketmap for socket %u\n", dg->dg_socket);
+		return -EINVAL;
+	}
+#endif
+
+	/* until there are devices, run as many workers as allowed */
+	workers = td_place_socket_workers(dg->dg_socket, dg);
+	if (workers)
+		limit = min(limit, workers);
+
+	count = td_place_socket_cpus(dg->dg_socket, cpus, limit, &isolated);
+	if (!count) {
+		pr_err("%s: no online CPU on socket %u\n",
+				dg->dg_name, dg->dg_socket);
+		return -ENODEV;
+	}
+
+	return count;
+}
+
+int td_place_plan(struct td_ioctl_placement *pl)
+{
+	struct td_ioctl_placement_socket *ps;
+	struct td_devgroup *dg;
+	unsigned socket, devices, channels, isolated, count, limit, workers, i;
+	unsigned cpus[TD_IOCTL_PLACEMENT_CPUS_MAX];
+	int rc;
+
+	if (pl->flags & TD_IOCTL_PLACEMENT_APPLY) {
+		rc = td_devgroup_replan();
+		if (rc)
+			return rc;
+	}
+
+	pl->socket_count = 0;
+
+	for (socket=0; socket<TD_IOCTL_PLACEMENT_SOCKETS_MAX; socket++) {
+		ps = pl->sockets + socket;
+		memset(ps, 0, sizeof(*ps));
+
+		dg = td_devgroup_get_by_node(socket);
+
+		limit = min_t(unsigned, td_work_node_max_workers(),
+				TD_IOCTL_PLACEMENT_CPUS_MAX);
+		count = td_place_socket_cpus(socket, cpus, limit, &isolated);
+		if (!count && !dg)
+			continue;
+
+		td_place_socket_dimms(socket, &devices, &channels);
+		ps->devices = devices;
+		ps->channels = channels;
+		ps->isolated = isolated;
+		pl->socket_count = socket + 1;
+
+		if (!dg) {
+			/* what a group created now would run */
+			workers = td_place_socket_workers(socket, NULL);
+			ps->worker_count = workers ? min(count, workers) : count;
+			for (i=0; i<ps->worker_count; i++)
+				ps->worker_cpu[i] = cpus[i];
+			continue;
+		}
+
+		td_devgroup_lock(dg);
+
+		ps->devices = max_t(unsigned, ps->devices,
+				dg->dg_work_node.wn_work_item_count);
+
+		if (td_devgroup_is_running(dg)) {
+			struct td_work_node *wn = &dg->dg_work_node;
+
+			ps->worker_count = min_t(unsigned, wn->wn_worker_count,
+					TD_IOCTL_PLACEMENT_CPUS_MAX);
+			for (i=0; i<ps->worker_count; i++)
+				ps->worker_cpu[i] = wn->wn_workers[i].w_cpu;
+		} else {
+			rc = td_place_node_cpus(dg, cpus, limit);
+			ps->worker_count = rc > 0 ? rc : 0;
+			for (i=0; i<ps->worker_count; i++)
+				ps->worker_cpu[i] = cpus[i];
+		}
+
+		td_devgroup_unlock(dg);
+		td_devgroup_put(dg);
+	}
+
+	return 0;
+}
+
+int __init td_place_init(void)
+{
+	int rc;
+
+	if (!zalloc_cpumask_var(&td_place_isolated, GFP_KERNEL))
+		return -ENOMEM;
+
+	if (td_isolated_cpus) {
+		rc = cpulist_parse(td_isolated_cpus, td_place_isolated);
+		if (rc) {
+			pr_err("Invalid isolated_cpus list '%s'\n",
+					td_isolated_cpus);
+			goto error_parse;
+		}
+	}
+#ifdef KABI__housekeeping_cpumask
+	else {
+		unsigned cpu;
+
+		for_each_possible_cpu(cpu) {
+			if (cpumask_test_cpu(cpu, housekeeping_cpumask(HK_FLAG_DOMAIN))
+					&& cpumask_test_cpu(cpu, housekeeping_cpumask(HK_FLAG_TICK)))
+				continue;
+			cpumask_set_cpu(cpu, td_place_isolated);
+		}
+	}
+#endif
+
+	td_place_have_isolated = !cpumask_empty(td_place_isolated);
+	if (td_place_have_isolated)
+		pr_info("Workers prefer %u isolated CPUs\n",
+				cpumask_weight(td_place_isolated));
+
+	return 0;
+
+error_parse:
+	free_cpumask_var(td_place_isolated);
+	return rc;
+}
+
+void td_place_exit(void)
+{
+	free_cpumask_var(td_place_isolated);
+}
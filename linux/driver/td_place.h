@@ -0,0 +1,40 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *                                                                       *
+ *    Copyright (c) 2013 Diablo Technologies Inc. (Diablo).              *
+ *    All rights reserved.                                               *
+ *                                                                       *
+ *    This program is free software; you can redistribute it and/or      *
+ *    modify it under the terms of the GNU General Public License        *
+ *    as published by the Free Software Foundation; either version 2     *
+ *    of the License, or (at your option) any later version located at   *
+ *    <http://www.gnu.org/licenses/                                      *
+ *                                                                       *
+ *    This program is distributed WITHOUT ANY WARRANTY; without even     *
+ *    the implied warranty of MERCHANTABILITY or FITNESS FOR A           *
+ *    PARTICULAR PURPOSE.  See the GNU General Public License for        *
+ *    more details.                                                      *
+ *                                                                       *
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef _TD_PLACE_H_
+#define _TD_PLACE_H_
+
+struct td_devgroup;
+struct td_ioctl_placement;
+
+extern int __init td_place_init(void);
+extern void td_place_exit(void);
+
+/** record a device found by discovery, before it's brought up */
+extern void td_place_device_discovered(unsigned socket, unsigned channel,
+		unsigned slot);
+
+/** pick the CPUs the workers of a device group run on
+ * @return number of CPUs written to @cpus, or negative errno */
+extern int td_place_node_cpus(struct td_devgroup *dg,
+		unsigned *cpus, unsigned limit);
+
+/** report, and optionally apply, the placement of every socket */
+extern int td_place_plan(struct td_ioctl_placement *pl);
+
+#endif
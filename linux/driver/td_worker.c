@@ -22,6 +22,7 @@
 #include "td_devgroup.h"
 #include "td_device.h"
 #include "td_eng_hal.h"
+#include "td_place.h"
 #include "td_compat.h"
 
 #define wi_trace(_wi_,_t_,_l_,_x_) \
@@ -68,6 +69,7 @@ module_param_array_named(devgroup_cpu_addr, td_devgroup_addr, ulong, &td_max_dev
 static void td_work_item_sync_event(struct td_work_item *wi);
 static int td_worker_thread(void *thread_data);
 static void td_work_node_check_and_recalc_work_tokens(struct td_work_node *wn);
+static void td_work_node_rescale(struct td_work_node *wn, struct td_worker *w);
 
 int td_worker_start(struct td_worker *w)
 {
@@ -252,6 +254,7 @@ static inline int td_worker_acquire_work_token(struct td_worker *w)
 
 	/* didn't get one */
 	atomic_inc(&wn->wn_worker_tokens);
+	atomic_inc(&wn->wn_token_misses);
 	return 0;
 }
 
@@ -642,8 +645,16 @@ static int td_worker_thread(void *thread_data)
 
 			w->w_total_activity += total_activity;
 
+			w->w_scale_loops ++;
+			if (total_activity)
+				w->w_scale_busy ++;
+
 			td_busy_end(dg);
 
+			/* grow or shrink the number of running workers */
+
+			td_work_node_rescale(wn, w);
+
 			/* time management */
 
 			now = td_get_cycles();
@@ -814,13 +825,40 @@ static void td_work_item_sync_event(struct td_work_item *wi)
 
 /* ------------------------------------------------------------------------ */
 
+unsigned td_work_node_max_workers(void)
+{
+	return min_t(unsigned, td_workers_per_node, TD_WORKER_MAX_PER_NODE);
+}
+
+/** allocate workers on the CPUs picked by the placement planner */
+static struct td_worker *td_work_node_alloc_workers(struct td_work_node *wn,
+		struct td_devgroup *dg, unsigned *count)
+{
+	unsigned cpus[TD_WORKER_MAX_PER_NODE];
+	struct td_worker *workers;
+	int rc, worker;
+
+	rc = td_place_node_cpus(dg, cpus, td_work_node_max_workers());
+	if (rc < 0)
+		return ERR_PTR(rc);
+
+	/* dg_socket is a socket number, the allocator wants a NUMA node */
+	workers = kzalloc_node(rc * sizeof(struct td_worker), GFP_KERNEL,
+			cpu_to_node(cpus[0]));
+	if (!workers)
+		return ERR_PTR(-ENOMEM);
+
+	for (worker=0; worker<rc; worker++)
+		td_worker_init(workers + worker, cpus[worker], wn);
+
+	*count = rc;
+	return workers;
+}
+
 int td_work_node_init(struct td_work_node *wn, struct td_devgroup *dg)
 {
-	unsigned size, cpus_per_socket;
-	unsigned cpu, worker;
-#ifdef CONFIG_TERADIMM_STATIC_NODEMAP
-	unsigned socket_cpu_start, socket_cpu_end;
-#endif
+	struct td_worker *workers;
+	unsigned count;
 
 	if (wn->wn_workers)
 		return 0;
@@ -831,70 +869,94 @@ int td_work_node_init(struct td_work_node *wn, struct td_devgroup *dg)
 
 	atomic_set(&wn->wn_token_recompute_needed, 0);
 
+	spin_lock_init(&wn->wn_scale_lock);
+	wn->wn_scale_next = jiffies;
+	wn->wn_scale_loops = 0;
+	wn->wn_scale_busy = 0;
+	atomic_set(&wn->wn_token_misses, 0);
+
 	atomic_set(&wn->wn_work_item_available_count, 0);
 	atomic_set(&wn->wn_work_item_active_count, 0);
 
 	memset(wn->wn_work_items, 0, sizeof(wn->wn_work_items));
 
-#ifdef CONFIG_TERADIMM_STATIC_NODEMAP
-	if (dg->dg_socket >= td_socketmap_size) {
-	       pr_err("No socketmap for socket %u\n", dg->dg_socket);
-	       return -EINVAL;
-	}
+	wn->wn_work_item_count = 0;
 
-	if (dg->dg_socket > 0)
-	      socket_cpu_start = td_socketmap[dg->dg_socket-1] + 1;
-	else
-	      socket_cpu_start = 0;
-	socket_cpu_end = td_socketmap[dg->dg_socket];
-	cpus_per_socket = socket_cpu_end - socket_cpu_start + 1;;
-#else
-	cpus_per_socket = 0;
-	for (cpu=0; cpu<MAX_CPU_NUMBER; cpu++) {
-		if (dg->dg_socket == topology_physical_package_id(cpu))
-			cpus_per_socket ++;
-	}
-#endif
+	workers = td_work_node_alloc_workers(wn, dg, &count);
+	if (IS_ERR(workers))
+		return PTR_ERR(workers);
 
-	if (cpus_per_socket >= td_workers_per_node)
-	      cpus_per_socket = td_workers_per_node;
+	wn->wn_devgroup = dg;
+	wn->wn_workers = workers;
+	wn->wn_worker_count = count;
+
+	return 0;
+}
+
+/**
+ * Move the workers of a running node to a new placement.
+ *
+ * The work items stay as they are; the old workers release the devices they
+ * hold as they exit, and the new ones scout them again.  Nothing is
+ * restarted if the planner picks the same CPUs, and the old workers are
+ * started again if the new ones can't be.
+ */
+int td_work_node_replan(struct td_work_node *wn)
+{
+	struct td_worker *workers, *old;
+	unsigned count, old_count, worker;
+	int rc;
 
-	size = cpus_per_socket * sizeof(struct td_worker);
-	wn->wn_workers = kzalloc_node(size, GFP_KERNEL, dg->dg_socket);
 	if (!wn->wn_workers)
-		return -ENOMEM;
-	
-	worker = 0;
-	for (cpu=0; cpu<MAX_CPU_NUMBER; cpu++) {
-#ifdef CONFIG_TERADIMM_STATIC_NODEMAP
-	        if (cpu < socket_cpu_start || cpu > socket_cpu_end)
-			continue;
-#else
-		if (dg->dg_socket != topology_physical_package_id(cpu))
-			continue;
-#endif
+		return 0;
 
-		WARN_ON(worker >= cpus_per_socket);
-		if(worker >= cpus_per_socket)
-			break;
+	workers = td_work_node_alloc_workers(wn, wn->wn_devgroup, &count);
+	if (IS_ERR(workers))
+		return PTR_ERR(workers);
 
-#if 0
-		/* Do not get HT siblings */
-		if (cpu % 2 == 0)
-			continue;
-#endif
-		td_worker_init(wn->wn_workers + worker,
-				cpu, wn);
-		worker++;
+	if (count == wn->wn_worker_count) {
+		for (worker=0; worker<count; worker++) {
+			if (workers[worker].w_cpu != wn->wn_workers[worker].w_cpu)
+				break;
+		}
+		if (worker == count) {
+			kfree(workers);
+			return 0;
+		}
 	}
-	WARN_ON(worker == 0);
 
-	wn->wn_devgroup = dg;
+	pr_info("%s: moving from %u to %u workers\n",
+			wn->wn_devgroup->dg_name, wn->wn_worker_count, count);
 
-	wn->wn_work_item_count = 0;
-	wn->wn_worker_count = worker;
+	td_work_node_stop(wn);
+
+	old = wn->wn_workers;
+	old_count = wn->wn_worker_count;
+	wn->wn_workers = workers;
+	wn->wn_worker_count = count;
+
+	rc = td_work_node_start(wn);
+	if (rc)
+		goto error_start;
 
+	kfree(old);
 	return 0;
+
+error_start:
+	/* the devices still need someone to run them, go back to the old
+	 * placement */
+	pr_err("%s: failed to move workers, rc=%d, keeping %u\n",
+			wn->wn_devgroup->dg_name, rc, old_count);
+
+	wn->wn_workers = old;
+	wn->wn_worker_count = old_count;
+	kfree(workers);
+
+	if (td_work_node_start(wn))
+		pr_err("%s: failed to restart workers\n",
+				wn->wn_devgroup->dg_name);
+
+	return rc;
 }
 
 void td_work_node_exit(struct td_work_node *wn)
@@ -973,11 +1035,13 @@ static void td_work_node_check_and_recalc_work_tokens(struct td_work_node *wn)
 	needed = max_t(long, needed, 1);
 	needed = min_t(long, needed, 100);
 
+	spin_lock(&wn->wn_scale_lock);
+
 	/* how far are we off from where we currently are */
 	delta = needed - wn->wn_total_worker_tokens;
 
 	if (!delta)
-		return;
+		goto unlock;
 
 	pr_info("%s: %s tokens by %lu to %lu\n",
 			wn->wn_devgroup->dg_name,
@@ -987,6 +1051,110 @@ static void td_work_node_check_and_recalc_work_tokens(struct td_work_node *wn)
 
 	wn->wn_total_worker_tokens += delta;
 	atomic_add(delta, &wn->wn_worker_tokens_idle);
+
+unlock:
+	spin_unlock(&wn->wn_scale_lock);
+}
+
+/**
+ * Periodically adjust the number of worker tokens to the load.
+ *
+ * A token is added, and a sleeping worker woken, when the busy devices have
+ * many bios queued or when woken workers could not get a token while the
+ * running ones were busy.  A token is removed when most worker loops find
+ * nothing to do; the worker that gives it up when it next goes idle stays
+ * parked.  The computed value from td_work_node_check_and_recalc_work_tokens()
+ * is the starting point, and is restored whenever the configuration changes.
+ */
+static void td_work_node_rescale(struct td_work_node *wn, struct td_worker *w)
+{
+	struct td_devgroup *dg = wn->wn_devgroup;
+	unsigned long total_loops = 0, total_busy = 0;
+	unsigned long loops, busy, pct, interval;
+	unsigned i, busy_devs = 0, queued = 0;
+	unsigned min_tokens, max_tokens;
+	int misses;
+	bool saturated;
+
+	interval = td_dg_conf_worker_var_get(dg, SCALE_MSEC);
+	if (!interval)
+		return;
+
+	if (time_before(jiffies, wn->wn_scale_next))
+		return;
+
+	/* only one worker makes the decision */
+	if (!spin_trylock(&wn->wn_scale_lock))
+		return;
+
+	if (time_before(jiffies, wn->wn_scale_next))
+		goto unlock;
+
+	wn->wn_scale_next = jiffies + msecs_to_jiffies(interval);
+
+	/* how busy were the running workers since last time */
+	for (i=0; i<wn->wn_worker_count; i++) {
+		total_loops += wn->wn_workers[i].w_scale_loops;
+		total_busy += wn->wn_workers[i].w_scale_busy;
+	}
+	loops = total_loops - wn->wn_scale_loops;
+	busy = total_busy - wn->wn_scale_busy;
+	wn->wn_scale_loops = total_loops;
+	wn->wn_scale_busy = total_busy;
+	pct = loops ? (busy * 100) / loops : 0;
+
+	/* how much is waiting on the devices */
+	for (i=0; i<TD_WORK_ITEM_MAX_PER_NODE; i++) {
+		struct td_work_item *wi = wn->wn_work_items + i;
+		struct td_device *dev = wi->wi_device;
+		struct td_engine *eng;
+
+		if (!dev || !td_work_item_can_run(wi))
+			continue;
+
+		eng = td_device_engine(dev);
+		if (!td_engine_queued_work(eng) && !td_all_active_tokens(eng))
+			continue;
+
+		busy_devs ++;
+		queued += td_engine_queued_bios(eng);
+	}
+
+	misses = atomic_xchg(&wn->wn_token_misses, 0);
+
+	/* busy devices always get a worker */
+	min_tokens = (busy_devs + td_dg_conf_worker_var_get(dg, MAX_OCCUPANCY) - 1)
+		/ max_t(unsigned, td_dg_conf_worker_var_get(dg, MAX_OCCUPANCY), 1);
+	min_tokens = max_t(unsigned, min_tokens,
+			td_dg_conf_worker_var_get(dg, SCALE_MIN_TOKENS));
+	min_tokens = max_t(unsigned, min_tokens, 1);
+
+	max_tokens = min_t(unsigned, wn->wn_worker_count,
+			td_dg_conf_worker_var_get(dg, SCALE_MAX_TOKENS));
+
+	saturated = (busy_devs && queued >= busy_devs
+				* td_dg_conf_worker_var_get(dg, SCALE_UP_QUEUED))
+		|| (misses && pct
+				>= td_dg_conf_worker_var_get(dg, SCALE_UP_PCT));
+
+	if (saturated && wn->wn_total_worker_tokens < max_tokens) {
+		wn->wn_total_worker_tokens ++;
+		atomic_inc(&wn->wn_worker_tokens);
+		td_worker_counter_inc(w, SCALE_UP);
+#ifndef TERADIMM_CONFIG_AVOID_EVENTS
+		wake_up_interruptible(&dg->dg_event);
+#endif
+
+	} else if (!saturated && loops
+			&& pct < td_dg_conf_worker_var_get(dg, SCALE_DOWN_PCT)
+			&& wn->wn_total_worker_tokens > min_tokens) {
+		wn->wn_total_worker_tokens --;
+		atomic_dec(&wn->wn_worker_tokens_idle);
+		td_worker_counter_inc(w, SCALE_DOWN);
+	}
+
+unlock:
+	spin_unlock(&wn->wn_scale_lock);
 }
 
 
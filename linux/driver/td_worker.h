@@ -67,6 +67,13 @@ struct td_work_node;
 #define TD_WORKER_WAKE_SHARE          1
 #define TD_WORKER_WAKE_SLEEP          0
 
+#define TD_WORKER_SCALE_MSEC          100       /* re-evaluate the number of running workers this often */
+#define TD_WORKER_SCALE_MIN_TOKENS    1         /* park down to this many running workers */
+#define TD_WORKER_SCALE_MAX_TOKENS    TD_WORKER_MAX_PER_NODE
+#define TD_WORKER_SCALE_UP_QUEUED     32        /* queued bios per busy device before adding a worker */
+#define TD_WORKER_SCALE_DOWN_PCT      10        /* park a worker when fewer loops than this % do work */
+#define TD_WORKER_SCALE_UP_PCT        50        /* on token misses, add a worker when this % of loops do work */
+
 #define TD_WORKER_MAX_PER_NODE        8         /* this limits the number of threads per node */
 
 #define TD_WORK_ITEM_MAX_PER_NODE     8         /* this limits the number of devices per node */
@@ -165,6 +172,8 @@ struct td_worker {
 
 	unsigned long       w_sleep_start;          /*!< jiffies of sleep start */
 	unsigned long       w_loops;
+	unsigned long       w_scale_loops;          /*!< all loops, for scaling decisions */
+	unsigned long       w_scale_busy;           /*!< loops that had device activity */
 	unsigned long       w_total_activity;
 	unsigned            w_work_item_scan_offset;
 
@@ -250,6 +259,14 @@ struct td_work_node {
 	unsigned            wn_total_worker_tokens;
 	atomic_t            wn_token_recompute_needed;
 
+	/** load driven scaling moves wn_total_worker_tokens between the
+	 * configured limits; the lock serializes it with recalculation */
+	spinlock_t          wn_scale_lock;
+	unsigned long       wn_scale_next;   /**< jiffies of the next scaling decision */
+	unsigned long       wn_scale_loops;  /**< worker loops seen at the last decision */
+	unsigned long       wn_scale_busy;   /**< busy worker loops seen at the last decision */
+	atomic_t            wn_token_misses; /**< woken workers that found no token */
+
 	atomic_t            wn_work_item_available_count; /**< number of devs with no td_worker_scout */
 	atomic_t            wn_work_item_active_count;    /**< number of devs with td_worker_active set */
 
@@ -267,6 +284,9 @@ extern void td_work_node_exit(struct td_work_node *wn);
 extern int td_work_node_start(struct td_work_node *wn);
 extern void td_work_node_stop(struct td_work_node *wn);
 
+extern unsigned td_work_node_max_workers(void);
+extern int td_work_node_replan(struct td_work_node *wn);
+
 extern int td_work_node_attach_device(struct td_work_node *wn, struct td_device *dev);
 extern void td_work_node_detach_device(struct td_work_node *wn, struct td_device *dev);
 
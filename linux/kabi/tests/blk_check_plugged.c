@@ -0,0 +1,12 @@
+#define __KERNEL__
+#include <linux/kconfig.h>
+#include <linux/blkdev.h>
+
+static void foo_unplug(struct blk_plug_cb *cb, bool from_schedule)
+{
+}
+
+struct blk_plug_cb *foo(void *data)
+{
+	return blk_check_plugged(foo_unplug, data, sizeof(struct blk_plug_cb));
+}
@@ -0,0 +1,11 @@
+#define __KERNEL__
+#include <linux/kconfig.h>
+#include <linux/eventfd.h>
+
+void foo(int fd)
+{
+	struct eventfd_ctx *ctx = eventfd_ctx_fdget(fd);
+
+	eventfd_signal(ctx, 1);
+	eventfd_ctx_put(ctx);
+}
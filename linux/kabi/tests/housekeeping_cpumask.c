@@ -0,0 +1,7 @@
+#define __KERNEL__
+#include <linux/kconfig.h>
+#include <linux/sched/isolation.h>
+
+const struct cpumask *foo(void) {
+	return housekeeping_cpumask(HK_FLAG_DOMAIN);
+}
@@ -0,0 +1,24 @@
+#define __KERNEL__
+#include <linux/kconfig.h>
+#include <linux/types.h>
+#include <asm/i387.h>
+
+
+void td_sha1_sha1rnds4(void *state)
+{
+	kernel_fpu_begin();
+	__asm__ __volatile__ (
+		"movdqu      0(%%rdi),     %%xmm0       \n"
+		"movdqu      16(%%rdi),    %%xmm1       \n"
+		"sha1nexte   %%xmm1,       %%xmm2       \n"
+		"sha1msg1    %%xmm1,       %%xmm3       \n"
+		"sha1msg2    %%xmm1,       %%xmm3       \n"
+		"sha1rnds4   $0, %%xmm1,   %%xmm0       \n"
+		"movdqu      %%xmm0,       0(%%rdi)     \n"
+
+		: /* no output */
+		: "D" (state)
+		: "memory"
+		);
+	kernel_fpu_end();
+}